@@ -208,6 +208,7 @@ handle_memory_finished_cb (EphyAboutHandler       *handler,
                            GAsyncResult           *result,
                            WebKitURISchemeRequest *request)
 {
+  EphyProcessScheduler *scheduler;
   GString *data_str;
   gsize data_length;
   char *memory;
@@ -223,6 +224,15 @@ handle_memory_finished_cb (EphyAboutHandler       *handler,
                             _("Memory usage"));
 
     g_string_append_printf (data_str, "<h1>%s</h1>", _("Memory usage"));
+
+    scheduler = ephy_embed_shell_get_process_scheduler (ephy_embed_shell_get_default ());
+    if (scheduler) {
+      char *processes = ephy_process_scheduler_to_html (scheduler);
+
+      g_string_append (data_str, processes);
+      g_free (processes);
+    }
+
     g_string_append (data_str, memory);
     g_free (memory);
   }
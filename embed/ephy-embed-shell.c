@@ -37,6 +37,8 @@
 #include "ephy-profile-utils.h"
 #include "ephy-settings.h"
 #include "ephy-snapshot-service.h"
+#include "ephy-startup-timeline.h"
+#include "ephy-string.h"
 #include "ephy-tabs-catalog.h"
 #include "ephy-uri-helpers.h"
 #include "ephy-uri-tester-shared.h"
@@ -55,6 +57,16 @@
 #define PRINT_SETTINGS_FILENAME "print-settings.ini"
 #define OVERVIEW_RELOAD_DELAY 500
 
+/* Run the deferred initialisation anyway if no window got painted by then,
+ * e.g. in search provider mode, which never shows one. */
+#define DEFERRED_INIT_TIMEOUT 10
+
+typedef struct {
+  const char *name;
+  EphyDeferredInitPriority priority;
+  EphyDeferredInitFunc func;
+} DeferredInit;
+
 typedef struct {
   WebKitWebContext *web_context;
   EphyHistoryService *global_history_service;
@@ -66,6 +78,7 @@ typedef struct {
   WebKitUserContentManager *user_content;
   EphyDownloadsManager *downloads_manager;
   EphyPermissionsManager *permissions_manager;
+  EphyPasswordManager *password_manager;
   EphyAboutHandler *about_handler;
   guint update_overview_timeout_id;
   guint hiding_overview_item;
@@ -73,8 +86,17 @@ typedef struct {
   GList *web_extensions;
   EphyFiltersManager *filters_manager;
   EphySearchEngineManager *search_engine_manager;
+  EphyProcessScheduler *process_scheduler;
+  EphyPrefetcher *prefetcher;
   GCancellable *cancellable;
   GList *app_origins;
+  GHashTable *zoom_levels;
+  gboolean zoom_levels_loaded;
+  GList *deferred_inits;
+  guint deferred_init_source_id;
+  gboolean deferred_init_started;
+  gboolean deferred_init_done;
+  gboolean gsb_updates_started;
 } EphyEmbedShellPrivate;
 
 enum {
@@ -85,6 +107,7 @@ enum {
   ALLOW_UNSAFE_BROWSING,
   FORM_AUTH_DATA_SAVE_REQUESTED,
   SENSITIVE_FORM_FOCUSED,
+  CACHED_USERS_REQUESTED,
 
   LAST_SIGNAL
 };
@@ -168,6 +191,13 @@ ephy_embed_shell_dispose (GObject *object)
     priv->update_overview_timeout_id = 0;
   }
 
+  if (priv->deferred_init_source_id > 0) {
+    g_source_remove (priv->deferred_init_source_id);
+    priv->deferred_init_source_id = 0;
+  }
+  g_list_free_full (priv->deferred_inits, g_free);
+  priv->deferred_inits = NULL;
+
   g_clear_object (&priv->encodings);
   g_clear_object (&priv->page_setup);
   g_clear_object (&priv->print_settings);
@@ -177,10 +207,13 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_object (&priv->user_content);
   g_clear_object (&priv->downloads_manager);
   g_clear_object (&priv->permissions_manager);
+  g_clear_object (&priv->password_manager);
   g_clear_object (&priv->web_context);
   g_clear_object (&priv->dbus_server);
   g_clear_object (&priv->filters_manager);
   g_clear_object (&priv->search_engine_manager);
+  g_clear_object (&priv->process_scheduler);
+  g_clear_object (&priv->prefetcher);
 
   G_OBJECT_CLASS (ephy_embed_shell_parent_class)->dispose (object);
 }
@@ -191,6 +224,7 @@ ephy_embed_shell_finalize (GObject *object)
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (EPHY_EMBED_SHELL (object));
 
   g_list_free_full (priv->app_origins, g_free);
+  g_clear_pointer (&priv->zoom_levels, g_hash_table_unref);
 
   G_OBJECT_CLASS (ephy_embed_shell_parent_class)->dispose (object);
 }
@@ -238,13 +272,34 @@ web_extension_sensitive_form_focused_message_received_cb (WebKitUserContentManag
 }
 
 static void
-history_service_query_urls_cb (EphyHistoryService *service,
-                               gboolean            success,
-                               GList              *urls,
-                               EphyEmbedShell     *shell)
+web_extension_cached_users_requested_message_received_cb (WebKitUserContentManager *manager,
+                                                          WebKitJavascriptResult   *message,
+                                                          EphyEmbedShell           *shell)
+{
+  guint64 page_id;
+  const char *origin;
+  GVariant *variant;
+  char *message_str;
+
+  message_str = ephy_embed_utils_get_js_result_as_string (message);
+  variant = g_variant_parse (G_VARIANT_TYPE ("(ts)"), message_str, NULL, NULL, NULL);
+  g_free (message_str);
+
+  g_variant_get (variant, "(t&s)", &page_id, &origin);
+  g_signal_emit (shell, signals[CACHED_USERS_REQUESTED], 0,
+                 page_id, origin);
+  g_variant_unref (variant);
+}
+
+static void
+history_service_query_urls_cb (EphyHistoryService    *service,
+                               gboolean               success,
+                               EphyHistoryURLResults *urls,
+                               EphyEmbedShell        *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
+  guint i;
 
   if (!success)
     return;
@@ -255,8 +310,10 @@ history_service_query_urls_cb (EphyHistoryService *service,
     ephy_web_extension_proxy_history_set_urls (web_extension, urls);
   }
 
-  for (l = urls; l; l = g_list_next (l))
-    ephy_embed_shell_schedule_thumbnail_update (shell, (EphyHistoryURL *)l->data);
+  for (i = 0; i < ephy_history_url_results_get_length (urls); i++)
+    ephy_embed_shell_schedule_thumbnail_update (shell, ephy_history_url_results_get (urls, i));
+
+  ephy_history_url_results_free (urls);
 }
 
 static void
@@ -266,9 +323,9 @@ ephy_embed_shell_update_overview_urls (EphyEmbedShell *shell)
   EphyHistoryQuery *query;
 
   query = ephy_history_query_new_for_overview ();
-  ephy_history_service_query_urls (priv->global_history_service, query, NULL,
-                                   (EphyHistoryJobCallback)history_service_query_urls_cb,
-                                   shell);
+  ephy_history_service_query_url_results (priv->global_history_service, query, NULL,
+                                          (EphyHistoryJobCallback)history_service_query_urls_cb,
+                                          shell);
   ephy_history_query_free (query);
 }
 
@@ -403,6 +460,24 @@ history_service_url_deleted_cb (EphyHistoryService *service,
   }
 }
 
+/* Hosts are matched by name, ignoring the scheme and a www. prefix, like
+ * the history service does when looking up the host row of a URL. */
+static char *
+zoom_level_key_for_url (const char *url)
+{
+  char *host;
+  char *key;
+
+  host = ephy_string_get_host_name (url);
+  if (!host || !g_str_has_prefix (host, "www."))
+    return host;
+
+  key = g_strdup (host + strlen ("www."));
+  g_free (host);
+
+  return key;
+}
+
 static void
 history_service_host_deleted_cb (EphyHistoryService *service,
                                  const char         *deleted_url,
@@ -411,6 +486,13 @@ history_service_host_deleted_cb (EphyHistoryService *service,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
   SoupURI *deleted_uri;
+  char *key;
+
+  key = zoom_level_key_for_url (deleted_url);
+  if (key) {
+    g_hash_table_remove (priv->zoom_levels, key);
+    g_free (key);
+  }
 
   deleted_uri = soup_uri_new (deleted_url);
 
@@ -430,6 +512,8 @@ history_service_cleared_cb (EphyHistoryService *service,
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   GList *l;
 
+  g_hash_table_remove_all (priv->zoom_levels);
+
   for (l = priv->web_extensions; l; l = g_list_next (l)) {
     EphyWebExtensionProxy *web_extension = (EphyWebExtensionProxy *)l->data;
 
@@ -437,6 +521,43 @@ history_service_cleared_cb (EphyHistoryService *service,
   }
 }
 
+static void
+history_service_get_hosts_cb (EphyHistoryService *service,
+                              gboolean            success,
+                              GList              *hosts,
+                              EphyEmbedShell     *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  GList *l;
+
+  /* Leave the cache unloaded, so that zoom levels keep being looked up in
+   * the history rather than reset to the default. */
+  if (!success) {
+    g_warning ("Failed to load the zoom levels from the history");
+    goto out;
+  }
+
+  for (l = hosts; l; l = g_list_next (l)) {
+    EphyHistoryHost *host = (EphyHistoryHost *)l->data;
+    char *key;
+
+    if (host->zoom_level == 1.0 || !ephy_embed_utils_address_has_web_scheme (host->url))
+      continue;
+
+    /* Don't override a zoom level set while the hosts were being loaded. */
+    key = zoom_level_key_for_url (host->url);
+    if (key && !g_hash_table_contains (priv->zoom_levels, key))
+      g_hash_table_insert (priv->zoom_levels, key, g_memdup (&host->zoom_level, sizeof (double)));
+    else
+      g_free (key);
+  }
+
+  priv->zoom_levels_loaded = TRUE;
+
+out:
+  g_list_free_full (hosts, (GDestroyNotify)ephy_history_host_free);
+}
+
 typedef struct {
   EphyWebExtensionProxy *extension;
   char *url;
@@ -596,6 +717,12 @@ ephy_embed_shell_get_global_history_service (EphyEmbedShell *shell)
     g_signal_connect (priv->global_history_service, "cleared",
                       G_CALLBACK (history_service_cleared_cb),
                       shell);
+
+    /* Zoom levels are looked up on every navigation, keep them all in memory. */
+    priv->zoom_levels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    ephy_history_service_get_hosts (priv->global_history_service, NULL,
+                                    (EphyHistoryJobCallback)history_service_get_hosts_cb,
+                                    shell);
   }
 
   return priv->global_history_service;
@@ -622,6 +749,10 @@ ephy_embed_shell_get_global_gsb_service (EphyEmbedShell *shell)
     filename = g_build_filename (ephy_dot_dir (), EPHY_GSB_FILE, NULL);
     priv->global_gsb_service = ephy_gsb_service_new (api_key, filename);
 
+    /* Don't compete with the first page loads for the network and the disk. */
+    if (priv->gsb_updates_started)
+      ephy_gsb_service_start_updates (priv->global_gsb_service);
+
     g_free (api_key);
     g_free (filename);
   }
@@ -629,6 +760,82 @@ ephy_embed_shell_get_global_gsb_service (EphyEmbedShell *shell)
   return priv->global_gsb_service;
 }
 
+/**
+ * ephy_embed_shell_lookup_zoom_level:
+ * @shell: the #EphyEmbedShell
+ * @url: the URL being loaded
+ * @zoom_level: (out): return location for the zoom level of @url's host
+ *
+ * Looks up the zoom level saved for the host of @url without going through
+ * the history thread.
+ *
+ * Returns: %FALSE if the zoom levels have not been loaded from the history
+ * yet, in which case @zoom_level is not set
+ **/
+gboolean
+ephy_embed_shell_lookup_zoom_level (EphyEmbedShell *shell,
+                                    const char     *url,
+                                    double         *zoom_level)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  double *value = NULL;
+  char *key;
+
+  g_assert (EPHY_IS_EMBED_SHELL (shell));
+  g_assert (url != NULL);
+  g_assert (zoom_level != NULL);
+
+  if (!priv->zoom_levels_loaded)
+    return FALSE;
+
+  key = zoom_level_key_for_url (url);
+  if (key) {
+    value = g_hash_table_lookup (priv->zoom_levels, key);
+    g_free (key);
+  }
+
+  *zoom_level = value ? *value : 1.0;
+
+  return TRUE;
+}
+
+/**
+ * ephy_embed_shell_set_zoom_level:
+ * @shell: the #EphyEmbedShell
+ * @url: a URL
+ * @zoom_level: the new zoom level for @url's host
+ *
+ * Saves @zoom_level for the host of @url in the history.
+ **/
+void
+ephy_embed_shell_set_zoom_level (EphyEmbedShell *shell,
+                                 const char     *url,
+                                 double          zoom_level)
+{
+  EphyEmbedShellPrivate *priv;
+  EphyHistoryService *history_service;
+  char *key;
+
+  g_assert (EPHY_IS_EMBED_SHELL (shell));
+  g_assert (url != NULL);
+
+  history_service = ephy_embed_shell_get_global_history_service (shell);
+  priv = ephy_embed_shell_get_instance_private (shell);
+
+  key = zoom_level_key_for_url (url);
+  if (key) {
+    if (zoom_level == 1.0) {
+      g_hash_table_remove (priv->zoom_levels, key);
+      g_free (key);
+    } else {
+      g_hash_table_replace (priv->zoom_levels, key, g_memdup (&zoom_level, sizeof (double)));
+    }
+  }
+
+  ephy_history_service_set_url_zoom_level (history_service, url, zoom_level,
+                                           NULL, NULL, NULL);
+}
+
 static void
 snapshot_saved_cb (EphySnapshotService *service,
                    const char          *url,
@@ -800,7 +1007,13 @@ web_extension_page_created (EphyWebExtensionProxy *extension,
                             guint64                page_id,
                             EphyEmbedShell        *shell)
 {
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
   g_object_set_data (G_OBJECT (extension), "initialized", GINT_TO_POINTER (TRUE));
+
+  if (priv->process_scheduler)
+    ephy_process_scheduler_page_created (priv->process_scheduler, page_id, extension);
+
   g_signal_emit (shell, signals[PAGE_CREATED], 0, page_id, extension);
 }
 
@@ -899,6 +1112,17 @@ ephy_embed_shell_setup_process_model (EphyEmbedShell *shell)
 
   webkit_web_context_set_process_model (priv->web_context, WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES);
   webkit_web_context_set_web_process_count_limit (priv->web_context, max_processes);
+
+  /* With more than one web process, WebKit spreads the views among them with
+   * no regard for what they show, so decide which process new tabs go to. */
+  if (max_processes != 1) {
+    guint memory_limit = g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_PROCESS_MEMORY_LIMIT);
+
+    priv->process_scheduler = ephy_process_scheduler_new (max_processes, (guint64)memory_limit * 1024 * 1024);
+    g_signal_connect_object (shell, "web-view-created",
+                             G_CALLBACK (ephy_process_scheduler_add_view),
+                             priv->process_scheduler, G_CONNECT_SWAPPED);
+  }
 }
 
 static void
@@ -968,6 +1192,184 @@ adblock_filters_dir (EphyEmbedShell *shell)
   return result;
 }
 
+static void first_window_added_cb (GtkApplication *application,
+                                   GtkWindow      *window,
+                                   EphyEmbedShell *shell);
+
+static gboolean
+run_next_deferred_init (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  DeferredInit *init;
+
+  /* One per main loop iteration, so that input is handled in between. */
+  if (priv->deferred_inits) {
+    init = priv->deferred_inits->data;
+    priv->deferred_inits = g_list_delete_link (priv->deferred_inits, priv->deferred_inits);
+
+    init->func (shell);
+    ephy_startup_timeline_mark (init->name);
+    g_free (init);
+
+    return G_SOURCE_CONTINUE;
+  }
+
+  priv->deferred_init_source_id = 0;
+  priv->deferred_init_done = TRUE;
+  ephy_startup_timeline_finish ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_embed_shell_start_deferred_init (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (priv->deferred_init_started)
+    return;
+
+  priv->deferred_init_started = TRUE;
+  g_signal_handlers_disconnect_by_func (shell, first_window_added_cb, shell);
+
+  if (priv->deferred_init_source_id)
+    g_source_remove (priv->deferred_init_source_id);
+
+  priv->deferred_init_source_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                   (GSourceFunc)run_next_deferred_init,
+                                                   shell, NULL);
+  g_source_set_name_by_id (priv->deferred_init_source_id, "[epiphany] deferred_init");
+}
+
+static gboolean
+deferred_init_timeout_cb (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  priv->deferred_init_source_id = 0;
+  ephy_embed_shell_start_deferred_init (shell);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+first_window_draw_cb (GtkWidget      *window,
+                      cairo_t        *cr,
+                      EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  g_signal_handlers_disconnect_by_func (window, first_window_draw_cb, shell);
+
+  if (!priv->deferred_init_started) {
+    ephy_startup_timeline_mark ("first-paint");
+    ephy_embed_shell_start_deferred_init (shell);
+  }
+
+  return GDK_EVENT_PROPAGATE;
+}
+
+static void
+first_window_added_cb (GtkApplication *application,
+                       GtkWindow      *window,
+                       EphyEmbedShell *shell)
+{
+  g_signal_handlers_disconnect_by_func (application, first_window_added_cb, shell);
+  g_signal_connect_after (window, "draw", G_CALLBACK (first_window_draw_cb), shell);
+}
+
+/**
+ * ephy_embed_shell_defer_init:
+ * @shell: an #EphyEmbedShell
+ * @name: a static string naming the task in the startup timeline
+ * @priority: an #EphyDeferredInitPriority
+ * @func: the function to run
+ *
+ * Schedules @func to run once the first window has been painted, so that
+ * work that is not needed to show it does not delay startup. Tasks run one
+ * per main loop iteration, in @priority order. If the deferred tasks have
+ * already run, @func is run right away.
+ **/
+void
+ephy_embed_shell_defer_init (EphyEmbedShell           *shell,
+                             const char               *name,
+                             EphyDeferredInitPriority  priority,
+                             EphyDeferredInitFunc      func)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  DeferredInit *init;
+  GList *l;
+
+  g_assert (EPHY_IS_EMBED_SHELL (shell));
+  g_assert (name);
+  g_assert (func);
+
+  if (priv->deferred_init_done) {
+    func (shell);
+    return;
+  }
+
+  init = g_new (DeferredInit, 1);
+  init->name = name;
+  init->priority = priority;
+  init->func = func;
+
+  /* Keep the list sorted, tasks of the same priority in the order they were added. */
+  for (l = priv->deferred_inits; l; l = l->next) {
+    if (((DeferredInit *)l->data)->priority > priority)
+      break;
+  }
+  priv->deferred_inits = g_list_insert_before (priv->deferred_inits, l, init);
+}
+
+static void
+prefetch_top_sites_deferred (EphyEmbedShell *shell)
+{
+  ephy_prefetcher_prefetch_top_sites (ephy_embed_shell_get_prefetcher (shell));
+}
+
+static void
+update_filters_deferred (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  ephy_filters_manager_update (priv->filters_manager);
+}
+
+static void
+start_gsb_updates_deferred (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  /* The service itself is still only created on the first navigation. */
+  priv->gsb_updates_started = TRUE;
+  if (priv->global_gsb_service)
+    ephy_gsb_service_start_updates (priv->global_gsb_service);
+}
+
+#if ENABLE_HTTPS_EVERYWHERE
+static void
+update_https_everywhere_deferred (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  HTTPSEverywhereContext *context;
+  HTTPSEverywhereUpdater *updater;
+
+  /* We might want to be smarter about this in the future. For now,
+   * trigger an update of the rulesets once each time Epiphany is started.
+   * Note that the updated rules will not be used until the next time Epiphany
+   * is started. */
+  context = https_everywhere_context_new ();
+  updater = https_everywhere_updater_new (context);
+  https_everywhere_updater_update (updater,
+                                   priv->cancellable,
+                                   (GAsyncReadyCallback)https_everywhere_update_cb,
+                                   NULL);
+  g_object_unref (context);
+  g_object_unref (updater);
+}
+#endif
+
 static void
 ephy_embed_shell_startup (GApplication *application)
 {
@@ -978,16 +1380,15 @@ ephy_embed_shell_startup (GApplication *application)
   char *filename;
   char *cookie_policy;
   char *filters_dir;
-#if ENABLE_HTTPS_EVERYWHERE
-  HTTPSEverywhereContext *context;
-  HTTPSEverywhereUpdater *updater;
-#endif
 
   G_APPLICATION_CLASS (ephy_embed_shell_parent_class)->startup (application);
+  ephy_startup_timeline_mark ("application-startup");
 
   ephy_embed_shell_create_web_context (shell);
+  ephy_startup_timeline_mark ("web-context");
 
   ephy_embed_shell_setup_web_extensions_server (shell);
+  ephy_startup_timeline_mark ("web-extensions-server");
 
   /* User content manager */
   if (priv->mode != EPHY_EMBED_SHELL_MODE_TEST)
@@ -1023,6 +1424,12 @@ ephy_embed_shell_startup (GApplication *application)
                     G_CALLBACK (web_extension_sensitive_form_focused_message_received_cb),
                     shell);
 
+  webkit_user_content_manager_register_script_message_handler (priv->user_content,
+                                                               "cachedUsersRequested");
+  g_signal_connect (priv->user_content, "script-message-received::cachedUsersRequested",
+                    G_CALLBACK (web_extension_cached_users_requested_message_received_cb),
+                    shell);
+
   webkit_user_content_manager_register_script_message_handler (priv->user_content,
                                                                "aboutApps");
   g_signal_connect (priv->user_content, "script-message-received::aboutApps",
@@ -1038,6 +1445,7 @@ ephy_embed_shell_startup (GApplication *application)
   g_signal_connect (priv->web_context, "initialize-notification-permissions",
                     G_CALLBACK (initialize_notification_permissions),
                     shell);
+  ephy_startup_timeline_mark ("permissions-manager");
 
   /* Favicon Database */
   if (priv->mode == EPHY_EMBED_SHELL_MODE_PRIVATE)
@@ -1086,27 +1494,40 @@ ephy_embed_shell_startup (GApplication *application)
   ephy_embed_prefs_set_cookie_accept_policy (cookie_manager, cookie_policy);
   g_free (cookie_policy);
 
+  ephy_startup_timeline_mark ("cookie-storage");
+
   filters_dir = adblock_filters_dir (shell);
   priv->filters_manager = ephy_filters_manager_new (filters_dir);
   g_free (filters_dir);
 
+  /* Everything below only keeps data up to date, which can wait until the
+   * first window is on screen. */
+  ephy_embed_shell_defer_init (shell, "adblock-filters", EPHY_DEFERRED_INIT_PRIORITY_FILTERS,
+                               update_filters_deferred);
+  ephy_embed_shell_defer_init (shell, "safe-browsing", EPHY_DEFERRED_INIT_PRIORITY_SAFE_BROWSING,
+                               start_gsb_updates_deferred);
+  if (ephy_embed_shell_get_prefetcher (shell))
+    ephy_embed_shell_defer_init (shell, "prefetch-top-sites", EPHY_DEFERRED_INIT_PRIORITY_PREFETCH,
+                                 prefetch_top_sites_deferred);
 #if ENABLE_HTTPS_EVERYWHERE
-    /* We might want to be smarter about this in the future. For now,
-     * trigger an update of the rulesets once each time Epiphany is started.
-     * Note that the updated rules will not be used until the next time Epiphany
-     * is started. */
   if (priv->mode != EPHY_EMBED_SHELL_MODE_TEST &&
-      priv->mode != EPHY_EMBED_SHELL_MODE_SEARCH_PROVIDER) {
-    context = https_everywhere_context_new ();
-    updater = https_everywhere_updater_new (context);
-    https_everywhere_updater_update (updater,
-                                     priv->cancellable,
-                                     (GAsyncReadyCallback)https_everywhere_update_cb,
-                                     NULL);
-    g_object_unref (context);
-    g_object_unref (updater);
-  }
+      priv->mode != EPHY_EMBED_SHELL_MODE_SEARCH_PROVIDER)
+    ephy_embed_shell_defer_init (shell, "https-everywhere", EPHY_DEFERRED_INIT_PRIORITY_HTTPS_EVERYWHERE,
+                                 update_https_everywhere_deferred);
 #endif
+
+  /* Tests never paint a window, so don't make them wait for one. */
+  if (priv->mode == EPHY_EMBED_SHELL_MODE_TEST) {
+    ephy_embed_shell_start_deferred_init (shell);
+  } else {
+    g_signal_connect (application, "window-added", G_CALLBACK (first_window_added_cb), shell);
+    priv->deferred_init_source_id = g_timeout_add_seconds (DEFERRED_INIT_TIMEOUT,
+                                                           (GSourceFunc)deferred_init_timeout_cb,
+                                                           shell);
+    g_source_set_name_by_id (priv->deferred_init_source_id, "[epiphany] deferred_init_timeout");
+  }
+
+  ephy_startup_timeline_mark ("embed-shell-startup");
 }
 
 static void
@@ -1122,10 +1543,14 @@ ephy_embed_shell_shutdown (GApplication *application)
   webkit_user_content_manager_unregister_script_message_handler (priv->user_content, "overview");
   webkit_user_content_manager_unregister_script_message_handler (priv->user_content, "tlsErrorPage");
   webkit_user_content_manager_unregister_script_message_handler (priv->user_content, "formAuthData");
+  webkit_user_content_manager_unregister_script_message_handler (priv->user_content, "cachedUsersRequested");
   webkit_user_content_manager_unregister_script_message_handler (priv->user_content, "aboutApps");
 
   g_list_foreach (priv->web_extensions, (GFunc)ephy_embed_shell_unwatch_web_extension, application);
 
+  if (ephy_snapshot_service_peek_default ())
+    ephy_snapshot_service_save_index (ephy_snapshot_service_peek_default ());
+
   g_object_unref (ephy_embed_prefs_get_settings ());
   ephy_embed_utils_shutdown ();
 }
@@ -1346,6 +1771,24 @@ ephy_embed_shell_class_init (EphyEmbedShellClass *klass)
                   G_TYPE_NONE, 2,
                   G_TYPE_UINT64,
                   G_TYPE_BOOLEAN);
+
+  /**
+   * EphyEmbedShell::cached-users-requested
+   * @shell: the #EphyEmbedShell
+   * @page_id: the identifier of the web page
+   * @origin: the security origin of a login form in the page
+   *
+   * Emitted when a web page needs the saved usernames of @origin,
+   * usually because a login form was found in a subframe.
+   */
+  signals[CACHED_USERS_REQUESTED] =
+    g_signal_new ("cached-users-requested",
+                  EPHY_TYPE_EMBED_SHELL,
+                  G_SIGNAL_RUN_FIRST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 2,
+                  G_TYPE_UINT64,
+                  G_TYPE_STRING);
 }
 
 /**
@@ -1625,6 +2068,45 @@ ephy_embed_shell_get_downloads_manager (EphyEmbedShell *shell)
   return priv->downloads_manager;
 }
 
+/**
+ * ephy_embed_shell_get_process_scheduler:
+ * @shell: the #EphyEmbedShell
+ *
+ * Returns: (transfer none): the #EphyProcessScheduler placing new tabs in
+ * web processes, or %NULL if all tabs share a single web process
+ **/
+EphyProcessScheduler *
+ephy_embed_shell_get_process_scheduler (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  return priv->process_scheduler;
+}
+
+/**
+ * ephy_embed_shell_get_prefetcher:
+ * @shell: the #EphyEmbedShell
+ *
+ * Returns: (transfer none): the #EphyPrefetcher resolving hosts the user is
+ * likely to visit, or %NULL in modes where that would be pointless or would
+ * leak browsing history
+ **/
+EphyPrefetcher *
+ephy_embed_shell_get_prefetcher (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (priv->mode == EPHY_EMBED_SHELL_MODE_INCOGNITO ||
+      priv->mode == EPHY_EMBED_SHELL_MODE_TEST ||
+      priv->mode == EPHY_EMBED_SHELL_MODE_SEARCH_PROVIDER)
+    return NULL;
+
+  if (!priv->prefetcher)
+    priv->prefetcher = ephy_prefetcher_new (priv->web_context,
+                                            ephy_embed_shell_get_global_history_service (shell));
+  return priv->prefetcher;
+}
+
 EphyPermissionsManager *
 ephy_embed_shell_get_permissions_manager (EphyEmbedShell *shell)
 {
@@ -1633,6 +2115,25 @@ ephy_embed_shell_get_permissions_manager (EphyEmbedShell *shell)
   return priv->permissions_manager;
 }
 
+/**
+ * ephy_embed_shell_get_password_manager:
+ * @shell: the #EphyEmbedShell
+ *
+ * Returns the passwords manager. It holds the usernames of all the stored
+ * passwords, and web processes get the ones they need from it.
+ *
+ * Return value: (transfer none): An #EphyPasswordManager.
+ */
+EphyPasswordManager *
+ephy_embed_shell_get_password_manager (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (!priv->password_manager)
+    priv->password_manager = ephy_password_manager_new (TRUE);
+  return priv->password_manager;
+}
+
 EphySearchEngineManager *
 ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell)
 {
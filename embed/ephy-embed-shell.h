@@ -27,7 +27,10 @@
 #include "ephy-encodings.h"
 #include "ephy-gsb-service.h"
 #include "ephy-history-service.h"
+#include "ephy-password-manager.h"
 #include "ephy-permissions-manager.h"
+#include "ephy-prefetcher.h"
+#include "ephy-process-scheduler.h"
 #include "ephy-search-engine-manager.h"
 
 G_BEGIN_DECLS
@@ -47,6 +50,18 @@ typedef enum
   EPHY_EMBED_SHELL_MODE_SEARCH_PROVIDER
 } EphyEmbedShellMode;
 
+/* Deferred initialisation tasks run in this order. */
+typedef enum
+{
+  EPHY_DEFERRED_INIT_PRIORITY_PREFETCH,
+  EPHY_DEFERRED_INIT_PRIORITY_FILTERS,
+  EPHY_DEFERRED_INIT_PRIORITY_SAFE_BROWSING,
+  EPHY_DEFERRED_INIT_PRIORITY_SYNC,
+  EPHY_DEFERRED_INIT_PRIORITY_HTTPS_EVERYWHERE
+} EphyDeferredInitPriority;
+
+typedef void (*EphyDeferredInitFunc) (EphyEmbedShell *shell);
+
 struct _EphyEmbedShellClass
 {
   GtkApplicationClass parent_class;
@@ -58,6 +73,12 @@ EphyEmbedShell    *ephy_embed_shell_get_default                (void);
 WebKitWebContext  *ephy_embed_shell_get_web_context            (EphyEmbedShell   *shell);
 EphyHistoryService
                   *ephy_embed_shell_get_global_history_service (EphyEmbedShell   *shell);
+gboolean           ephy_embed_shell_lookup_zoom_level          (EphyEmbedShell   *shell,
+                                                                const char       *url,
+                                                                double           *zoom_level);
+void               ephy_embed_shell_set_zoom_level             (EphyEmbedShell   *shell,
+                                                                const char       *url,
+                                                                double            zoom_level);
 EphyGSBService    *ephy_embed_shell_get_global_gsb_service     (EphyEmbedShell   *shell);
 EphyEncodings     *ephy_embed_shell_get_encodings              (EphyEmbedShell   *shell);
 void               ephy_embed_shell_restored_window            (EphyEmbedShell   *shell);
@@ -86,6 +107,13 @@ void               ephy_embed_shell_schedule_thumbnail_update  (EphyEmbedShell
 WebKitUserContentManager *ephy_embed_shell_get_user_content_manager (EphyEmbedShell *shell);
 EphyDownloadsManager     *ephy_embed_shell_get_downloads_manager    (EphyEmbedShell *shell);
 EphyPermissionsManager   *ephy_embed_shell_get_permissions_manager  (EphyEmbedShell *shell);
+EphyPasswordManager      *ephy_embed_shell_get_password_manager     (EphyEmbedShell *shell);
 EphySearchEngineManager  *ephy_embed_shell_get_search_engine_manager (EphyEmbedShell *shell);
+EphyProcessScheduler     *ephy_embed_shell_get_process_scheduler    (EphyEmbedShell *shell);
+EphyPrefetcher           *ephy_embed_shell_get_prefetcher           (EphyEmbedShell *shell);
+void                      ephy_embed_shell_defer_init               (EphyEmbedShell           *shell,
+                                                                     const char               *name,
+                                                                     EphyDeferredInitPriority  priority,
+                                                                     EphyDeferredInitFunc      func);
 
 G_END_DECLS
@@ -70,6 +70,7 @@ struct _EphyEmbed {
   WebKitURIRequest *delayed_request;
   WebKitWebViewSessionState *delayed_state;
   guint delayed_request_source_id;
+  gint64 last_visible_time;
 
   GSList *messages;
   GSList *keys;
@@ -694,9 +695,16 @@ ephy_embed_restored_window_cb (EphyEmbedShell *shell, EphyEmbed *embed)
 static void
 ephy_embed_mapped_cb (GtkWidget *widget, gpointer data)
 {
+  ((EphyEmbed *)widget)->last_visible_time = g_get_monotonic_time ();
   ephy_embed_maybe_load_delayed_request ((EphyEmbed *)widget);
 }
 
+static void
+ephy_embed_unmapped_cb (GtkWidget *widget, gpointer data)
+{
+  ((EphyEmbed *)widget)->last_visible_time = g_get_monotonic_time ();
+}
+
 static void
 ephy_embed_constructed (GObject *object)
 {
@@ -710,6 +718,8 @@ ephy_embed_constructed (GObject *object)
 
   g_signal_connect (embed, "map",
                     G_CALLBACK (ephy_embed_mapped_cb), NULL);
+  g_signal_connect (embed, "unmap",
+                    G_CALLBACK (ephy_embed_unmapped_cb), NULL);
 
   /* Skeleton */
   embed->overlay = gtk_overlay_new ();
@@ -796,6 +806,7 @@ ephy_embed_init (EphyEmbed *embed)
   gtk_orientable_set_orientation (GTK_ORIENTABLE (embed),
                                   GTK_ORIENTATION_VERTICAL);
 
+  embed->last_visible_time = g_get_monotonic_time ();
   embed->paned = GTK_PANED (gtk_paned_new (GTK_ORIENTATION_VERTICAL));
   embed->top_widgets_vbox = GTK_BOX (gtk_box_new (GTK_ORIENTATION_VERTICAL, 0));
   embed->seq_context_id = 1;
@@ -914,6 +925,72 @@ ephy_embed_set_delayed_load_request (EphyEmbed *embed, WebKitURIRequest *request
     embed->delayed_state = webkit_web_view_session_state_ref (state);
 }
 
+/**
+ * ephy_embed_get_delayed_session_state:
+ * @embed: a #EphyEmbed
+ *
+ * Gets the session state that will be restored when the delayed load request
+ * of @embed is loaded.
+ *
+ * Returns: (transfer none) (nullable): the pending #WebKitWebViewSessionState
+ */
+WebKitWebViewSessionState *
+ephy_embed_get_delayed_session_state (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  return embed->delayed_state;
+}
+
+/**
+ * ephy_embed_discard:
+ * @embed: a #EphyEmbed
+ *
+ * Unloads the page shown in @embed, replacing it with a placeholder that
+ * keeps its title and favicon. The page and its back/forward list are
+ * restored when the tab is switched to again, like tabs restored from a
+ * session with delayed loads.
+ */
+void
+ephy_embed_discard (EphyEmbed *embed)
+{
+  WebKitWebViewSessionState *state;
+  WebKitURIRequest *request;
+  EphyWebView *web_view;
+  const char *address;
+
+  g_assert (EPHY_IS_EMBED (embed));
+  g_assert (!embed->delayed_request);
+
+  web_view = EPHY_WEB_VIEW (embed->web_view);
+  address = ephy_web_view_get_address (web_view);
+  if (!address)
+    return;
+
+  state = webkit_web_view_get_session_state (embed->web_view);
+  request = webkit_uri_request_new (address);
+  ephy_embed_set_delayed_load_request (embed, request, state);
+  ephy_web_view_set_placeholder (web_view, address, embed->title ? embed->title : "");
+  g_object_unref (request);
+  webkit_web_view_session_state_unref (state);
+}
+
+/**
+ * ephy_embed_get_last_visible_time:
+ * @embed: a #EphyEmbed
+ *
+ * Gets the monotonic time at which @embed was last shown or hidden.
+ *
+ * Returns: a time as returned by g_get_monotonic_time()
+ */
+gint64
+ephy_embed_get_last_visible_time (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  return embed->last_visible_time;
+}
+
 /**
  * ephy_embed_has_load_pending:
  * @embed: a #EphyEmbed
@@ -50,6 +50,9 @@ void             ephy_embed_set_delayed_load_request      (EphyEmbed *embed,
                                                            WebKitURIRequest          *request,
                                                            WebKitWebViewSessionState *state);
 gboolean         ephy_embed_has_load_pending              (EphyEmbed *embed);
+WebKitWebViewSessionState *ephy_embed_get_delayed_session_state (EphyEmbed *embed);
+void             ephy_embed_discard                       (EphyEmbed *embed);
+gint64           ephy_embed_get_last_visible_time         (EphyEmbed *embed);
 gboolean         ephy_embed_inspector_is_loaded           (EphyEmbed *embed);
 const char      *ephy_embed_get_title                     (EphyEmbed *embed);
 void             ephy_embed_attach_notification_container (EphyEmbed *embed);
@@ -21,20 +21,30 @@
 #include "config.h"
 #include "ephy-filters-manager.h"
 
-#include "ephy-download.h"
+#include "ephy-debug.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-uri-tester-shared.h"
+#include "ephy-user-agent.h"
 
 #include <gio/gio.h>
+#include <libsoup/soup.h>
 
 #define ADBLOCK_FILTER_UPDATE_FREQUENCY 24 * 60 * 60 /* In seconds */
 
+/* The HTTP validators and the checksum of every filter file, in a group
+ * named after the file, so that updates can be conditional requests. */
+#define ADBLOCK_FILTER_METADATA_FILE "metadata.ini"
+
 struct _EphyFiltersManager {
   GObject parent_instance;
 
   char *filters_dir;
   GCancellable *cancellable;
+  SoupSession *session;
+  GKeyFile *metadata;
+  gboolean metadata_changed;
+  guint pending_filters;
 };
 
 G_DEFINE_TYPE (EphyFiltersManager, ephy_filters_manager, G_TYPE_OBJECT)
@@ -48,120 +58,472 @@ enum {
 static GParamSpec *object_properties[N_PROPERTIES] = { NULL, };
 
 static gboolean
-adblock_filter_file_is_valid (GFile *file)
+adblock_filter_file_is_valid (GFileInfo *file_info)
 {
-  GFileInfo *file_info;
   gboolean result = FALSE;
 
   /* Now check if the local file is too old. */
-  file_info = g_file_query_info (file,
-                                 G_FILE_ATTRIBUTE_TIME_MODIFIED","G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                 G_FILE_QUERY_INFO_NONE,
-                                 NULL,
-                                 NULL);
-  if (file_info) {
-    if (g_file_info_get_size (file_info) > 0) {
-      GTimeVal current_time;
-      GTimeVal mod_time;
-
-      g_get_current_time (&current_time);
-      g_file_info_get_modification_time (file_info, &mod_time);
-
-      if (current_time.tv_sec > mod_time.tv_sec) {
-        gint64 expire_time = mod_time.tv_sec + ADBLOCK_FILTER_UPDATE_FREQUENCY;
-
-        result = current_time.tv_sec < expire_time;
-      }
+  if (g_file_info_get_size (file_info) > 0) {
+    GTimeVal current_time;
+    GTimeVal mod_time;
+
+    g_get_current_time (&current_time);
+    g_file_info_get_modification_time (file_info, &mod_time);
+
+    if (current_time.tv_sec > mod_time.tv_sec) {
+      gint64 expire_time = mod_time.tv_sec + ADBLOCK_FILTER_UPDATE_FREQUENCY;
+
+      result = current_time.tv_sec < expire_time;
     }
-    g_object_unref (file_info);
   }
 
   return result;
 }
 
+static GFile *
+get_metadata_file (EphyFiltersManager *manager)
+{
+  char *path;
+  GFile *file;
+
+  path = g_build_filename (manager->filters_dir, ADBLOCK_FILTER_METADATA_FILE, NULL);
+  file = g_file_new_for_path (path);
+  g_free (path);
+
+  return file;
+}
+
+static void
+metadata_saved_cb (GFile        *file,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GError *error = NULL;
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error)) {
+    g_warning ("Failed to save adblock filters metadata: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static void
+save_metadata (EphyFiltersManager *manager)
+{
+  GBytes *bytes;
+  GFile *file;
+  char *data;
+  gsize length;
+
+  manager->metadata_changed = FALSE;
+
+  data = g_key_file_to_data (manager->metadata, &length, NULL);
+  bytes = g_bytes_new_take (data, length);
+  file = get_metadata_file (manager);
+  g_file_replace_contents_bytes_async (file, bytes, NULL, FALSE,
+                                       G_FILE_CREATE_PRIVATE, NULL,
+                                       (GAsyncReadyCallback)metadata_saved_cb,
+                                       NULL);
+  g_object_unref (file);
+  g_bytes_unref (bytes);
+}
+
 typedef struct {
   EphyFiltersManager *manager;
-  EphyDownload *download;
+  GCancellable *cancellable;
+  GFile *file;
+  GFile *tmp_file;
+  char *group;
   char *source_uri;
+  gboolean has_content;
 } AdblockFilterRetrieveData;
 
 static AdblockFilterRetrieveData *
 adblock_filter_retrieve_data_new (EphyFiltersManager *manager,
-                                  EphyDownload       *download,
-                                  char               *source_uri)
+                                  const char         *source_uri,
+                                  GFile              *file)
 {
   AdblockFilterRetrieveData* data;
-  data = g_slice_new (AdblockFilterRetrieveData);
+  GFile *parent;
+  char *tmp_filename;
+
+  data = g_slice_new0 (AdblockFilterRetrieveData);
   data->manager = g_object_ref (manager);
-  data->download = g_object_ref (download);
+  data->cancellable = g_object_ref (manager->cancellable);
+  data->file = g_object_ref (file);
+  data->group = g_file_get_basename (file);
+  parent = g_file_get_parent (file);
+  tmp_filename = g_strconcat (data->group, ".tmp", NULL);
+  data->tmp_file = g_file_get_child (parent, tmp_filename);
+  g_free (tmp_filename);
+  g_object_unref (parent);
   data->source_uri = g_strdup (source_uri);
+  manager->pending_filters++;
   return data;
 }
 
 static void
 adblock_filter_retrieve_data_free (AdblockFilterRetrieveData *data)
 {
+  EphyFiltersManager *manager = data->manager;
+
+  /* Write the metadata once, after all the filters are done with it. */
+  if (--manager->pending_filters == 0 && manager->metadata_changed)
+    save_metadata (manager);
+
   g_object_unref (data->manager);
-  g_object_unref (data->download);
+  g_object_unref (data->cancellable);
+  g_object_unref (data->file);
+  g_object_unref (data->tmp_file);
+  g_free (data->group);
   g_free (data->source_uri);
   g_slice_free (AdblockFilterRetrieveData, data);
 }
 
 static void
-download_completed_cb (EphyDownload              *download,
-                       AdblockFilterRetrieveData *data)
+empty_filter_file_closed_cb (GOutputStream             *stream,
+                             GAsyncResult              *result,
+                             AdblockFilterRetrieveData *data)
 {
-  g_signal_handlers_disconnect_by_data (download, data);
+  g_output_stream_close_finish (stream, result, NULL);
   adblock_filter_retrieve_data_free (data);
 }
 
 static void
-download_error_cb (EphyDownload              *download,
-                   GError                    *error,
-                   AdblockFilterRetrieveData *data)
+empty_filter_file_created_cb (GFile                     *file,
+                              GAsyncResult              *result,
+                              AdblockFilterRetrieveData *data)
 {
   GFileOutputStream *stream;
-  GFile *file;
 
-  /* Create an empty file if it doesn't exist to unblock extensions */
-  file = g_file_new_for_uri (ephy_download_get_destination_uri (download));
-  stream = g_file_create (file, G_FILE_CREATE_NONE, NULL, NULL);
-  if (stream)
-    g_object_unref (stream);
-  g_object_unref (file);
+  /* Fails if the file already exists, which is just as good. */
+  stream = g_file_create_finish (file, result, NULL);
+  if (!stream) {
+    adblock_filter_retrieve_data_free (data);
+    return;
+  }
+
+  g_output_stream_close_async (G_OUTPUT_STREAM (stream), G_PRIORITY_DEFAULT, NULL,
+                               (GAsyncReadyCallback)empty_filter_file_closed_cb,
+                               data);
+  g_object_unref (stream);
+}
+
+/* The web processes wait for every enabled filter file to exist, so leave an
+ * empty one behind when there is nothing better to give them. Frees @data
+ * once done. */
+static void
+ensure_filter_file_exists (AdblockFilterRetrieveData *data)
+{
+  g_file_create_async (data->file, G_FILE_CREATE_NONE, G_PRIORITY_DEFAULT, NULL,
+                       (GAsyncReadyCallback)empty_filter_file_created_cb,
+                       data);
+}
 
-  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-    g_warning ("Error retrieving filter %s: %s\n", data->source_uri, error->message);
+static void
+filter_file_touched_cb (GFile                     *file,
+                        GAsyncResult              *result,
+                        AdblockFilterRetrieveData *data)
+{
+  GError *error = NULL;
+
+  if (!g_file_set_attributes_finish (file, result, NULL, &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to update modification time of filter %s: %s", data->source_uri, error->message);
+    g_error_free (error);
+  }
 
-  g_signal_handlers_disconnect_by_data (download, data);
   adblock_filter_retrieve_data_free (data);
 }
 
+/* The filter did not change upstream. Just mark the local copy as fresh,
+ * leaving its contents, and so the web processes, alone. */
 static void
-start_retrieving_filter_file (EphyFiltersManager *manager,
-                              const char         *filter_url,
-                              GFile              *destination)
+touch_filter_file (AdblockFilterRetrieveData *data)
 {
-  EphyDownload *download;
-  WebKitDownload *wk_download;
-  AdblockFilterRetrieveData *data;
-  char *path;
+  GFileInfo *info;
+  GTimeVal current_time;
+
+  g_get_current_time (&current_time);
+
+  info = g_file_info_new ();
+  g_file_info_set_modification_time (info, &current_time);
+  g_file_set_attributes_async (data->file, info, G_FILE_QUERY_INFO_NONE,
+                               G_PRIORITY_LOW, data->cancellable,
+                               (GAsyncReadyCallback)filter_file_touched_cb,
+                               data);
+  g_object_unref (info);
+}
 
-  download = ephy_download_new_for_uri (filter_url);
-  path = g_file_get_uri (destination);
-  ephy_download_set_destination_uri (download, path);
-  g_free (path);
+static void
+filter_file_save_failed (AdblockFilterRetrieveData *data,
+                         GError                    *error)
+{
+  g_file_delete_async (data->tmp_file, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
 
-  wk_download = ephy_download_get_webkit_download (download);
-  webkit_download_set_allow_overwrite (wk_download, TRUE);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free (error);
+    adblock_filter_retrieve_data_free (data);
+    return;
+  }
 
-  data = adblock_filter_retrieve_data_new (manager, download, g_strdup (filter_url));
+  g_warning ("Failed to save filter %s: %s", data->source_uri, error->message);
+  g_error_free (error);
 
-  g_signal_connect (download, "completed",
-                    G_CALLBACK (download_completed_cb), data);
-  g_signal_connect (download, "error",
-                    G_CALLBACK (download_error_cb), data);
-  g_object_unref (download);
+  /* Make sure the next update downloads it again. */
+  g_key_file_remove_group (data->manager->metadata, data->group, NULL);
+  data->manager->metadata_changed = TRUE;
+  ensure_filter_file_exists (data);
+}
+
+static void
+filter_file_moved_cb (GFile                     *tmp_file,
+                      GAsyncResult              *result,
+                      AdblockFilterRetrieveData *data)
+{
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    filter_file_save_failed (data, error);
+    return;
+  }
+
+  adblock_filter_retrieve_data_free (data);
+}
+
+/* GIO has no asynchronous move, so do it in a thread. */
+static void
+move_filter_file_thread (GTask        *task,
+                         GFile        *tmp_file,
+                         GFile        *file,
+                         GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (!g_file_move (tmp_file, file, G_FILE_COPY_OVERWRITE, cancellable, NULL, NULL, &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+filter_file_replaced_cb (GFile                     *file,
+                         GAsyncResult              *result,
+                         AdblockFilterRetrieveData *data)
+{
+  GError *error = NULL;
+  GTask *task;
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error)) {
+    filter_file_save_failed (data, error);
+    return;
+  }
+
+  /* The web processes watch for the filter being renamed into place, and
+   * so never read a partial one. */
+  task = g_task_new (data->tmp_file, data->cancellable,
+                     (GAsyncReadyCallback)filter_file_moved_cb, data);
+  g_task_set_task_data (task, g_object_ref (data->file), g_object_unref);
+  g_task_run_in_thread (task, (GTaskThreadFunc)move_filter_file_thread);
+  g_object_unref (task);
+}
+
+static void
+set_metadata_header (AdblockFilterRetrieveData *data,
+                     SoupMessage               *msg,
+                     const char                *header,
+                     const char                *key)
+{
+  const char *value;
+
+  value = soup_message_headers_get_one (msg->response_headers, header);
+  if (value)
+    g_key_file_set_string (data->manager->metadata, data->group, key, value);
+  else
+    g_key_file_remove_key (data->manager->metadata, data->group, key, NULL);
+}
+
+static void
+filter_downloaded_cb (SoupSession               *session,
+                      SoupMessage               *msg,
+                      AdblockFilterRetrieveData *data)
+{
+  EphyFiltersManager *manager = data->manager;
+  SoupBuffer *buffer;
+  GBytes *bytes;
+  char *checksum;
+  char *old_checksum;
+
+  if (msg->status_code == SOUP_STATUS_CANCELLED || g_cancellable_is_cancelled (data->cancellable)) {
+    adblock_filter_retrieve_data_free (data);
+    return;
+  }
+
+  if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+    LOG ("Filter %s was not modified", data->source_uri);
+    touch_filter_file (data);
+    return;
+  }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (msg->status_code)) {
+    g_warning ("Error retrieving filter %s: %u %s\n", data->source_uri, msg->status_code, msg->reason_phrase);
+    ensure_filter_file_exists (data);
+    return;
+  }
+
+  set_metadata_header (data, msg, "ETag", "etag");
+  set_metadata_header (data, msg, "Last-Modified", "last-modified");
+  manager->metadata_changed = TRUE;
+
+  buffer = soup_message_body_flatten (msg->response_body);
+  bytes = soup_buffer_get_as_bytes (buffer);
+  soup_buffer_free (buffer);
+
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+  old_checksum = g_key_file_get_string (manager->metadata, data->group, "checksum", NULL);
+
+  /* Some servers ignore the validators and send the whole list every time,
+   * so compare the contents too. */
+  if (data->has_content && g_strcmp0 (checksum, old_checksum) == 0) {
+    LOG ("Filter %s did not change", data->source_uri);
+    touch_filter_file (data);
+  } else {
+    LOG ("Filter %s changed, saving it", data->source_uri);
+    g_key_file_set_string (manager->metadata, data->group, "checksum", checksum);
+
+    g_file_replace_contents_bytes_async (data->tmp_file, bytes, NULL, FALSE,
+                                         G_FILE_CREATE_NONE, data->cancellable,
+                                         (GAsyncReadyCallback)filter_file_replaced_cb,
+                                         data);
+  }
+
+  g_free (old_checksum);
+  g_free (checksum);
+  g_bytes_unref (bytes);
+}
+
+static void
+start_retrieving_filter_file (AdblockFilterRetrieveData *data)
+{
+  EphyFiltersManager *manager = data->manager;
+  SoupMessage *msg;
+  char *value;
+
+  msg = soup_message_new (SOUP_METHOD_GET, data->source_uri);
+  if (!msg) {
+    g_warning ("Invalid adblock filter URI %s", data->source_uri);
+    ensure_filter_file_exists (data);
+    return;
+  }
+
+  /* Only ask for changes when there is a local copy to fall back on. */
+  if (data->has_content) {
+    value = g_key_file_get_string (manager->metadata, data->group, "etag", NULL);
+    if (value)
+      soup_message_headers_append (msg->request_headers, "If-None-Match", value);
+    g_free (value);
+
+    value = g_key_file_get_string (manager->metadata, data->group, "last-modified", NULL);
+    if (value)
+      soup_message_headers_append (msg->request_headers, "If-Modified-Since", value);
+    g_free (value);
+  }
+
+  soup_session_queue_message (manager->session, msg,
+                              (SoupSessionCallback)filter_downloaded_cb,
+                              data);
+}
+
+static void
+filter_file_queried_cb (GFile                     *file,
+                        GAsyncResult              *result,
+                        AdblockFilterRetrieveData *data)
+{
+  GFileInfo *file_info;
+  GError *error = NULL;
+
+  file_info = g_file_query_info_finish (file, result, &error);
+  if (!file_info) {
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free (error);
+      adblock_filter_retrieve_data_free (data);
+      return;
+    }
+
+    /* Most likely the filter was never downloaded. */
+    g_error_free (error);
+    start_retrieving_filter_file (data);
+    return;
+  }
+
+  if (adblock_filter_file_is_valid (file_info)) {
+    g_object_unref (file_info);
+    adblock_filter_retrieve_data_free (data);
+    return;
+  }
+
+  data->has_content = g_file_info_get_size (file_info) > 0;
+  g_object_unref (file_info);
+
+  start_retrieving_filter_file (data);
+}
+
+static void
+check_adblock_filter_files (EphyFiltersManager *manager)
+{
+  char **filters;
+
+  filters = g_settings_get_strv (EPHY_SETTINGS_MAIN, EPHY_PREFS_ADBLOCK_FILTERS);
+  for (guint i = 0; filters[i]; i++) {
+    AdblockFilterRetrieveData *data;
+    GFile *filter_file;
+
+    filter_file = ephy_uri_tester_get_adblock_filter_file (manager->filters_dir, filters[i]);
+    data = adblock_filter_retrieve_data_new (manager, filters[i], filter_file);
+    g_file_query_info_async (filter_file,
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED","G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                             G_FILE_QUERY_INFO_NONE,
+                             G_PRIORITY_LOW,
+                             manager->cancellable,
+                             (GAsyncReadyCallback)filter_file_queried_cb,
+                             data);
+    g_object_unref (filter_file);
+  }
+
+  g_strfreev (filters);
+}
+
+static void
+metadata_loaded_cb (GFile              *file,
+                    GAsyncResult       *result,
+                    EphyFiltersManager *manager)
+{
+  GError *error = NULL;
+  char *contents;
+  gsize length;
+
+  if (!g_file_load_contents_finish (file, result, &contents, &length, NULL, &error)) {
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free (error);
+      g_object_unref (manager);
+      return;
+    }
+
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      g_warning ("Failed to load adblock filters metadata: %s", error->message);
+    g_error_free (error);
+    contents = NULL;
+  }
+
+  /* Another update may have loaded it in the meantime. */
+  if (!manager->metadata) {
+    manager->metadata = g_key_file_new ();
+    if (contents)
+      g_key_file_load_from_data (manager->metadata, contents, length, G_KEY_FILE_NONE, NULL);
+  }
+  g_free (contents);
+
+  check_adblock_filter_files (manager);
+  g_object_unref (manager);
 }
 
 static void
@@ -230,6 +592,7 @@ update_adblock_filter_files (EphyFiltersManager *manager)
 {
   char **filters;
   GList *files = NULL;
+  GFile *metadata_file;
 
   if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK))
     return;
@@ -238,21 +601,30 @@ update_adblock_filter_files (EphyFiltersManager *manager)
   g_cancellable_cancel (manager->cancellable);
   g_object_unref (manager->cancellable);
   manager->cancellable = g_cancellable_new ();
+  soup_session_abort (manager->session);
 
   filters = g_settings_get_strv (EPHY_SETTINGS_MAIN, EPHY_PREFS_ADBLOCK_FILTERS);
-  for (guint i = 0; filters[i]; i++) {
-    GFile *filter_file;
+  for (guint i = 0; filters[i]; i++)
+    files = g_list_prepend (files, ephy_uri_tester_get_adblock_filter_file (manager->filters_dir, filters[i]));
 
-    filter_file = ephy_uri_tester_get_adblock_filter_file (manager->filters_dir, filters[i]);
-    if (!adblock_filter_file_is_valid (filter_file))
-      start_retrieving_filter_file (manager, filters[i], filter_file);
-    files = g_list_prepend (files, filter_file);
-  }
+  metadata_file = get_metadata_file (manager);
+  files = g_list_prepend (files, g_object_ref (metadata_file));
 
   remove_old_adblock_filters (manager, files);
 
   g_strfreev (filters);
   g_list_free_full (files, g_object_unref);
+
+  /* Nothing here blocks: the files are checked, and the filters downloaded
+   * if needed, asynchronously. */
+  if (manager->metadata) {
+    check_adblock_filter_files (manager);
+  } else {
+    g_file_load_contents_async (metadata_file, manager->cancellable,
+                                (GAsyncReadyCallback)metadata_loaded_cb,
+                                g_object_ref (manager));
+  }
+  g_object_unref (metadata_file);
 }
 
 static void
@@ -281,6 +653,11 @@ ephy_filters_manager_dispose (GObject *object)
     g_clear_object (&manager->cancellable);
   }
 
+  if (manager->session) {
+    soup_session_abort (manager->session);
+    g_clear_object (&manager->session);
+  }
+
   G_OBJECT_CLASS (ephy_filters_manager_parent_class)->dispose (object);
 }
 
@@ -290,6 +667,7 @@ ephy_filters_manager_finalize (GObject *object)
   EphyFiltersManager *manager = EPHY_FILTERS_MANAGER (object);
 
   g_free (manager->filters_dir);
+  g_clear_pointer (&manager->metadata, g_key_file_unref);
 
   G_OBJECT_CLASS (ephy_filters_manager_parent_class)->finalize (object);
 }
@@ -308,7 +686,6 @@ ephy_filters_manager_constructed (GObject *object)
                     G_CALLBACK (enable_adblock_changed_cb), manager);
 
   g_mkdir_with_parents (manager->filters_dir, 0700);
-  update_adblock_filter_files (manager);
 }
 
 static void
@@ -372,6 +749,13 @@ static void
 ephy_filters_manager_init (EphyFiltersManager *manager)
 {
   manager->cancellable = g_cancellable_new ();
+  /* Same network setup as the web context: the system proxy settings, and
+   * TLS errors are fatal. */
+  manager->session = soup_session_new_with_options (SOUP_SESSION_PROXY_RESOLVER, g_proxy_resolver_get_default (),
+                                                    SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE, TRUE,
+                                                    SOUP_SESSION_SSL_STRICT, TRUE,
+                                                    SOUP_SESSION_USER_AGENT, ephy_user_agent_get_internal (),
+                                                    NULL);
 }
 
 EphyFiltersManager *
@@ -387,3 +771,19 @@ ephy_filters_manager_get_adblock_filters_dir (EphyFiltersManager *manager)
 {
   return manager->filters_dir;
 }
+
+/**
+ * ephy_filters_manager_update:
+ * @manager: an #EphyFiltersManager
+ *
+ * Checks the adblock filter files and downloads the ones that are missing
+ * or out of date. Later changes to the filter settings update the files on
+ * their own.
+ **/
+void
+ephy_filters_manager_update (EphyFiltersManager *manager)
+{
+  g_assert (EPHY_IS_FILTERS_MANAGER (manager));
+
+  update_adblock_filter_files (manager);
+}
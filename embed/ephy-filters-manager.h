@@ -30,5 +30,6 @@ G_DECLARE_FINAL_TYPE (EphyFiltersManager, ephy_filters_manager, EPHY, FILTERS_MA
 
 EphyFiltersManager *ephy_filters_manager_new                     (const char *adblock_filters_dir);
 const char         *ephy_filters_manager_get_adblock_filters_dir (EphyFiltersManager *manager);
+void                ephy_filters_manager_update                  (EphyFiltersManager *manager);
 
 G_END_DECLS
@@ -0,0 +1,316 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-prefetcher.h"
+
+#include "ephy-about-handler.h"
+#include "ephy-debug.h"
+
+#include <libsoup/soup.h>
+#include <string.h>
+
+/* Only the best few completions are worth a lookup, the user is very
+ * unlikely to pick anything further down. */
+#define PREFETCH_MAX_CANDIDATES 3
+
+/* A prefetched host is not looked up again for this long, and a navigation
+ * to it within that time counts as a hit. Resolvers cache answers for about
+ * as long. */
+#define PREFETCH_HOST_LIFETIME (60 * G_USEC_PER_SEC)
+
+/* Past this many hosts, the expired ones get dropped. */
+#define PREFETCH_MAX_HOSTS 256
+
+struct _EphyPrefetcher {
+  GObject parent_instance;
+
+  WebKitWebContext *web_context;
+  EphyHistoryService *history_service;
+  GCancellable *cancellable;
+
+  /* Host -> time it was prefetched at. */
+  GHashTable *prefetched_hosts;
+  gint64 top_sites_time;
+
+  guint lookups;
+  guint navigations;
+  guint hits;
+};
+
+G_DEFINE_TYPE (EphyPrefetcher, ephy_prefetcher, G_TYPE_OBJECT)
+
+static char *
+get_host (const char *uri)
+{
+  SoupURI *soup_uri;
+  char *host = NULL;
+
+  soup_uri = soup_uri_new (uri);
+  if (!soup_uri)
+    return NULL;
+
+  if ((soup_uri->scheme == SOUP_URI_SCHEME_HTTP || soup_uri->scheme == SOUP_URI_SCHEME_HTTPS) &&
+      soup_uri->host && *soup_uri->host)
+    host = g_strdup (soup_uri->host);
+  soup_uri_free (soup_uri);
+
+  return host;
+}
+
+static gboolean
+host_was_prefetched (EphyPrefetcher *prefetcher,
+                     const char     *host,
+                     gint64          now)
+{
+  gpointer time;
+
+  if (!g_hash_table_lookup_extended (prefetcher->prefetched_hosts, host, NULL, &time))
+    return FALSE;
+
+  return now - *(gint64 *)time < PREFETCH_HOST_LIFETIME;
+}
+
+static gboolean
+host_expired (const char *host,
+              gint64     *time,
+              gint64     *now)
+{
+  return *now - *time >= PREFETCH_HOST_LIFETIME;
+}
+
+/* Returns whether a lookup was started for @host, as opposed to it still
+ * being fresh from an earlier one. */
+static gboolean
+prefetch_host (EphyPrefetcher *prefetcher,
+               const char     *host)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (host_was_prefetched (prefetcher, host, now))
+    return FALSE;
+
+  if (g_hash_table_size (prefetcher->prefetched_hosts) >= PREFETCH_MAX_HOSTS)
+    g_hash_table_foreach_remove (prefetcher->prefetched_hosts, (GHRFunc)host_expired, &now);
+
+  /* WebKitGTK only offers DNS prefetching. It has no way to preconnect, and
+   * connections made from the UI process would be of no use to the network
+   * process anyway. */
+  webkit_web_context_prefetch_dns (prefetcher->web_context, host);
+  g_hash_table_insert (prefetcher->prefetched_hosts, g_strdup (host), g_memdup (&now, sizeof (now)));
+  prefetcher->lookups++;
+
+  return TRUE;
+}
+
+static void
+ephy_prefetcher_dispose (GObject *object)
+{
+  EphyPrefetcher *prefetcher = EPHY_PREFETCHER (object);
+
+  if (prefetcher->cancellable) {
+    g_cancellable_cancel (prefetcher->cancellable);
+    g_clear_object (&prefetcher->cancellable);
+  }
+
+  if (prefetcher->lookups > 0) {
+    LOG ("Prefetcher made %u lookups, %u of %u navigations went to a prefetched host",
+         prefetcher->lookups, prefetcher->hits, prefetcher->navigations);
+  }
+
+  g_clear_object (&prefetcher->web_context);
+  g_clear_object (&prefetcher->history_service);
+
+  G_OBJECT_CLASS (ephy_prefetcher_parent_class)->dispose (object);
+}
+
+static void
+ephy_prefetcher_finalize (GObject *object)
+{
+  EphyPrefetcher *prefetcher = EPHY_PREFETCHER (object);
+
+  g_hash_table_unref (prefetcher->prefetched_hosts);
+
+  G_OBJECT_CLASS (ephy_prefetcher_parent_class)->finalize (object);
+}
+
+static void
+ephy_prefetcher_class_init (EphyPrefetcherClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_prefetcher_dispose;
+  object_class->finalize = ephy_prefetcher_finalize;
+}
+
+static void
+ephy_prefetcher_init (EphyPrefetcher *prefetcher)
+{
+  prefetcher->cancellable = g_cancellable_new ();
+  prefetcher->prefetched_hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+EphyPrefetcher *
+ephy_prefetcher_new (WebKitWebContext   *web_context,
+                     EphyHistoryService *history_service)
+{
+  EphyPrefetcher *prefetcher;
+
+  g_assert (WEBKIT_IS_WEB_CONTEXT (web_context));
+  g_assert (EPHY_IS_HISTORY_SERVICE (history_service));
+
+  prefetcher = g_object_new (EPHY_TYPE_PREFETCHER, NULL);
+  prefetcher->web_context = g_object_ref (web_context);
+  prefetcher->history_service = g_object_ref (history_service);
+
+  return prefetcher;
+}
+
+/**
+ * ephy_prefetcher_prefetch_candidates:
+ * @prefetcher: an #EphyPrefetcher
+ * @uris: (array length=n_uris): the addresses the user may be about to
+ *   visit, the most likely first
+ * @n_uris: the length of @uris
+ *
+ * Resolves the hosts of the first few of @uris in advance, so that the
+ * lookup is done by the time the user picks one of them.
+ **/
+void
+ephy_prefetcher_prefetch_candidates (EphyPrefetcher     *prefetcher,
+                                     const char * const *uris,
+                                     guint               n_uris)
+{
+  GPtrArray *hosts;
+  guint i;
+
+  g_assert (EPHY_IS_PREFETCHER (prefetcher));
+
+  hosts = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 0; i < n_uris && hosts->len < PREFETCH_MAX_CANDIDATES; i++) {
+    char *host = get_host (uris[i]);
+    gboolean seen = FALSE;
+    guint j;
+
+    if (!host)
+      continue;
+
+    /* Completions often share a host, and each host counts only once. */
+    for (j = 0; j < hosts->len && !seen; j++)
+      seen = strcmp (g_ptr_array_index (hosts, j), host) == 0;
+
+    if (seen) {
+      g_free (host);
+      continue;
+    }
+
+    if (prefetch_host (prefetcher, host))
+      LOG ("Prefetching %s for completion %s", host, uris[i]);
+    g_ptr_array_add (hosts, host);
+  }
+
+  g_ptr_array_unref (hosts);
+}
+
+static void
+top_sites_query_cb (EphyHistoryService    *service,
+                    gboolean               success,
+                    EphyHistoryURLResults *urls,
+                    EphyPrefetcher        *prefetcher)
+{
+  guint i;
+
+  for (i = 0; i < ephy_history_url_results_get_length (urls); i++) {
+    EphyHistoryURL *url = ephy_history_url_results_get (urls, i);
+    char *host = get_host (url->url);
+
+    if (host && prefetch_host (prefetcher, host))
+      LOG ("Prefetching top site %s", host);
+    g_free (host);
+  }
+
+  ephy_history_url_results_free (urls);
+}
+
+/**
+ * ephy_prefetcher_prefetch_top_sites:
+ * @prefetcher: an #EphyPrefetcher
+ *
+ * Resolves the hosts of the most visited sites, the ones the new tab page
+ * shows, since that is where the user is most likely to go next.
+ **/
+void
+ephy_prefetcher_prefetch_top_sites (EphyPrefetcher *prefetcher)
+{
+  EphyHistoryQuery *query;
+  gint64 now;
+
+  g_assert (EPHY_IS_PREFETCHER (prefetcher));
+
+  /* New tabs come in bursts, and the lookups are still fresh anyway. */
+  now = g_get_monotonic_time ();
+  if (prefetcher->top_sites_time && now - prefetcher->top_sites_time < PREFETCH_HOST_LIFETIME)
+    return;
+  prefetcher->top_sites_time = now;
+
+  query = ephy_history_query_new_for_overview ();
+  ephy_history_service_query_url_results (prefetcher->history_service, query,
+                                          prefetcher->cancellable,
+                                          (EphyHistoryJobCallback)top_sites_query_cb,
+                                          prefetcher);
+  ephy_history_query_free (query);
+}
+
+/**
+ * ephy_prefetcher_record_navigation:
+ * @prefetcher: an #EphyPrefetcher
+ * @uri: the address a main frame started loading
+ *
+ * Accounts for a navigation, counting it as a hit if its host was
+ * prefetched recently, so that the hit rate can be followed in the debug
+ * log.
+ **/
+void
+ephy_prefetcher_record_navigation (EphyPrefetcher *prefetcher,
+                                   const char     *uri)
+{
+  char *host;
+
+  g_assert (EPHY_IS_PREFETCHER (prefetcher));
+
+  host = uri ? get_host (uri) : NULL;
+  if (!host)
+    return;
+
+  prefetcher->navigations++;
+
+  /* A lookup only saves time for the first navigation to its host, later
+   * ones would have hit the resolver cache anyway. */
+  if (host_was_prefetched (prefetcher, host, g_get_monotonic_time ())) {
+    prefetcher->hits++;
+    g_hash_table_remove (prefetcher->prefetched_hosts, host);
+  }
+
+  LOG ("Navigation to %s: %u of %u navigations hit a prefetched host, %u of %u lookups were used",
+       host, prefetcher->hits, prefetcher->navigations, prefetcher->hits, prefetcher->lookups);
+
+  g_free (host);
+}
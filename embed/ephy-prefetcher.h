@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-history-service.h"
+
+#include <glib-object.h>
+#include <webkit2/webkit2.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_PREFETCHER (ephy_prefetcher_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyPrefetcher, ephy_prefetcher, EPHY, PREFETCHER, GObject)
+
+EphyPrefetcher *ephy_prefetcher_new                 (WebKitWebContext   *web_context,
+                                                     EphyHistoryService *history_service);
+void            ephy_prefetcher_prefetch_candidates (EphyPrefetcher     *prefetcher,
+                                                     const char * const *uris,
+                                                     guint               n_uris);
+void            ephy_prefetcher_prefetch_top_sites  (EphyPrefetcher     *prefetcher);
+void            ephy_prefetcher_record_navigation   (EphyPrefetcher     *prefetcher,
+                                                     const char         *uri);
+
+G_END_DECLS
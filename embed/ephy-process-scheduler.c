@@ -0,0 +1,472 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-process-scheduler.h"
+
+#include "ephy-debug.h"
+
+#include <glib/gi18n.h>
+#include <libsoup/soup.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Reading /proc for every new tab would be wasteful when a whole session is
+ * being restored, and memory usage does not change that fast anyway. */
+#define PROCESS_RSS_REFRESH_INTERVAL (5 * G_USEC_PER_SEC)
+
+/* WebKit does not tell which web process a view lives in, but every web
+ * process runs our web extension, which connects to the UI process through
+ * its own D-Bus connection. So a process is identified by its extension
+ * proxy, and views are assigned to it when their page gets created there. */
+typedef struct {
+  EphyWebExtensionProxy *web_extension;
+  pid_t pid;
+  GList *views;
+  guint64 rss;
+  gint64 rss_time;
+} ProcessInfo;
+
+typedef struct {
+  WebKitWebView *view;
+  char *site;
+  ProcessInfo *process;
+} ViewInfo;
+
+struct _EphyProcessScheduler {
+  GObject parent_instance;
+
+  guint max_processes;
+  guint64 memory_limit;
+
+  GHashTable *processes;
+  GHashTable *views;
+};
+
+G_DEFINE_TYPE (EphyProcessScheduler, ephy_process_scheduler, G_TYPE_OBJECT)
+
+static void
+view_info_free (ViewInfo *info)
+{
+  g_free (info->site);
+  g_slice_free (ViewInfo, info);
+}
+
+static void
+process_info_free (ProcessInfo *process)
+{
+  g_list_free (process->views);
+  g_slice_free (ProcessInfo, process);
+}
+
+static guint64
+process_info_get_rss (ProcessInfo *process)
+{
+  char *path;
+  char *contents;
+  guint64 resident;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+  if (process->pid <= 0 || now - process->rss_time < PROCESS_RSS_REFRESH_INTERVAL)
+    return process->rss;
+
+  process->rss_time = now;
+
+  /* The second field of statm is the resident set size, in pages. */
+  path = g_strdup_printf ("/proc/%d/statm", process->pid);
+  if (g_file_get_contents (path, &contents, NULL, NULL)) {
+    if (sscanf (contents, "%*u %" G_GUINT64_FORMAT, &resident) == 1)
+      process->rss = resident * sysconf (_SC_PAGESIZE);
+    g_free (contents);
+  }
+  g_free (path);
+
+  return process->rss;
+}
+
+static gboolean
+process_info_is_over_budget (EphyProcessScheduler *scheduler,
+                             ProcessInfo          *process)
+{
+  return scheduler->memory_limit > 0 && process_info_get_rss (process) > scheduler->memory_limit;
+}
+
+static void
+view_info_set_process (ViewInfo    *info,
+                       ProcessInfo *process)
+{
+  if (info->process == process)
+    return;
+
+  if (info->process)
+    info->process->views = g_list_remove (info->process->views, info);
+
+  info->process = process;
+  if (process)
+    process->views = g_list_append (process->views, info);
+}
+
+static void
+web_extension_destroyed (EphyProcessScheduler *scheduler,
+                         GObject              *web_extension)
+{
+  ProcessInfo *process;
+  GList *l;
+
+  process = g_hash_table_lookup (scheduler->processes, web_extension);
+  if (!process)
+    return;
+
+  LOG ("Web process %d is gone, %u tabs were using it", process->pid, g_list_length (process->views));
+
+  /* The views get moved to a new process once their page is created again. */
+  for (l = process->views; l; l = l->next)
+    ((ViewInfo *)l->data)->process = NULL;
+
+  g_hash_table_remove (scheduler->processes, web_extension);
+}
+
+/* Pages of the same registrable domain, like www.example.com and
+ * mail.example.com, may script each other, so they are one site. Hosts with
+ * no registrable domain, like IP addresses, are sites of their own. */
+static char *
+get_site_for_uri (const char *uri)
+{
+  SoupURI *soup_uri;
+  const char *host;
+  const char *base_domain;
+  char *site = NULL;
+
+  if (!uri)
+    return NULL;
+
+  soup_uri = soup_uri_new (uri);
+  if (!soup_uri)
+    return NULL;
+
+  host = soup_uri_get_host (soup_uri);
+  if (host && *host) {
+    base_domain = soup_tld_get_base_domain (host, NULL);
+    site = g_strdup (base_domain ? base_domain : host);
+  }
+
+  soup_uri_free (soup_uri);
+
+  return site;
+}
+
+static void
+view_uri_changed_cb (WebKitWebView        *view,
+                     GParamSpec           *pspec,
+                     EphyProcessScheduler *scheduler)
+{
+  ViewInfo *info;
+
+  info = g_hash_table_lookup (scheduler->views, view);
+  if (!info)
+    return;
+
+  g_free (info->site);
+  info->site = get_site_for_uri (webkit_web_view_get_uri (view));
+}
+
+static void
+view_destroyed (EphyProcessScheduler *scheduler,
+                GObject              *view)
+{
+  ViewInfo *info;
+
+  info = g_hash_table_lookup (scheduler->views, view);
+  if (!info)
+    return;
+
+  view_info_set_process (info, NULL);
+  g_hash_table_remove (scheduler->views, view);
+}
+
+static void
+ephy_process_scheduler_dispose (GObject *object)
+{
+  EphyProcessScheduler *scheduler = EPHY_PROCESS_SCHEDULER (object);
+  GHashTableIter iter;
+  gpointer key;
+
+  if (scheduler->views) {
+    g_hash_table_iter_init (&iter, scheduler->views);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+      g_signal_handlers_disconnect_by_func (key, view_uri_changed_cb, scheduler);
+      g_object_weak_unref (G_OBJECT (key), (GWeakNotify)view_destroyed, scheduler);
+    }
+    g_clear_pointer (&scheduler->views, g_hash_table_unref);
+  }
+
+  if (scheduler->processes) {
+    g_hash_table_iter_init (&iter, scheduler->processes);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+      g_object_weak_unref (G_OBJECT (key), (GWeakNotify)web_extension_destroyed, scheduler);
+    g_clear_pointer (&scheduler->processes, g_hash_table_unref);
+  }
+
+  G_OBJECT_CLASS (ephy_process_scheduler_parent_class)->dispose (object);
+}
+
+static void
+ephy_process_scheduler_class_init (EphyProcessSchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_process_scheduler_dispose;
+}
+
+static void
+ephy_process_scheduler_init (EphyProcessScheduler *scheduler)
+{
+  scheduler->processes = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)process_info_free);
+  scheduler->views = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)view_info_free);
+}
+
+/**
+ * ephy_process_scheduler_new:
+ * @max_processes: the maximum number of web processes, or 0 for no limit
+ * @memory_limit: the resident memory, in bytes, above which a web process
+ *   should not get any more tabs, or 0 for no limit
+ *
+ * Creates a scheduler that decides which web process new tabs go to. It
+ * only makes sense with one secondary process per web view.
+ *
+ * Returns: (transfer full): a new #EphyProcessScheduler
+ **/
+EphyProcessScheduler *
+ephy_process_scheduler_new (guint   max_processes,
+                            guint64 memory_limit)
+{
+  EphyProcessScheduler *scheduler;
+
+  scheduler = g_object_new (EPHY_TYPE_PROCESS_SCHEDULER, NULL);
+  scheduler->max_processes = max_processes;
+  scheduler->memory_limit = memory_limit;
+
+  return scheduler;
+}
+
+/**
+ * ephy_process_scheduler_add_view:
+ * @scheduler: an #EphyProcessScheduler
+ * @view: a newly created #WebKitWebView
+ *
+ * Starts keeping track of the site @view shows and of the web process it
+ * ends up in.
+ **/
+void
+ephy_process_scheduler_add_view (EphyProcessScheduler *scheduler,
+                                 WebKitWebView        *view)
+{
+  ViewInfo *info;
+
+  g_assert (EPHY_IS_PROCESS_SCHEDULER (scheduler));
+  g_assert (WEBKIT_IS_WEB_VIEW (view));
+
+  if (g_hash_table_contains (scheduler->views, view))
+    return;
+
+  info = g_slice_new0 (ViewInfo);
+  info->view = view;
+  g_hash_table_insert (scheduler->views, view, info);
+
+  g_signal_connect (view, "notify::uri", G_CALLBACK (view_uri_changed_cb), scheduler);
+  g_object_weak_ref (G_OBJECT (view), (GWeakNotify)view_destroyed, scheduler);
+}
+
+/**
+ * ephy_process_scheduler_page_created:
+ * @scheduler: an #EphyProcessScheduler
+ * @page_id: the identifier of the web page created
+ * @web_extension: the extension of the web process the page was created in
+ *
+ * Records that the view showing @page_id now lives in the web process of
+ * @web_extension. This happens once for every view, and again whenever its
+ * web process had to be replaced.
+ **/
+void
+ephy_process_scheduler_page_created (EphyProcessScheduler  *scheduler,
+                                     guint64                page_id,
+                                     EphyWebExtensionProxy *web_extension)
+{
+  GHashTableIter iter;
+  ProcessInfo *process;
+  ViewInfo *info;
+
+  g_assert (EPHY_IS_PROCESS_SCHEDULER (scheduler));
+  g_assert (EPHY_IS_WEB_EXTENSION_PROXY (web_extension));
+
+  process = g_hash_table_lookup (scheduler->processes, web_extension);
+  if (!process) {
+    process = g_slice_new0 (ProcessInfo);
+    process->web_extension = web_extension;
+    process->pid = ephy_web_extension_proxy_get_pid (web_extension);
+    g_hash_table_insert (scheduler->processes, web_extension, process);
+    g_object_weak_ref (G_OBJECT (web_extension), (GWeakNotify)web_extension_destroyed, scheduler);
+  }
+
+  g_hash_table_iter_init (&iter, scheduler->views);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&info)) {
+    if (webkit_web_view_get_page_id (info->view) == page_id) {
+      view_info_set_process (info, process);
+      break;
+    }
+  }
+}
+
+/**
+ * ephy_process_scheduler_get_related_view:
+ * @scheduler: an #EphyProcessScheduler
+ * @uri: the address a new tab is about to load
+ *
+ * Picks the web process a new tab for @uri should go to. Tabs of the same
+ * site are kept together, as long as their process stays within the memory
+ * budget. Other tabs get a process of their own while the process limit
+ * allows it, and otherwise go to the process using the least memory,
+ * instead of wherever WebKit would put them.
+ *
+ * Returns: (transfer none): a view to create the new tab's view as related
+ * to, with ephy_web_view_new_with_related_view(), or %NULL to let WebKit
+ * start a new process
+ **/
+WebKitWebView *
+ephy_process_scheduler_get_related_view (EphyProcessScheduler *scheduler,
+                                         const char           *uri)
+{
+  GHashTableIter iter;
+  ProcessInfo *process;
+  ProcessInfo *lightest = NULL;
+  ViewInfo *info;
+  WebKitWebView *related_view = NULL;
+  char *site;
+
+  g_assert (EPHY_IS_PROCESS_SCHEDULER (scheduler));
+
+  /* Without a limit WebKit gives every view a process of its own, which is
+   * what the user asked for. */
+  if (scheduler->max_processes == 0 && scheduler->memory_limit == 0)
+    return NULL;
+
+  site = get_site_for_uri (uri);
+
+  /* A view whose page was not created yet has no process, but WebKit puts a
+   * related view in the same one anyway, so it is a good match too. This is
+   * what keeps the tabs of a restored session together. */
+  if (site) {
+    g_hash_table_iter_init (&iter, scheduler->views);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&info)) {
+      if (g_strcmp0 (info->site, site) != 0)
+        continue;
+
+      if (!info->process || !process_info_is_over_budget (scheduler, info->process)) {
+        related_view = info->view;
+        LOG ("Placing %s with the other tabs of its site in web process %d",
+             site, info->process ? info->process->pid : -1);
+        goto out;
+      }
+    }
+  }
+
+  if (scheduler->max_processes == 0 || g_hash_table_size (scheduler->processes) < scheduler->max_processes) {
+    LOG ("Placing %s in a new web process, %u are running",
+         uri, g_hash_table_size (scheduler->processes));
+    goto out;
+  }
+
+  /* At the process limit, spread the load rather than letting unrelated
+   * tabs pile up on a process that is already heavy. */
+  g_hash_table_iter_init (&iter, scheduler->processes);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&process)) {
+    if (!process->views)
+      continue;
+
+    if (!lightest || process_info_get_rss (process) < process_info_get_rss (lightest))
+      lightest = process;
+  }
+
+  if (lightest) {
+    related_view = ((ViewInfo *)lightest->views->data)->view;
+    LOG ("Placing %s in web process %d, which has %u tabs and uses %" G_GUINT64_FORMAT " KiB",
+         uri, lightest->pid, g_list_length (lightest->views), process_info_get_rss (lightest) / 1024);
+  }
+
+ out:
+  g_free (site);
+
+  return related_view;
+}
+
+/**
+ * ephy_process_scheduler_to_html:
+ * @scheduler: an #EphyProcessScheduler
+ *
+ * Returns: (transfer full): an HTML table with the web processes, their
+ * number of tabs and memory usage, for about:memory
+ **/
+char *
+ephy_process_scheduler_to_html (EphyProcessScheduler *scheduler)
+{
+  GHashTableIter iter;
+  ProcessInfo *process;
+  GString *str;
+  GList *l;
+
+  g_assert (EPHY_IS_PROCESS_SCHEDULER (scheduler));
+
+  str = g_string_new ("");
+  g_string_append_printf (str, "<h2>%s</h2>", _("Web processes"));
+  g_string_append_printf (str, "<p>%u / ", g_hash_table_size (scheduler->processes));
+  if (scheduler->max_processes)
+    g_string_append_printf (str, "%u</p>", scheduler->max_processes);
+  else
+    g_string_append (str, "∞</p>");
+
+  g_string_append_printf (str, "<table><tr><th>%s</th><th>%s</th><th>%s</th><th>%s</th></tr>",
+                          _("Process"), _("Tabs"), _("Resident memory (KiB)"), _("Sites"));
+
+  g_hash_table_iter_init (&iter, scheduler->processes);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&process)) {
+    g_string_append_printf (str, "<tr><td>%d</td><td>%u</td><td>%" G_GUINT64_FORMAT "</td><td>",
+                            process->pid, g_list_length (process->views),
+                            process_info_get_rss (process) / 1024);
+
+    for (l = process->views; l; l = l->next) {
+      ViewInfo *info = (ViewInfo *)l->data;
+      char *escaped;
+
+      if (!info->site)
+        continue;
+
+      escaped = g_markup_escape_text (info->site, -1);
+      g_string_append_printf (str, "%s%s", escaped, l->next ? ", " : "");
+      g_free (escaped);
+    }
+
+    g_string_append (str, "</td></tr>");
+  }
+
+  g_string_append (str, "</table>");
+
+  return g_string_free (str, FALSE);
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-web-extension-proxy.h"
+
+#include <glib-object.h>
+#include <webkit2/webkit2.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_PROCESS_SCHEDULER (ephy_process_scheduler_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyProcessScheduler, ephy_process_scheduler, EPHY, PROCESS_SCHEDULER, GObject)
+
+EphyProcessScheduler *ephy_process_scheduler_new              (guint                  max_processes,
+                                                               guint64                memory_limit);
+void                  ephy_process_scheduler_add_view         (EphyProcessScheduler  *scheduler,
+                                                               WebKitWebView         *view);
+void                  ephy_process_scheduler_page_created     (EphyProcessScheduler  *scheduler,
+                                                               guint64                page_id,
+                                                               EphyWebExtensionProxy *web_extension);
+WebKitWebView        *ephy_process_scheduler_get_related_view (EphyProcessScheduler  *scheduler,
+                                                               const char            *uri);
+char                 *ephy_process_scheduler_to_html          (EphyProcessScheduler  *scheduler);
+
+G_END_DECLS
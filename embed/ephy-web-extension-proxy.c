@@ -188,6 +188,28 @@ ephy_web_extension_proxy_new (GDBusConnection *connection)
   return web_extension;
 }
 
+/**
+ * ephy_web_extension_proxy_get_pid:
+ * @web_extension: an #EphyWebExtensionProxy
+ *
+ * Returns: the process id of the web process @web_extension lives in, as
+ * given by the credentials of its D-Bus connection, or -1 if it is unknown.
+ **/
+pid_t
+ephy_web_extension_proxy_get_pid (EphyWebExtensionProxy *web_extension)
+{
+  GCredentials *credentials;
+
+  if (!web_extension->connection)
+    return -1;
+
+  credentials = g_dbus_connection_get_peer_credentials (web_extension->connection);
+  if (!credentials)
+    return -1;
+
+  return g_credentials_get_unix_pid (credentials, NULL);
+}
+
 void
 ephy_web_extension_proxy_form_auth_data_save_confirmation_response (EphyWebExtensionProxy *web_extension,
                                                                     guint                  request_id,
@@ -395,17 +417,17 @@ ephy_web_extension_proxy_get_web_app_title_finish (EphyWebExtensionProxy *web_ex
 
 void
 ephy_web_extension_proxy_history_set_urls (EphyWebExtensionProxy *web_extension,
-                                           GList                 *urls)
+                                           EphyHistoryURLResults *urls)
 {
-  GList *l;
   GVariantBuilder builder;
+  guint i;
 
   if (!web_extension->proxy)
     return;
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
-  for (l = urls; l; l = g_list_next (l)) {
-    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+  for (i = 0; i < ephy_history_url_results_get_length (urls); i++) {
+    EphyHistoryURL *url = ephy_history_url_results_get (urls, i);
 
     g_variant_builder_add (&builder, "(ss)", url->url, url->title);
   }
@@ -499,3 +521,26 @@ ephy_web_extension_proxy_history_clear (EphyWebExtensionProxy *web_extension)
                      web_extension->cancellable,
                      NULL, NULL);
 }
+
+void
+ephy_web_extension_proxy_passwords_set_cached_users (EphyWebExtensionProxy *web_extension,
+                                                     const char            *origin,
+                                                     GList                 *usernames)
+{
+  GVariantBuilder builder;
+
+  if (!web_extension->proxy)
+    return;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+  for (GList *l = usernames; l && l->data; l = l->next)
+    g_variant_builder_add (&builder, "s", l->data);
+
+  g_dbus_proxy_call (web_extension->proxy,
+                     "PasswordsSetCachedUsers",
+                     g_variant_new ("(s@as)", origin, g_variant_builder_end (&builder)),
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1,
+                     web_extension->cancellable,
+                     NULL, NULL);
+}
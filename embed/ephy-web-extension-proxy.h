@@ -20,7 +20,10 @@
 
 #pragma once
 
+#include "ephy-history-types.h"
+
 #include <gio/gio.h>
+#include <sys/types.h>
 
 G_BEGIN_DECLS
 
@@ -29,6 +32,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (EphyWebExtensionProxy, ephy_web_extension_proxy, EPHY, WEB_EXTENSION_PROXY, GObject)
 
 EphyWebExtensionProxy *ephy_web_extension_proxy_new                                       (GDBusConnection       *connection);
+pid_t                  ephy_web_extension_proxy_get_pid                                   (EphyWebExtensionProxy *web_extension);
 void                   ephy_web_extension_proxy_form_auth_data_save_confirmation_response (EphyWebExtensionProxy *web_extension,
                                                                                            guint                  request_id,
                                                                                            gboolean               response);
@@ -60,7 +64,7 @@ char                  *ephy_web_extension_proxy_get_web_app_title_finish
                                                                                            GAsyncResult          *result,
                                                                                            GError               **error);
 void                   ephy_web_extension_proxy_history_set_urls                          (EphyWebExtensionProxy *web_extension,
-                                                                                           GList                 *urls);
+                                                                                           EphyHistoryURLResults *urls);
 void                   ephy_web_extension_proxy_history_set_url_thumbnail                 (EphyWebExtensionProxy *web_extension,
                                                                                            const char            *url,
                                                                                            const char            *path);
@@ -72,5 +76,8 @@ void                   ephy_web_extension_proxy_history_delete_url
 void                   ephy_web_extension_proxy_history_delete_host                       (EphyWebExtensionProxy *web_extension,
                                                                                            const char            *host);
 void                   ephy_web_extension_proxy_history_clear                             (EphyWebExtensionProxy *web_extension);
+void                   ephy_web_extension_proxy_passwords_set_cached_users                (EphyWebExtensionProxy *web_extension,
+                                                                                           const char            *origin,
+                                                                                           GList                 *usernames);
 
 G_END_DECLS
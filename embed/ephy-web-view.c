@@ -128,6 +128,7 @@ struct _EphyWebView {
 
   /* Web Extension */
   EphyWebExtensionProxy *web_extension;
+  GHashTable *cached_users_origins;
 };
 
 typedef struct {
@@ -686,18 +687,21 @@ typedef struct {
   EphyWebView *web_view;
   guint request_id;
   char *origin;
+  char *username;
 } FormAuthRequestData;
 
 static FormAuthRequestData *
 form_auth_request_data_new (EphyWebView *web_view,
                             guint        request_id,
-                            const char  *origin)
+                            const char  *origin,
+                            const char  *username)
 {
   FormAuthRequestData *data;
   data = g_slice_new (FormAuthRequestData);
   data->web_view = web_view;
   data->request_id = request_id;
   data->origin = g_strdup (origin);
+  data->username = g_strdup (username);
   return data;
 }
 
@@ -705,6 +709,7 @@ static void
 form_auth_request_data_free (FormAuthRequestData *data)
 {
   g_free (data->origin);
+  g_free (data->username);
   g_slice_free (FormAuthRequestData, data);
 }
 
@@ -731,6 +736,14 @@ form_auth_data_save_confirmation_response (GtkInfoBar          *info_bar,
                                                                         response_id == GTK_RESPONSE_YES);
   }
 
+  /* The web process stores the password, keep the usernames cache in sync. */
+  if (response_id == GTK_RESPONSE_YES && data->username && *data->username) {
+    EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+
+    ephy_password_manager_add_cached_user (ephy_embed_shell_get_password_manager (shell),
+                                           data->origin, data->username);
+  }
+
   if (response_id == GTK_RESPONSE_REJECT) {
     EphyEmbedShell *shell = ephy_embed_shell_get_default ();
     EphyPermissionsManager *manager = ephy_embed_shell_get_permissions_manager (shell);
@@ -761,7 +774,7 @@ form_auth_data_save_requested (EphyEmbedShell *shell,
     return;
 
   info_bar = ephy_web_view_create_form_auth_save_confirmation_info_bar (web_view, origin, username);
-  data = form_auth_request_data_new (web_view, request_id, origin);
+  data = form_auth_request_data_new (web_view, request_id, origin, username);
   g_signal_connect (info_bar, "response",
                     G_CALLBACK (form_auth_data_save_confirmation_response),
                     data);
@@ -841,6 +854,93 @@ allow_unsafe_browsing_cb (EphyEmbedShell *shell,
   ephy_web_view_load_url (view, ephy_web_view_get_address (view));
 }
 
+static void
+send_cached_users_for_origin (EphyWebView *view,
+                              const char  *origin)
+{
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  EphyEmbedShellMode mode;
+  EphyPasswordManager *manager;
+
+  if (!view->web_extension)
+    return;
+
+  mode = ephy_embed_shell_get_mode (shell);
+  if (mode == EPHY_EMBED_SHELL_MODE_PRIVATE || mode == EPHY_EMBED_SHELL_MODE_INCOGNITO)
+    return;
+
+  if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_REMEMBER_PASSWORDS))
+    return;
+
+  /* Only the usernames of the origins loaded in the page are sent to the
+   * web process, so that it doesn't need to read the whole keyring. */
+  manager = ephy_embed_shell_get_password_manager (shell);
+  ephy_web_extension_proxy_passwords_set_cached_users (view->web_extension, origin,
+                                                       ephy_password_manager_get_cached_users (manager, origin));
+}
+
+static void
+send_cached_users (EphyWebView *view,
+                   const char  *uri)
+{
+  char *origin;
+
+  origin = ephy_uri_to_security_origin (uri);
+  if (!origin)
+    return;
+
+  send_cached_users_for_origin (view, origin);
+  g_free (origin);
+}
+
+static void
+cached_users_changed_cb (EphyPasswordManager *manager,
+                         const char          *origin,
+                         EphyWebView         *view)
+{
+  const char *uri = webkit_web_view_get_uri (WEBKIT_WEB_VIEW (view));
+  char *view_origin;
+  GHashTableIter iter;
+  gpointer key;
+
+  /* Keep up to date the origins requested by the frames of the page too. */
+  if (!origin) {
+    g_hash_table_iter_init (&iter, view->cached_users_origins);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+      send_cached_users_for_origin (view, key);
+  } else if (g_hash_table_contains (view->cached_users_origins, origin)) {
+    send_cached_users_for_origin (view, origin);
+    return;
+  }
+
+  if (!uri)
+    return;
+
+  if (origin) {
+    view_origin = ephy_uri_to_security_origin (uri);
+    if (g_strcmp0 (origin, view_origin)) {
+      g_free (view_origin);
+      return;
+    }
+    g_free (view_origin);
+  }
+
+  send_cached_users (view, uri);
+}
+
+static void
+cached_users_requested_cb (EphyEmbedShell *shell,
+                           guint64         page_id,
+                           const char     *origin,
+                           EphyWebView    *view)
+{
+  if (webkit_web_view_get_page_id (WEBKIT_WEB_VIEW (view)) != page_id)
+    return;
+
+  g_hash_table_add (view->cached_users_origins, g_strdup (origin));
+  send_cached_users_for_origin (view, origin);
+}
+
 static void
 page_created_cb (EphyEmbedShell        *shell,
                  guint64                page_id,
@@ -853,6 +953,9 @@ page_created_cb (EphyEmbedShell        *shell,
   view->web_extension = web_extension;
   g_object_add_weak_pointer (G_OBJECT (view->web_extension), (gpointer *)&view->web_extension);
 
+  /* A new web process has no usernames cached. */
+  g_hash_table_remove_all (view->cached_users_origins);
+
   g_signal_connect_object (shell, "form-auth-data-save-requested",
                            G_CALLBACK (form_auth_data_save_requested),
                            view, 0);
@@ -861,6 +964,10 @@ page_created_cb (EphyEmbedShell        *shell,
                            G_CALLBACK (sensitive_form_focused_cb),
                            view, 0);
 
+  g_signal_connect_object (shell, "cached-users-requested",
+                           G_CALLBACK (cached_users_requested_cb),
+                           view, 0);
+
   g_signal_connect_object (shell, "allow-tls-certificate",
                            G_CALLBACK (allow_tls_certificate_cb),
                            view, 0);
@@ -868,6 +975,10 @@ page_created_cb (EphyEmbedShell        *shell,
   g_signal_connect_object (shell, "allow-unsafe-browsing",
                            G_CALLBACK (allow_unsafe_browsing_cb),
                            view, 0);
+
+  /* The first load of the view started before the extension was attached. */
+  if (webkit_web_view_get_uri (WEBKIT_WEB_VIEW (view)))
+    send_cached_users (view, webkit_web_view_get_uri (WEBKIT_WEB_VIEW (view)));
 }
 
 static void
@@ -931,6 +1042,7 @@ ephy_web_view_finalize (GObject *object)
   g_free (view->link_message);
   g_free (view->loading_message);
   g_free (view->tls_error_failing_uri);
+  g_hash_table_unref (view->cached_users_origins);
 
   G_OBJECT_CLASS (ephy_web_view_parent_class)->finalize (object);
 }
@@ -1582,6 +1694,21 @@ out:
   return TRUE;
 }
 
+static void
+apply_zoom_level (EphyWebView *view,
+                  double       zoom_level)
+{
+  double current_zoom;
+
+  current_zoom = webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view));
+
+  if (zoom_level != current_zoom) {
+    view->is_setting_zoom = TRUE;
+    webkit_web_view_set_zoom_level (WEBKIT_WEB_VIEW (view), zoom_level);
+    view->is_setting_zoom = FALSE;
+  }
+}
+
 static void
 get_host_for_url_cb (gpointer service,
                      gboolean success,
@@ -1589,23 +1716,12 @@ get_host_for_url_cb (gpointer service,
                      gpointer user_data)
 {
   EphyHistoryHost *host;
-  EphyWebView *view;
-  double current_zoom;
 
   if (success == FALSE)
     return;
 
-  view = EPHY_WEB_VIEW (user_data);
   host = (EphyHistoryHost *)result_data;
-
-  current_zoom = webkit_web_view_get_zoom_level (WEBKIT_WEB_VIEW (view));
-
-  if (host->zoom_level != current_zoom) {
-    view->is_setting_zoom = TRUE;
-    webkit_web_view_set_zoom_level (WEBKIT_WEB_VIEW (view), host->zoom_level);
-    view->is_setting_zoom = FALSE;
-  }
-
+  apply_zoom_level (EPHY_WEB_VIEW (user_data), host->zoom_level);
   ephy_history_host_free (host);
 }
 
@@ -1613,10 +1729,20 @@ static void
 restore_zoom_level (EphyWebView *view,
                     const char  *address)
 {
-  if (ephy_embed_utils_address_has_web_scheme (address))
-    ephy_history_service_get_host_for_url (view->history_service,
-                                           address, view->history_service_cancellable,
-                                           (EphyHistoryJobCallback)get_host_for_url_cb, view);
+  double zoom_level;
+
+  if (!ephy_embed_utils_address_has_web_scheme (address))
+    return;
+
+  if (ephy_embed_shell_lookup_zoom_level (ephy_embed_shell_get_default (), address, &zoom_level)) {
+    apply_zoom_level (view, zoom_level);
+    return;
+  }
+
+  /* Zoom levels are not loaded yet, or failed to load; ask the history thread. */
+  ephy_history_service_get_host_for_url (view->history_service,
+                                         address, view->history_service_cancellable,
+                                         (EphyHistoryJobCallback)get_host_for_url_cb, view);
 }
 
 /**
@@ -1746,6 +1872,7 @@ load_changed_cb (WebKitWebView  *web_view,
 
   switch (load_event) {
     case WEBKIT_LOAD_STARTED: {
+      EphyPrefetcher *prefetcher;
       const char *loading_uri = NULL;
 
       view->load_failed = FALSE;
@@ -1765,11 +1892,18 @@ load_changed_cb (WebKitWebView  *web_view,
 
       ephy_web_view_set_loading_message (view, loading_uri);
 
+      prefetcher = ephy_embed_shell_get_prefetcher (ephy_embed_shell_get_default ());
+      if (prefetcher)
+        ephy_prefetcher_record_navigation (prefetcher, loading_uri);
+
       /* Zoom level. */
       restore_zoom_level (view, loading_uri);
+
+      send_cached_users (view, loading_uri);
       break;
     }
     case WEBKIT_LOAD_REDIRECTED:
+      send_cached_users (view, webkit_web_view_get_uri (web_view));
       break;
     case WEBKIT_LOAD_COMMITTED: {
       const char *uri;
@@ -2566,11 +2700,8 @@ zoom_changed_cb (WebKitWebView *web_view,
     return;
 
   address = ephy_web_view_get_address (EPHY_WEB_VIEW (web_view));
-  if (ephy_embed_utils_address_has_web_scheme (address)) {
-    ephy_history_service_set_url_zoom_level (EPHY_WEB_VIEW (web_view)->history_service,
-                                             address, zoom,
-                                             NULL, NULL, NULL);
-  }
+  if (ephy_embed_utils_address_has_web_scheme (address))
+    ephy_embed_shell_set_zoom_level (ephy_embed_shell_get_default (), address, zoom);
 }
 
 static gboolean
@@ -2591,10 +2722,13 @@ script_dialog_cb (WebKitWebView      *web_view,
 static void
 ephy_web_view_init (EphyWebView *web_view)
 {
+  EphyEmbedShellMode mode;
+
   web_view->is_blank = TRUE;
   web_view->ever_committed = FALSE;
   web_view->document_type = EPHY_WEB_VIEW_DOCUMENT_HTML;
   web_view->security_level = EPHY_SECURITY_LEVEL_TO_BE_DETERMINED;
+  web_view->cached_users_origins = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   web_view->file_monitor = ephy_file_monitor_new (web_view);
 
@@ -2663,6 +2797,18 @@ ephy_web_view_init (EphyWebView *web_view)
   g_signal_connect_object (ephy_embed_shell_get_default (), "page-created",
                            G_CALLBACK (page_created_cb),
                            web_view, 0);
+
+  /* Passwords are not remembered in private modes, and tests don't have a
+   * keyring to load the usernames from. */
+  mode = ephy_embed_shell_get_mode (ephy_embed_shell_get_default ());
+  if (mode != EPHY_EMBED_SHELL_MODE_PRIVATE &&
+      mode != EPHY_EMBED_SHELL_MODE_INCOGNITO &&
+      mode != EPHY_EMBED_SHELL_MODE_TEST) {
+    g_signal_connect_object (ephy_embed_shell_get_password_manager (ephy_embed_shell_get_default ()),
+                             "cached-users-changed",
+                             G_CALLBACK (cached_users_changed_cb),
+                             web_view, 0);
+  }
 }
 
 /**
@@ -3486,12 +3632,18 @@ ephy_web_view_load_new_tab_page (EphyWebView *view)
 {
   EphyEmbedShell *shell;
   EphyEmbedShellMode mode;
+  EphyPrefetcher *prefetcher;
 
   g_assert (EPHY_IS_WEB_VIEW (view));
 
   shell = ephy_embed_shell_get_default ();
   mode = ephy_embed_shell_get_mode (shell);
 
+  /* The new tab page offers the most visited sites. */
+  prefetcher = ephy_embed_shell_get_prefetcher (shell);
+  if (prefetcher)
+    ephy_prefetcher_prefetch_top_sites (prefetcher);
+
   ephy_web_view_freeze_history (view);
   ephy_web_view_set_visit_type (view, EPHY_PAGE_VISIT_HOMEPAGE);
   if (mode == EPHY_EMBED_SHELL_MODE_INCOGNITO)
@@ -31,6 +31,7 @@
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-uri-tester-shared.h"
+#include "ephy-web-extension-settings.h"
 
 #include <gio/gio.h>
 #include <glib/gstdio.h>
@@ -668,11 +669,15 @@ adblock_file_monitor_changed (GFileMonitor     *monitor,
                               GFileMonitorEvent event_type,
                               EphyUriTester    *tester)
 {
-  if (event_type != G_FILE_MONITOR_EVENT_RENAMED)
+  /* The UI process renames downloaded filters into place, but writes the
+   * empty file it leaves behind on errors directly. */
+  if (event_type == G_FILE_MONITOR_EVENT_RENAMED)
+    file = other_file;
+  else if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
     return;
 
   g_signal_handlers_disconnect_by_func (monitor, adblock_file_monitor_changed, tester);
-  g_file_read_async (other_file, G_PRIORITY_DEFAULT_IDLE, NULL,
+  g_file_read_async (file, G_PRIORITY_DEFAULT_IDLE, NULL,
                      (GAsyncReadyCallback)file_read_cb,
                      tester);
 }
@@ -928,7 +933,7 @@ ephy_uri_tester_load (EphyUriTester *tester)
 
   g_assert (EPHY_IS_URI_TESTER (tester));
 
-  if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK))
+  if (!ephy_web_extension_settings_get ()->enable_adblock)
     tester->adblock_loaded = TRUE;
 
   if (tester->adblock_loaded
@@ -542,6 +542,16 @@ next:
   return password_fields;
 }
 
+static gboolean
+is_username_input_type (const char *type)
+{
+  return g_strcmp0 (type, "text") == 0 ||
+         g_strcmp0 (type, "email") == 0 ||
+         g_strcmp0 (type, "tel") == 0 ||
+         g_strcmp0 (type, "url") == 0 ||
+         g_strcmp0 (type, "number") == 0;
+}
+
 /*
  * The heuristic is based on the one used in Firefox. See
  * https://dxr.mozilla.org/mozilla-central/rev/892c8916ba32b7733e06bfbfdd4083ffae3ca028/toolkit/components/passwordmgr/LoginManagerContent.jsm#733
@@ -579,11 +589,7 @@ ephy_web_dom_utils_find_form_auth_elements (WebKitDOMHTMLFormElement *form,
       continue;
 
     g_object_get (element, "type", &element_type, NULL);
-    if (g_strcmp0 (element_type, "text") == 0 ||
-        g_strcmp0 (element_type, "email") == 0 ||
-        g_strcmp0 (element_type, "tel") == 0 ||
-        g_strcmp0 (element_type, "url") == 0 ||
-        g_strcmp0 (element_type, "number") == 0) {
+    if (is_username_input_type (element_type)) {
       username_node = g_object_ref (WEBKIT_DOM_HTML_INPUT_ELEMENT (element));
       g_free (element_type);
       break;
@@ -723,6 +729,78 @@ ephy_web_dom_utils_form_contains_sensitive_element (WebKitDOMHTMLFormElement *fo
   return found_auth_element;
 }
 
+/**
+ * ephy_web_dom_utils_scan_form:
+ * @form: a #WebKitDOMHTMLFormElement
+ * @sensitive: (out): whether @form contains a password field
+ * @username: (out) (transfer full): return location for the username node
+ * @password: (out) (transfer full): return location for the password node
+ *
+ * Classifies the controls of @form in a single pass over its elements. This
+ * is equivalent to calling ephy_web_dom_utils_form_contains_sensitive_element()
+ * and ephy_web_dom_utils_find_form_auth_elements() in %AUTH_CACHE_AUTOFILL
+ * mode, in which the values of the fields don't matter, but only reads the
+ * type of each control once.
+ *
+ * Returns: %TRUE if a password node was found to autofill
+ **/
+gboolean
+ephy_web_dom_utils_scan_form (WebKitDOMHTMLFormElement *form,
+                              gboolean                 *sensitive,
+                              WebKitDOMNode           **username,
+                              WebKitDOMNode           **password)
+{
+  WebKitDOMHTMLCollection *elements;
+  WebKitDOMNode *username_node = NULL;
+  WebKitDOMNode *password_node = NULL;
+  guint i, n_elements;
+  guint n_passwords = 0;
+
+  *sensitive = FALSE;
+
+  elements = webkit_dom_html_form_element_get_elements (form);
+  n_elements = webkit_dom_html_collection_get_length (elements);
+
+  for (i = 0; i < n_elements; i++) {
+    WebKitDOMNode *element;
+    char *element_type;
+
+    element = webkit_dom_html_collection_item (elements, i);
+    if (!WEBKIT_DOM_IS_HTML_INPUT_ELEMENT (element))
+      continue;
+
+    g_object_get (element, "type", &element_type, NULL);
+
+    if (g_strcmp0 (element_type, "password") == 0) {
+      *sensitive = TRUE;
+      /* The first password field is the one to fill, and the username is the
+       * closest eligible field before it. */
+      if (n_passwords++ == 0)
+        password_node = element;
+    } else if (g_strcmp0 (element_type, "adminpw") == 0) {
+      *sensitive = TRUE;
+    } else if (n_passwords == 0 && is_username_input_type (element_type)) {
+      username_node = element;
+    }
+
+    g_free (element_type);
+  }
+
+  /* See ephy_web_dom_utils_find_password_fields(). */
+  if (n_passwords == 0 || n_passwords > 3) {
+    g_object_unref (elements);
+    return FALSE;
+  }
+
+  *password = g_object_ref (password_node);
+  if (username_node)
+    *username = g_object_ref (username_node);
+
+  g_object_unref (elements);
+
+  return TRUE;
+}
+
 /**
  * ephy_web_dom_utils_get_absolute_position_for_element:
  * @element: the #WebKitDOMElement.
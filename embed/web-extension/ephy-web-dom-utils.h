@@ -48,6 +48,11 @@ gboolean ephy_web_dom_utils_find_form_auth_elements (WebKitDOMHTMLFormElement *f
 
 gboolean ephy_web_dom_utils_form_contains_sensitive_element (WebKitDOMHTMLFormElement *form);
 
+gboolean ephy_web_dom_utils_scan_form (WebKitDOMHTMLFormElement *form,
+                                       gboolean                 *sensitive,
+                                       WebKitDOMNode           **username,
+                                       WebKitDOMNode           **password);
+
 void ephy_web_dom_utils_get_absolute_bottom_for_element (WebKitDOMElement *element,
                                                          double           *x,
                                                          double           *y);
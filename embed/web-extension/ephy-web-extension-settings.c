@@ -0,0 +1,98 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-web-extension-settings.h"
+
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
+
+#include <string.h>
+
+/* The settings read for every request and every form. They are copied
+ * into a snapshot that is replaced as a whole when any of them changes. */
+static EphyWebExtensionSettings *snapshot = NULL;
+
+static EphyWebExtensionSettings *
+settings_snapshot_new (void)
+{
+  EphyWebExtensionSettings *settings;
+
+  settings = g_new (EphyWebExtensionSettings, 1);
+  settings->enable_adblock = g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK);
+  settings->do_not_track = g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_DO_NOT_TRACK);
+  settings->remember_passwords = g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_REMEMBER_PASSWORDS);
+
+  return settings;
+}
+
+static void
+web_settings_changed_cb (GSettings  *settings,
+                         const char *key,
+                         gpointer    user_data)
+{
+  if (strcmp (key, EPHY_PREFS_WEB_ENABLE_ADBLOCK) != 0 &&
+      strcmp (key, EPHY_PREFS_WEB_DO_NOT_TRACK) != 0 &&
+      strcmp (key, EPHY_PREFS_WEB_REMEMBER_PASSWORDS) != 0)
+    return;
+
+  g_free (snapshot);
+  snapshot = settings_snapshot_new ();
+}
+
+void
+ephy_web_extension_settings_init (void)
+{
+  g_assert (snapshot == NULL);
+
+  g_signal_connect (EPHY_SETTINGS_WEB, "changed",
+                    G_CALLBACK (web_settings_changed_cb), NULL);
+
+  /* Reading the keys after connecting also ensures GSettings emits the
+   * changed signal for them. */
+  snapshot = settings_snapshot_new ();
+}
+
+void
+ephy_web_extension_settings_shutdown (void)
+{
+  if (!snapshot)
+    return;
+
+  g_signal_handlers_disconnect_by_func (EPHY_SETTINGS_WEB, web_settings_changed_cb, NULL);
+  g_clear_pointer (&snapshot, g_free);
+}
+
+/**
+ * ephy_web_extension_settings_get:
+ *
+ * Gets the current snapshot of the settings used by the web extension. The
+ * snapshot is replaced when the settings change, so the returned pointer
+ * must not be kept across main loop iterations.
+ *
+ * Returns: (transfer none): the current settings
+ **/
+const EphyWebExtensionSettings *
+ephy_web_extension_settings_get (void)
+{
+  g_assert (snapshot != NULL);
+
+  return snapshot;
+}
@@ -35,6 +35,7 @@
 #include "ephy-uri-helpers.h"
 #include "ephy-uri-tester.h"
 #include "ephy-web-dom-utils.h"
+#include "ephy-web-extension-settings.h"
 #include "ephy-web-overview.h"
 
 #include <gio/gio.h>
@@ -44,6 +45,8 @@
 #include <webkit2/webkit-web-extension.h>
 #include <JavaScriptCore/JavaScript.h>
 
+#define TRACKING_PARAMETERS_FILE "tracking-parameters.txt"
+
 struct _EphyWebExtension {
   GObject parent_instance;
 
@@ -103,6 +106,10 @@ static const char introspection_xml[] =
   "   <arg type='s' name='host' direction='in'/>"
   "  </method>"
   "  <method name='HistoryClear'/>"
+  "  <method name='PasswordsSetCachedUsers'>"
+  "   <arg type='s' name='origin' direction='in'/>"
+  "   <arg type='as' name='usernames' direction='in'/>"
+  "  </method>"
   " </interface>"
   "</node>";
 
@@ -154,7 +161,7 @@ should_use_adblocker (const char *request_uri,
                       const char *page_uri,
                       const char *redirected_request_uri)
 {
-  if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK))
+  if (!ephy_web_extension_settings_get ()->enable_adblock)
     return FALSE;
 
   /* Always load the main resource... */
@@ -187,10 +194,10 @@ should_use_adblocker (const char *request_uri,
 }
 
 static gboolean
-web_page_send_request (WebKitWebPage     *web_page,
-                       WebKitURIRequest  *request,
-                       WebKitURIResponse *redirected_response,
-                       EphyWebExtension  *extension)
+web_page_filter_request (WebKitWebPage     *web_page,
+                         WebKitURIRequest  *request,
+                         WebKitURIResponse *redirected_response,
+                         EphyWebExtension  *extension)
 {
   const char *request_uri;
   const char *redirected_response_uri;
@@ -205,7 +212,7 @@ web_page_send_request (WebKitWebPage     *web_page,
   if (!should_use_adblocker (request_uri, page_uri, redirected_response_uri))
     flags &= ~EPHY_URI_TEST_ADBLOCK;
 
-  if (g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_DO_NOT_TRACK)) {
+  if (ephy_web_extension_settings_get ()->do_not_track) {
     SoupMessageHeaders *headers = webkit_uri_request_get_http_headers (request);
     if (headers) {
       /* Do Not Track header. '1' means 'opt-out'. See:
@@ -247,6 +254,41 @@ web_page_send_request (WebKitWebPage     *web_page,
   return FALSE;
 }
 
+#if DEVELOPER_MODE
+#define SEND_REQUEST_STATS_INTERVAL 1000
+
+static struct {
+  guint64 requests;
+  gint64 total_time;
+} send_request_stats;
+#endif
+
+static gboolean
+web_page_send_request (WebKitWebPage     *web_page,
+                       WebKitURIRequest  *request,
+                       WebKitURIResponse *redirected_response,
+                       EphyWebExtension  *extension)
+{
+#if DEVELOPER_MODE
+  gint64 start_time;
+  gboolean ret;
+
+  start_time = g_get_monotonic_time ();
+  ret = web_page_filter_request (web_page, request, redirected_response, extension);
+  send_request_stats.total_time += g_get_monotonic_time () - start_time;
+
+  if (++send_request_stats.requests % SEND_REQUEST_STATS_INTERVAL == 0) {
+    LOG ("Filtered %" G_GUINT64_FORMAT " requests, %.2f µs per request on average",
+         send_request_stats.requests,
+         (double)send_request_stats.total_time / send_request_stats.requests);
+  }
+
+  return ret;
+#else
+  return web_page_filter_request (web_page, request, redirected_response, extension);
+#endif
+}
+
 static GHashTable *
 ephy_web_extension_get_form_auth_data_save_requests (EphyWebExtension *extension)
 {
@@ -782,6 +824,7 @@ show_user_choices (WebKitDOMDocument *document,
   WebKitDOMElement *main_div;
   WebKitDOMElement *ul;
   GList *cached_users;
+  const char *origin;
   gboolean username_node_ever_edited;
   double x, y;
   double input_width;
@@ -827,7 +870,10 @@ show_user_choices (WebKitDOMDocument *document,
                                     "padding: 0;",
                                     NULL);
 
-  cached_users = (GList *)g_object_get_data (G_OBJECT (username_node), "ephy-cached-users");
+  /* The cache may have been refreshed by the UI process since the form was
+   * scanned, so always look the usernames up when showing them. */
+  origin = g_object_get_data (G_OBJECT (username_node), "ephy-form-origin");
+  cached_users = ephy_password_manager_get_cached_users (ephy_web_extension_get ()->password_manager, origin);
 
   username_node_ever_edited =
     GPOINTER_TO_INT (g_object_get_data (G_OBJECT (username_node),
@@ -897,7 +943,7 @@ username_node_changed_cb (WebKitDOMNode  *username_node,
 {
   WebKitDOMDocument *document;
 
-  document = webkit_web_page_get_dom_document (web_page);
+  document = webkit_dom_node_get_owner_document (username_node);
   remove_user_choices (document);
 
   return TRUE;
@@ -910,7 +956,7 @@ username_node_clicked_cb (WebKitDOMNode  *username_node,
 {
   WebKitDOMDocument *document;
 
-  document = webkit_web_page_get_dom_document (web_page);
+  document = webkit_dom_node_get_owner_document (username_node);
   if (webkit_dom_document_get_element_by_id (document, "ephy-user-choices-container"))
     return TRUE;
 
@@ -961,7 +1007,7 @@ username_node_keydown_cb (WebKitDOMNode  *username_node,
   const char *username;
 
   keyboard_event = WEBKIT_DOM_KEYBOARD_EVENT (dom_event);
-  document = webkit_web_page_get_dom_document (web_page);
+  document = webkit_dom_node_get_owner_document (username_node);
 
   /* U+001B means the Esc key here; we should find a better way of testing which
    * key has been pressed.
@@ -1057,7 +1103,7 @@ username_node_input_cb (WebKitDOMNode  *username_node,
     return TRUE;
 
   g_object_set_data (G_OBJECT (username_node), "ephy-user-ever-edited", GINT_TO_POINTER (TRUE));
-  document = webkit_web_page_get_dom_document (web_page);
+  document = webkit_dom_node_get_owner_document (username_node);
   remove_user_choices (document);
   show_user_choices (document, username_node);
 
@@ -1111,27 +1157,171 @@ sensitive_form_focused_cb (WebKitDOMHTMLFormElement *form,
   return FALSE;
 }
 
+static gboolean
+username_node_event_cb (WebKitDOMDocument *document,
+                        WebKitDOMEvent    *dom_event,
+                        WebKitWebPage     *web_page)
+{
+  WebKitDOMEventTarget *target = NULL;
+  EphyPasswordManager *password_manager;
+  GList *cached_users;
+  const char *origin;
+  char *type = NULL;
+
+  /* Hooked username nodes are marked with the origin of their form; only
+   * those with more than one cached user get a menu, everything else is
+   * ignored as cheaply as possible. */
+  g_object_get (dom_event, "target", &target, NULL);
+  if (!WEBKIT_DOM_IS_HTML_INPUT_ELEMENT (target))
+    goto out;
+
+  origin = g_object_get_data (G_OBJECT (target), "ephy-form-origin");
+  password_manager = ephy_web_extension_get ()->password_manager;
+  if (!origin || !password_manager)
+    goto out;
+
+  cached_users = ephy_password_manager_get_cached_users (password_manager, origin);
+  if (!cached_users || !cached_users->next)
+    goto out;
+
+  g_object_get (dom_event, "type", &type, NULL);
+  if (g_strcmp0 (type, "input") == 0)
+    username_node_input_cb (WEBKIT_DOM_NODE (target), dom_event, web_page);
+  else if (g_strcmp0 (type, "keydown") == 0)
+    username_node_keydown_cb (WEBKIT_DOM_NODE (target), dom_event, web_page);
+  else if (g_strcmp0 (type, "mouseup") == 0)
+    username_node_clicked_cb (WEBKIT_DOM_NODE (target), dom_event, web_page);
+  else if (g_strcmp0 (type, "change") == 0 || g_strcmp0 (type, "blur") == 0)
+    username_node_changed_cb (WEBKIT_DOM_NODE (target), dom_event, web_page);
+
+out:
+  g_free (type);
+  g_clear_object (&target);
+
+  return TRUE;
+}
+
+static void
+document_hook_username_events (WebKitDOMDocument *document,
+                               WebKitWebPage     *web_page)
+{
+  static const char * const events[] = { "input", "keydown", "mouseup", "change", "blur" };
+  guint i;
+
+  if (g_object_get_data (G_OBJECT (document), "ephy-username-events-hooked"))
+    return;
+
+  /* Use the capture phase, since blur does not bubble. */
+  for (i = 0; i < G_N_ELEMENTS (events); i++) {
+    webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (document), events[i],
+                                                G_CALLBACK (username_node_event_cb), TRUE,
+                                                web_page);
+  }
+
+  g_object_set_data (G_OBJECT (document), "ephy-username-events-hooked", GINT_TO_POINTER (TRUE));
+}
+
+/* Security origins of the page and form actions, cached until the page URI
+ * changes. */
+static const char *
+web_page_get_security_origin (WebKitWebPage *web_page,
+                              const char    *uri)
+{
+  GHashTable *origins;
+  char *origin;
+
+  if (!uri)
+    return NULL;
+
+  origins = g_object_get_data (G_OBJECT (web_page), "ephy-security-origins");
+  if (!origins) {
+    origins = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    g_object_set_data_full (G_OBJECT (web_page), "ephy-security-origins",
+                            origins, (GDestroyNotify)g_hash_table_unref);
+  }
+
+  if (g_hash_table_lookup_extended (origins, uri, NULL, (gpointer *)&origin))
+    return origin;
+
+  origin = ephy_uri_to_security_origin (uri);
+  g_hash_table_insert (origins, g_strdup (uri), origin);
+
+  return origin;
+}
+
 static void
 form_destroyed_cb (gpointer form_auth, GObject *form)
 {
   g_object_unref (form_auth);
 }
 
+/* Asks the UI process for the usernames saved for @origin, once per page.
+ * Subframes may have a different origin than the page, whose usernames are
+ * the only ones sent by the UI process when the page is loaded. */
+static void
+web_page_request_cached_users (WebKitWebPage *web_page,
+                               const char    *origin)
+{
+  EphyWebExtension *extension = ephy_web_extension_get ();
+  WebKitDOMDOMWindow *dom_window;
+  GHashTable *requested;
+  GVariant *variant;
+  char *message;
+
+  if (ephy_password_manager_get_cached_users (extension->password_manager, origin))
+    return;
+
+  requested = g_object_get_data (G_OBJECT (web_page), "ephy-cached-users-requested");
+  if (!requested) {
+    requested = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_object_set_data_full (G_OBJECT (web_page), "ephy-cached-users-requested",
+                            requested, (GDestroyNotify)g_hash_table_unref);
+  }
+
+  if (g_hash_table_contains (requested, origin))
+    return;
+
+  dom_window = webkit_dom_document_get_default_view (webkit_web_page_get_dom_document (web_page));
+  if (dom_window == NULL)
+    return;
+
+  g_hash_table_add (requested, g_strdup (origin));
+
+  variant = g_variant_new ("(ts)", webkit_web_page_get_id (web_page), origin);
+  message = g_variant_print (variant, FALSE);
+
+  if (!webkit_dom_dom_window_webkit_message_handlers_post_message (dom_window, "cachedUsersRequested", message))
+    g_warning ("Error sending cachedUsersRequested message");
+
+  g_free (message);
+  g_object_unref (dom_window);
+  g_variant_unref (variant);
+}
+
 static void
 web_page_form_controls_associated (WebKitWebPage    *web_page,
                                    GPtrArray        *elements,
                                    EphyWebExtension *extension)
 {
-  WebKitDOMDocument *document = NULL;
+  gboolean remember_passwords;
   guint i;
 
-  document = webkit_web_page_get_dom_document (web_page);
+  remember_passwords = extension->password_manager &&
+                       ephy_web_extension_settings_get ()->remember_passwords;
 
   for (i = 0; i < elements->len; ++i) {
     WebKitDOMElement *element;
     WebKitDOMHTMLFormElement *form;
     WebKitDOMNode *username_node = NULL;
     WebKitDOMNode *password_node = NULL;
+    WebKitDOMDocument *document;
+    EphyEmbedFormAuth *form_auth;
+    char *form_uri;
+    char *form_action;
+    const char *origin;
+    const char *target_origin;
+    gboolean sensitive;
+    gboolean has_auth_elements;
 
     element = WEBKIT_DOM_ELEMENT (g_ptr_array_index (elements, i));
     if (!WEBKIT_DOM_IS_HTML_FORM_ELEMENT (element))
@@ -1139,83 +1329,62 @@ web_page_form_controls_associated (WebKitWebPage    *web_page,
 
     form = WEBKIT_DOM_HTML_FORM_ELEMENT (element);
 
-    if (ephy_web_dom_utils_form_contains_sensitive_element (form)) {
+    has_auth_elements = ephy_web_dom_utils_scan_form (form, &sensitive,
+                                                      &username_node,
+                                                      &password_node);
+
+    if (sensitive) {
       LOG ("Sensitive form element detected, hooking sensitive form focused callback");
       webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (form), "focus",
                                                   G_CALLBACK (sensitive_form_focused_cb), TRUE,
                                                   web_page);
     }
 
-    if (!extension->password_manager ||
-        !g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_REMEMBER_PASSWORDS))
+    if (!has_auth_elements)
+      LOG ("No pre-fillable/hookable form found");
+
+    if (!has_auth_elements || !remember_passwords) {
+      g_clear_object (&username_node);
+      g_clear_object (&password_node);
       continue;
+    }
 
-    /* We have a field that may be the user, and one for a password. */
-    if (ephy_web_dom_utils_find_form_auth_elements (form,
-                                                    &username_node,
-                                                    &password_node,
-                                                    AUTH_CACHE_AUTOFILL)) {
-      EphyEmbedFormAuth *form_auth;
-      GList *cached_users;
-      const char *uri;
-      char *origin;
-      char *form_action;
-      char *target_origin;
-
-      uri = webkit_web_page_get_uri (web_page);
-
-      form_action = webkit_dom_html_form_element_get_action (form);
-      if (form_action == NULL)
-        form_action = g_strdup (uri);
-      target_origin = ephy_uri_to_security_origin (form_action);
-
-      LOG ("Hooking and pre-filling a form");
-
-      /* EphyEmbedFormAuth takes ownership of the nodes */
-      form_auth = ephy_embed_form_auth_new (web_page,
-                                            target_origin,
-                                            username_node,
-                                            password_node,
-                                            NULL);
-      webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (form), "submit",
-                                                  G_CALLBACK (form_submitted_cb), FALSE,
-                                                  web_page);
+    /* We have a field that may be the user, and one for a password. Forms
+     * in subframes belong to the origin of their own document. */
+    document = webkit_dom_node_get_owner_document (WEBKIT_DOM_NODE (form));
+    form_uri = webkit_dom_document_get_url (document);
+    origin = web_page_get_security_origin (web_page, form_uri);
+    form_action = webkit_dom_html_form_element_get_action (form);
+    target_origin = web_page_get_security_origin (web_page, form_action ? form_action : form_uri);
+
+    LOG ("Hooking and pre-filling a form");
+
+    /* EphyEmbedFormAuth takes ownership of the nodes */
+    form_auth = ephy_embed_form_auth_new (web_page,
+                                          target_origin,
+                                          username_node,
+                                          password_node,
+                                          NULL);
+    webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (form), "submit",
+                                                G_CALLBACK (form_submitted_cb), FALSE,
+                                                web_page);
+
+    /* Plug in the user autocomplete. The usernames are looked up when the
+     * menu is shown, so they may arrive after the form has been hooked. */
+    if (origin && username_node) {
+      LOG ("Hooking menu for choosing which user on focus");
+      g_object_set_data_full (G_OBJECT (username_node), "ephy-form-origin",
+                              g_strdup (origin), g_free);
+      g_object_set_data (G_OBJECT (username_node), "ephy-form-auth", form_auth);
+      document_hook_username_events (document, web_page);
+      web_page_request_cached_users (web_page, origin);
+    }
 
-      /* Plug in the user autocomplete */
-      origin = ephy_uri_to_security_origin (uri);
-      cached_users = ephy_password_manager_get_cached_users (extension->password_manager, origin);
-
-      if (cached_users && cached_users->next && username_node) {
-        LOG ("More than 1 password saved, hooking menu for choosing which on focus");
-        g_object_set_data (G_OBJECT (username_node), "ephy-cached-users", cached_users);
-        g_object_set_data (G_OBJECT (username_node), "ephy-form-auth", form_auth);
-        g_object_set_data (G_OBJECT (username_node), "ephy-document", document);
-        webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (username_node), "input",
-                                                    G_CALLBACK (username_node_input_cb), TRUE,
-                                                    web_page);
-        webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (username_node), "keydown",
-                                                    G_CALLBACK (username_node_keydown_cb), FALSE,
-                                                    web_page);
-        webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (username_node), "mouseup",
-                                                    G_CALLBACK (username_node_clicked_cb), FALSE,
-                                                    web_page);
-        webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (username_node), "change",
-                                                    G_CALLBACK (username_node_changed_cb), FALSE,
-                                                    web_page);
-        webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (username_node), "blur",
-                                                    G_CALLBACK (username_node_changed_cb), FALSE,
-                                                    web_page);
-      } else
-        LOG ("No items or a single item in cached_users, not hooking menu for choosing.");
-
-      pre_fill_form (form_auth);
-
-      g_free (origin);
-      g_free (form_action);
-      g_free (target_origin);
-      g_object_weak_ref (G_OBJECT (form), form_destroyed_cb, form_auth);
-    } else
-      LOG ("No pre-fillable/hookable form found");
+    pre_fill_form (form_auth);
+
+    g_free (form_uri);
+    g_free (form_action);
+    g_object_weak_ref (G_OBJECT (form), form_destroyed_cb, form_auth);
   }
 }
 
@@ -1229,6 +1398,7 @@ web_page_uri_changed (WebKitWebPage    *web_page,
   if (g_strcmp0 (webkit_web_page_get_uri (web_page), "ephy-about:overview") == 0)
     overview = ephy_web_overview_new (web_page, extension->overview_model);
 
+  g_object_set_data (G_OBJECT (web_page), "ephy-security-origins", NULL);
   g_object_set_data_full (G_OBJECT (web_page), "ephy-web-overview", overview, g_object_unref);
 }
 
@@ -1495,6 +1665,16 @@ handle_method_call (GDBusConnection       *connection,
     if (extension->overview_model)
       ephy_web_overview_model_clear (extension->overview_model);
     g_dbus_method_invocation_return_value (invocation, NULL);
+  } else if (g_strcmp0 (method_name, "PasswordsSetCachedUsers") == 0) {
+    if (extension->password_manager) {
+      const char *origin;
+      const char **usernames;
+
+      g_variant_get (parameters, "(&s^a&s)", &origin, &usernames);
+      ephy_password_manager_set_cached_users (extension->password_manager, origin, usernames);
+      g_free (usernames);
+    }
+    g_dbus_method_invocation_return_value (invocation, NULL);
   }
 }
 
@@ -1583,6 +1763,9 @@ ephy_web_extension_dispose (GObject *object)
 
   g_clear_object (&extension->uri_tester);
   g_clear_object (&extension->overview_model);
+
+  if (extension->initialized)
+    ephy_web_extension_settings_shutdown ();
   g_clear_object (&extension->permissions_manager);
 
   if (extension->password_manager) {
@@ -1673,6 +1856,25 @@ dbus_connection_created_cb (GObject          *source_object,
   ephy_web_extension_emit_page_created_signals_pending (extension);
 }
 
+static void
+load_tracking_parameters (void)
+{
+  char *filename;
+  GError *error = NULL;
+
+  if (!ephy_dot_dir ())
+    return;
+
+  /* Optional list of tracking parameters replacing the built-in one. */
+  filename = g_build_filename (ephy_dot_dir (), TRACKING_PARAMETERS_FILE, NULL);
+  if (!ephy_uri_helpers_load_tracking_parameters (filename, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to load tracking parameters from %s: %s", filename, error->message);
+    g_error_free (error);
+  }
+  g_free (filename);
+}
+
 static gboolean
 authorize_authenticated_peer_cb (GDBusAuthObserver *observer,
                                  GIOStream         *stream,
@@ -1699,9 +1901,14 @@ ephy_web_extension_initialize (EphyWebExtension   *extension,
 
   extension->initialized = TRUE;
 
+  ephy_web_extension_settings_init ();
+  load_tracking_parameters ();
+
   extension->extension = g_object_ref (wk_extension);
   if (!is_private_profile) {
-    extension->password_manager = ephy_password_manager_new ();
+    /* Usernames are provided by the UI process for the origins loaded here,
+     * and passwords are only looked up when a form is filled. */
+    extension->password_manager = ephy_password_manager_new (FALSE);
 
     if (is_browser_mode) {
       if (ephy_sync_utils_user_is_signed_in ())
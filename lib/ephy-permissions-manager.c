@@ -25,18 +25,38 @@
 #include "ephy-file-helpers.h"
 #include "ephy-string.h"
 
-#define G_SETTINGS_ENABLE_BACKEND 1
-#include <gio/gsettingsbackend.h>
 #include <stdlib.h>
 #include <string.h>
 #include <webkit2/webkit2.h>
 
+#define PERMISSIONS_FILENAME "permissions.ini"
+
+#define EPHY_PERMISSION_TYPE_COUNT (EPHY_PERMISSION_TYPE_ACCESS_WEBCAM + 1)
+
+typedef struct {
+  char *group;
+  EphyPermissionType type;
+  EphyPermission permission;
+} PendingChange;
+
 struct _EphyPermissionsManager
 {
   GObject parent_instance;
 
-  GHashTable *origins_mapping;
-  GHashTable *settings_mapping;
+  /* The whole permissions file is parsed once and kept in memory. The key
+   * file is only used to write it back, so that unknown keys survive. */
+  GKeyFile *keyfile;
+  char *filename;
+  GFileMonitor *monitor;
+  guint save_source_id;
+
+  /* Changes not written yet, in order. They are applied again on top of the
+   * file whenever it is reloaded, so that changes made by another process in
+   * the meantime are kept. */
+  GArray *pending_changes;
+
+  GHashTable *origin_groups; /* origin -> key file group */
+  GHashTable *permissions;   /* key file group -> EphyPermission[EPHY_PERMISSION_TYPE_COUNT] */
 
   GHashTable *permission_type_permitted_origins;
   GHashTable *permission_type_denied_origins;
@@ -44,18 +64,51 @@ struct _EphyPermissionsManager
 
 G_DEFINE_TYPE (EphyPermissionsManager, ephy_permissions_manager, G_TYPE_OBJECT)
 
-#define PERMISSIONS_FILENAME "permissions.ini"
+static const char *
+permission_type_to_string (EphyPermissionType type)
+{
+  switch (type) {
+  case EPHY_PERMISSION_TYPE_SHOW_NOTIFICATIONS:
+    return "notifications-permission";
+  case EPHY_PERMISSION_TYPE_SAVE_PASSWORD:
+    return "save-password-permission";
+  case EPHY_PERMISSION_TYPE_ACCESS_LOCATION:
+    return "geolocation-permission";
+  case EPHY_PERMISSION_TYPE_ACCESS_MICROPHONE:
+    return "audio-device-permission";
+  case EPHY_PERMISSION_TYPE_ACCESS_WEBCAM:
+    return "video-device-permission";
+  default:
+    g_assert_not_reached ();
+  }
+}
 
-static void
-ephy_permissions_manager_init (EphyPermissionsManager *manager)
+/* Values are stored the way GSettings does for the
+ * org.gnome.Epiphany.Permission enum, so that older versions can still
+ * read the file. */
+static const char *
+permission_to_string (EphyPermission permission)
 {
-  manager->origins_mapping = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
-  manager->settings_mapping = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  switch (permission) {
+  case EPHY_PERMISSION_UNDECIDED:
+    return "'undecided'";
+  case EPHY_PERMISSION_DENY:
+    return "'deny'";
+  case EPHY_PERMISSION_PERMIT:
+    return "'allow'";
+  default:
+    g_assert_not_reached ();
+  }
+}
 
-  /* We cannot use a key_destroy_func here because we need to be able to update
-   * the GList keys without destroying the contents of the lists. */
-  manager->permission_type_permitted_origins = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
-  manager->permission_type_denied_origins = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
+static EphyPermission
+permission_from_string (const char *value)
+{
+  if (g_strcmp0 (value, "'allow'") == 0)
+    return EPHY_PERMISSION_PERMIT;
+  if (g_strcmp0 (value, "'deny'") == 0)
+    return EPHY_PERMISSION_DENY;
+  return EPHY_PERMISSION_UNDECIDED;
 }
 
 static void
@@ -66,13 +119,192 @@ free_cached_origin_list (gpointer key,
   g_list_free_full ((GList *)value, (GDestroyNotify)webkit_security_origin_unref);
 }
 
+static void
+pending_change_clear (PendingChange *change)
+{
+  g_free (change->group);
+}
+
+static EphyPermission *
+permissions_entry_new (void)
+{
+  EphyPermission *entry = g_new (EphyPermission, EPHY_PERMISSION_TYPE_COUNT);
+
+  for (guint i = 0; i < EPHY_PERMISSION_TYPE_COUNT; i++)
+    entry[i] = EPHY_PERMISSION_UNDECIDED;
+
+  return entry;
+}
+
+static void
+apply_change (EphyPermissionsManager *manager,
+              const char             *group,
+              EphyPermissionType      type,
+              EphyPermission          permission)
+{
+  EphyPermission *entry;
+
+  entry = g_hash_table_lookup (manager->permissions, group);
+  if (!entry) {
+    entry = permissions_entry_new ();
+    g_hash_table_insert (manager->permissions, g_strdup (group), entry);
+  }
+  entry[type] = permission;
+
+  g_key_file_set_string (manager->keyfile, group, permission_type_to_string (type),
+                         permission_to_string (permission));
+}
+
+static void refresh_cached_origin_lists (EphyPermissionsManager *manager);
+
+static void
+ephy_permissions_manager_load (EphyPermissionsManager *manager)
+{
+  char **groups;
+  GError *error = NULL;
+
+  g_hash_table_remove_all (manager->permissions);
+
+  g_clear_pointer (&manager->keyfile, g_key_file_unref);
+  manager->keyfile = g_key_file_new ();
+
+  g_key_file_load_from_file (manager->keyfile, manager->filename, G_KEY_FILE_KEEP_COMMENTS, &error);
+  if (error) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Error processing %s: %s", manager->filename, error->message);
+    g_error_free (error);
+    goto out;
+  }
+
+  groups = g_key_file_get_groups (manager->keyfile, NULL);
+  for (guint i = 0; groups[i]; i++) {
+    EphyPermission *entry = NULL;
+
+    for (guint type = 0; type < EPHY_PERMISSION_TYPE_COUNT; type++) {
+      char *value;
+
+      value = g_key_file_get_string (manager->keyfile, groups[i], permission_type_to_string (type), NULL);
+      if (!value)
+        continue;
+
+      if (!entry)
+        entry = permissions_entry_new ();
+      entry[type] = permission_from_string (value);
+      g_free (value);
+    }
+
+    if (entry)
+      g_hash_table_insert (manager->permissions, g_strdup (groups[i]), entry);
+  }
+
+  g_strfreev (groups);
+
+out:
+  for (guint i = 0; i < manager->pending_changes->len; i++) {
+    PendingChange *change = &g_array_index (manager->pending_changes, PendingChange, i);
+
+    apply_change (manager, change->group, change->type, change->permission);
+  }
+
+  refresh_cached_origin_lists (manager);
+}
+
+static gboolean
+save_idle_cb (EphyPermissionsManager *manager)
+{
+  GError *error = NULL;
+
+  manager->save_source_id = 0;
+
+  /* Start from the file as it is now, in case another process changed it
+   * since it was last loaded. */
+  ephy_permissions_manager_load (manager);
+  g_array_set_size (manager->pending_changes, 0);
+
+  if (!g_key_file_save_to_file (manager->keyfile, manager->filename, &error)) {
+    g_warning ("Failed to save %s: %s", manager->filename, error->message);
+    g_error_free (error);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Web processes read the file to decide on permission requests, so changes
+ * are written as soon as the main loop is idle. The ones made meanwhile are
+ * written together. */
+static void
+ephy_permissions_manager_schedule_save (EphyPermissionsManager *manager)
+{
+  if (manager->save_source_id)
+    return;
+
+  manager->save_source_id = g_idle_add ((GSourceFunc)save_idle_cb, manager);
+  g_source_set_name_by_id (manager->save_source_id, "[epiphany] save_idle_cb");
+}
+
+static void
+permissions_file_changed_cb (GFileMonitor           *monitor,
+                             GFile                  *file,
+                             GFile                  *other_file,
+                             GFileMonitorEvent       event_type,
+                             EphyPermissionsManager *manager)
+{
+  if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+      event_type != G_FILE_MONITOR_EVENT_CREATED &&
+      event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  /* Another process (e.g. the UI process, for web processes) changed it.
+   * Pending changes are newer, and are applied again on top of it. */
+  ephy_permissions_manager_load (manager);
+}
+
+static void
+ephy_permissions_manager_init (EphyPermissionsManager *manager)
+{
+  GFile *file;
+
+  manager->origin_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  manager->permissions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  manager->pending_changes = g_array_new (FALSE, FALSE, sizeof (PendingChange));
+  g_array_set_clear_func (manager->pending_changes, (GDestroyNotify)pending_change_clear);
+
+  /* We cannot use a key_destroy_func here because we need to be able to update
+   * the GList keys without destroying the contents of the lists. */
+  manager->permission_type_permitted_origins = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
+  manager->permission_type_denied_origins = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, NULL);
+
+  manager->filename = g_build_filename (ephy_dot_dir (), PERMISSIONS_FILENAME, NULL);
+  ephy_permissions_manager_load (manager);
+
+  file = g_file_new_for_path (manager->filename);
+  manager->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  if (manager->monitor)
+    g_signal_connect (manager->monitor, "changed",
+                      G_CALLBACK (permissions_file_changed_cb), manager);
+  g_object_unref (file);
+}
+
 static void
 ephy_permissions_manager_dispose (GObject *object)
 {
   EphyPermissionsManager *manager = EPHY_PERMISSIONS_MANAGER (object);
 
-  g_clear_pointer (&manager->origins_mapping, g_hash_table_destroy);
-  g_clear_pointer (&manager->settings_mapping, g_hash_table_destroy);
+  if (manager->save_source_id) {
+    g_source_remove (manager->save_source_id);
+    save_idle_cb (manager);
+  }
+
+  if (manager->monitor) {
+    g_signal_handlers_disconnect_by_func (manager->monitor, permissions_file_changed_cb, manager);
+    g_clear_object (&manager->monitor);
+  }
+
+  g_clear_pointer (&manager->keyfile, g_key_file_unref);
+  g_clear_pointer (&manager->filename, g_free);
+  g_clear_pointer (&manager->origin_groups, g_hash_table_destroy);
+  g_clear_pointer (&manager->permissions, g_hash_table_destroy);
+  g_clear_pointer (&manager->pending_changes, g_array_unref);
 
   if (manager->permission_type_permitted_origins != NULL) {
     g_hash_table_foreach (manager->permission_type_permitted_origins, free_cached_origin_list, NULL);
@@ -97,27 +329,20 @@ ephy_permissions_manager_class_init (EphyPermissionsManagerClass *klass)
   object_class->dispose = ephy_permissions_manager_dispose;
 }
 
-static GSettings *
-ephy_permissions_manager_get_settings_for_origin (EphyPermissionsManager *manager,
-                                                  const char             *origin)
+static const char *
+ephy_permissions_manager_get_group_for_origin (EphyPermissionsManager *manager,
+                                               const char             *origin)
 {
-  char *origin_path;
   char *trimmed_protocol;
-  char *filename;
-  GSettingsBackend* backend;
-  GSettings *settings;
+  char *group;
   WebKitSecurityOrigin *security_origin;
   char *pos;
 
   g_assert (origin != NULL);
 
-  settings = g_hash_table_lookup (manager->origins_mapping, origin);
-  if (settings)
-    return settings;
-
-  filename = g_build_filename (ephy_dot_dir (), PERMISSIONS_FILENAME, NULL);
-  backend = g_keyfile_settings_backend_new (filename, "/", NULL);
-  g_free (filename);
+  group = g_hash_table_lookup (manager->origin_groups, origin);
+  if (group)
+    return group;
 
   /* Cannot contain consecutive slashes in GSettings path... */
   security_origin = webkit_security_origin_new_for_uri (origin);
@@ -126,22 +351,18 @@ ephy_permissions_manager_get_settings_for_origin (EphyPermissionsManager *manage
   if (pos != NULL)
     *pos = '\0';
 
-  origin_path = g_strdup_printf ("/org/gnome/epiphany/permissions/%s/%s/%u/",
-                                 trimmed_protocol,
-                                 webkit_security_origin_get_host (security_origin),
-                                 webkit_security_origin_get_port (security_origin));
+  /* Same group GSettings used to write through its key file backend. */
+  group = g_strdup_printf ("org/gnome/epiphany/permissions/%s/%s/%u",
+                           trimmed_protocol,
+                           webkit_security_origin_get_host (security_origin),
+                           webkit_security_origin_get_port (security_origin));
 
-  settings = g_settings_new_with_backend_and_path ("org.gnome.Epiphany.permissions", backend, origin_path);
   g_free (trimmed_protocol);
-  g_free (origin_path);
-  g_object_unref (backend);
   webkit_security_origin_unref (security_origin);
 
-  /* Note that settings is owned only by the first hash table! */
-  g_hash_table_insert (manager->origins_mapping, g_strdup (origin), settings);
-  g_hash_table_insert (manager->settings_mapping, settings, g_strdup (origin));
+  g_hash_table_insert (manager->origin_groups, g_strdup (origin), group);
 
-  return settings;
+  return group;
 }
 
 EphyPermissionsManager *
@@ -150,32 +371,17 @@ ephy_permissions_manager_new (void)
   return EPHY_PERMISSIONS_MANAGER (g_object_new (EPHY_TYPE_PERMISSIONS_MANAGER, NULL));
 }
 
-static const char *
-permission_type_to_string (EphyPermissionType type)
-{
-  switch (type) {
-  case EPHY_PERMISSION_TYPE_SHOW_NOTIFICATIONS:
-    return "notifications-permission";
-  case EPHY_PERMISSION_TYPE_SAVE_PASSWORD:
-    return "save-password-permission";
-  case EPHY_PERMISSION_TYPE_ACCESS_LOCATION:
-    return "geolocation-permission";
-  case EPHY_PERMISSION_TYPE_ACCESS_MICROPHONE:
-    return "audio-device-permission";
-  case EPHY_PERMISSION_TYPE_ACCESS_WEBCAM:
-    return "video-device-permission";
-  default:
-    g_assert_not_reached ();
-  }
-}
-
 EphyPermission
 ephy_permissions_manager_get_permission (EphyPermissionsManager *manager,
                                          EphyPermissionType      type,
                                          const char             *origin)
 {
-  GSettings *settings = ephy_permissions_manager_get_settings_for_origin (manager, origin);
-  return g_settings_get_enum (settings, permission_type_to_string (type));
+  EphyPermission *entry;
+
+  entry = g_hash_table_lookup (manager->permissions,
+                               ephy_permissions_manager_get_group_for_origin (manager, origin));
+
+  return entry ? entry[type] : EPHY_PERMISSION_UNDECIDED;
 }
 
 static gint
@@ -240,14 +446,21 @@ ephy_permissions_manager_set_permission (EphyPermissionsManager *manager,
                                          EphyPermission          permission)
 {
   WebKitSecurityOrigin *webkit_origin;
-  GSettings *settings;
+  PendingChange change;
+  const char *group;
 
   webkit_origin = webkit_security_origin_new_for_uri (origin);
   if (webkit_origin == NULL)
     return;
 
-  settings = ephy_permissions_manager_get_settings_for_origin (manager, origin);
-  g_settings_set_enum (settings, permission_type_to_string (type), permission);
+  group = ephy_permissions_manager_get_group_for_origin (manager, origin);
+  apply_change (manager, group, type, permission);
+
+  change.group = g_strdup (group);
+  change.type = type;
+  change.permission = permission;
+  g_array_append_val (manager->pending_changes, change);
+  ephy_permissions_manager_schedule_save (manager);
 
   switch (permission) {
     case EPHY_PERMISSION_UNDECIDED:
@@ -285,66 +498,74 @@ group_name_to_security_origin (const char *group)
   return origin;
 }
 
-static WebKitSecurityOrigin *
-origin_for_keyfile_key (GKeyFile           *file,
-                        const char         *filename,
-                        const char         *group,
-                        const char         *key,
-                        EphyPermissionType  type,
-                        gboolean            permit)
+static GList *
+find_matching_origins (EphyPermissionsManager *manager,
+                       EphyPermissionType      type,
+                       EphyPermission          wanted)
 {
-  WebKitSecurityOrigin *origin = NULL;
-  char *value;
-  GError *error = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *origins = NULL;
 
-  if (strcmp (permission_type_to_string (type), key) == 0) {
-    value = g_key_file_get_string (file, group, key, &error);
-    if (error != NULL) {
-      g_warning ("Error processing %s group %s key %s: %s",
-                 filename, group, key, error->message);
-      g_error_free (error);
-      return NULL;
-    }
+  g_hash_table_iter_init (&iter, manager->permissions);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    EphyPermission *entry = value;
+    WebKitSecurityOrigin *origin;
 
-    if ((permit && strcmp (value, "'allow'") == 0) ||
-        (!permit && strcmp (value, "'deny'") == 0))
-      origin = group_name_to_security_origin (group);
+    if (entry[type] != wanted)
+      continue;
 
-    g_free (value);
+    origin = group_name_to_security_origin (key);
+    if (origin)
+      origins = g_list_prepend (origins, origin);
   }
 
-  return origin;
+  return origins;
 }
 
-static GList *
-origins_for_keyfile_group (GKeyFile           *file,
-                           const char         *filename,
-                           const char         *group,
-                           EphyPermissionType  type,
-                           gboolean            permit)
+/* The cached lists are returned as transfer none, so they are updated in
+ * place like ephy_permissions_manager_set_permission() does, rather than
+ * freed, when the permissions are reloaded. */
+static void
+refresh_cached_origin_list (EphyPermissionsManager *manager,
+                            GHashTable             *cache,
+                            EphyPermissionType      type,
+                            EphyPermission          wanted)
 {
-  char **keys;
-  gsize keys_length;
-  GList *origins = NULL;
-  WebKitSecurityOrigin *origin;
-  GError *error = NULL;
+  GList *origins;
+  GList *matching;
+  GList *l;
 
-  keys = g_key_file_get_keys (file, group, &keys_length, &error);
-  if (error != NULL) {
-    g_warning ("Error processing %s group %s: %s", filename, group, error->message);
-    g_error_free (error);
-    return NULL;
-  }
+  origins = g_hash_table_lookup (cache, GINT_TO_POINTER (type));
+  if (!origins)
+    return;
 
-  for (guint i = 0; i < keys_length; i++) {
-    origin = origin_for_keyfile_key (file, filename, group, keys[i], type, permit);
-    if (origin)
-      origins = g_list_prepend (origins, origin);
+  matching = find_matching_origins (manager, type, wanted);
+
+  l = origins;
+  while (l) {
+    GList *next = l->next;
+
+    if (!g_list_find_custom (matching, l->data, (GCompareFunc)webkit_security_origin_compare))
+      maybe_remove_origin_from_permission_type_cache (cache, type, l->data);
+    l = next;
   }
 
-  g_strfreev (keys);
+  for (l = matching; l; l = l->next)
+    maybe_add_origin_to_permission_type_cache (cache, type, l->data);
 
-  return origins;
+  g_list_free_full (matching, (GDestroyNotify)webkit_security_origin_unref);
+}
+
+static void
+refresh_cached_origin_lists (EphyPermissionsManager *manager)
+{
+  for (guint type = 0; type < EPHY_PERMISSION_TYPE_COUNT; type++) {
+    refresh_cached_origin_list (manager, manager->permission_type_permitted_origins,
+                                type, EPHY_PERMISSION_PERMIT);
+    refresh_cached_origin_list (manager, manager->permission_type_denied_origins,
+                                type, EPHY_PERMISSION_DENY);
+  }
 }
 
 static GList *
@@ -352,12 +573,8 @@ ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
                                                EphyPermissionType      type,
                                                gboolean                permit)
 {
-  GKeyFile *file;
-  char *filename;
-  char **groups = NULL;
-  gsize groups_length;
   GList *origins = NULL;
-  GError *error = NULL;
+  EphyPermission wanted = permit ? EPHY_PERMISSION_PERMIT : EPHY_PERMISSION_DENY;
 
   /* Return results from cache, if they exist. */
   if (permit) {
@@ -370,23 +587,7 @@ ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
       return origins;
   }
 
-  /* Not cached. Load results from GSettings keyfile. Do it manually because the
-   * GSettings API is not designed to be used for enumerating settings. */
-  file = g_key_file_new ();
-  filename = g_build_filename (ephy_dot_dir (), PERMISSIONS_FILENAME, NULL);
-
-  g_key_file_load_from_file (file, filename, G_KEY_FILE_NONE, &error);
-  if (error != NULL) {
-    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-      g_warning ("Error processing %s: %s", filename, error->message);
-    g_error_free (error);
-    goto out;
-  }
-
-  groups = g_key_file_get_groups (file, &groups_length);
-  for (guint i = 0; i < groups_length; i++)
-    origins = g_list_concat (origins,
-                             origins_for_keyfile_group (file, filename, groups[i], type, permit));
+  origins = find_matching_origins (manager, type, wanted);
 
   /* Cache the results. */
   if (origins != NULL) {
@@ -396,11 +597,6 @@ ephy_permissions_manager_get_matching_origins (EphyPermissionsManager *manager,
                          origins);
   }
 
-out:
-  g_key_file_unref (file);
-  g_strfreev (groups);
-  g_free (filename);
-
   return origins;
 }
 
@@ -0,0 +1,168 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-pixbuf-utils.h"
+
+#include <string.h>
+
+/* Splits @length source pixels into @dest_length consecutive boxes, storing
+ * the first source pixel of every box plus the end in @starts. */
+static void
+compute_box_starts (int  length,
+                    int  dest_length,
+                    int *starts)
+{
+  for (int i = 0; i <= dest_length; i++)
+    starts[i] = (int)(((gint64)i * length) / dest_length);
+}
+
+/**
+ * ephy_pixbuf_get_from_surface_downscaled:
+ * @surface: a %CAIRO_FORMAT_ARGB32 or %CAIRO_FORMAT_RGB24 image surface
+ * @x: left edge of the area of @surface to use
+ * @y: top edge of the area of @surface to use
+ * @width: width of the area, at least @dest_width
+ * @height: height of the area, at least @dest_height
+ * @dest_width: width of the resulting pixbuf
+ * @dest_height: height of the resulting pixbuf
+ *
+ * Shrinks an area of @surface by averaging the box of source pixels that
+ * falls on each destination pixel. The surface data is read directly, so
+ * unlike gdk_pixbuf_get_from_surface() no full size copy is made, and the
+ * loops are simple enough for the compiler to vectorize. Only touches
+ * memory it owns, so it can be used from any thread.
+ *
+ * Returns: (transfer full): a new RGBA #GdkPixbuf
+ */
+GdkPixbuf *
+ephy_pixbuf_get_from_surface_downscaled (cairo_surface_t *surface,
+                                         int              x,
+                                         int              y,
+                                         int              width,
+                                         int              height,
+                                         int              dest_width,
+                                         int              dest_height)
+{
+  GdkPixbuf *pixbuf;
+  const guchar *src_data;
+  guchar *dest_data;
+  int src_stride;
+  int dest_stride;
+  int *x_starts;
+  int *y_starts;
+  guint32 *row_sums;
+  guint32 *sums;
+
+  g_assert (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_ARGB32 ||
+            cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24);
+  g_assert (x >= 0 && y >= 0);
+  g_assert (x + width <= cairo_image_surface_get_width (surface));
+  g_assert (y + height <= cairo_image_surface_get_height (surface));
+  g_assert (dest_width > 0 && dest_width <= width);
+  g_assert (dest_height > 0 && dest_height <= height);
+
+  cairo_surface_flush (surface);
+  src_data = cairo_image_surface_get_data (surface);
+  src_stride = cairo_image_surface_get_stride (surface);
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, dest_width, dest_height);
+  dest_data = gdk_pixbuf_get_pixels (pixbuf);
+  dest_stride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  x_starts = g_new (int, dest_width + 1);
+  y_starts = g_new (int, dest_height + 1);
+  compute_box_starts (width, dest_width, x_starts);
+  compute_box_starts (height, dest_height, y_starts);
+
+  /* Channel sums, in A, R, G, B order, of the current source row once
+   * horizontally reduced, and of all the rows of the current box. */
+  row_sums = g_new (guint32, dest_width * 4);
+  sums = g_new (guint32, dest_width * 4);
+
+  for (int dy = 0; dy < dest_height; dy++) {
+    int box_height = y_starts[dy + 1] - y_starts[dy];
+    guchar *dest_row = dest_data + dy * dest_stride;
+
+    memset (sums, 0, dest_width * 4 * sizeof (guint32));
+
+    for (int sy = y_starts[dy]; sy < y_starts[dy + 1]; sy++) {
+      const guint32 *src_row = (const guint32 *)(src_data + (y + sy) * src_stride) + x;
+
+      /* Horizontal pass: reduce a source row to dest_width boxes. */
+      for (int dx = 0; dx < dest_width; dx++) {
+        guint32 a = 0, r = 0, g = 0, b = 0;
+
+        for (int sx = x_starts[dx]; sx < x_starts[dx + 1]; sx++) {
+          guint32 pixel = src_row[sx];
+
+          a += pixel >> 24;
+          r += (pixel >> 16) & 0xff;
+          g += (pixel >> 8) & 0xff;
+          b += pixel & 0xff;
+        }
+
+        row_sums[dx * 4] = a;
+        row_sums[dx * 4 + 1] = r;
+        row_sums[dx * 4 + 2] = g;
+        row_sums[dx * 4 + 3] = b;
+      }
+
+      /* Vertical pass: accumulate the row into the box sums. */
+      for (int i = 0; i < dest_width * 4; i++)
+        sums[i] += row_sums[i];
+    }
+
+    for (int dx = 0; dx < dest_width; dx++) {
+      guint32 count = (x_starts[dx + 1] - x_starts[dx]) * box_height;
+      guint32 a, r, g, b;
+      guchar *pixel = dest_row + dx * 4;
+
+      if (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24)
+        a = 0xff;
+      else
+        a = (sums[dx * 4] + count / 2) / count;
+      r = (sums[dx * 4 + 1] + count / 2) / count;
+      g = (sums[dx * 4 + 2] + count / 2) / count;
+      b = (sums[dx * 4 + 3] + count / 2) / count;
+
+      /* Cairo uses premultiplied alpha, GdkPixbuf doesn't. */
+      if (a == 0) {
+        r = g = b = 0;
+      } else if (a < 0xff) {
+        r = MIN ((r * 0xff + a / 2) / a, 0xff);
+        g = MIN ((g * 0xff + a / 2) / a, 0xff);
+        b = MIN ((b * 0xff + a / 2) / a, 0xff);
+      }
+
+      pixel[0] = r;
+      pixel[1] = g;
+      pixel[2] = b;
+      pixel[3] = a;
+    }
+  }
+
+  g_free (x_starts);
+  g_free (y_starts);
+  g_free (row_sums);
+  g_free (sums);
+
+  return pixbuf;
+}
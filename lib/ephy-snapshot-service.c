@@ -22,6 +22,8 @@
 #include "ephy-snapshot-service.h"
 
 #include "ephy-favicon-helpers.h"
+#include "ephy-file-helpers.h"
+#include "ephy-pixbuf-utils.h"
 
 #ifndef GNOME_DESKTOP_USE_UNSTABLE_API
 #define GNOME_DESKTOP_USE_UNSTABLE_API
@@ -37,6 +39,12 @@ struct _EphySnapshotService {
 
   /* Memory cache */
   GHashTable *cache;
+
+  /* Persistent index of the disk cache, shared by the saving threads */
+  char *index_path;
+  GHashTable *index;
+  GMutex index_lock;
+  guint index_save_source_id;
 };
 
 G_DEFINE_TYPE (EphySnapshotService, ephy_snapshot_service, G_TYPE_OBJECT)
@@ -55,9 +63,32 @@ typedef enum {
 
 typedef struct {
   char *path;
+  time_t mtime;
   EphySnapshotFreshness freshness;
 } SnapshotPathCachedData;
 
+/* Maps URL to (path, mtime). */
+#define SNAPSHOT_INDEX_FILE "snapshot-index.gvariant"
+#define SNAPSHOT_INDEX_TYPE "a{s(sx)}"
+#define SNAPSHOT_INDEX_MAX_ENTRIES 1000
+/* Index updates arriving within this many seconds are written at once. */
+#define SNAPSHOT_INDEX_SAVE_DELAY 5
+
+static SnapshotPathCachedData *
+snapshot_path_cached_data_new (const char           *path,
+                               time_t                mtime,
+                               EphySnapshotFreshness freshness)
+{
+  SnapshotPathCachedData *data;
+
+  data = g_new (SnapshotPathCachedData, 1);
+  data->path = g_strdup (path);
+  data->mtime = mtime;
+  data->freshness = freshness;
+
+  return data;
+}
+
 static void
 snapshot_path_cached_data_free (SnapshotPathCachedData *data)
 {
@@ -65,11 +96,29 @@ snapshot_path_cached_data_free (SnapshotPathCachedData *data)
   g_free (data);
 }
 
+static void
+ephy_snapshot_service_finalize (GObject *object)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (object);
+
+  ephy_snapshot_service_save_index (self);
+
+  g_clear_object (&self->factory);
+  g_clear_pointer (&self->cache, g_hash_table_unref);
+  g_clear_pointer (&self->index, g_hash_table_unref);
+  g_free (self->index_path);
+  g_mutex_clear (&self->index_lock);
+
+  G_OBJECT_CLASS (ephy_snapshot_service_parent_class)->finalize (object);
+}
+
 static void
 ephy_snapshot_service_class_init (EphySnapshotServiceClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->finalize = ephy_snapshot_service_finalize;
+
   /**
    * EphySnapshotService::snapshot-saved:
    * @url: the URL the snapshot was saved for
@@ -88,6 +137,42 @@ ephy_snapshot_service_class_init (EphySnapshotServiceClass *klass)
                                           G_TYPE_INT64);
 }
 
+static void
+ephy_snapshot_service_load_index (EphySnapshotService *self)
+{
+  GVariant *variant;
+  GVariantIter iter;
+  GBytes *bytes;
+  char *contents;
+  gsize length;
+  const char *url;
+  const char *path;
+  gint64 mtime;
+  GError *error = NULL;
+
+  if (!g_file_get_contents (self->index_path, &contents, &length, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to read snapshot index: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  bytes = g_bytes_new_take (contents, length);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_INDEX_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  /* The entries are only checked against the disk cache when looked up,
+   * see get_snapshot_path_for_url_thread(). */
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "{&s(&sx)}", &url, &path, &mtime)) {
+    g_hash_table_replace (self->index,
+                          g_strdup (url),
+                          snapshot_path_cached_data_new (path, mtime, SNAPSHOT_STALE));
+  }
+
+  g_variant_unref (variant);
+}
+
 static void
 ephy_snapshot_service_init (EphySnapshotService *self)
 {
@@ -95,16 +180,211 @@ ephy_snapshot_service_init (EphySnapshotService *self)
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                        (GDestroyNotify)g_free,
                                        (GDestroyNotify)snapshot_path_cached_data_free);
+  self->index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       (GDestroyNotify)g_free,
+                                       (GDestroyNotify)snapshot_path_cached_data_free);
+  g_mutex_init (&self->index_lock);
+
+  if (ephy_dot_dir ()) {
+    self->index_path = g_build_filename (ephy_dot_dir (), SNAPSHOT_INDEX_FILE, NULL);
+    ephy_snapshot_service_load_index (self);
+  }
+}
+
+static void
+snapshot_index_remove_oldest (GHashTable *index)
+{
+  GHashTableIter iter;
+  SnapshotPathCachedData *data;
+  const char *url;
+  const char *oldest_url = NULL;
+  time_t oldest_mtime = 0;
+
+  g_hash_table_iter_init (&iter, index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&url, (gpointer *)&data)) {
+    if (!oldest_url || data->mtime < oldest_mtime) {
+      oldest_url = url;
+      oldest_mtime = data->mtime;
+    }
+  }
+
+  if (oldest_url)
+    g_hash_table_remove (index, oldest_url);
+}
+
+/* Must be called with the index lock held. */
+static GVariant *
+ephy_snapshot_service_build_index_variant (EphySnapshotService *service)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  SnapshotPathCachedData *data;
+  const char *url;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (SNAPSHOT_INDEX_TYPE));
+  g_hash_table_iter_init (&iter, service->index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&url, (gpointer *)&data))
+    g_variant_builder_add (&builder, "{s(sx)}", url, data->path, (gint64)data->mtime);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+ephy_snapshot_service_write_index (EphySnapshotService *service,
+                                   GVariant            *variant)
+{
+  GError *error = NULL;
+
+  if (!g_file_set_contents (service->index_path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error)) {
+    g_warning ("Failed to write snapshot index: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static gboolean
+save_index_timeout_cb (EphySnapshotService *service)
+{
+  GVariant *variant;
+
+  g_mutex_lock (&service->index_lock);
+  service->index_save_source_id = 0;
+  variant = ephy_snapshot_service_build_index_variant (service);
+  g_mutex_unlock (&service->index_lock);
+
+  /* Only the main thread writes the index, so no lock is needed here. */
+  ephy_snapshot_service_write_index (service, variant);
+  g_variant_unref (variant);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the index lock held. */
+static void
+ephy_snapshot_service_schedule_index_save (EphySnapshotService *service)
+{
+  GSource *source;
+
+  /* Coalesce the updates of a burst of snapshots into a single write,
+   * performed from the main thread. */
+  if (service->index_save_source_id == 0) {
+    source = g_timeout_source_new_seconds (SNAPSHOT_INDEX_SAVE_DELAY);
+    g_source_set_callback (source, (GSourceFunc)save_index_timeout_cb, service, NULL);
+    g_source_set_name (source, "[epiphany] save_index_timeout_cb");
+    service->index_save_source_id = g_source_attach (source, NULL);
+    g_source_unref (source);
+  }
 }
 
+/* Runs in the saving and lookup threads. */
+static void
+ephy_snapshot_service_update_index (EphySnapshotService *service,
+                                    const char          *url,
+                                    const char          *path,
+                                    time_t               mtime)
+{
+  SnapshotPathCachedData *data;
+
+  if (!service->index_path)
+    return;
+
+  g_mutex_lock (&service->index_lock);
+
+  data = g_hash_table_lookup (service->index, url);
+  if (data && data->mtime == mtime && g_strcmp0 (data->path, path) == 0) {
+    g_mutex_unlock (&service->index_lock);
+    return;
+  }
+
+  g_hash_table_replace (service->index,
+                        g_strdup (url),
+                        snapshot_path_cached_data_new (path, mtime, SNAPSHOT_STALE));
+  if (g_hash_table_size (service->index) > SNAPSHOT_INDEX_MAX_ENTRIES)
+    snapshot_index_remove_oldest (service->index);
+
+  ephy_snapshot_service_schedule_index_save (service);
+
+  g_mutex_unlock (&service->index_lock);
+}
+
+/* Runs in the lookup threads. Returns the indexed path of the snapshot of
+ * @url, if it was taken at @mtime and is still on disk. Otherwise, the entry
+ * is evicted from the index. */
+static char *
+ephy_snapshot_service_lookup_index (EphySnapshotService *service,
+                                    const char          *url,
+                                    time_t               mtime)
+{
+  SnapshotPathCachedData *data;
+  char *path = NULL;
+
+  if (!service->index_path)
+    return NULL;
+
+  g_mutex_lock (&service->index_lock);
+  data = g_hash_table_lookup (service->index, url);
+  if (data && data->mtime == mtime)
+    path = g_strdup (data->path);
+  g_mutex_unlock (&service->index_lock);
+
+  if (path && g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    return path;
+
+  g_free (path);
+
+  g_mutex_lock (&service->index_lock);
+  if (g_hash_table_remove (service->index, url))
+    ephy_snapshot_service_schedule_index_save (service);
+  g_mutex_unlock (&service->index_lock);
+
+  return NULL;
+}
+
+/**
+ * ephy_snapshot_service_save_index:
+ * @service: an #EphySnapshotService
+ *
+ * Writes pending changes of the snapshot index to disk right away,
+ * instead of waiting for the scheduled save. Must be called from the
+ * main thread.
+ **/
+void
+ephy_snapshot_service_save_index (EphySnapshotService *service)
+{
+  GVariant *variant;
+
+  g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
+
+  g_mutex_lock (&service->index_lock);
+  if (service->index_save_source_id == 0) {
+    g_mutex_unlock (&service->index_lock);
+    return;
+  }
+
+  g_source_remove (service->index_save_source_id);
+  service->index_save_source_id = 0;
+  variant = ephy_snapshot_service_build_index_variant (service);
+  g_mutex_unlock (&service->index_lock);
+
+  ephy_snapshot_service_write_index (service, variant);
+  g_variant_unref (variant);
+}
+
+#define FAVICON_SIZE 16
+
+/* Runs in a thread: it only touches the surface and the pixbufs, which
+ * nothing else uses while the snapshot is being saved. */
 static GdkPixbuf *
 ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
-                                        cairo_surface_t *favicon)
+                                        GdkPixbuf       *favicon)
 {
   GdkPixbuf *snapshot, *scaled;
   int orig_width, orig_height;
   float orig_aspect_ratio, dest_aspect_ratio;
   int x_offset, new_width = 0, new_height;
+  cairo_format_t format;
 
   orig_width = cairo_image_surface_get_width (surface);
   orig_height = cairo_image_surface_get_height (surface);
@@ -118,6 +398,7 @@ ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
                                       EPHY_THUMBNAIL_WIDTH,
                                       EPHY_THUMBNAIL_HEIGHT,
                                       GDK_INTERP_TILES);
+    g_object_unref (snapshot);
   } else {
     orig_aspect_ratio = orig_width / (float)orig_height;
     dest_aspect_ratio = EPHY_THUMBNAIL_WIDTH / (float)EPHY_THUMBNAIL_HEIGHT;
@@ -134,27 +415,33 @@ ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
       x_offset = 0;
     }
 
-    snapshot = gdk_pixbuf_get_from_surface (surface, x_offset, 0, new_width, new_height);
-    scaled = gdk_pixbuf_scale_simple (snapshot,
-                                      EPHY_THUMBNAIL_WIDTH,
-                                      EPHY_THUMBNAIL_HEIGHT,
-                                      GDK_INTERP_BILINEAR);
+    format = cairo_image_surface_get_format (surface);
+    if ((format == CAIRO_FORMAT_ARGB32 || format == CAIRO_FORMAT_RGB24) &&
+        new_width >= EPHY_THUMBNAIL_WIDTH && new_height >= EPHY_THUMBNAIL_HEIGHT) {
+      /* Crop, convert and scale in a single pass over the surface data. */
+      scaled = ephy_pixbuf_get_from_surface_downscaled (surface,
+                                                        x_offset, 0,
+                                                        new_width, new_height,
+                                                        EPHY_THUMBNAIL_WIDTH,
+                                                        EPHY_THUMBNAIL_HEIGHT);
+    } else {
+      snapshot = gdk_pixbuf_get_from_surface (surface, x_offset, 0, new_width, new_height);
+      scaled = gdk_pixbuf_scale_simple (snapshot,
+                                        EPHY_THUMBNAIL_WIDTH,
+                                        EPHY_THUMBNAIL_HEIGHT,
+                                        GDK_INTERP_BILINEAR);
+      g_object_unref (snapshot);
+    }
   }
 
-  g_object_unref (snapshot);
-
   x_offset = 6;
   if (favicon) {
-    GdkPixbuf *fav_pixbuf;
-    int favicon_size = 16;
-    int y_offset = gdk_pixbuf_get_height (scaled) - favicon_size - x_offset;
+    int y_offset = gdk_pixbuf_get_height (scaled) - FAVICON_SIZE - x_offset;
 
-    fav_pixbuf = ephy_pixbuf_get_from_surface_scaled (favicon, favicon_size, favicon_size);
-    gdk_pixbuf_composite (fav_pixbuf, scaled,
-                          x_offset, y_offset, favicon_size, favicon_size,
+    gdk_pixbuf_composite (favicon, scaled,
+                          x_offset, y_offset, FAVICON_SIZE, FAVICON_SIZE,
                           x_offset, y_offset, 1, 1,
                           GDK_INTERP_NEAREST, 255);
-    g_object_unref (fav_pixbuf);
   }
 
   return scaled;
@@ -163,6 +450,8 @@ ephy_snapshot_service_prepare_snapshot (cairo_surface_t *surface,
 typedef struct {
   EphySnapshotService *service;
   GdkPixbuf *snapshot;
+  cairo_surface_t *surface;
+  GdkPixbuf *favicon;
   WebKitWebView *web_view;
   time_t mtime;
   char *url;
@@ -206,6 +495,8 @@ snapshot_async_data_free (SnapshotAsyncData *data)
 {
   g_clear_object (&data->service);
   g_clear_object (&data->snapshot);
+  g_clear_object (&data->favicon);
+  g_clear_pointer (&data->surface, cairo_surface_destroy);
 
   if (data->web_view)
     g_object_remove_weak_pointer (G_OBJECT (data->web_view), (gpointer *)&data->web_view);
@@ -236,15 +527,14 @@ static void
 cache_snapshot_data_in_idle (EphySnapshotService  *service,
                              const char           *url,
                              const char           *path,
+                             time_t                mtime,
                              EphySnapshotFreshness freshness)
 {
   CacheData *data;
   data = g_new (CacheData, 1);
   data->cache = g_hash_table_ref (service->cache);
   data->url = g_strdup (url);
-  data->data = g_new (SnapshotPathCachedData, 1);
-  data->data->path = g_strdup (path);
-  data->data->freshness = freshness;
+  data->data = snapshot_path_cached_data_new (path, mtime, freshness);
   g_idle_add (idle_cache_snapshot_path, data);
 }
 
@@ -267,6 +557,9 @@ save_snapshot_thread (GTask               *task,
 {
   char *path;
 
+  data->snapshot = ephy_snapshot_service_prepare_snapshot (data->surface, data->favicon);
+  g_clear_pointer (&data->surface, cairo_surface_destroy);
+
   gnome_desktop_thumbnail_factory_save_thumbnail (service->factory,
                                                   data->snapshot,
                                                   data->url,
@@ -274,14 +567,16 @@ save_snapshot_thread (GTask               *task,
   g_idle_add (idle_emit_snapshot_saved, snapshot_async_data_copy (data));
 
   path = gnome_desktop_thumbnail_path_for_uri (data->url, GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE);
-  cache_snapshot_data_in_idle (service, data->url, path, SNAPSHOT_FRESH);
+  cache_snapshot_data_in_idle (service, data->url, path, data->mtime, SNAPSHOT_FRESH);
+  ephy_snapshot_service_update_index (service, data->url, path, data->mtime);
 
   g_task_return_pointer (task, path, g_free);
 }
 
 static void
 ephy_snapshot_service_save_snapshot_async (EphySnapshotService *service,
-                                           GdkPixbuf           *snapshot,
+                                           cairo_surface_t     *surface,
+                                           GdkPixbuf           *favicon,
                                            const char          *url,
                                            time_t               mtime,
                                            GCancellable        *cancellable,
@@ -289,16 +584,18 @@ ephy_snapshot_service_save_snapshot_async (EphySnapshotService *service,
                                            gpointer             user_data)
 {
   GTask *task;
+  SnapshotAsyncData *data;
 
   g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
-  g_assert (GDK_IS_PIXBUF (snapshot));
+  g_assert (surface != NULL);
   g_assert (url != NULL);
 
   task = g_task_new (service, cancellable, callback, user_data);
   g_task_set_priority (task, G_PRIORITY_LOW);
-  g_task_set_task_data (task,
-                        snapshot_async_data_new (service, snapshot, NULL, mtime, url),
-                        (GDestroyNotify)snapshot_async_data_free);
+  data = snapshot_async_data_new (service, NULL, NULL, mtime, url);
+  data->surface = cairo_surface_reference (surface);
+  data->favicon = favicon ? g_object_ref (favicon) : NULL;
+  g_task_set_task_data (task, data, (GDestroyNotify)snapshot_async_data_free);
   g_task_run_in_thread (task, (GTaskThreadFunc)save_snapshot_thread);
   g_object_unref (task);
 }
@@ -331,17 +628,22 @@ save_snapshot (cairo_surface_t *surface,
                GTask           *task)
 {
   SnapshotAsyncData *data = g_task_get_task_data (task);
+  GdkPixbuf *favicon;
 
-  data->snapshot = ephy_snapshot_service_prepare_snapshot (surface,
-                                                           webkit_web_view_get_favicon (data->web_view));
+  /* Everything else is done in the saving thread, but the favicon belongs
+   * to the web view, so convert it here. It is tiny anyway. */
+  favicon = ephy_pixbuf_get_from_surface_scaled (webkit_web_view_get_favicon (data->web_view),
+                                                 FAVICON_SIZE, FAVICON_SIZE);
 
   ephy_snapshot_service_save_snapshot_async (g_task_get_source_object (task),
-                                             data->snapshot,
+                                             surface,
+                                             favicon,
                                              webkit_web_view_get_uri (data->web_view),
                                              data->mtime,
                                              g_task_get_cancellable (task),
                                              (GAsyncReadyCallback)snapshot_saved,
                                              task);
+  g_clear_object (&favicon);
 }
 
 static void
@@ -473,6 +775,8 @@ ephy_snapshot_service_error_quark (void)
   return g_quark_from_static_string ("ephy-snapshot-service-error-quark");
 }
 
+static EphySnapshotService *default_service = NULL;
+
 /**
  * ephy_snapshot_service_get_default:
  *
@@ -483,12 +787,24 @@ ephy_snapshot_service_error_quark (void)
 EphySnapshotService *
 ephy_snapshot_service_get_default (void)
 {
-  static EphySnapshotService *service = NULL;
+  if (default_service == NULL)
+    default_service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
 
-  if (service == NULL)
-    service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+  return default_service;
+}
 
-  return service;
+/**
+ * ephy_snapshot_service_peek_default:
+ *
+ * Gets the default instance of #EphySnapshotService, without creating it.
+ *
+ * Returns: (nullable): a #EphySnapshotService, or %NULL if it does not
+ *          exist yet
+ **/
+EphySnapshotService *
+ephy_snapshot_service_peek_default (void)
+{
+  return default_service;
 }
 
 const char *
@@ -523,16 +839,22 @@ get_snapshot_path_for_url_thread (GTask               *task,
 {
   char *path;
 
-  path = gnome_desktop_thumbnail_factory_lookup (service->factory, data->url, data->mtime);
+  /* The index spares reading the snapshot to check its mtime. Snapshots
+   * found either way are from a previous session, hence stale. */
+  path = ephy_snapshot_service_lookup_index (service, data->url, data->mtime);
   if (!path) {
-    g_task_return_new_error (task,
-                             EPHY_SNAPSHOT_SERVICE_ERROR,
-                             EPHY_SNAPSHOT_SERVICE_ERROR_NOT_FOUND,
-                             "Snapshot for url \"%s\" not found in disk cache", data->url);
-    return;
+    path = gnome_desktop_thumbnail_factory_lookup (service->factory, data->url, data->mtime);
+    if (!path) {
+      g_task_return_new_error (task,
+                               EPHY_SNAPSHOT_SERVICE_ERROR,
+                               EPHY_SNAPSHOT_SERVICE_ERROR_NOT_FOUND,
+                               "Snapshot for url \"%s\" not found in disk cache", data->url);
+      return;
+    }
+    ephy_snapshot_service_update_index (service, data->url, path, data->mtime);
   }
 
-  cache_snapshot_data_in_idle (service, data->url, path, SNAPSHOT_STALE);
+  cache_snapshot_data_in_idle (service, data->url, path, data->mtime, SNAPSHOT_STALE);
 
   g_task_return_pointer (task, path, g_free);
 }
@@ -47,6 +47,8 @@ GQuark               ephy_snapshot_service_error_quark                      (voi
 
 EphySnapshotService *ephy_snapshot_service_get_default                      (void);
 
+EphySnapshotService *ephy_snapshot_service_peek_default                     (void);
+
 const char          *ephy_snapshot_service_lookup_cached_snapshot_path      (EphySnapshotService *service,
                                                                              const char *url);
 
@@ -72,4 +74,6 @@ char                *ephy_snapshot_service_get_snapshot_path_finish         (Eph
                                                                              GAsyncResult *result,
                                                                              GError **error);
 
+void                 ephy_snapshot_service_save_index                       (EphySnapshotService *service);
+
 G_END_DECLS
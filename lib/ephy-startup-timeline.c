@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-startup-timeline.h"
+
+#include "ephy-debug.h"
+
+#include <json-glib/json-glib.h>
+
+/* Set this to a file name to get the timeline written there as JSON once
+ * startup has finished, e.g. to compare cold starts across builds. */
+#define STARTUP_TIMELINE_ENV "EPHY_STARTUP_TIMELINE"
+
+typedef struct {
+  const char *phase;
+  gint64      time;
+} TimelineMark;
+
+static GArray *timeline;
+static gboolean timeline_finished;
+
+/**
+ * ephy_startup_timeline_mark:
+ * @phase: a static string naming the startup phase that just completed
+ *
+ * Records the monotonic time at which @phase completed. The first mark is
+ * the origin of the timeline. Marks after ephy_startup_timeline_finish()
+ * are ignored, so code shared with later stages can mark unconditionally.
+ **/
+void
+ephy_startup_timeline_mark (const char *phase)
+{
+  TimelineMark mark;
+
+  g_assert (phase);
+
+  if (timeline_finished)
+    return;
+
+  if (!timeline)
+    timeline = g_array_new (FALSE, FALSE, sizeof (TimelineMark));
+
+  mark.phase = phase;
+  mark.time = g_get_monotonic_time ();
+  g_array_append_val (timeline, mark);
+
+  LOG ("Startup phase %s done after %.1f ms", phase,
+       (mark.time - g_array_index (timeline, TimelineMark, 0).time) / 1000.0);
+}
+
+/**
+ * ephy_startup_timeline_to_json:
+ *
+ * Return value: (transfer full): the timeline as a JSON array of
+ * {"phase", "time"} objects, times being milliseconds since the first mark
+ **/
+char *
+ephy_startup_timeline_to_json (void)
+{
+  JsonBuilder *builder;
+  JsonNode *root;
+  char *json;
+
+  builder = json_builder_new ();
+  json_builder_begin_array (builder);
+
+  for (guint i = 0; timeline && i < timeline->len; i++) {
+    TimelineMark *mark = &g_array_index (timeline, TimelineMark, i);
+
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "phase");
+    json_builder_add_string_value (builder, mark->phase);
+    json_builder_set_member_name (builder, "time");
+    json_builder_add_double_value (builder,
+                                   (mark->time - g_array_index (timeline, TimelineMark, 0).time) / 1000.0);
+    json_builder_end_object (builder);
+  }
+
+  json_builder_end_array (builder);
+  root = json_builder_get_root (builder);
+  json = json_to_string (root, TRUE);
+
+  json_node_unref (root);
+  g_object_unref (builder);
+
+  return json;
+}
+
+/**
+ * ephy_startup_timeline_finish:
+ *
+ * Stops recording and, if the EPHY_STARTUP_TIMELINE environment variable is
+ * set, writes the timeline to the file it names.
+ **/
+void
+ephy_startup_timeline_finish (void)
+{
+  const char *filename;
+  GError *error = NULL;
+  char *json;
+
+  if (timeline_finished)
+    return;
+
+  ephy_startup_timeline_mark ("startup-finished");
+  timeline_finished = TRUE;
+
+  filename = g_getenv (STARTUP_TIMELINE_ENV);
+  if (filename && *filename) {
+    json = ephy_startup_timeline_to_json ();
+    if (!g_file_set_contents (filename, json, -1, &error)) {
+      g_warning ("Failed to write startup timeline to %s: %s", filename, error->message);
+      g_error_free (error);
+    }
+    g_free (json);
+  }
+
+  g_clear_pointer (&timeline, g_array_unref);
+}
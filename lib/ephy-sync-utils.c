@@ -21,9 +21,12 @@
 #include "config.h"
 #include "ephy-sync-utils.h"
 
+#include "ephy-file-helpers.h"
 #include "ephy-settings.h"
 
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
@@ -495,3 +498,162 @@ ephy_sync_utils_get_open_tabs_sync_time (void)
 {
   return g_settings_get_double (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_OPEN_TABS_TIME);
 }
+
+static char *
+get_merged_ids_filename (const char *collection)
+{
+  char *basename;
+  char *filename;
+
+  basename = g_strdup_printf ("sync-merged-ids-%s", collection);
+  filename = g_build_filename (ephy_dot_dir (), basename, NULL);
+  g_free (basename);
+
+  return filename;
+}
+
+/* Pass a %NULL offset to forget the cursor of @collection, along with the IDs
+ * added by ephy_sync_utils_add_merged_ids(). */
+void
+ephy_sync_utils_set_download_cursor (const char *collection,
+                                     const char *offset,
+                                     double      newer,
+                                     double      last_modified)
+{
+  GVariantBuilder builder;
+  GVariantIter iter;
+  GVariant *cursors;
+  GVariant *value;
+  const char *name;
+
+  g_assert (collection);
+
+  cursors = g_settings_get_value (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_DOWNLOAD_CURSORS);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(sdd)}"));
+
+  g_variant_iter_init (&iter, cursors);
+  while (g_variant_iter_next (&iter, "{&s@(sdd)}", &name, &value)) {
+    if (g_strcmp0 (name, collection))
+      g_variant_builder_add (&builder, "{s@(sdd)}", name, value);
+    g_variant_unref (value);
+  }
+
+  if (offset) {
+    g_variant_builder_add (&builder, "{s(sdd)}", collection, offset, newer, last_modified);
+  } else {
+    char *filename = get_merged_ids_filename (collection);
+
+    g_unlink (filename);
+    g_free (filename);
+  }
+
+  g_settings_set_value (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_DOWNLOAD_CURSORS,
+                        g_variant_builder_end (&builder));
+  g_variant_unref (cursors);
+}
+
+gboolean
+ephy_sync_utils_get_download_cursor (const char  *collection,
+                                     char       **offset,
+                                     double      *newer,
+                                     double      *last_modified)
+{
+  GVariant *cursors;
+  gboolean found;
+
+  g_assert (collection);
+  g_assert (offset);
+  g_assert (newer);
+  g_assert (last_modified);
+
+  cursors = g_settings_get_value (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_DOWNLOAD_CURSORS);
+  found = g_variant_lookup (cursors, collection, "(sdd)", offset, newer, last_modified);
+  g_variant_unref (cursors);
+
+  return found;
+}
+
+void
+ephy_sync_utils_clear_download_cursors (void)
+{
+  GVariantIter iter;
+  GVariant *cursors;
+  const char *name;
+
+  cursors = g_settings_get_value (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_DOWNLOAD_CURSORS);
+  g_variant_iter_init (&iter, cursors);
+  while (g_variant_iter_next (&iter, "{&s@(sdd)}", &name, NULL)) {
+    char *filename = get_merged_ids_filename (name);
+
+    g_unlink (filename);
+    g_free (filename);
+  }
+  g_variant_unref (cursors);
+
+  g_settings_reset (EPHY_SETTINGS_SYNC, EPHY_PREFS_SYNC_DOWNLOAD_CURSORS);
+}
+
+/* An initial sync that is interrupted resumes from its download cursor. The
+ * IDs of the records merged from the pages downloaded before are kept next to
+ * it, one per line, for the local records matching them not to be uploaded
+ * once more. They are appended to after each page, and forgotten along with
+ * the cursor. */
+void
+ephy_sync_utils_add_merged_ids (const char *collection,
+                                GPtrArray  *ids)
+{
+  char *filename;
+  FILE *file;
+
+  g_assert (collection);
+  g_assert (ids);
+
+  if (ids->len == 0)
+    return;
+
+  filename = get_merged_ids_filename (collection);
+  file = g_fopen (filename, "a");
+  if (!file) {
+    g_warning ("Failed to open %s: %s", filename, g_strerror (errno));
+    g_free (filename);
+    return;
+  }
+
+  for (guint i = 0; i < ids->len; i++) {
+    fputs (g_ptr_array_index (ids, i), file);
+    fputc ('\n', file);
+  }
+
+  if (fclose (file) != 0)
+    g_warning ("Failed to write %s: %s", filename, g_strerror (errno));
+  g_free (filename);
+}
+
+/* Returns a set of the IDs added by ephy_sync_utils_add_merged_ids(). */
+GHashTable *
+ephy_sync_utils_get_merged_ids (const char *collection)
+{
+  GHashTable *ids;
+  char *filename;
+  char *contents;
+  char **lines;
+
+  g_assert (collection);
+
+  ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  filename = get_merged_ids_filename (collection);
+
+  if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+    lines = g_strsplit (contents, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+      if (*lines[i])
+        g_hash_table_add (ids, g_strdup (lines[i]));
+    }
+    g_strfreev (lines);
+    g_free (contents);
+  }
+
+  g_free (filename);
+
+  return ids;
+}
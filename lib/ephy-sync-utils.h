@@ -100,4 +100,17 @@ gboolean  ephy_sync_utils_open_tabs_sync_is_enabled     (void);
 void      ephy_sync_utils_set_open_tabs_sync_time       (double time);
 double    ephy_sync_utils_get_open_tabs_sync_time       (void);
 
+void      ephy_sync_utils_set_download_cursor           (const char *collection,
+                                                         const char *offset,
+                                                         double      newer,
+                                                         double      last_modified);
+gboolean  ephy_sync_utils_get_download_cursor           (const char  *collection,
+                                                         char       **offset,
+                                                         double      *newer,
+                                                         double      *last_modified);
+void      ephy_sync_utils_clear_download_cursors        (void);
+void      ephy_sync_utils_add_merged_ids                (const char *collection,
+                                                         GPtrArray  *ids);
+GHashTable *ephy_sync_utils_get_merged_ids              (const char *collection);
+
 G_END_DECLS
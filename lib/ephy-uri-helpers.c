@@ -35,22 +35,6 @@
  * URI related functions, including functions to clean up URI.
  */
 
-/* QueryItem holds the decoded name for each parameter, as well as the untouched
- * name/value pair. The name is unescaped in query_decode() with form_decode(),
- * the pair is not altered. */
-typedef struct {
-  char *decoded_name;
-  char *pair;
-} QueryItem;
-
-static void
-query_item_free (QueryItem *item)
-{
-  g_free (item->decoded_name);
-  g_free (item->pair);
-  g_slice_free (QueryItem, item);
-}
-
 #define XDIGIT(c) ((c) <= '9' ? (c) - '0' : ((c) & 0x4F) - 'A' + 10)
 #define HEXCHAR(s) ((XDIGIT (s[1]) << 4) + XDIGIT (s[2]))
 
@@ -77,118 +61,280 @@ form_decode (char *part)
   return TRUE;
 }
 
-static GList *
-query_split (const char *query)
+/* Tracking parameters are looked up by name in a hash table. Query items are
+ * copied to a buffer on the stack to be looked up, so the query does not
+ * need to be split. */
+typedef struct {
+  /* Maps each name to a GPtrArray of hosts, or to NULL when the parameter is
+   * stripped on every host. */
+  GHashTable *rules;
+  gsize max_length;
+} TrackingParameters;
+
+static TrackingParameters *tracking_parameters = NULL;
+
+static const struct {
+  const char *name;
+  const char *host;
+} default_tracking_parameters[] = {
+  /* analytics.google.com */
+  { "utm_source", NULL },
+  { "utm_medium", NULL },
+  { "utm_term", NULL },
+  { "utm_content", NULL },
+  { "utm_campaign", NULL },
+  { "utm_reader", NULL },
+  /* metrika.yandex.ru */
+  { "yclid", NULL },
+  /* youtube.com */
+  { "feature", "youtube.com" },
+  /* facebook.com */
+  { "fb_action_ids", NULL },
+  { "fb_action_types", NULL },
+  { "fb_ref", NULL },
+  { "fb_source", NULL },
+  { "action_object_map", NULL },
+  { "action_type_map", NULL },
+  { "action_ref_map", NULL },
+  { "ref", "facebook.com" },
+  { "fref", "facebook.com" },
+  { "hc_location", "facebook.com" },
+  /* imdb.com */
+  { "ref_", "imdb.com" },
+  /* addons.mozilla.org */
+  { "src", "addons.mozilla.org" }
+};
+
+static void
+tracking_rules_add (GHashTable *rules,
+                    const char *name,
+                    const char *host)
 {
-  GList *items;
-  char **pairs;
-  int i;
-
-  items = NULL;
-  pairs = g_strsplit (query, "&", -1);
-  for (i = 0; pairs[i]; i++) {
-    QueryItem *item;
-    char *decoded_name = NULL;
-    char *pair, *eq;
-
-    pair = pairs[i];
-    eq = strchr (pair, '=');
-    if (eq)
-      decoded_name = g_strndup (pair, eq - pair);
-    else
-      decoded_name = g_strdup (pair);
+  GPtrArray *hosts;
 
-    if (!form_decode (decoded_name)) {
-      g_free (decoded_name);
-      decoded_name = NULL;
-    }
+  if (!g_hash_table_lookup_extended (rules, name, NULL, (gpointer *)&hosts)) {
+    hosts = host ? g_ptr_array_new_with_free_func (g_free) : NULL;
+    g_hash_table_insert (rules, g_strdup (name), hosts);
+  }
+
+  /* A parameter stripped everywhere does not need a host list. */
+  if (!hosts)
+    return;
 
-    item = g_slice_new0 (QueryItem);
-    item->decoded_name = decoded_name;
-    item->pair = pair;
-    items = g_list_prepend (items, item);
+  if (host)
+    g_ptr_array_add (hosts, g_strdup (host));
+  else
+    g_hash_table_insert (rules, g_strdup (name), NULL);
+}
+
+static void
+tracking_rule_hosts_free (GPtrArray *hosts)
+{
+  if (hosts)
+    g_ptr_array_unref (hosts);
+}
+
+static GHashTable *
+tracking_rules_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal,
+                                g_free, (GDestroyNotify)tracking_rule_hosts_free);
+}
+
+static void
+tracking_parameters_free (TrackingParameters *parameters)
+{
+  g_hash_table_unref (parameters->rules);
+  g_free (parameters);
+}
+
+static TrackingParameters *
+tracking_parameters_new (GHashTable *rules)
+{
+  TrackingParameters *parameters;
+  GHashTableIter iter;
+  const char *name;
+
+  parameters = g_new0 (TrackingParameters, 1);
+  parameters->rules = g_hash_table_ref (rules);
+
+  g_hash_table_iter_init (&iter, rules);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, NULL))
+    parameters->max_length = MAX (parameters->max_length, strlen (name));
+
+  return parameters;
+}
+
+static TrackingParameters *
+get_tracking_parameters (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GHashTable *rules = tracking_rules_new ();
+
+    for (guint i = 0; i < G_N_ELEMENTS (default_tracking_parameters); i++)
+      tracking_rules_add (rules, default_tracking_parameters[i].name, default_tracking_parameters[i].host);
+
+    tracking_parameters = tracking_parameters_new (rules);
+
+    g_hash_table_unref (rules);
+    g_once_init_leave (&initialized, 1);
   }
-  g_free (pairs);
 
-  return g_list_reverse (items);
+  return tracking_parameters;
 }
 
-static char *
-query_concat (GList *items)
+/**
+ * ephy_uri_helpers_load_tracking_parameters:
+ * @filename: the file listing the tracking parameters
+ * @error: return location for a #GError, or %NULL
+ *
+ * Replaces the query parameters stripped by ephy_remove_tracking_from_uri()
+ * with the ones listed in @filename. Each line holds a parameter name,
+ * optionally followed by the host it is restricted to. Empty lines and
+ * lines starting with '#' are ignored.
+ *
+ * This is not thread-safe: call it before stripping any URI.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+ephy_uri_helpers_load_tracking_parameters (const char  *filename,
+                                           GError     **error)
 {
-  GList *l;
-  GPtrArray *array;
-  char *ret;
+  GHashTable *rules;
+  char *contents;
+  char **lines;
 
-  if (!items)
-    return NULL;
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return FALSE;
 
-  array = g_ptr_array_new ();
+  rules = tracking_rules_new ();
+  lines = g_strsplit (contents, "\n", -1);
+  for (guint i = 0; lines[i]; i++) {
+    char **fields;
+    const char *host;
 
-  for (l = items; l != NULL; l = l->next) {
-    QueryItem *item = l->data;
+    g_strstrip (lines[i]);
+    if (lines[i][0] == '\0' || lines[i][0] == '#')
+      continue;
 
-    g_ptr_array_add (array, item->pair);
+    fields = g_strsplit_set (lines[i], " \t", -1);
+    host = NULL;
+    for (guint j = 1; fields[j] && !host; j++) {
+      if (fields[j][0] != '\0')
+        host = fields[j];
+    }
+    tracking_rules_add (rules, fields[0], host);
+    g_strfreev (fields);
   }
-  g_ptr_array_add (array, NULL);
+  g_strfreev (lines);
+  g_free (contents);
 
-  ret = g_strjoinv ("&", (char **)array->pdata);
-  g_ptr_array_free (array, TRUE);
+  /* Make sure the defaults are not loaded over these later. */
+  get_tracking_parameters ();
+  g_clear_pointer (&tracking_parameters, tracking_parameters_free);
+  tracking_parameters = tracking_parameters_new (rules);
+  g_hash_table_unref (rules);
 
-  return ret;
+  return TRUE;
 }
 
 static gboolean
-is_garbage (const char *name,
-            const char *host)
+host_has_suffix (const char *host,
+                 gsize       host_length,
+                 const char *suffix)
 {
-  struct {
-    const char *field;
-    const char *host;
-  } const fields[] = {
-    /* analytics.google.com */
-    { "utm_source", NULL },
-    { "utm_medium", NULL },
-    { "utm_term", NULL },
-    { "utm_content", NULL },
-    { "utm_campaign", NULL },
-    { "utm_reader", NULL },
-    /* metrika.yandex.ru */
-    { "yclid", NULL },
-    /* youtube.com */
-    { "feature", "youtube.com" },
-    /* facebook.com */
-    { "fb_action_ids", NULL },
-    { "fb_action_types", NULL },
-    { "fb_ref", NULL },
-    { "fb_source", NULL },
-    { "action_object_map", NULL },
-    { "action_type_map", NULL },
-    { "action_ref_map", NULL },
-    { "ref", "facebook.com" },
-    { "fref", "facebook.com" },
-    { "hc_location", "facebook.com" },
-    /* imdb.com */
-    { "ref_", "imdb.com" },
-    /* addons.mozilla.org */
-    { "src", "addons.mozilla.org" }
-  };
-  guint i;
-
-  if (name == NULL)
+  gsize suffix_length = strlen (suffix);
+
+  if (suffix_length > host_length)
     return FALSE;
 
-  for (i = 0; i < G_N_ELEMENTS (fields); i++) {
-    if (fields[i].host != NULL &&
-        !g_str_has_suffix (host, fields[i].host))
-      continue;
-    if (!g_strcmp0 (fields[i].field, name))
+  return g_ascii_strncasecmp (host + host_length - suffix_length, suffix, suffix_length) == 0;
+}
+
+/* Finds the host in @uri_string without parsing the whole URI. */
+static const char *
+find_host (const char *uri_string,
+           gsize      *length)
+{
+  const char *host, *end, *p;
+
+  host = strstr (uri_string, "://");
+  if (!host)
+    return NULL;
+  host += 3;
+
+  end = host + strcspn (host, "/?#");
+
+  /* Skip the user info... */
+  for (p = end; p > host; p--) {
+    if (p[-1] == '@') {
+      host = p;
+      break;
+    }
+  }
+
+  /* ...and the port. */
+  for (p = end; p > host && p[-1] != ']'; p--) {
+    if (p[-1] == ':') {
+      end = p - 1;
+      break;
+    }
+  }
+
+  *length = end - host;
+  return host;
+}
+
+static gboolean
+is_tracking_parameter (TrackingParameters *parameters,
+                       const char         *name,
+                       gsize               length,
+                       const char         *uri_string)
+{
+  GPtrArray *hosts;
+  char decoded[256];
+  const char *host;
+  gsize host_length;
+
+  /* Escaped names are at most three times longer than the decoded ones. */
+  if (length == 0 || length > 3 * parameters->max_length || length >= sizeof (decoded))
+    return FALSE;
+
+  memcpy (decoded, name, length);
+  decoded[length] = '\0';
+  if ((memchr (name, '%', length) || memchr (name, '+', length)) && !form_decode (decoded))
+    return FALSE;
+
+  if (!g_hash_table_lookup_extended (parameters->rules, decoded, NULL, (gpointer *)&hosts))
+    return FALSE;
+
+  if (!hosts)
+    return TRUE;
+
+  host = find_host (uri_string, &host_length);
+  if (!host)
+    return FALSE;
+
+  for (guint i = 0; i < hosts->len; i++) {
+    if (host_has_suffix (host, host_length, g_ptr_array_index (hosts, i)))
       return TRUE;
   }
 
   return FALSE;
 }
 
+static gsize
+query_item_name_length (const char *item,
+                        gsize       length)
+{
+  const char *eq = memchr (item, '=', length);
+
+  return eq ? (gsize)(eq - item) : length;
+}
+
 /**
  * ephy_remove_tracking_from_uri:
  * @uri_string: a uri
@@ -197,59 +343,75 @@ is_garbage (const char *name,
  * information. Inspired by the Firefox PureURL add-on:
  * https://addons.mozilla.org/fr/firefox/addon/pure-url/
  *
+ * The query is scanned in place, memory is only allocated when something
+ * needs to be removed.
+ *
  * Returns: the sanitized uri, or %NULL on error or when the URI did
  * not change.
  */
 char *
 ephy_remove_tracking_from_uri (const char *uri_string)
 {
-  SoupURI *uri;
-  GList *items, *new_items, *l;
-  const char *query, *host;
-  gboolean has_garbage = FALSE;
-  char *ret = NULL;
+  TrackingParameters *parameters;
+  const char *query, *query_end, *item;
+  const char *first_tracking_item = NULL;
+  GString *result;
+  gboolean first = TRUE;
 
-  uri = soup_uri_new (uri_string);
-  if (!uri)
-    return ret;
+  if (!uri_string)
+    return NULL;
 
-  host = soup_uri_get_host (uri);
-  query = soup_uri_get_query (uri);
-  if (!query)
-    goto bail;
+  query = strpbrk (uri_string, "?#");
+  if (!query || *query == '#')
+    return NULL;
+  query++;
+  query_end = query + strcspn (query, "#");
 
-  items = query_split (query);
-  if (!items)
-    goto bail;
+  parameters = get_tracking_parameters ();
 
-  new_items = NULL;
-  for (l = items; l != NULL; l = l->next) {
-    QueryItem *item = l->data;
+  for (item = query; item < query_end; item++) {
+    gsize length = strcspn (item, "&#");
 
-    if (!is_garbage (item->decoded_name, host))
-      new_items = g_list_prepend (new_items, item);
-    else
-      has_garbage = TRUE;
+    if (is_tracking_parameter (parameters, item, query_item_name_length (item, length), uri_string)) {
+      first_tracking_item = item;
+      break;
+    }
+
+    item += length;
   }
 
-  if (has_garbage) {
-    char *new_query;
+  if (!first_tracking_item)
+    return NULL;
+
+  /* Copy everything before the query, then the items to keep. */
+  result = g_string_sized_new (strlen (uri_string));
+  g_string_append_len (result, uri_string, query - uri_string);
+
+  for (item = query; item < query_end; item++) {
+    gsize length = strcspn (item, "&#");
 
-    new_items = g_list_reverse (new_items);
-    new_query = query_concat (new_items);
+    if (item == first_tracking_item ||
+        (item > first_tracking_item &&
+         is_tracking_parameter (parameters, item, query_item_name_length (item, length), uri_string))) {
+      item += length;
+      continue;
+    }
 
-    soup_uri_set_query (uri, new_query);
-    g_free (new_query);
+    if (!first)
+      g_string_append_c (result, '&');
+    g_string_append_len (result, item, length);
+    first = FALSE;
 
-    ret = soup_uri_to_string (uri, FALSE);
+    item += length;
   }
 
-  g_list_free_full (items, (GDestroyNotify)query_item_free);
-  g_list_free (new_items);
+  /* Drop the '?' when nothing is left in the query. */
+  if (first)
+    g_string_truncate (result, result->len - 1);
 
- bail:
-  soup_uri_free (uri);
-  return ret;
+  g_string_append (result, query_end);
+
+  return g_string_free (result, FALSE);
 }
 
 /* Use this function to format a URI for display. The URIs used
@@ -35,6 +35,15 @@
 
 #define EPHY_WEB_APP_DESKTOP_FILE_PREFIX "epiphany-"
 
+/* The registry caches what would otherwise have to be parsed out of the
+ * desktop file of every installed application. It is a GVariant of type
+ * a(sssx), one (profile directory, name, address, install time) tuple per
+ * application. Creating and deleting an application update it, so listing
+ * the applications does not touch their profile directories. It is only
+ * rebuilt from the desktop files when it is missing or corrupted. */
+#define EPHY_WEB_APP_REGISTRY_FILE "web-apps.gvariant"
+#define EPHY_WEB_APP_REGISTRY_TYPE G_VARIANT_TYPE ("a(sssx)")
+
 /* This is necessary because of gnome-shell's guessing of a .desktop
    filename from WM_CLASS property. */
 static char *
@@ -77,6 +86,304 @@ desktop_filename_from_wm_class (char *wm_class)
   return filename;
 }
 
+static char *
+get_web_apps_dir (void)
+{
+  return !ephy_dot_dir_is_default () ? ephy_default_dot_dir () : g_strdup (ephy_dot_dir ());
+}
+
+static char *
+get_profile_directory_name (EphyWebApplication *app)
+{
+  char *wm_class;
+  char *name;
+
+  wm_class = g_strndup (app->desktop_file, strlen (app->desktop_file) - strlen (".desktop"));
+  name = g_strconcat (EPHY_WEB_APP_PREFIX, wm_class, NULL);
+  g_free (wm_class);
+
+  return name;
+}
+
+static char *
+get_desktop_file_path (const char *apps_dir,
+                       const char *profile_name)
+{
+  char *desktop_file;
+  char *path;
+
+  desktop_file = g_strconcat (profile_name + strlen (EPHY_WEB_APP_PREFIX), ".desktop", NULL);
+  path = g_build_filename (apps_dir, profile_name, desktop_file, NULL);
+  g_free (desktop_file);
+
+  return path;
+}
+
+static EphyWebApplication *
+ephy_web_application_new (const char *apps_dir,
+                          const char *profile_name,
+                          const char *name,
+                          const char *url,
+                          gint64      install_time)
+{
+  EphyWebApplication *app;
+  char *profile_dir;
+  GDate *date;
+
+  app = g_slice_new0 (EphyWebApplication);
+  app->name = g_strdup (name);
+  app->url = g_strdup (url);
+  app->install_time = install_time;
+
+  profile_dir = g_build_filename (apps_dir, profile_name, NULL);
+  app->icon_url = g_build_filename (profile_dir, EPHY_WEB_APP_ICON_NAME, NULL);
+  app->desktop_file = g_strconcat (profile_name + strlen (EPHY_WEB_APP_PREFIX), ".desktop", NULL);
+  g_free (profile_dir);
+
+  date = g_date_new ();
+  g_date_set_time_t (date, (time_t)install_time);
+  g_date_strftime (app->install_date, 127, "%x", date);
+  g_date_free (date);
+
+  return app;
+}
+
+/* Reads an application out of its desktop file, which is what the registry
+ * is there to avoid doing for every application every time. */
+static EphyWebApplication *
+ephy_web_application_load (const char *apps_dir,
+                           const char *profile_name)
+{
+  EphyWebApplication *app = NULL;
+  GFileInfo *desktop_info = NULL;
+  GKeyFile *key;
+  GFile *file = NULL;
+  char *desktop_file_path;
+  char *name = NULL;
+  char *exec = NULL;
+  char **strings = NULL;
+  int i;
+
+  desktop_file_path = get_desktop_file_path (apps_dir, profile_name);
+
+  key = g_key_file_new ();
+  if (!g_key_file_load_from_file (key, desktop_file_path, 0, NULL))
+    goto out;
+
+  name = g_key_file_get_string (key, "Desktop Entry", "Name", NULL);
+  exec = g_key_file_get_string (key, "Desktop Entry", "Exec", NULL);
+  if (!name || !exec)
+    goto out;
+
+  /* The address is the last argument of the command line. */
+  strings = g_strsplit (exec, " ", -1);
+  for (i = 0; strings[i]; i++);
+  if (i == 0)
+    goto out;
+
+  file = g_file_new_for_path (desktop_file_path);
+
+  /* FIXME: this should use TIME_CREATED but it does not seem to be working. */
+  desktop_info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED, 0, NULL, NULL);
+  if (!desktop_info)
+    goto out;
+
+  app = ephy_web_application_new (apps_dir, profile_name, name, strings[i - 1],
+                                  g_file_info_get_attribute_uint64 (desktop_info, G_FILE_ATTRIBUTE_TIME_MODIFIED));
+
+ out:
+  g_clear_object (&desktop_info);
+  g_clear_object (&file);
+  g_strfreev (strings);
+  g_free (exec);
+  g_free (name);
+  g_key_file_free (key);
+  g_free (desktop_file_path);
+
+  return app;
+}
+
+static void
+ephy_web_application_free (EphyWebApplication *app)
+{
+  g_free (app->name);
+  g_free (app->icon_url);
+  g_free (app->url);
+  g_free (app->desktop_file);
+  g_slice_free (EphyWebApplication, app);
+}
+
+/* Returns the registered applications, or sets @found to %FALSE if the
+ * registry has to be rebuilt. */
+static GList *
+ephy_web_application_registry_load (const char *apps_dir,
+                                    gboolean   *found)
+{
+  GVariantIter iter;
+  GVariant *variant;
+  GError *error = NULL;
+  GList *applications = NULL;
+  const char *profile_name;
+  const char *name;
+  const char *url;
+  gint64 install_time;
+  char *filename;
+  char *contents;
+  gsize length;
+
+  *found = FALSE;
+
+  filename = g_build_filename (apps_dir, EPHY_WEB_APP_REGISTRY_FILE, NULL);
+  if (!g_file_get_contents (filename, &contents, &length, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to load web application registry %s: %s", filename, error->message);
+    g_error_free (error);
+    g_free (filename);
+    return NULL;
+  }
+
+  variant = g_variant_new_from_data (EPHY_WEB_APP_REGISTRY_TYPE, contents, length, FALSE, g_free, contents);
+  g_variant_ref_sink (variant);
+
+  if (!g_variant_is_normal_form (variant)) {
+    g_warning ("Web application registry %s is corrupted, ignoring it", filename);
+    g_variant_unref (variant);
+    g_free (filename);
+    return NULL;
+  }
+
+  *found = TRUE;
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(&s&s&sx)", &profile_name, &name, &url, &install_time)) {
+    if (!g_str_has_prefix (profile_name, EPHY_WEB_APP_PREFIX))
+      continue;
+
+    applications = g_list_prepend (applications,
+                                   ephy_web_application_new (apps_dir, profile_name, name, url, install_time));
+  }
+
+  g_variant_unref (variant);
+  g_free (filename);
+
+  return g_list_reverse (applications);
+}
+
+static void
+ephy_web_application_registry_save (const char *apps_dir,
+                                    GList      *applications)
+{
+  GVariantBuilder builder;
+  GVariant *variant;
+  GError *error = NULL;
+  GList *l;
+  char *filename;
+
+  g_variant_builder_init (&builder, EPHY_WEB_APP_REGISTRY_TYPE);
+  for (l = applications; l; l = l->next) {
+    EphyWebApplication *app = (EphyWebApplication *)l->data;
+    char *profile_name = get_profile_directory_name (app);
+
+    g_variant_builder_add (&builder, "(sssx)", profile_name, app->name, app->url, app->install_time);
+    g_free (profile_name);
+  }
+
+  variant = g_variant_builder_end (&builder);
+  g_variant_ref_sink (variant);
+
+  filename = g_build_filename (apps_dir, EPHY_WEB_APP_REGISTRY_FILE, NULL);
+  if (!g_file_set_contents (filename, g_variant_get_data (variant), g_variant_get_size (variant), &error)) {
+    g_warning ("Failed to save web application registry %s: %s", filename, error->message);
+    g_error_free (error);
+  }
+
+  g_variant_unref (variant);
+  g_free (filename);
+}
+
+/* Reads every installed application out of its desktop file. */
+static GList *
+ephy_web_application_scan (const char *apps_dir)
+{
+  GFileEnumerator *children;
+  EphyWebApplication *app;
+  GFileInfo *info;
+  GList *applications = NULL;
+  GFile *file;
+
+  file = g_file_new_for_path (apps_dir);
+  children = g_file_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, NULL);
+  g_object_unref (file);
+
+  while (children && (info = g_file_enumerator_next_file (children, NULL, NULL))) {
+    const char *name = g_file_info_get_name (info);
+
+    if (g_str_has_prefix (name, EPHY_WEB_APP_PREFIX)) {
+      app = ephy_web_application_load (apps_dir, name);
+      if (app)
+        applications = g_list_prepend (applications, app);
+    }
+
+    g_object_unref (info);
+  }
+  g_clear_object (&children);
+
+  return g_list_reverse (applications);
+}
+
+static GList *
+ephy_web_application_registry_load_or_rebuild (const char *apps_dir)
+{
+  GList *applications;
+  gboolean found;
+
+  applications = ephy_web_application_registry_load (apps_dir, &found);
+  if (!found) {
+    LOG ("Rebuilding the web application registry");
+    applications = ephy_web_application_scan (apps_dir);
+    ephy_web_application_registry_save (apps_dir, applications);
+  }
+
+  return applications;
+}
+
+/* Replaces the registry entry of the application in @profile_dir with @app,
+ * or removes it if @app is %NULL. Takes ownership of @app. */
+static void
+ephy_web_application_registry_update (const char         *profile_dir,
+                                      EphyWebApplication *app)
+{
+  GList *applications;
+  GList *l;
+  char *apps_dir;
+  char *profile_name;
+
+  apps_dir = g_path_get_dirname (profile_dir);
+  profile_name = g_path_get_basename (profile_dir);
+
+  applications = ephy_web_application_registry_load_or_rebuild (apps_dir);
+
+  for (l = applications; l; l = l->next) {
+    char *name = get_profile_directory_name (l->data);
+
+    if (g_strcmp0 (name, profile_name) == 0) {
+      ephy_web_application_free (l->data);
+      applications = g_list_delete_link (applications, l);
+      g_free (name);
+      break;
+    }
+    g_free (name);
+  }
+
+  if (app)
+    applications = g_list_append (applications, app);
+
+  ephy_web_application_registry_save (apps_dir, applications);
+
+  ephy_web_application_free_application_list (applications);
+  g_free (profile_name);
+  g_free (apps_dir);
+}
+
 /**
  * ephy_web_application_get_profile_directory:
  * @name: the application name
@@ -146,6 +453,8 @@ ephy_web_application_delete (const char *name)
     goto out;
   LOG ("Deleted application profile.\n");
 
+  ephy_web_application_registry_update (profile_dir, NULL);
+
   wm_class = get_wm_class_from_app_title (name);
   desktop_file = desktop_filename_from_wm_class (wm_class);
   g_free (wm_class);
@@ -274,6 +583,8 @@ ephy_web_application_create (const char *address, const char *name, GdkPixbuf *i
 {
   char *profile_dir = NULL;
   char *desktop_file_path = NULL;
+  char *apps_dir;
+  char *profile_name;
 
   /* If there's already a WebApp profile for the contents of this
    * view, do nothing. */
@@ -291,9 +602,18 @@ ephy_web_application_create (const char *address, const char *name, GdkPixbuf *i
 
   /* Create the deskop file. */
   desktop_file_path = create_desktop_file (address, profile_dir, name, icon);
-  if (desktop_file_path)
+  if (desktop_file_path) {
     ephy_web_application_initialize_settings (profile_dir);
 
+    apps_dir = g_path_get_dirname (profile_dir);
+    profile_name = g_path_get_basename (profile_dir);
+    ephy_web_application_registry_update (profile_dir,
+                                          ephy_web_application_new (apps_dir, profile_name, name, address,
+                                                                    g_get_real_time () / G_USEC_PER_SEC));
+    g_free (profile_name);
+    g_free (apps_dir);
+  }
+
  out:
   if (profile_dir)
     g_free (profile_dir);
@@ -434,107 +754,16 @@ ephy_web_application_setup_from_desktop_file (GDesktopAppInfo *desktop_info)
 GList *
 ephy_web_application_get_application_list (void)
 {
-  GFileEnumerator *children = NULL;
-  GFileInfo *info;
-  GList *applications = NULL;
-  GFile *dot_dir;
-  char *default_dot_dir;
-
-  default_dot_dir = !ephy_dot_dir_is_default () ? ephy_default_dot_dir () : NULL;
-  dot_dir = g_file_new_for_path (default_dot_dir ? default_dot_dir : ephy_dot_dir ());
-  children = g_file_enumerate_children (dot_dir,
-                                        "standard::name",
-                                        0, NULL, NULL);
-  g_object_unref (dot_dir);
-
-  info = g_file_enumerator_next_file (children, NULL, NULL);
-  while (info) {
-    EphyWebApplication *app;
-    const char *name;
-    glong prefix_length = g_utf8_strlen (EPHY_WEB_APP_PREFIX, -1);
-
-    name = g_file_info_get_name (info);
-    if (g_str_has_prefix (name, EPHY_WEB_APP_PREFIX)) {
-      char *profile_dir;
-      guint64 created;
-      GDate *date;
-      char *desktop_file, *desktop_file_path;
-      char *contents;
-      GFileInfo *desktop_info;
-
-      app = g_slice_new0 (EphyWebApplication);
-
-      profile_dir = g_build_filename (default_dot_dir ? default_dot_dir : ephy_dot_dir (), name, NULL);
-      app->icon_url = g_build_filename (profile_dir, EPHY_WEB_APP_ICON_NAME, NULL);
-
-      desktop_file = g_strconcat (name + prefix_length, ".desktop", NULL);
-      desktop_file_path = g_build_filename (profile_dir, desktop_file, NULL);
-      app->desktop_file = g_strdup (desktop_file);
-
-      if (g_file_get_contents (desktop_file_path, &contents, NULL, NULL)) {
-        char *exec;
-        char **strings;
-        GKeyFile *key;
-        int i;
-        GFile *file;
-
-        key = g_key_file_new ();
-        g_key_file_load_from_data (key, contents, -1, 0, NULL);
-        app->name = g_key_file_get_string (key, "Desktop Entry", "Name", NULL);
-        exec = g_key_file_get_string (key, "Desktop Entry", "Exec", NULL);
-        strings = g_strsplit (exec, " ", -1);
-
-        for (i = 0; strings[i]; i++);
-        app->url = g_strdup (strings[i - 1]);
-
-        g_strfreev (strings);
-        g_free (exec);
-        g_key_file_free (key);
-
-        file = g_file_new_for_path (desktop_file_path);
-
-        /* FIXME: this should use TIME_CREATED but it does not seem to be working. */
-        desktop_info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED, 0, NULL, NULL);
-        created = g_file_info_get_attribute_uint64 (desktop_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-
-        date = g_date_new ();
-        g_date_set_time_t (date, (time_t)created);
-        g_date_strftime (app->install_date, 127, "%x", date);
-
-        g_date_free (date);
-        g_object_unref (file);
-        g_object_unref (desktop_info);
-
-        applications = g_list_append (applications, app);
-      }
-
-      g_free (contents);
-      g_free (desktop_file);
-      g_free (profile_dir);
-      g_free (desktop_file_path);
-    }
+  GList *applications;
+  char *apps_dir;
 
-    g_object_unref (info);
-
-    info = g_file_enumerator_next_file (children, NULL, NULL);
-  }
-
-  g_object_unref (children);
-  g_free (default_dot_dir);
+  apps_dir = get_web_apps_dir ();
+  applications = ephy_web_application_registry_load_or_rebuild (apps_dir);
+  g_free (apps_dir);
 
   return applications;
 }
 
-static void
-ephy_web_application_free (EphyWebApplication *app)
-{
-  g_free (app->name);
-  g_free (app->icon_url);
-  g_free (app->url);
-  g_free (app->desktop_file);
-  g_slice_free (EphyWebApplication, app);
-}
-
 /**
  * ephy_web_application_free_application_list:
  * @list: an #EphyWebApplication GList
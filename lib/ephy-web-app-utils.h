@@ -31,6 +31,7 @@ typedef struct {
     char *icon_url;
     char *url;
     char *desktop_file;
+    gint64 install_time;
     char install_date[128];
 } EphyWebApplication;
 
@@ -36,13 +36,19 @@ struct _EphyHistoryService {
   gboolean scheduled_to_quit;
   gboolean read_only;
   int queue_urls_visited_id;
+  GHashTable *pending_url_updates;
+  guint url_updates_source_id;
 };
 
 gboolean                 ephy_history_service_initialize_urls_table   (EphyHistoryService *self);
 EphyHistoryURL *         ephy_history_service_get_url_row             (EphyHistoryService *self, const char *url_string, EphyHistoryURL *url);
+EphySQLiteStatement *    ephy_history_service_create_url_lookup_statement (EphyHistoryService *self, const char *column);
+EphyHistoryURL *         ephy_history_service_lookup_url_row          (EphyHistoryService *self, EphySQLiteStatement *statement, const char *value);
+GList *                  ephy_history_service_find_synced_url_rows    (EphyHistoryService *self, GHashTable *exclude_sync_ids);
 void                     ephy_history_service_add_url_row             (EphyHistoryService *self, EphyHistoryURL *url);
 void                     ephy_history_service_update_url_row          (EphyHistoryService *self, EphyHistoryURL *url);
 GList*                   ephy_history_service_find_url_rows           (EphyHistoryService *self, EphyHistoryQuery *query);
+EphyHistoryURLResults *  ephy_history_service_find_url_results        (EphyHistoryService *self, EphyHistoryQuery *query);
 void                     ephy_history_service_delete_url              (EphyHistoryService *self, EphyHistoryURL *url);
 
 gboolean                 ephy_history_service_initialize_visits_table (EphyHistoryService *self);
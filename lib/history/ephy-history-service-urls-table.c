@@ -23,13 +23,42 @@
 #include "ephy-history-service.h"
 #include "ephy-history-service-private.h"
 
+/* URLs are looked up by address on every visit, and by sync ID when merging
+ * synced history. The history dialog pages through them sorted by one of the
+ * sort keys of get_sort_key(), whose expressions must be indexed verbatim.
+ * Older databases lack these indexes, so always create them. */
+static const char * const urls_indexes[] = {
+  "CREATE INDEX IF NOT EXISTS urls_url ON urls (url)",
+  "CREATE INDEX IF NOT EXISTS urls_sync_id ON urls (sync_id)",
+  "CREATE INDEX IF NOT EXISTS urls_last_visit_time ON urls (last_visit_time)",
+  "CREATE INDEX IF NOT EXISTS urls_title_sort ON urls (IFNULL(LOWER(title), ''))",
+  "CREATE INDEX IF NOT EXISTS urls_url_sort ON urls (IFNULL(LOWER(url), ''))"
+};
+
+static gboolean
+ephy_history_service_initialize_urls_indexes (EphyHistoryService *self)
+{
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (urls_indexes) && !error; i++)
+    ephy_sqlite_connection_execute (self->history_database, urls_indexes[i], &error);
+
+  if (error) {
+    g_warning ("Could not create urls table indexes: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
 gboolean
 ephy_history_service_initialize_urls_table (EphyHistoryService *self)
 {
   GError *error = NULL;
 
   if (ephy_sqlite_connection_table_exists (self->history_database, "visits")) {
-    return TRUE;
+    return ephy_history_service_initialize_urls_indexes (self);
   }
   ephy_sqlite_connection_execute (self->history_database,
                                   "CREATE TABLE urls ("
@@ -49,7 +78,7 @@ ephy_history_service_initialize_urls_table (EphyHistoryService *self)
     g_error_free (error);
     return FALSE;
   }
-  return TRUE;
+  return ephy_history_service_initialize_urls_indexes (self);
 }
 
 EphyHistoryURL *
@@ -123,6 +152,125 @@ ephy_history_service_get_url_row (EphyHistoryService *self, const char *url_stri
   return url;
 }
 
+/* Prepares a statement looking up a URL by @column, to be reused with
+ * ephy_history_service_lookup_url_row() for many lookups in a row. */
+EphySQLiteStatement *
+ephy_history_service_create_url_lookup_statement (EphyHistoryService *self,
+                                                  const char         *column)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+  char *sql;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database != NULL);
+  g_assert (g_strcmp0 (column, "url") == 0 || g_strcmp0 (column, "sync_id") == 0);
+
+  sql = g_strdup_printf ("SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, thumbnail_update_time, sync_id FROM urls "
+                         "WHERE %s=? LIMIT 1", column);
+  statement = ephy_sqlite_connection_create_statement (self->history_database, sql, &error);
+  g_free (sql);
+
+  if (error) {
+    g_warning ("Could not build urls table lookup statement: %s", error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  return statement;
+}
+
+EphyHistoryURL *
+ephy_history_service_lookup_url_row (EphyHistoryService  *self,
+                                     EphySQLiteStatement *statement,
+                                     const char          *value)
+{
+  EphyHistoryURL *url = NULL;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  if (statement == NULL || value == NULL)
+    return NULL;
+
+  if (ephy_sqlite_statement_bind_string (statement, 0, value, &error) == FALSE) {
+    g_warning ("Could not look up URL in urls table: %s", error->message);
+    g_error_free (error);
+    goto out;
+  }
+
+  if (ephy_sqlite_statement_step (statement, &error)) {
+    url = ephy_history_url_new (ephy_sqlite_statement_get_column_as_string (statement, 1),
+                                ephy_sqlite_statement_get_column_as_string (statement, 2),
+                                ephy_sqlite_statement_get_column_as_int (statement, 3),
+                                ephy_sqlite_statement_get_column_as_int (statement, 4),
+                                ephy_sqlite_statement_get_column_as_int64 (statement, 5));
+    url->id = ephy_sqlite_statement_get_column_as_int (statement, 0);
+    url->hidden = ephy_sqlite_statement_get_column_as_int (statement, 6);
+    url->thumbnail_time = ephy_sqlite_statement_get_column_as_int64 (statement, 7);
+    url->sync_id = g_strdup (ephy_sqlite_statement_get_column_as_string (statement, 8));
+  } else if (error) {
+    g_warning ("Could not look up URL in urls table: %s", error->message);
+    g_error_free (error);
+  }
+
+out:
+  ephy_sqlite_statement_reset (statement);
+  return url;
+}
+
+/* Returns the URLs with a sync ID, except those whose sync ID is in
+ * @exclude_sync_ids. */
+GList *
+ephy_history_service_find_synced_url_rows (EphyHistoryService *self,
+                                           GHashTable         *exclude_sync_ids)
+{
+  EphySQLiteStatement *statement;
+  GList *urls = NULL;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database != NULL);
+
+  statement = ephy_sqlite_connection_create_statement (self->history_database,
+                                                       "SELECT id, url, title, visit_count, typed_count, last_visit_time, hidden_from_overview, thumbnail_update_time, sync_id FROM urls "
+                                                       "WHERE sync_id IS NOT NULL", &error);
+  if (error) {
+    g_warning ("Could not build urls table query statement: %s", error->message);
+    g_error_free (error);
+    return NULL;
+  }
+
+  while (ephy_sqlite_statement_step (statement, &error)) {
+    EphyHistoryURL *url;
+    const char *sync_id = ephy_sqlite_statement_get_column_as_string (statement, 8);
+
+    if (exclude_sync_ids && g_hash_table_contains (exclude_sync_ids, sync_id))
+      continue;
+
+    url = ephy_history_url_new (ephy_sqlite_statement_get_column_as_string (statement, 1),
+                                ephy_sqlite_statement_get_column_as_string (statement, 2),
+                                ephy_sqlite_statement_get_column_as_int (statement, 3),
+                                ephy_sqlite_statement_get_column_as_int (statement, 4),
+                                ephy_sqlite_statement_get_column_as_int64 (statement, 5));
+    url->id = ephy_sqlite_statement_get_column_as_int (statement, 0);
+    url->hidden = ephy_sqlite_statement_get_column_as_int (statement, 6);
+    url->thumbnail_time = ephy_sqlite_statement_get_column_as_int64 (statement, 7);
+    url->sync_id = g_strdup (sync_id);
+    urls = g_list_prepend (urls, url);
+  }
+
+  if (error) {
+    g_warning ("Could not execute urls table query statement: %s", error->message);
+    g_error_free (error);
+    ephy_history_url_list_free (urls);
+    urls = NULL;
+  }
+
+  g_object_unref (statement);
+  return g_list_reverse (urls);
+}
+
 void
 ephy_history_service_add_url_row (EphyHistoryService *self, EphyHistoryURL *url)
 {
@@ -224,13 +372,100 @@ create_url_from_statement (EphySQLiteStatement *statement)
   return url;
 }
 
-GList *
-ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+static void
+append_url_from_statement (EphyHistoryURLResults *results,
+                           EphySQLiteStatement   *statement)
+{
+  EphyHistoryURL *url;
+
+  url = ephy_history_url_results_append (results,
+                                         ephy_sqlite_statement_get_column_as_string (statement, 1),
+                                         ephy_sqlite_statement_get_column_as_string (statement, 2),
+                                         ephy_sqlite_statement_get_column_as_string (statement, 9));
+  url->id = ephy_sqlite_statement_get_column_as_int (statement, 0);
+  url->visit_count = ephy_sqlite_statement_get_column_as_int (statement, 3);
+  url->typed_count = ephy_sqlite_statement_get_column_as_int (statement, 4);
+  url->last_visit_time = ephy_sqlite_statement_get_column_as_int64 (statement, 5);
+  url->hidden = ephy_sqlite_statement_get_column_as_int (statement, 6);
+  url->thumbnail_time = ephy_sqlite_statement_get_column_as_int64 (statement, 7);
+  url->host->id = ephy_sqlite_statement_get_column_as_int (statement, 8);
+}
+
+/* Returns the SQL expression urls are ordered by for @sort_type, or %NULL
+ * for unsorted queries. Rows sharing a key are further ordered by id in the
+ * same direction, so that (key, id) identifies a position for keyset
+ * pagination. */
+static const char *
+get_sort_key (EphyHistorySortType  sort_type,
+              gboolean            *descending,
+              gboolean            *is_string)
+{
+  *descending = FALSE;
+  *is_string = FALSE;
+
+  switch (sort_type) {
+    case EPHY_HISTORY_SORT_MOST_VISITED:
+      *descending = TRUE;
+    /* fall through */
+    case EPHY_HISTORY_SORT_LEAST_VISITED:
+      return "urls.visit_count";
+    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
+      *descending = TRUE;
+    /* fall through */
+    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
+      return "urls.last_visit_time";
+    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
+      *descending = TRUE;
+    /* fall through */
+    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
+      *is_string = TRUE;
+      return "IFNULL(LOWER(urls.title), '')";
+    case EPHY_HISTORY_SORT_URL_DESCENDING:
+      *descending = TRUE;
+    /* fall through */
+    case EPHY_HISTORY_SORT_URL_ASCENDING:
+      *is_string = TRUE;
+      return "IFNULL(LOWER(urls.url), '')";
+    case EPHY_HISTORY_SORT_NONE:
+    default:
+      return NULL;
+  }
+}
+
+static gboolean
+bind_sort_key (EphySQLiteStatement  *statement,
+               int                  *column,
+               EphyHistorySortType   sort_type,
+               EphyHistoryURL       *url,
+               GError              **error)
+{
+  switch (sort_type) {
+    case EPHY_HISTORY_SORT_MOST_VISITED:
+    case EPHY_HISTORY_SORT_LEAST_VISITED:
+      return ephy_sqlite_statement_bind_int (statement, (*column)++, url->visit_count, error);
+    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
+    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
+      return ephy_sqlite_statement_bind_int64 (statement, (*column)++, url->last_visit_time, error);
+    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
+    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
+      return ephy_sqlite_statement_bind_string (statement, (*column)++, url->title, error);
+    case EPHY_HISTORY_SORT_URL_ASCENDING:
+    case EPHY_HISTORY_SORT_URL_DESCENDING:
+      return ephy_sqlite_statement_bind_string (statement, (*column)++, url->url, error);
+    case EPHY_HISTORY_SORT_NONE:
+    default:
+      g_assert_not_reached ();
+  }
+
+  return FALSE;
+}
+
+static EphySQLiteStatement *
+create_url_query_statement (EphyHistoryService *self, EphyHistoryQuery *query)
 {
   EphySQLiteStatement *statement = NULL;
   GList *substring;
   GString *statement_str;
-  GList *urls = NULL;
   GError *error = NULL;
   const char *base_statement = ""
                                "SELECT "
@@ -247,6 +482,9 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
                                "FROM "
                                "urls ";
 
+  const char *sort_key;
+  gboolean sort_descending;
+  gboolean sort_key_is_string;
   int i = 0;
 
   g_assert (self->history_thread == g_thread_self ());
@@ -278,34 +516,23 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
 
   statement_str = g_string_append (statement_str, "1 ");
 
-  switch (query->sort_type) {
-    case EPHY_HISTORY_SORT_MOST_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count DESC ");
-      break;
-    case EPHY_HISTORY_SORT_LEAST_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count ");
-      break;
-    case EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time DESC ");
-      break;
-    case EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.last_visit_time ");
-      break;
-    case EPHY_HISTORY_SORT_TITLE_ASCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.title) ");
-      break;
-    case EPHY_HISTORY_SORT_TITLE_DESCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.title) DESC ");
-      break;
-    case EPHY_HISTORY_SORT_URL_ASCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.url) ");
-      break;
-    case EPHY_HISTORY_SORT_URL_DESCENDING:
-      statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.url) DESC ");
-      break;
-    case EPHY_HISTORY_SORT_NONE:
-    default:
-      g_warning ("We don't support this sorting method yet.");
+  sort_key = get_sort_key (query->sort_type, &sort_descending, &sort_key_is_string);
+  if (sort_key == NULL)
+    g_warning ("We don't support this sorting method yet.");
+
+  if (query->after && sort_key) {
+    const char *key_param = sort_key_is_string ? "IFNULL(LOWER(?), '')" : "?";
+    char op = sort_descending ? '<' : '>';
+
+    g_string_append_printf (statement_str, "AND (%s %c %s OR (%s = %s AND urls.id %c ?)) ",
+                            sort_key, op, key_param, sort_key, key_param, op);
+  }
+
+  if (sort_key) {
+    g_string_append_printf (statement_str, "ORDER BY %s%s, urls.id%s ",
+                            sort_key,
+                            sort_descending ? " DESC" : "",
+                            sort_descending ? " DESC" : "");
   }
 
   if (query->limit) {
@@ -365,6 +592,17 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
     g_free (string);
   }
 
+  if (query->after && sort_key) {
+    if (bind_sort_key (statement, &i, query->sort_type, query->after, &error) == FALSE ||
+        bind_sort_key (statement, &i, query->sort_type, query->after, &error) == FALSE ||
+        ephy_sqlite_statement_bind_int (statement, i++, query->after->id, &error) == FALSE) {
+      g_warning ("Could not build urls table query statement: %s", error->message);
+      g_error_free (error);
+      g_object_unref (statement);
+      return NULL;
+    }
+  }
+
   if (query->limit)
     if (ephy_sqlite_statement_bind_int (statement, i++, query->limit, &error) == FALSE) {
       g_warning ("Could not build urls table query statement: %s", error->message);
@@ -373,6 +611,20 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
       return NULL;
     }
 
+  return statement;
+}
+
+GList *
+ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *query)
+{
+  EphySQLiteStatement *statement;
+  GList *urls = NULL;
+  GError *error = NULL;
+
+  statement = create_url_query_statement (self, query);
+  if (!statement)
+    return NULL;
+
   while (ephy_sqlite_statement_step (statement, &error))
     urls = g_list_prepend (urls, create_url_from_statement (statement));
 
@@ -390,6 +642,41 @@ ephy_history_service_find_url_rows (EphyHistoryService *self, EphyHistoryQuery *
   return urls;
 }
 
+/* Same as ephy_history_service_find_url_rows(), but all the rows are kept in
+ * a single #EphyHistoryURLResults, which is far cheaper to build and to free
+ * than a list of separately allocated URLs. Returns %NULL if no URL matched. */
+EphyHistoryURLResults *
+ephy_history_service_find_url_results (EphyHistoryService *self, EphyHistoryQuery *query)
+{
+  EphySQLiteStatement *statement;
+  EphyHistoryURLResults *results;
+  GError *error = NULL;
+
+  statement = create_url_query_statement (self, query);
+  if (!statement)
+    return NULL;
+
+  results = ephy_history_url_results_new (query->limit > 0 ? query->limit : 0);
+  while (ephy_sqlite_statement_step (statement, &error))
+    append_url_from_statement (results, statement);
+
+  g_object_unref (statement);
+
+  if (error) {
+    g_warning ("Could not execute urls table query statement: %s", error->message);
+    g_error_free (error);
+    ephy_history_url_results_free (results);
+    return NULL;
+  }
+
+  if (ephy_history_url_results_get_length (results) == 0) {
+    ephy_history_url_results_free (results);
+    return NULL;
+  }
+
+  return results;
+}
+
 void
 ephy_history_service_delete_url (EphyHistoryService *self, EphyHistoryURL *url)
 {
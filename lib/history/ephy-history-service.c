@@ -39,8 +39,10 @@ typedef enum {
   SET_URL_ZOOM_LEVEL,
   SET_URL_HIDDEN,
   SET_URL_THUMBNAIL_TIME,
+  UPDATE_URLS,
   ADD_VISIT,
   ADD_VISITS,
+  MERGE_URLS,
   DELETE_URLS,
   DELETE_HOST,
   CLEAR,
@@ -50,6 +52,8 @@ typedef enum {
   GET_URL,
   GET_HOST_FOR_URL,
   QUERY_URLS,
+  QUERY_URL_RESULTS,
+  FIND_SYNCED_URLS,
   QUERY_VISITS,
   GET_HOSTS,
   QUERY_HOSTS
@@ -83,6 +87,7 @@ static gpointer run_history_service_thread (EphyHistoryService *self);
 static void ephy_history_service_process_message (EphyHistoryService *self, EphyHistoryServiceMessage *message);
 static gboolean ephy_history_service_execute_quit (EphyHistoryService *self, gpointer data, gpointer *result);
 static void ephy_history_service_quit (EphyHistoryService *self, EphyHistoryJobCallback callback, gpointer user_data);
+static void ephy_history_service_flush_url_updates (EphyHistoryService *self, gboolean notify);
 
 enum {
   PROP_0,
@@ -139,6 +144,7 @@ ephy_history_service_finalize (GObject *object)
     g_thread_join (self->history_thread);
 
   g_free (self->history_filename);
+  g_hash_table_unref (self->pending_url_updates);
 
   G_OBJECT_CLASS (ephy_history_service_parent_class)->finalize (object);
 }
@@ -153,6 +159,10 @@ ephy_history_service_dispose (GObject *object)
     self->queue_urls_visited_id = 0;
   }
 
+  /* Nobody is left to be notified by now, but the updates are still worth
+   * saving. */
+  ephy_history_service_flush_url_updates (self, FALSE);
+
   G_OBJECT_CLASS (ephy_history_service_parent_class)->dispose (object);
 }
 
@@ -299,6 +309,8 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
 static void
 ephy_history_service_init (EphyHistoryService *self)
 {
+  self->pending_url_updates = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                                     (GDestroyNotify)ephy_history_url_free);
 }
 
 EphyHistoryService *
@@ -497,6 +509,8 @@ ephy_history_service_execute_job_callback (gpointer data)
   g_assert (message->callback || message->type == CLEAR);
 
   if (g_cancellable_is_cancelled (message->cancellable)) {
+    if (message->type == QUERY_URL_RESULTS)
+      ephy_history_url_results_free (message->result);
     ephy_history_service_message_free (message);
     return FALSE;
   }
@@ -624,6 +638,69 @@ ephy_history_service_execute_add_visits (EphyHistoryService *self, GList *visits
   return success;
 }
 
+static gboolean
+ephy_history_service_execute_merge_urls (EphyHistoryService  *self,
+                                         GPtrArray           *urls,
+                                         gpointer            *result)
+{
+  EphyHistoryMergeResult *merge_result;
+  EphySQLiteStatement *by_sync_id;
+  EphySQLiteStatement *by_url;
+  gboolean success = TRUE;
+  guint i;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  if (self->read_only)
+    return FALSE;
+
+  /* The whole merge runs in the message's transaction, and the lookups reuse
+   * two prepared statements instead of loading all local URLs. */
+  by_sync_id = ephy_history_service_create_url_lookup_statement (self, "sync_id");
+  by_url = ephy_history_service_create_url_lookup_statement (self, "url");
+  if (!by_sync_id || !by_url) {
+    g_clear_object (&by_sync_id);
+    g_clear_object (&by_url);
+    return FALSE;
+  }
+
+  merge_result = g_new0 (EphyHistoryMergeResult, 1);
+  merge_result->matches = g_ptr_array_new_full (urls->len, (GDestroyNotify)ephy_history_url_free);
+
+  for (i = 0; i < urls->len; i++) {
+    EphyHistoryURL *remote = g_ptr_array_index (urls, i);
+    EphyHistoryURL *local;
+    EphyHistoryPageVisit *visit = NULL;
+
+    local = ephy_history_service_lookup_url_row (self, by_sync_id, remote->sync_id);
+    if (!local)
+      local = ephy_history_service_lookup_url_row (self, by_url, remote->url);
+
+    if (local) {
+      /* Known URL, possibly under another sync ID, which is kept. */
+      if (remote->last_visit_time > local->last_visit_time)
+        visit = ephy_history_page_visit_new (local->url, remote->last_visit_time, EPHY_PAGE_VISIT_LINK);
+    } else if (remote->url && remote->last_visit_time > 0) {
+      visit = ephy_history_page_visit_new (remote->url, remote->last_visit_time, EPHY_PAGE_VISIT_LINK);
+      visit->url->sync_id = g_strdup (remote->sync_id);
+    }
+
+    if (visit) {
+      visit->url->notify_visit = FALSE;
+      success = ephy_history_service_execute_add_visit_helper (self, visit) && success;
+      ephy_history_page_visit_free (visit);
+    }
+
+    g_ptr_array_add (merge_result->matches, local);
+  }
+
+  g_object_unref (by_sync_id);
+  g_object_unref (by_url);
+
+  *result = merge_result;
+  return success;
+}
+
 static gboolean
 ephy_history_service_execute_find_visits (EphyHistoryService *self, EphyHistoryQuery *query, gpointer *result)
 {
@@ -700,6 +777,88 @@ ephy_history_service_add_visits (EphyHistoryService *self, GList *visits, GCance
   ephy_history_service_send_message (self, message);
 }
 
+/**
+ * ephy_history_service_merge_urls:
+ * @self: the #EphyHistoryService
+ * @urls: (element-type EphyHistoryURL): URLs with an address, a sync ID and
+ *   a last visit time
+ * @cancellable: a #GCancellable
+ * @callback: callback receiving an #EphyHistoryMergeResult
+ * @user_data: user data for @callback
+ *
+ * Upserts @urls in a single transaction. Each URL is matched against the
+ * local history by sync ID, then by address. Known URLs get a visit at
+ * their last visit time when it is newer than the local one, keeping their
+ * local sync ID; unknown URLs with a positive last visit time are added.
+ **/
+void
+ephy_history_service_merge_urls (EphyHistoryService    *self,
+                                 GPtrArray             *urls,
+                                 GCancellable          *cancellable,
+                                 EphyHistoryJobCallback callback,
+                                 gpointer               user_data)
+{
+  EphyHistoryServiceMessage *message;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (urls != NULL);
+
+  message = ephy_history_service_message_new (self, MERGE_URLS,
+                                              g_ptr_array_ref (urls), (GDestroyNotify)g_ptr_array_unref,
+                                              cancellable, callback, user_data);
+  ephy_history_service_send_message (self, message);
+
+  ephy_history_service_queue_urls_visited (self);
+}
+
+static gboolean
+ephy_history_service_execute_find_synced_urls (EphyHistoryService *self,
+                                               GHashTable         *exclude_sync_ids,
+                                               gpointer           *result)
+{
+  *result = ephy_history_service_find_synced_url_rows (self, exclude_sync_ids);
+
+  return TRUE;
+}
+
+/**
+ * ephy_history_service_find_synced_urls:
+ * @self: the #EphyHistoryService
+ * @exclude_sync_ids: (element-type utf8 utf8): a set of sync IDs to skip
+ * @cancellable: a #GCancellable
+ * @callback: callback receiving a #GList of #EphyHistoryURL
+ * @user_data: user data for @callback
+ *
+ * Finds the local URLs that have a sync ID, except those in
+ * @exclude_sync_ids. The set is copied, so it can be modified as soon as
+ * this function returns.
+ **/
+void
+ephy_history_service_find_synced_urls (EphyHistoryService    *self,
+                                       GHashTable            *exclude_sync_ids,
+                                       GCancellable          *cancellable,
+                                       EphyHistoryJobCallback callback,
+                                       gpointer               user_data)
+{
+  EphyHistoryServiceMessage *message;
+  GHashTable *sync_ids;
+  GHashTableIter iter;
+  gpointer sync_id;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (exclude_sync_ids != NULL);
+
+  sync_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_hash_table_iter_init (&iter, exclude_sync_ids);
+  while (g_hash_table_iter_next (&iter, &sync_id, NULL))
+    g_hash_table_add (sync_ids, g_strdup (sync_id));
+
+  message = ephy_history_service_message_new (self, FIND_SYNCED_URLS,
+                                              sync_ids, (GDestroyNotify)g_hash_table_unref,
+                                              cancellable, callback, user_data);
+  ephy_history_service_send_message (self, message);
+}
+
 void
 ephy_history_service_find_visits_in_time (EphyHistoryService *self, gint64 from, gint64 to, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data)
 {
@@ -752,6 +911,37 @@ ephy_history_service_query_urls (EphyHistoryService *self, EphyHistoryQuery *que
   ephy_history_service_send_message (self, message);
 }
 
+static gboolean
+ephy_history_service_execute_query_url_results (EphyHistoryService *self, EphyHistoryQuery *query, gpointer *result)
+{
+  *result = ephy_history_service_find_url_results (self, query);
+
+  return TRUE;
+}
+
+/* Like ephy_history_service_query_urls(), except that the callback gets an
+ * #EphyHistoryURLResults, or %NULL if no URL matched, rather than a list. It
+ * is much cheaper to build and free, so prefer it for frequent queries whose
+ * rows are not kept around. The callback owns the results and must free them
+ * with ephy_history_url_results_free(). */
+void
+ephy_history_service_query_url_results (EphyHistoryService    *self,
+                                        EphyHistoryQuery      *query,
+                                        GCancellable          *cancellable,
+                                        EphyHistoryJobCallback callback,
+                                        gpointer               user_data)
+{
+  EphyHistoryServiceMessage *message;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (query != NULL);
+
+  message = ephy_history_service_message_new (self, QUERY_URL_RESULTS,
+                                              ephy_history_query_copy (query), (GDestroyNotify)ephy_history_query_free,
+                                              cancellable, callback, user_data);
+  ephy_history_service_send_message (self, message);
+}
+
 void
 ephy_history_service_get_hosts (EphyHistoryService    *self,
                                 GCancellable          *cancellable,
@@ -786,6 +976,95 @@ ephy_history_service_query_hosts (EphyHistoryService    *self,
   ephy_history_service_send_message (self, message);
 }
 
+/* Pages, single page applications in particular, can change their title many
+ * times a second while loading, and every change ends up sent to all the web
+ * processes. So the title and thumbnail time updates that nobody waits for are
+ * held back for a little while, during which only the latest ones of every URL
+ * are kept, and then written all at once. */
+#define URL_UPDATES_DELAY 500 /* milliseconds */
+
+typedef struct {
+  /* Each URL holds its new title, or NULL, and its new thumbnail time, or -1,
+   * if they are unchanged. */
+  GPtrArray *urls;
+  gboolean notify;
+} URLUpdates;
+
+static void
+url_updates_free (URLUpdates *updates)
+{
+  g_ptr_array_unref (updates->urls);
+  g_slice_free (URLUpdates, updates);
+}
+
+static void
+ephy_history_service_flush_url_updates (EphyHistoryService *self,
+                                        gboolean            notify)
+{
+  EphyHistoryServiceMessage *message;
+  URLUpdates *updates;
+  GHashTableIter iter;
+  EphyHistoryURL *url;
+
+  if (self->url_updates_source_id) {
+    g_source_remove (self->url_updates_source_id);
+    self->url_updates_source_id = 0;
+  }
+
+  if (g_hash_table_size (self->pending_url_updates) == 0)
+    return;
+
+  updates = g_slice_new (URLUpdates);
+  updates->urls = g_ptr_array_new_full (g_hash_table_size (self->pending_url_updates),
+                                        (GDestroyNotify)ephy_history_url_free);
+  updates->notify = notify;
+
+  g_hash_table_iter_init (&iter, self->pending_url_updates);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&url)) {
+    g_hash_table_iter_steal (&iter);
+    g_ptr_array_add (updates->urls, url);
+  }
+
+  message = ephy_history_service_message_new (self, UPDATE_URLS,
+                                              updates, (GDestroyNotify)url_updates_free,
+                                              NULL, NULL, NULL);
+  ephy_history_service_send_message (self, message);
+}
+
+static gboolean
+url_updates_timeout_cb (EphyHistoryService *self)
+{
+  self->url_updates_source_id = 0;
+  ephy_history_service_flush_url_updates (self, TRUE);
+
+  return G_SOURCE_REMOVE;
+}
+
+static EphyHistoryURL *
+ephy_history_service_get_pending_url_update (EphyHistoryService *self,
+                                             const char         *url_string)
+{
+  EphyHistoryURL *url;
+
+  url = g_hash_table_lookup (self->pending_url_updates, url_string);
+  if (!url) {
+    url = ephy_history_url_new (url_string, NULL, 0, 0, 0);
+    url->thumbnail_time = -1;
+    g_hash_table_insert (self->pending_url_updates, url->url, url);
+  }
+
+  /* The window is not extended by later updates, or a page changing its
+   * title all the time would never get it saved. */
+  if (!self->url_updates_source_id) {
+    self->url_updates_source_id = g_timeout_add (URL_UPDATES_DELAY,
+                                                 (GSourceFunc)url_updates_timeout_cb,
+                                                 self);
+    g_source_set_name_by_id (self->url_updates_source_id, "[epiphany] history_url_updates");
+  }
+
+  return url;
+}
+
 static gboolean
 set_url_title_signal_emit (SignalEmissionContext *ctx)
 {
@@ -843,6 +1122,18 @@ ephy_history_service_set_url_title (EphyHistoryService    *self,
   g_assert (title != NULL);
   g_assert (*title != '\0');
 
+  if (!callback && !cancellable) {
+    url = ephy_history_service_get_pending_url_update (self, orig_url);
+    g_free (url->title);
+    url->title = g_strdup (title);
+    return;
+  }
+
+  /* This one supersedes any pending title update. */
+  url = g_hash_table_lookup (self->pending_url_updates, orig_url);
+  if (url)
+    g_clear_pointer (&url->title, g_free);
+
   url = ephy_history_url_new (orig_url, title, 0, 0, 0);
   message = ephy_history_service_message_new (self, SET_URL_TITLE,
                                               url, (GDestroyNotify)ephy_history_url_free,
@@ -977,6 +1268,16 @@ ephy_history_service_set_url_thumbnail_time (EphyHistoryService    *self,
   g_assert (EPHY_IS_HISTORY_SERVICE (self));
   g_assert (orig_url != NULL);
 
+  if (!callback && !cancellable) {
+    url = ephy_history_service_get_pending_url_update (self, orig_url);
+    url->thumbnail_time = thumbnail_time;
+    return;
+  }
+
+  url = g_hash_table_lookup (self->pending_url_updates, orig_url);
+  if (url)
+    url->thumbnail_time = -1;
+
   url = ephy_history_url_new (orig_url, NULL, 0, 0, 0);
   url->thumbnail_time = thumbnail_time;
   message = ephy_history_service_message_new (self, SET_URL_THUMBNAIL_TIME,
@@ -985,6 +1286,55 @@ ephy_history_service_set_url_thumbnail_time (EphyHistoryService    *self,
   ephy_history_service_send_message (self, message);
 }
 
+static gboolean
+ephy_history_service_execute_update_urls (EphyHistoryService *self,
+                                          URLUpdates         *updates,
+                                          gpointer           *result)
+{
+  guint i;
+
+  if (self->read_only)
+    return FALSE;
+
+  for (i = 0; i < updates->urls->len; i++) {
+    EphyHistoryURL *update = g_ptr_array_index (updates->urls, i);
+    EphyHistoryURL *url;
+    gboolean title_changed;
+    gboolean thumbnail_time_changed;
+
+    /* The URL is not yet in the database, so we can't update it. */
+    url = ephy_history_service_get_url_row (self, update->url, NULL);
+    if (!url)
+      continue;
+
+    title_changed = update->title && g_strcmp0 (update->title, url->title) != 0;
+    thumbnail_time_changed = update->thumbnail_time != -1 && update->thumbnail_time != url->thumbnail_time;
+
+    if (title_changed) {
+      g_free (url->title);
+      url->title = g_strdup (update->title);
+    }
+    if (thumbnail_time_changed)
+      url->thumbnail_time = update->thumbnail_time;
+
+    if (title_changed || thumbnail_time_changed)
+      ephy_history_service_update_url_row (self, url);
+
+    if (title_changed && updates->notify) {
+      SignalEmissionContext *ctx;
+
+      ctx = signal_emission_context_new (self, url, (GDestroyNotify)ephy_history_url_free);
+      g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                       (GSourceFunc)set_url_title_signal_emit,
+                       ctx, (GDestroyNotify)signal_emission_context_free);
+    } else {
+      ephy_history_url_free (url);
+    }
+  }
+
+  return TRUE;
+}
+
 static gboolean
 ephy_history_service_execute_get_url (EphyHistoryService *self,
                                       const gchar        *orig_url,
@@ -1185,6 +1535,8 @@ ephy_history_service_clear (EphyHistoryService    *self,
 
   g_assert (EPHY_IS_HISTORY_SERVICE (self));
 
+  g_hash_table_remove_all (self->pending_url_updates);
+
   message = ephy_history_service_message_new (self, CLEAR,
                                               NULL, NULL,
                                               cancellable, callback, user_data);
@@ -1208,8 +1560,10 @@ static EphyHistoryServiceMethod methods[] = {
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_zoom_level,
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_hidden,
   (EphyHistoryServiceMethod)ephy_history_service_execute_set_url_thumbnail_time,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_update_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_add_visit,
   (EphyHistoryServiceMethod)ephy_history_service_execute_add_visits,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_merge_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_host,
   (EphyHistoryServiceMethod)ephy_history_service_execute_clear,
@@ -1217,6 +1571,8 @@ static EphyHistoryServiceMethod methods[] = {
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_host_for_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_urls,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_query_url_results,
+  (EphyHistoryServiceMethod)ephy_history_service_execute_find_synced_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_find_visits,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_hosts,
   (EphyHistoryServiceMethod)ephy_history_service_execute_query_hosts
@@ -19,6 +19,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 
 #include "ephy-history-types.h"
 
@@ -198,6 +199,113 @@ ephy_history_url_list_free (GList *list)
   g_list_free_full (list, (GDestroyNotify)ephy_history_url_free);
 }
 
+/* Large enough for the url, title and sync id of a few dozen rows. */
+#define URL_RESULTS_STRING_CHUNK_SIZE 4096
+
+typedef struct {
+  EphyHistoryURL url;
+  EphyHistoryHost host;
+} URLResultsRow;
+
+struct _EphyHistoryURLResults {
+  /* The rows are stored contiguously, each one with its host, and all their
+   * strings come from the same chunk, so a query costs a handful of
+   * allocations rather than several per row. */
+  GArray *rows;
+  GStringChunk *strings;
+};
+
+EphyHistoryURLResults *
+ephy_history_url_results_new (guint reserved_size)
+{
+  EphyHistoryURLResults *results = g_slice_new (EphyHistoryURLResults);
+
+  results->rows = g_array_sized_new (FALSE, FALSE, sizeof (URLResultsRow), reserved_size);
+  results->strings = g_string_chunk_new (URL_RESULTS_STRING_CHUNK_SIZE);
+
+  return results;
+}
+
+static char *
+url_results_insert_string (EphyHistoryURLResults *results,
+                           const char            *string)
+{
+  return string ? g_string_chunk_insert (results->strings, string) : NULL;
+}
+
+/* Adds a row initialized like ephy_history_url_new() does, with an empty
+ * host. The returned row is only valid until the next one is appended. */
+EphyHistoryURL *
+ephy_history_url_results_append (EphyHistoryURLResults *results,
+                                 const char            *url,
+                                 const char            *title,
+                                 const char            *sync_id)
+{
+  URLResultsRow *row;
+
+  g_array_set_size (results->rows, results->rows->len + 1);
+  row = &g_array_index (results->rows, URLResultsRow, results->rows->len - 1);
+  memset (row, 0, sizeof (URLResultsRow));
+
+  row->url.id = -1;
+  row->url.url = url_results_insert_string (results, url);
+  row->url.title = url_results_insert_string (results, title);
+  row->url.sync_id = url_results_insert_string (results, sync_id);
+  row->url.host = &row->host;
+  row->url.notify_visit = TRUE;
+  row->url.notify_delete = TRUE;
+
+  row->host.id = -1;
+  row->host.zoom_level = 1.0;
+
+  return &row->url;
+}
+
+guint
+ephy_history_url_results_get_length (EphyHistoryURLResults *results)
+{
+  return results ? results->rows->len : 0;
+}
+
+EphyHistoryURL *
+ephy_history_url_results_get (EphyHistoryURLResults *results,
+                              guint                  index)
+{
+  URLResultsRow *row;
+
+  g_assert (index < ephy_history_url_results_get_length (results));
+
+  /* Growing the array may have moved the rows since they were appended. */
+  row = &g_array_index (results->rows, URLResultsRow, index);
+  row->url.host = &row->host;
+
+  return &row->url;
+}
+
+/* For the callers that still need separately allocated URLs. */
+GList *
+ephy_history_url_results_to_list (EphyHistoryURLResults *results)
+{
+  GList *list = NULL;
+  guint i;
+
+  for (i = ephy_history_url_results_get_length (results); i > 0; i--)
+    list = g_list_prepend (list, ephy_history_url_copy (ephy_history_url_results_get (results, i - 1)));
+
+  return list;
+}
+
+void
+ephy_history_url_results_free (EphyHistoryURLResults *results)
+{
+  if (results == NULL)
+    return;
+
+  g_array_free (results->rows, TRUE);
+  g_string_chunk_free (results->strings);
+  g_slice_free (EphyHistoryURLResults, results);
+}
+
 EphyHistoryQuery *
 ephy_history_query_new (void)
 {
@@ -208,6 +316,7 @@ void
 ephy_history_query_free (EphyHistoryQuery *query)
 {
   g_list_free_full (query->substring_list, g_free);
+  ephy_history_url_free (query->after);
   g_slice_free1 (sizeof (EphyHistoryQuery), query);
 }
 
@@ -223,6 +332,7 @@ ephy_history_query_copy (EphyHistoryQuery *query)
   copy->ignore_hidden = query->ignore_hidden;
   copy->ignore_local = query->ignore_local;
   copy->host = query->host;
+  copy->after = ephy_history_url_copy (query->after);
 
   for (iter = query->substring_list; iter != NULL; iter = iter->next) {
     copy->substring_list = g_list_prepend (copy->substring_list, g_strdup (iter->data));
@@ -231,3 +341,13 @@ ephy_history_query_copy (EphyHistoryQuery *query)
 
   return copy;
 }
+
+void
+ephy_history_merge_result_free (EphyHistoryMergeResult *result)
+{
+  if (result == NULL)
+    return;
+
+  g_ptr_array_unref (result->matches);
+  g_free (result);
+}
@@ -82,6 +82,11 @@ typedef struct _EphyHistoryURL
   gboolean notify_delete;
 } EphyHistoryURL;
 
+/* The result of a URL query, with all its rows and their strings stored
+ * together. The rows are owned by the result set: they must not be freed or
+ * modified, and must be copied to be kept around after it is freed. */
+typedef struct _EphyHistoryURLResults EphyHistoryURLResults;
+
 typedef struct _EphyHistoryPageVisit
 {
   EphyHistoryURL* url;
@@ -100,8 +105,18 @@ typedef struct _EphyHistoryQuery
   gboolean ignore_local;
   gint host;
   EphyHistorySortType sort_type;
+  /* Keyset pagination: when set, only the rows sorting strictly after
+   * this one according to sort_type are returned. */
+  EphyHistoryURL *after;
 } EphyHistoryQuery;
 
+typedef struct _EphyHistoryMergeResult
+{
+  /* For each merged URL, the local URL it matched before the merge, by sync
+   * ID or else by address, or NULL. */
+  GPtrArray *matches;
+} EphyHistoryMergeResult;
+
 EphyHistoryPageVisit *          ephy_history_page_visit_new (const char *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_new_with_url (EphyHistoryURL *url, gint64 visit_time, EphyHistoryPageVisitType visit_type);
 EphyHistoryPageVisit *          ephy_history_page_visit_copy (EphyHistoryPageVisit *visit);
@@ -121,8 +136,17 @@ void                            ephy_history_url_free (EphyHistoryURL *url);
 GList *                         ephy_history_url_list_copy (GList *original);
 void                            ephy_history_url_list_free (GList *list);
 
+EphyHistoryURLResults *         ephy_history_url_results_new (guint reserved_size);
+EphyHistoryURL *                ephy_history_url_results_append (EphyHistoryURLResults *results, const char *url, const char *title, const char *sync_id);
+guint                           ephy_history_url_results_get_length (EphyHistoryURLResults *results);
+EphyHistoryURL *                ephy_history_url_results_get (EphyHistoryURLResults *results, guint index);
+GList *                         ephy_history_url_results_to_list (EphyHistoryURLResults *results);
+void                            ephy_history_url_results_free (EphyHistoryURLResults *results);
+
 EphyHistoryQuery *              ephy_history_query_new (void);
 void                            ephy_history_query_free (EphyHistoryQuery *query);
 EphyHistoryQuery *              ephy_history_query_copy (EphyHistoryQuery *query);
 
+void                            ephy_history_merge_result_free (EphyHistoryMergeResult *result);
+
 G_END_DECLS
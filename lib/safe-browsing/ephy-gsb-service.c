@@ -44,6 +44,7 @@ struct _EphyGSBService {
   EphyGSBStorage *storage;
 
   gboolean        is_updating;
+  gboolean        updates_started;
   guint           source_id;
 
   gint64          next_full_hashes_time;
@@ -497,11 +498,6 @@ ephy_gsb_service_constructed (GObject *object)
     self->next_list_updates_time = self->back_off_exit_time;
   else
     ephy_gsb_service_reset_back_off_mode (self);
-
-  if (self->next_list_updates_time > CURRENT_TIME)
-    ephy_gsb_service_schedule_update (self);
-  else
-    ephy_gsb_service_update (self);
 }
 
 static void
@@ -563,6 +559,30 @@ ephy_gsb_service_new (const char *api_key,
   return service;
 }
 
+/**
+ * ephy_gsb_service_start_updates:
+ * @self: an #EphyGSBService
+ *
+ * Starts keeping the local threat lists up to date. An update can mean a
+ * large download and many database writes, so this is left to the caller
+ * instead of happening as soon as the service is created.
+ **/
+void
+ephy_gsb_service_start_updates (EphyGSBService *self)
+{
+  g_assert (EPHY_IS_GSB_SERVICE (self));
+
+  if (self->updates_started || !ephy_gsb_storage_is_operable (self->storage))
+    return;
+
+  self->updates_started = TRUE;
+
+  if (self->next_list_updates_time > CURRENT_TIME)
+    ephy_gsb_service_schedule_update (self);
+  else
+    ephy_gsb_service_update (self);
+}
+
 static void
 ephy_gsb_service_update_full_hashes_sync (EphyGSBService *self,
                                           GList          *prefixes)
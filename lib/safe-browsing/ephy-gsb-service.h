@@ -31,6 +31,7 @@ G_DECLARE_FINAL_TYPE (EphyGSBService, ephy_gsb_service, EPHY, GSB_SERVICE, GObje
 
 EphyGSBService *ephy_gsb_service_new                (const char *api_key,
                                                      const char *db_path);
+void            ephy_gsb_service_start_updates      (EphyGSBService      *self);
 void            ephy_gsb_service_verify_url         (EphyGSBService      *self,
                                                      const char          *url,
                                                      GAsyncReadyCallback  callback,
@@ -286,46 +286,42 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
    */
 }
 
+static void
+ephy_history_manager_remove_url (EphyHistoryManager *self,
+                                 EphyHistoryURL     *url)
+{
+  EphyHistoryRecord *record;
+
+  record = ephy_history_record_new (url->sync_id, url->title, url->url, url->last_visit_time);
+  ephy_synchronizable_manager_remove (EPHY_SYNCHRONIZABLE_MANAGER (self),
+                                      EPHY_SYNCHRONIZABLE (record));
+  g_object_unref (record);
+}
+
 static void
 ephy_history_manager_handle_different_id_same_url (EphyHistoryManager *self,
-                                                   EphyHistoryRecord  *local,
+                                                   EphyHistoryURL     *local,
                                                    EphyHistoryRecord  *remote)
 {
-  gint64 local_last_visit_time;
-  gint64 remote_last_visit_time;
-
   g_assert (EPHY_IS_HISTORY_MANAGER (self));
-  g_assert (EPHY_HISTORY_RECORD (local));
+  g_assert (local);
   g_assert (EPHY_HISTORY_RECORD (remote));
 
-  local_last_visit_time = ephy_history_record_get_last_visit_time (local);
-  remote_last_visit_time = ephy_history_record_get_last_visit_time (remote);
-
-  if (remote_last_visit_time > local_last_visit_time)
-    ephy_history_service_visit_url (self->service,
-                                    ephy_history_record_get_uri (local),
-                                    ephy_history_record_get_id (local),
-                                    local_last_visit_time,
-                                    EPHY_PAGE_VISIT_LINK, FALSE);
-
-  ephy_history_record_set_id (remote, ephy_history_record_get_id (local));
-  ephy_history_record_add_visit_time (remote, local_last_visit_time);
+  /* The merge already visited the local URL at the remote last visit time,
+   * if newer. Keep the local ID. */
+  g_signal_emit_by_name (self, "synchronizable-deleted", remote);
+  ephy_history_record_set_id (remote, local->sync_id);
+  ephy_history_record_add_visit_time (remote, local->last_visit_time);
 }
 
 static GPtrArray *
-ephy_history_manager_handle_initial_merge (EphyHistoryManager *self,
-                                           GHashTable         *records_ht_id,
-                                           GHashTable         *records_ht_url,
-                                           GList              *remote_records)
+ephy_history_manager_handle_initial_merge (EphyHistoryManager     *self,
+                                           GList                  *remote_records,
+                                           EphyHistoryMergeResult *result)
 {
-  EphyHistoryRecord *record;
-  GHashTableIter iter;
-  gpointer key, value;
+  EphyHistoryURL *local;
   GPtrArray *to_upload;
-  const char *remote_id;
-  const char *remote_url;
-  gint64 remote_last_visit_time;
-  gint64 local_last_visit_time;
+  guint i = 0;
 
   g_assert (EPHY_IS_HISTORY_MANAGER (self));
 
@@ -335,126 +331,73 @@ ephy_history_manager_handle_initial_merge (EphyHistoryManager *self,
    * importing history records from server, we may encounter duplicates either
    * by ID or by URL. We start from the assumption that same ID means same URL
    * but same URL does not necessarily mean same ID. This is what our merge
-   * logic is based on.
+   * logic is based on. The history service matched each remote record by ID,
+   * then by URL, and already added the visits; what is left here is deciding
+   * what to upload.
    */
-  for (GList *l = remote_records; l && l->data; l = l->next) {
-    remote_id = ephy_history_record_get_id (l->data);
-    remote_url = ephy_history_record_get_uri (l->data);
-    remote_last_visit_time = ephy_history_record_get_last_visit_time (l->data);
-
-    /* Try find by ID. */
-    record = g_hash_table_lookup (records_ht_id, remote_id);
-    if (record) {
-      /* Same ID, same URL. Update last visit time for the local record and add
-       * the local last visit time to the remote one. */
-      local_last_visit_time = ephy_history_record_get_last_visit_time (record);
-      if (remote_last_visit_time > local_last_visit_time)
-        ephy_history_service_visit_url (self->service, remote_url,
-                                        remote_id, remote_last_visit_time,
-                                        EPHY_PAGE_VISIT_LINK, FALSE);
-
-      if (ephy_history_record_add_visit_time (l->data, local_last_visit_time))
-        g_ptr_array_add (to_upload, g_object_ref (l->data));
+  for (GList *l = remote_records; l && l->data; l = l->next, i++) {
+    local = g_ptr_array_index (result->matches, i);
 
-      g_hash_table_remove (records_ht_id, remote_id);
-    } else {
-    /* Try find by URL. */
-      record = g_hash_table_lookup (records_ht_url, remote_url);
-      if (record) {
-        /* Different ID, same URL. Keep local ID. */
-        g_signal_emit_by_name (self, "synchronizable-deleted", l->data);
-        ephy_history_manager_handle_different_id_same_url (self, record, l->data);
+    /* Different ID, different URL. This is a new record, or migrated history
+     * without an ID, which the merge took care of. */
+    if (!local || !local->sync_id)
+      continue;
+
+    if (g_strcmp0 (local->sync_id, ephy_history_record_get_id (l->data)) == 0) {
+      /* Same ID, same URL. Add the local last visit time to the remote one. */
+      if (ephy_history_record_add_visit_time (l->data, local->last_visit_time))
         g_ptr_array_add (to_upload, g_object_ref (l->data));
-        g_hash_table_remove (records_ht_id, ephy_history_record_get_id (record));
-      } else {
-        /* Different ID, different URL. This is a new record. */
-        if (remote_last_visit_time > 0)
-          ephy_history_service_visit_url (self->service, remote_url,
-                                          remote_id, remote_last_visit_time,
-                                          EPHY_PAGE_VISIT_LINK, FALSE);
-      }
+    } else {
+      /* Different ID, same URL. Keep local ID. */
+      ephy_history_manager_handle_different_id_same_url (self, local, l->data);
+      g_ptr_array_add (to_upload, g_object_ref (l->data));
     }
   }
 
-  /* Set the remaining local records to be uploaded to server. */
-  g_hash_table_iter_init (&iter, records_ht_id);
-  while (g_hash_table_iter_next (&iter, &key, &value))
-    g_ptr_array_add (to_upload, g_object_ref (value));
-
   return to_upload;
 }
 
 static GPtrArray *
-ephy_history_manager_handle_regular_merge (EphyHistoryManager  *self,
-                                           GHashTable          *records_ht_id,
-                                           GHashTable          *records_ht_url,
-                                           GList               *deleted_records,
-                                           GList               *updated_records)
+ephy_history_manager_handle_regular_merge (EphyHistoryManager     *self,
+                                           GList                  *deleted_records,
+                                           GList                  *updated_records,
+                                           EphyHistoryMergeResult *result)
 {
-  EphyHistoryRecord *record;
+  EphyHistoryURL *local;
   GPtrArray *to_upload;
-  const char *remote_id;
-  const char *remote_url;
-  gint64 remote_last_visit_time;
-  gint64 local_last_visit_time;
+  guint i = 0;
 
   g_assert (EPHY_IS_HISTORY_MANAGER (self));
 
   to_upload = g_ptr_array_new_with_free_func (g_object_unref);
 
-  for (GList *l = deleted_records; l && l->data; l = l->next) {
-    remote_id = ephy_history_record_get_id (l->data);
-    remote_url = ephy_history_record_get_uri (l->data);
+  for (GList *l = deleted_records; l && l->data; l = l->next, i++) {
+    local = g_ptr_array_index (result->matches, i);
 
-    record = g_hash_table_lookup (records_ht_id, remote_id);
-    if (record) {
-      ephy_synchronizable_manager_remove (EPHY_SYNCHRONIZABLE_MANAGER (self),
-                                          EPHY_SYNCHRONIZABLE (record));
-      g_hash_table_remove (records_ht_id, remote_id);
-      g_hash_table_remove (records_ht_url, remote_url);
-    }
+    if (local && g_strcmp0 (local->sync_id, ephy_history_record_get_id (l->data)) == 0)
+      ephy_history_manager_remove_url (self, local);
   }
 
   /* See comment in ephy_history_manager_handle_initial_merge. */
-  for (GList *l = updated_records; l && l->data; l = l->next) {
-    remote_id = ephy_history_record_get_id (l->data);
-    remote_url = ephy_history_record_get_uri (l->data);
-    remote_last_visit_time = ephy_history_record_get_last_visit_time (l->data);
+  for (GList *l = updated_records; l && l->data; l = l->next, i++) {
+    local = g_ptr_array_index (result->matches, i);
 
-    /* Try find by ID. */
-    record = g_hash_table_lookup (records_ht_id, remote_id);
-    if (record) {
-      /* Same ID, same URL. Update last visit time for the local record. */
-      local_last_visit_time = ephy_history_record_get_last_visit_time (record);
+    if (!local || !local->sync_id)
+      continue;
 
+    if (g_strcmp0 (local->sync_id, ephy_history_record_get_id (l->data)) == 0) {
       /* Firefox offers the option to "forget about this site" which means that
        * the record is not deleted from server but only has its visit times
        * deleted. Having no visit times translates to a negative last visit time
        * in Epiphany. Since Epiphany does not support having a history record
        * with no visit time, we delete it for good from the local database.
        */
-      if (remote_last_visit_time <= 0)
-        ephy_synchronizable_manager_remove (EPHY_SYNCHRONIZABLE_MANAGER (self),
-                                            EPHY_SYNCHRONIZABLE (record));
-      else if (remote_last_visit_time > local_last_visit_time)
-        ephy_history_service_visit_url (self->service, remote_url,
-                                        remote_id, remote_last_visit_time,
-                                        EPHY_PAGE_VISIT_LINK, FALSE);
+      if (ephy_history_record_get_last_visit_time (l->data) <= 0)
+        ephy_history_manager_remove_url (self, local);
     } else {
-      /* Try find by URL. */
-      record = g_hash_table_lookup (records_ht_url, remote_url);
-      if (record) {
-        /* Different ID, same URL. Keep local ID. */
-        g_signal_emit_by_name (self, "synchronizable-deleted", l->data);
-        ephy_history_manager_handle_different_id_same_url (self, record, l->data);
-        g_ptr_array_add (to_upload, g_object_ref (l->data));
-      } else {
-        /* Different ID, different URL. This is a new record. */
-        if (remote_last_visit_time > 0)
-          ephy_history_service_visit_url (self->service, remote_url,
-                                          remote_id, remote_last_visit_time,
-                                          EPHY_PAGE_VISIT_LINK, FALSE);
-      }
+      /* Different ID, same URL. Keep local ID. */
+      ephy_history_manager_handle_different_id_same_url (self, local, l->data);
+      g_ptr_array_add (to_upload, g_object_ref (l->data));
     }
   }
 
@@ -462,59 +405,51 @@ ephy_history_manager_handle_regular_merge (EphyHistoryManager  *self,
 }
 
 static void
-merge_history_cb (EphyHistoryService    *service,
-                  gboolean               success,
-                  GList                 *urls,
-                  MergeHistoryAsyncData *data)
+merge_history_cb (EphyHistoryService     *service,
+                  gboolean                success,
+                  EphyHistoryMergeResult *result,
+                  MergeHistoryAsyncData  *data)
 {
-  GHashTable *records_ht_id = NULL;
-  GHashTable *records_ht_url = NULL;
   GPtrArray *to_upload = NULL;
 
-  if (!success) {
-    g_warning ("Failed to retrieve URLs in history");
+  if (!result) {
+    g_warning ("Failed to merge URLs in history");
     goto out;
   }
 
-  records_ht_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
-  records_ht_url = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
-
-  for (GList *l = urls; l && l->data; l = l->next) {
-    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
-    EphyHistoryRecord *record;
-
-    /* Ignore migrated history, i.e. URLs with a NULL id. */
-    if (!url->sync_id)
-      continue;
-
-    record = ephy_history_record_new (url->sync_id, url->title, url->url, url->last_visit_time);
-    g_hash_table_insert (records_ht_id, g_strdup (url->sync_id), record);
-    g_hash_table_insert (records_ht_url, g_strdup (url->url), g_object_ref (record));
-  }
-
   if (data->is_initial)
     to_upload = ephy_history_manager_handle_initial_merge (data->manager,
-                                                           records_ht_id,
-                                                           records_ht_url,
-                                                           data->remotes_updated);
+                                                           data->remotes_updated,
+                                                           result);
   else
     to_upload = ephy_history_manager_handle_regular_merge (data->manager,
-                                                           records_ht_id,
-                                                           records_ht_url,
                                                            data->remotes_deleted,
-                                                           data->remotes_updated);
+                                                           data->remotes_updated,
+                                                           result);
 
 out:
   data->callback (to_upload, data->user_data);
 
-  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
-  if (records_ht_id)
-    g_hash_table_unref (records_ht_id);
-  if (records_ht_url)
-    g_hash_table_unref (records_ht_url);
+  ephy_history_merge_result_free (result);
   merge_history_async_data_free (data);
 }
 
+static void
+add_remote_records (GPtrArray *urls,
+                    GList     *records,
+                    gboolean   deleted)
+{
+  for (GList *l = records; l && l->data; l = l->next) {
+    EphyHistoryURL *url;
+
+    /* Deleted records are only looked up, never visited. */
+    url = ephy_history_url_new (ephy_history_record_get_uri (l->data), NULL, 0, 0,
+                                deleted ? 0 : ephy_history_record_get_last_visit_time (l->data));
+    url->sync_id = g_strdup (ephy_history_record_get_id (l->data));
+    g_ptr_array_add (urls, url);
+  }
+}
+
 static void
 synchronizable_manager_merge (EphySynchronizableManager              *manager,
                               gboolean                                is_initial,
@@ -524,16 +459,75 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
                               gpointer                                user_data)
 {
   EphyHistoryManager *self = EPHY_HISTORY_MANAGER (manager);
+  GPtrArray *urls;
+
+  /* The matches come back in this order: deleted records first, then
+   * updated ones. Deleted records are irrelevant to an initial merge. */
+  urls = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_url_free);
+  if (!is_initial)
+    add_remote_records (urls, remotes_deleted, TRUE);
+  add_remote_records (urls, remotes_updated, FALSE);
+
+  ephy_history_service_merge_urls (self->service, urls, NULL,
+                                   (EphyHistoryJobCallback)merge_history_cb,
+                                   merge_history_async_data_new (self,
+                                                                 is_initial,
+                                                                 remotes_deleted,
+                                                                 remotes_updated,
+                                                                 callback,
+                                                                 user_data));
+  g_ptr_array_unref (urls);
+}
+
+typedef struct {
+  EphySynchronizableManagerMergeCallback callback;
+  gpointer                               user_data;
+} CollectUnmergedAsyncData;
+
+static void
+collect_unmerged_cb (EphyHistoryService       *service,
+                     gboolean                  success,
+                     GList                    *urls,
+                     CollectUnmergedAsyncData *data)
+{
+  GPtrArray *to_upload = NULL;
+
+  if (!success) {
+    g_warning ("Failed to find unmerged URLs in history");
+    goto out;
+  }
+
+  to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+  for (GList *l = urls; l && l->data; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    g_ptr_array_add (to_upload, ephy_history_record_new (url->sync_id, url->title,
+                                                         url->url, url->last_visit_time));
+  }
+
+out:
+  data->callback (to_upload, data->user_data);
+
+  ephy_history_url_list_free (urls);
+  g_free (data);
+}
+
+static void
+synchronizable_manager_collect_unmerged (EphySynchronizableManager              *manager,
+                                         GHashTable                             *merged_ids,
+                                         EphySynchronizableManagerMergeCallback  callback,
+                                         gpointer                                user_data)
+{
+  EphyHistoryManager *self = EPHY_HISTORY_MANAGER (manager);
+  CollectUnmergedAsyncData *data;
+
+  data = g_new (CollectUnmergedAsyncData, 1);
+  data->callback = callback;
+  data->user_data = user_data;
 
-  ephy_history_service_find_urls (self->service, -1, -1, -1, 0, NULL,
-                                  EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED, NULL,
-                                  (EphyHistoryJobCallback)merge_history_cb,
-                                  merge_history_async_data_new (self,
-                                                                is_initial,
-                                                                remotes_deleted,
-                                                                remotes_updated,
-                                                                callback,
-                                                                user_data));
+  ephy_history_service_find_synced_urls (self->service, merged_ids, NULL,
+                                         (EphyHistoryJobCallback)collect_unmerged_cb,
+                                         data);
 }
 
 static void
@@ -549,4 +543,5 @@ ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *ifac
   iface->remove = synchronizable_manager_remove;
   iface->save = synchronizable_manager_save;
   iface->merge = synchronizable_manager_merge;
+  iface->collect_unmerged = synchronizable_manager_collect_unmerged;
 }
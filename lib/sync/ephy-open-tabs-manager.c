@@ -248,6 +248,20 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
    */
 }
 
+static GList *
+remove_remote_record (GList      *records,
+                      const char *id)
+{
+  for (GList *l = records; l && l->data; l = l->next) {
+    if (!g_strcmp0 (ephy_open_tabs_record_get_id (l->data), id)) {
+      g_object_unref (l->data);
+      return g_list_delete_link (records, l);
+    }
+  }
+
+  return records;
+}
+
 static void
 synchronizable_manager_merge (EphySynchronizableManager              *manager,
                               gboolean                                is_initial,
@@ -257,20 +271,46 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
                               gpointer                                user_data)
 {
   EphyOpenTabsManager *self = EPHY_OPEN_TABS_MANAGER (manager);
-  GPtrArray *to_upload;
   char *device_bso_id;
 
+  /* Remote records are collected page after page. The ones of clients that
+   * are gone are dropped once all pages are merged, see below. */
   device_bso_id = ephy_sync_utils_get_device_bso_id ();
-  g_list_free_full (self->remote_records, g_object_unref);
-  self->remote_records = NULL;
-
   for (GList *l = remotes_updated; l && l->data; l = l->next) {
+    const char *id = ephy_open_tabs_record_get_id (l->data);
+
     /* Exclude the record which describes the local open tabs. */
-    if (!g_strcmp0 (device_bso_id, ephy_open_tabs_record_get_id (l->data)))
+    if (!g_strcmp0 (device_bso_id, id))
       continue;
 
+    self->remote_records = remove_remote_record (self->remote_records, id);
     self->remote_records = g_list_prepend (self->remote_records, g_object_ref (l->data));
   }
+  g_free (device_bso_id);
+
+  callback (g_ptr_array_new_with_free_func (g_object_unref), user_data);
+}
+
+static void
+synchronizable_manager_collect_unmerged (EphySynchronizableManager              *manager,
+                                         GHashTable                             *merged_ids,
+                                         EphySynchronizableManagerMergeCallback  callback,
+                                         gpointer                                user_data)
+{
+  EphyOpenTabsManager *self = EPHY_OPEN_TABS_MANAGER (manager);
+  GPtrArray *to_upload;
+  GList *l = self->remote_records;
+
+  /* Forget the clients that the server no longer has. */
+  while (l) {
+    GList *next = l->next;
+
+    if (!g_hash_table_contains (merged_ids, ephy_open_tabs_record_get_id (l->data))) {
+      g_object_unref (l->data);
+      self->remote_records = g_list_delete_link (self->remote_records, l);
+    }
+    l = next;
+  }
 
   /* Only upload the local open tabs, we don't want to alter open tabs of
    * other clients. Also, overwrite any previous value by doing a force upload.
@@ -278,8 +318,6 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
   to_upload = g_ptr_array_new_with_free_func (g_object_unref);
   g_ptr_array_add (to_upload, ephy_open_tabs_manager_get_local_tabs (self));
 
-  g_free (device_bso_id);
-
   callback (to_upload, user_data);
 }
 
@@ -296,4 +334,5 @@ ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *ifac
   iface->remove = synchronizable_manager_remove;
   iface->save = synchronizable_manager_save;
   iface->merge = synchronizable_manager_merge;
+  iface->collect_unmerged = synchronizable_manager_collect_unmerged;
 }
@@ -28,6 +28,7 @@
 
 #include <glib/gi18n.h>
 #include <stdio.h>
+#include <string.h>
 
 const SecretSchema *
 ephy_password_manager_get_password_schema (void)
@@ -52,6 +53,12 @@ struct _EphyPasswordManager {
   GObject parent_instance;
 
   GHashTable *cache;
+  gboolean    load_cache;
+
+  /* IDs of local records replaced during the initial merge. Their removal
+   * from the keyring is asynchronous, so they must not be collected as
+   * unmerged in the meantime. */
+  GHashTable *merge_forgotten_ids;
 };
 
 static void ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *iface);
@@ -60,6 +67,21 @@ G_DEFINE_TYPE_WITH_CODE (EphyPasswordManager, ephy_password_manager, G_TYPE_OBJE
                          G_IMPLEMENT_INTERFACE (EPHY_TYPE_SYNCHRONIZABLE_MANAGER,
                                                 ephy_synchronizable_manager_iface_init))
 
+enum {
+  PROP_0,
+  PROP_LOAD_CACHE,
+  LAST_PROP
+};
+
+static GParamSpec *obj_properties[LAST_PROP];
+
+enum {
+  CACHED_USERS_CHANGED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 typedef struct {
   EphyPasswordManagerQueryCallback callback;
   gpointer user_data;
@@ -84,6 +106,11 @@ typedef struct {
   gpointer                                user_data;
 } MergePasswordsAsyncData;
 
+typedef struct {
+  GHashTable *by_id;
+  GHashTable *by_tuple;
+} LocalRecordsIndex;
+
 static QueryAsyncData *
 query_async_data_new (EphyPasswordManagerQueryCallback callback,
                       gpointer                         user_data)
@@ -261,10 +288,11 @@ ephy_password_manager_cache_remove (EphyPasswordManager *self,
     }
     g_hash_table_replace (self->cache, g_strdup (origin), new_usernames);
     g_list_free_full (usernames, g_free);
+    g_signal_emit (self, signals[CACHED_USERS_CHANGED], 0, origin);
   }
 }
 
-static void
+static gboolean
 ephy_password_manager_cache_add (EphyPasswordManager *self,
                                  const char          *origin,
                                  const char          *username)
@@ -275,32 +303,121 @@ ephy_password_manager_cache_add (EphyPasswordManager *self,
   g_assert (self->cache);
 
   if (!origin || !username)
-    return;
+    return FALSE;
 
   usernames = g_hash_table_lookup (self->cache, origin);
   for (GList *l = usernames; l && l->data; l = l->next) {
     if (!g_strcmp0 (username, l->data))
-      return;
+      return FALSE;
   }
   usernames = g_list_prepend (usernames, g_strdup (username));
   g_hash_table_replace (self->cache, g_strdup (origin), usernames);
+
+  return TRUE;
 }
 
 static void
-populate_cache_cb (GList    *records,
-                   gpointer  user_data)
+populate_cache_cb (SecretService       *service,
+                   GAsyncResult        *result,
+                   EphyPasswordManager *self)
 {
-  EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (user_data);
+  GList *matches;
+  GError *error = NULL;
 
-  for (GList *l = records; l && l->data; l = l->next) {
-    EphyPasswordRecord *record = EPHY_PASSWORD_RECORD (l->data);
-    const char *origin = ephy_password_record_get_origin (record);
-    const char *username = ephy_password_record_get_username (record);
+  matches = secret_service_search_finish (service, result, &error);
+  if (error) {
+    g_warning ("Failed to search secrets in password schema: %s", error->message);
+    g_error_free (error);
+    goto out;
+  }
+
+  /* The manager may have been disposed while the search was running. */
+  if (!self->cache)
+    goto out;
+
+  for (GList *l = matches; l && l->data; l = l->next) {
+    GHashTable *attributes = secret_item_get_attributes (l->data);
 
-    ephy_password_manager_cache_add (self, origin, username);
+    ephy_password_manager_cache_add (self,
+                                     g_hash_table_lookup (attributes, ORIGIN_KEY),
+                                     g_hash_table_lookup (attributes, USERNAME_KEY));
+    g_hash_table_unref (attributes);
   }
 
-  g_list_free_full (records, g_object_unref);
+  /* Views may have started loading before the cache was ready. */
+  g_signal_emit (self, signals[CACHED_USERS_CHANGED], 0, NULL);
+
+out:
+  g_list_free_full (matches, g_object_unref);
+  g_object_unref (self);
+}
+
+static void
+ephy_password_manager_populate_cache (EphyPasswordManager *self)
+{
+  GHashTable *attributes;
+
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+
+  LOG ("Loading usernames into internal cache...");
+
+  /* Usernames are stored as attributes, so there is no need to unlock the
+   * keyring nor to decrypt any secret to build the cache. */
+  attributes = secret_attributes_build (EPHY_FORM_PASSWORD_SCHEMA, NULL);
+  secret_service_search (NULL,
+                         EPHY_FORM_PASSWORD_SCHEMA,
+                         attributes,
+                         SECRET_SEARCH_ALL,
+                         NULL,
+                         (GAsyncReadyCallback)populate_cache_cb,
+                         g_object_ref (self));
+
+  g_hash_table_unref (attributes);
+}
+
+static void
+ephy_password_manager_set_property (GObject      *object,
+                                    guint         prop_id,
+                                    const GValue *value,
+                                    GParamSpec   *pspec)
+{
+  EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (object);
+
+  switch (prop_id) {
+    case PROP_LOAD_CACHE:
+      self->load_cache = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+ephy_password_manager_get_property (GObject    *object,
+                                    guint       prop_id,
+                                    GValue     *value,
+                                    GParamSpec *pspec)
+{
+  EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (object);
+
+  switch (prop_id) {
+    case PROP_LOAD_CACHE:
+      g_value_set_boolean (value, self->load_cache);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+ephy_password_manager_constructed (GObject *object)
+{
+  EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (object);
+
+  G_OBJECT_CLASS (ephy_password_manager_parent_class)->constructed (object);
+
+  if (self->load_cache)
+    ephy_password_manager_populate_cache (self);
 }
 
 static void
@@ -313,6 +430,8 @@ ephy_password_manager_dispose (GObject *object)
     g_clear_pointer (&self->cache, g_hash_table_unref);
   }
 
+  g_clear_pointer (&self->merge_forgotten_ids, g_hash_table_unref);
+
   G_OBJECT_CLASS (ephy_password_manager_parent_class)->dispose (object);
 }
 
@@ -321,22 +440,44 @@ ephy_password_manager_class_init (EphyPasswordManagerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->set_property = ephy_password_manager_set_property;
+  object_class->get_property = ephy_password_manager_get_property;
+  object_class->constructed = ephy_password_manager_constructed;
   object_class->dispose = ephy_password_manager_dispose;
+
+  obj_properties[PROP_LOAD_CACHE] =
+    g_param_spec_boolean ("load-cache",
+                          "Load cache",
+                          "Whether to fill the usernames cache from the keyring",
+                          TRUE,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
+
+  /* Emitted with the origin whose usernames changed, or NULL if any origin
+   * may have changed, whether from a form, the passwords dialog or sync. */
+  signals[CACHED_USERS_CHANGED] =
+    g_signal_new ("cached-users-changed",
+                  EPHY_TYPE_PASSWORD_MANAGER,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_STRING);
 }
 
 static void
 ephy_password_manager_init (EphyPasswordManager *self)
 {
-  LOG ("Loading usernames into internal cache...");
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL,
-                               populate_cache_cb, self);
+  self->merge_forgotten_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 EphyPasswordManager *
-ephy_password_manager_new (void)
+ephy_password_manager_new (gboolean load_cache)
 {
-  return EPHY_PASSWORD_MANAGER (g_object_new (EPHY_TYPE_PASSWORD_MANAGER, NULL));
+  return EPHY_PASSWORD_MANAGER (g_object_new (EPHY_TYPE_PASSWORD_MANAGER,
+                                              "load-cache", load_cache,
+                                              NULL));
 }
 
 GList *
@@ -349,6 +490,41 @@ ephy_password_manager_get_cached_users (EphyPasswordManager *self,
   return g_hash_table_lookup (self->cache, origin);
 }
 
+/* Used by web processes, which don't load the cache themselves but receive
+ * the usernames of the origins they load from the UI process. */
+void
+ephy_password_manager_set_cached_users (EphyPasswordManager *self,
+                                        const char          *origin,
+                                        const char * const  *usernames)
+{
+  GList *old_usernames;
+  GList *new_usernames = NULL;
+
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+  g_assert (origin);
+
+  for (guint i = 0; usernames && usernames[i]; i++)
+    new_usernames = g_list_prepend (new_usernames, g_strdup (usernames[i]));
+
+  old_usernames = g_hash_table_lookup (self->cache, origin);
+  if (new_usernames)
+    g_hash_table_replace (self->cache, g_strdup (origin), new_usernames);
+  else
+    g_hash_table_remove (self->cache, origin);
+  g_list_free_full (old_usernames, g_free);
+}
+
+void
+ephy_password_manager_add_cached_user (EphyPasswordManager *self,
+                                       const char          *origin,
+                                       const char          *username)
+{
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+
+  if (ephy_password_manager_cache_add (self, origin, username))
+    g_signal_emit (self, signals[CACHED_USERS_CHANGED], 0, origin);
+}
+
 static void
 secret_service_store_cb (SecretService         *service,
                          GAsyncResult          *result,
@@ -371,8 +547,8 @@ secret_service_store_cb (SecretService         *service,
                ephy_password_record_get_password_field (data->record),
                error->message);
     g_error_free (error);
-  } else {
-    ephy_password_manager_cache_add (data->manager, origin, username);
+  } else if (ephy_password_manager_cache_add (data->manager, origin, username)) {
+    g_signal_emit (data->manager, signals[CACHED_USERS_CHANGED], 0, origin);
   }
 
   manage_record_async_data_free (data);
@@ -699,6 +875,7 @@ forget_all_cb (GList    *records,
     g_signal_emit_by_name (self, "synchronizable-deleted", l->data);
 
   ephy_password_manager_cache_clear (self);
+  g_signal_emit (self, signals[CACHED_USERS_CHANGED], 0, NULL);
 
   g_hash_table_unref (attributes);
   g_list_free_full (records, g_object_unref);
@@ -812,53 +989,116 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
   ephy_password_manager_replace_existing (self, record);
 }
 
-static EphyPasswordRecord *
-get_record_by_id (GList      *records,
-                  const char *id)
+/* A saved password record is identified either by its ID or by its tuple of
+ * (origin, target origin, username, username field, password field). Each
+ * field is prefixed by its length, so that the key is unambiguous. */
+static char *
+get_tuple_key (const char *origin,
+               const char *target_origin,
+               const char *username,
+               const char *username_field,
+               const char *password_field)
 {
-  g_assert (id);
+  const char *fields[] = { origin, target_origin, username, username_field, password_field };
+  GString *key = g_string_new (NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (fields); i++) {
+    if (fields[i])
+      g_string_append_printf (key, "%" G_GSIZE_FORMAT ":%s", strlen (fields[i]), fields[i]);
+    else
+      g_string_append_c (key, '-');
+  }
+
+  return g_string_free (key, FALSE);
+}
+
+static char *
+get_record_tuple_key (EphyPasswordRecord *record)
+{
+  return get_tuple_key (ephy_password_record_get_origin (record),
+                        ephy_password_record_get_target_origin (record),
+                        ephy_password_record_get_username (record),
+                        ephy_password_record_get_username_field (record),
+                        ephy_password_record_get_password_field (record));
+}
+
+/* Indexes the local records by ID and by tuple, so that merging a large
+ * number of remote records against them does not scan the list each time.
+ * The records must outlive the index. When several records share a key, the
+ * first one wins, like a linear search would. */
+static LocalRecordsIndex *
+local_records_index_new (GList *records)
+{
+  LocalRecordsIndex *index;
+
+  index = g_slice_new (LocalRecordsIndex);
+  index->by_id = g_hash_table_new (g_str_hash, g_str_equal);
+  index->by_tuple = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_id (l->data), id))
-      return l->data;
+    const char *id = ephy_password_record_get_id (l->data);
+    char *key;
+
+    if (!g_hash_table_contains (index->by_id, id))
+      g_hash_table_insert (index->by_id, (char *)id, l->data);
+
+    key = get_record_tuple_key (l->data);
+    if (!g_hash_table_contains (index->by_tuple, key))
+      g_hash_table_insert (index->by_tuple, key, l->data);
+    else
+      g_free (key);
   }
 
-  return NULL;
+  return index;
+}
+
+static void
+local_records_index_free (LocalRecordsIndex *index)
+{
+  g_hash_table_unref (index->by_id);
+  g_hash_table_unref (index->by_tuple);
+  g_slice_free (LocalRecordsIndex, index);
 }
 
 static EphyPasswordRecord *
-get_record_by_parameters (GList      *records,
-                          const char *origin,
-                          const char *target_origin,
-                          const char *username,
-                          const char *username_field,
-                          const char *password_field)
+get_record_by_id (LocalRecordsIndex *index,
+                  const char        *id)
 {
-  for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_username (l->data), username) &&
-        !g_strcmp0 (ephy_password_record_get_origin (l->data), origin) &&
-        !g_strcmp0 (ephy_password_record_get_target_origin (l->data), target_origin) &&
-        !g_strcmp0 (ephy_password_record_get_username_field (l->data), username_field) &&
-        !g_strcmp0 (ephy_password_record_get_password_field (l->data), password_field))
-      return l->data;
-  }
+  g_assert (id);
 
-  return NULL;
+  return g_hash_table_lookup (index->by_id, id);
 }
 
+static EphyPasswordRecord *
+get_record_by_parameters (LocalRecordsIndex *index,
+                          const char        *origin,
+                          const char        *target_origin,
+                          const char        *username,
+                          const char        *username_field,
+                          const char        *password_field)
+{
+  EphyPasswordRecord *record;
+  char *key;
+
+  key = get_tuple_key (origin, target_origin, username, username_field, password_field);
+  record = g_hash_table_lookup (index->by_tuple, key);
+  g_free (key);
+
+  return record;
+}
 
-static GList *
-delete_record_by_id (GList      *records,
-                     const char *id)
+static void
+remove_record_from_index (LocalRecordsIndex  *index,
+                          EphyPasswordRecord *record)
 {
-  for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_id (l->data), id)) {
-      g_object_unref (l->data);
-      return g_list_delete_link (records, l);
-    }
-  }
+  char *key;
+
+  g_hash_table_remove (index->by_id, ephy_password_record_get_id (record));
 
-  return records;
+  key = get_record_tuple_key (record);
+  if (g_hash_table_lookup (index->by_tuple, key) == record)
+    g_hash_table_remove (index->by_tuple, key);
+  g_free (key);
 }
 
 static GPtrArray *
@@ -867,7 +1107,7 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
                                             GList               *remote_records)
 {
   EphyPasswordRecord *record;
-  GHashTable *dont_upload;
+  LocalRecordsIndex *index;
   GPtrArray *to_upload;
   const char *remote_id;
   const char *remote_origin;
@@ -888,10 +1128,11 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
    * password records from server, we may encounter duplicates either by ID
    * or by mentioned tuple. We start from the assumption that same ID means
    * same tuple but same tuple does not necessarily mean same ID. This is what
-   * our merge logic is based on.
+   * our merge logic is based on. Local records left unmatched are collected
+   * separately, once all remote records are merged.
    */
   to_upload = g_ptr_array_new_with_free_func (g_object_unref);
-  dont_upload = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  index = local_records_index_new (local_records);
 
   for (GList *l = remote_records; l && l->data; l = l->next) {
     remote_id = ephy_password_record_get_id (l->data);
@@ -904,11 +1145,10 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
     remote_timestamp = ephy_password_record_get_time_password_changed (l->data);
     remote_server_time_modified = ephy_synchronizable_get_server_time_modified (l->data);
 
-    record = get_record_by_id (local_records, remote_id);
+    record = get_record_by_id (index, remote_id);
     if (record) {
       if (!g_strcmp0 (ephy_password_record_get_password (record), remote_password)) {
         /* Same id, same password. Nothing to do. */
-        g_hash_table_add (dont_upload, g_strdup (remote_id));
       } else {
         /* Same id, different password. Keep the most recent modified. */
         local_timestamp = ephy_password_record_get_time_password_changed (record);
@@ -921,14 +1161,14 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
                                                           remote_server_time_modified);
             ephy_password_manager_replace_existing (self, record);
           }
+          g_ptr_array_add (to_upload, g_object_ref (record));
         } else {
           /* Remote record is newer. Forget local record and store remote record. */
           ephy_password_manager_forget_record (self, record, l->data);
-          g_hash_table_add (dont_upload, g_strdup (remote_id));
         }
       }
     } else {
-      record = get_record_by_parameters (local_records,
+      record = get_record_by_parameters (index,
                                          remote_origin,
                                          remote_target_origin,
                                          remote_username,
@@ -939,14 +1179,16 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
         local_timestamp = ephy_password_record_get_time_password_changed (record);
         if (local_timestamp > remote_timestamp) {
           /* Local record is newer. Keep it, upload it and delete remote record from server. */
+          g_ptr_array_add (to_upload, g_object_ref (record));
           g_signal_emit_by_name (self, "synchronizable-deleted", l->data);
         } else {
           /* Remote record is newer. Forget local record and store remote record. */
           ephy_password_manager_forget_record (self, record, l->data);
-          g_hash_table_add (dont_upload, g_strdup (remote_id));
+          g_hash_table_add (self->merge_forgotten_ids,
+                            g_strdup (ephy_password_record_get_id (record)));
         }
       } else {
-        record = get_record_by_parameters (local_records,
+        record = get_record_by_parameters (index,
                                            remote_origin,
                                            remote_origin,
                                            remote_username,
@@ -956,35 +1198,29 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
           /* A leftover from migration: the local record has incorrect target_origin
            * Replace it with remote record */
           ephy_password_manager_forget_record (self, record, l->data);
-          g_hash_table_add (dont_upload, g_strdup (ephy_password_record_get_id (record)));
+          g_hash_table_add (self->merge_forgotten_ids,
+                            g_strdup (ephy_password_record_get_id (record)));
         } else {
           /* Different id, different tuple. This is a new record. */
           ephy_password_manager_store_record (self, l->data);
-          g_hash_table_add (dont_upload, g_strdup (remote_id));
         }
       }
     }
   }
 
-  /* Set the remaining local records to be uploaded to server. */
-  for (GList *l = local_records; l && l->data; l = l->next) {
-    record = EPHY_PASSWORD_RECORD (l->data);
-    if (!g_hash_table_contains (dont_upload, ephy_password_record_get_id (record)))
-      g_ptr_array_add (to_upload, g_object_ref (record));
-  }
-
-  g_hash_table_unref (dont_upload);
+  local_records_index_free (index);
 
   return to_upload;
 }
 
 static GPtrArray *
-ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
-                                            GList               **local_records,
-                                            GList                *deleted_records,
-                                            GList                *updated_records)
+ephy_password_manager_handle_regular_merge (EphyPasswordManager *self,
+                                            GList               *local_records,
+                                            GList               *deleted_records,
+                                            GList               *updated_records)
 {
   EphyPasswordRecord *record;
+  LocalRecordsIndex *index;
   GPtrArray *to_upload;
   const char *remote_id;
   const char *remote_origin;
@@ -998,13 +1234,14 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
   g_assert (EPHY_IS_PASSWORD_MANAGER (self));
 
   to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+  index = local_records_index_new (local_records);
 
   for (GList *l = deleted_records; l && l->data; l = l->next) {
     remote_id = ephy_password_record_get_id (l->data);
-    record = get_record_by_id (*local_records, remote_id);
+    record = get_record_by_id (index, remote_id);
     if (record) {
       ephy_password_manager_forget_record (self, record, NULL);
-      *local_records = delete_record_by_id (*local_records, remote_id);
+      remove_record_from_index (index, record);
     }
   }
 
@@ -1018,12 +1255,12 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
     remote_password_field = ephy_password_record_get_password_field (l->data);
     remote_timestamp = ephy_password_record_get_time_password_changed (l->data);
 
-    record = get_record_by_id (*local_records, remote_id);
+    record = get_record_by_id (index, remote_id);
     if (record) {
       /* Same id. Overwrite local record. */
       ephy_password_manager_forget_record (self, record, l->data);
     } else {
-      record = get_record_by_parameters (*local_records,
+      record = get_record_by_parameters (index,
                                          remote_origin,
                                          remote_target_origin,
                                          remote_username,
@@ -1047,6 +1284,8 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
     }
   }
 
+  local_records_index_free (index);
+
   return to_upload;
 }
 
@@ -1061,7 +1300,7 @@ merge_cb (GList    *records,
     to_upload = ephy_password_manager_handle_initial_merge (data->manager, records,
                                                             data->remotes_updated);
   else
-    to_upload = ephy_password_manager_handle_regular_merge (data->manager, &records,
+    to_upload = ephy_password_manager_handle_regular_merge (data->manager, records,
                                                             data->remotes_deleted,
                                                             data->remotes_updated);
 
@@ -1080,15 +1319,71 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
                               gpointer                                user_data)
 {
   EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (manager);
+  MergePasswordsAsyncData *data;
 
-  ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL,
-                               merge_cb,
-                               merge_passwords_async_data_new (self,
-                                                               is_initial,
-                                                               remotes_deleted,
-                                                               remotes_updated,
-                                                               callback,
-                                                               user_data));
+  /* Nothing changed remotely, so there is no need to search the keyring. */
+  if (!is_initial && !remotes_deleted && !remotes_updated) {
+    callback (g_ptr_array_new_with_free_func (g_object_unref), user_data);
+    return;
+  }
+
+  data = merge_passwords_async_data_new (self, is_initial,
+                                         remotes_deleted, remotes_updated,
+                                         callback, user_data);
+
+  /* A single query for the whole collection, indexed locally, is much cheaper
+   * than one keyring search per remote record. */
+  ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL, merge_cb, data);
+}
+
+typedef struct {
+  EphyPasswordManager                    *manager;
+  GHashTable                             *merged_ids;
+  EphySynchronizableManagerMergeCallback  callback;
+  gpointer                                user_data;
+} CollectUnmergedAsyncData;
+
+static void
+collect_unmerged_cb (GList    *records,
+                     gpointer  user_data)
+{
+  CollectUnmergedAsyncData *data = (CollectUnmergedAsyncData *)user_data;
+  GPtrArray *to_upload;
+  const char *id;
+
+  to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+  for (GList *l = records; l && l->data; l = l->next) {
+    id = ephy_password_record_get_id (l->data);
+    if (!g_hash_table_contains (data->merged_ids, id) &&
+        !g_hash_table_contains (data->manager->merge_forgotten_ids, id))
+      g_ptr_array_add (to_upload, g_object_ref (l->data));
+  }
+
+  g_hash_table_remove_all (data->manager->merge_forgotten_ids);
+  data->callback (to_upload, data->user_data);
+
+  g_list_free_full (records, g_object_unref);
+  g_object_unref (data->manager);
+  g_hash_table_unref (data->merged_ids);
+  g_free (data);
+}
+
+static void
+synchronizable_manager_collect_unmerged (EphySynchronizableManager              *manager,
+                                         GHashTable                             *merged_ids,
+                                         EphySynchronizableManagerMergeCallback  callback,
+                                         gpointer                                user_data)
+{
+  CollectUnmergedAsyncData *data;
+
+  data = g_new (CollectUnmergedAsyncData, 1);
+  data->manager = g_object_ref (EPHY_PASSWORD_MANAGER (manager));
+  data->merged_ids = g_hash_table_ref (merged_ids);
+  data->callback = callback;
+  data->user_data = user_data;
+
+  ephy_password_manager_query (data->manager, NULL, NULL, NULL, NULL, NULL, NULL,
+                               collect_unmerged_cb, data);
 }
 
 static void
@@ -1104,4 +1399,5 @@ ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *ifac
   iface->remove = synchronizable_manager_remove;
   iface->save = synchronizable_manager_save;
   iface->merge = synchronizable_manager_merge;
+  iface->collect_unmerged = synchronizable_manager_collect_unmerged;
 }
@@ -45,9 +45,15 @@ G_DECLARE_FINAL_TYPE (EphyPasswordManager, ephy_password_manager, EPHY, PASSWORD
 
 typedef void (*EphyPasswordManagerQueryCallback) (GList *records, gpointer user_data);
 
-EphyPasswordManager *ephy_password_manager_new                      (void);
+EphyPasswordManager *ephy_password_manager_new                      (gboolean load_cache);
 GList               *ephy_password_manager_get_cached_users         (EphyPasswordManager *self,
                                                                      const char          *origin);
+void                 ephy_password_manager_set_cached_users         (EphyPasswordManager *self,
+                                                                     const char          *origin,
+                                                                     const char * const  *usernames);
+void                 ephy_password_manager_add_cached_user          (EphyPasswordManager *self,
+                                                                     const char          *origin,
+                                                                     const char          *username);
 void                 ephy_password_manager_save                     (EphyPasswordManager *self,
                                                                      const char          *origin,
                                                                      const char          *target_origin,
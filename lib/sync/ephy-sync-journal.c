@@ -0,0 +1,453 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-journal.h"
+
+#include "ephy-debug.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/* The journal is an append-only log of GVariants of type (bsssx), one
+ * (forgotten, collection, id, bso, time) tuple per local change that has to
+ * reach the server, or per change that the server acknowledged, each preceded
+ * by its size as a little endian 32 bits integer. The BSO is stored already
+ * encrypted, exactly as it is to be uploaded, so the journal never holds
+ * cleartext records, which matters for passwords. */
+#define SYNC_JOURNAL_ENTRY_TYPE G_VARIANT_TYPE ("(bsssx)")
+
+/* Changes tend to come in bursts, e.g. while browsing, so they are appended
+ * to the file in batches. */
+#define SYNC_JOURNAL_SAVE_DELAY 2
+
+/* Once the log holds this many more entries than there are pending changes,
+ * it is rewritten with just the pending ones. */
+#define SYNC_JOURNAL_COMPACT_SLACK 256
+
+typedef struct {
+  char   *bso;
+  gint64  time;
+} JournalEntry;
+
+struct _EphySyncJournal {
+  GObject parent_instance;
+
+  char       *filename;
+  GHashTable *collections;
+  guint       n_pending;
+  guint       n_logged;
+  GByteArray *unsaved;
+  guint       save_source_id;
+};
+
+G_DEFINE_TYPE (EphySyncJournal, ephy_sync_journal, G_TYPE_OBJECT)
+
+static void
+journal_entry_free (JournalEntry *entry)
+{
+  g_free (entry->bso);
+  g_slice_free (JournalEntry, entry);
+}
+
+static GHashTable *
+ephy_sync_journal_get_collection (EphySyncJournal *journal,
+                                  const char      *collection,
+                                  gboolean         create)
+{
+  GHashTable *entries;
+
+  entries = g_hash_table_lookup (journal->collections, collection);
+  if (!entries && create) {
+    entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                     (GDestroyNotify)journal_entry_free);
+    g_hash_table_insert (journal->collections, g_strdup (collection), entries);
+  }
+
+  return entries;
+}
+
+static void
+ephy_sync_journal_set (EphySyncJournal *journal,
+                       const char      *collection,
+                       const char      *id,
+                       const char      *bso,
+                       gint64           time)
+{
+  JournalEntry *entry;
+
+  GHashTable *entries;
+
+  entry = g_slice_new (JournalEntry);
+  entry->bso = g_strdup (bso);
+  entry->time = time;
+
+  entries = ephy_sync_journal_get_collection (journal, collection, TRUE);
+  if (!g_hash_table_contains (entries, id))
+    journal->n_pending++;
+  g_hash_table_replace (entries, g_strdup (id), entry);
+}
+
+static void
+ephy_sync_journal_unset (EphySyncJournal *journal,
+                         const char      *collection,
+                         const char      *id)
+{
+  GHashTable *entries;
+
+  entries = ephy_sync_journal_get_collection (journal, collection, FALSE);
+  if (entries && g_hash_table_remove (entries, id))
+    journal->n_pending--;
+}
+
+static void
+append_entry (GByteArray *buffer,
+              gboolean    forgotten,
+              const char *collection,
+              const char *id,
+              const char *bso,
+              gint64      time)
+{
+  GVariant *variant;
+  guint32 size;
+
+  variant = g_variant_ref_sink (g_variant_new ("(bsssx)", forgotten, collection, id, bso, time));
+  size = GUINT32_TO_LE (g_variant_get_size (variant));
+  g_byte_array_append (buffer, (const guint8 *)&size, sizeof (size));
+  g_byte_array_append (buffer, g_variant_get_data (variant), g_variant_get_size (variant));
+  g_variant_unref (variant);
+}
+
+static void
+ephy_sync_journal_load (EphySyncJournal *journal)
+{
+  GError *error = NULL;
+  const char *collection;
+  const char *id;
+  const char *bso;
+  gboolean forgotten;
+  gint64 time;
+  char *contents;
+  gsize length;
+  gsize offset = 0;
+
+  if (!g_file_get_contents (journal->filename, &contents, &length, &error)) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to load sync journal %s: %s", journal->filename, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  while (offset < length) {
+    GVariant *variant;
+    GBytes *bytes;
+    guint32 size;
+
+    /* The file is written by the browser, but don't trust it blindly. An
+     * entry cut short by a crash while appending ends the log. */
+    if (length - offset < sizeof (size)) {
+      g_warning ("Sync journal %s is corrupted, ignoring its end", journal->filename);
+      break;
+    }
+    memcpy (&size, contents + offset, sizeof (size));
+    size = GUINT32_FROM_LE (size);
+    offset += sizeof (size);
+
+    if (size > length - offset) {
+      g_warning ("Sync journal %s is corrupted, ignoring its end", journal->filename);
+      break;
+    }
+
+    /* Copied, since the entry is not suitably aligned within the file. */
+    bytes = g_bytes_new (contents + offset, size);
+    variant = g_variant_ref_sink (g_variant_new_from_bytes (SYNC_JOURNAL_ENTRY_TYPE, bytes, FALSE));
+    g_bytes_unref (bytes);
+    offset += size;
+
+    if (!g_variant_is_normal_form (variant)) {
+      g_warning ("Sync journal %s is corrupted, ignoring its end", journal->filename);
+      g_variant_unref (variant);
+      break;
+    }
+
+    g_variant_get (variant, "(b&s&s&sx)", &forgotten, &collection, &id, &bso, &time);
+    if (forgotten)
+      ephy_sync_journal_unset (journal, collection, id);
+    else
+      ephy_sync_journal_set (journal, collection, id, bso, time);
+    journal->n_logged++;
+
+    g_variant_unref (variant);
+  }
+
+  g_free (contents);
+
+  LOG ("Loaded %u pending changes from sync journal", journal->n_pending);
+}
+
+/* Rewrites the log with only the pending changes. */
+static void
+ephy_sync_journal_compact (EphySyncJournal *journal)
+{
+  GByteArray *buffer;
+  GHashTableIter iter;
+  GHashTableIter entries_iter;
+  GError *error = NULL;
+  const char *collection;
+  const char *id;
+  GHashTable *entries;
+  JournalEntry *entry;
+
+  buffer = g_byte_array_new ();
+
+  g_hash_table_iter_init (&iter, journal->collections);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&collection, (gpointer *)&entries)) {
+    g_hash_table_iter_init (&entries_iter, entries);
+    while (g_hash_table_iter_next (&entries_iter, (gpointer *)&id, (gpointer *)&entry))
+      append_entry (buffer, FALSE, collection, id, entry->bso, entry->time);
+  }
+
+  if (!g_file_set_contents (journal->filename, (const char *)buffer->data, buffer->len, &error)) {
+    g_warning ("Failed to save sync journal %s: %s", journal->filename, error->message);
+    g_error_free (error);
+  }
+
+  journal->n_logged = journal->n_pending;
+  g_byte_array_set_size (journal->unsaved, 0);
+  g_byte_array_unref (buffer);
+}
+
+static void
+ephy_sync_journal_save (EphySyncJournal *journal)
+{
+  FILE *file;
+
+  if (journal->n_logged > journal->n_pending + SYNC_JOURNAL_COMPACT_SLACK) {
+    LOG ("Compacting sync journal from %u to %u entries", journal->n_logged, journal->n_pending);
+    ephy_sync_journal_compact (journal);
+    return;
+  }
+
+  if (journal->unsaved->len == 0)
+    return;
+
+  file = g_fopen (journal->filename, "ab");
+  if (!file || fwrite (journal->unsaved->data, 1, journal->unsaved->len, file) != journal->unsaved->len) {
+    g_warning ("Failed to save sync journal %s: %s", journal->filename, g_strerror (errno));
+    if (file)
+      fclose (file);
+    /* The file might now end with a partial entry, which would hide
+     * everything appended after it, so write it from scratch. */
+    ephy_sync_journal_compact (journal);
+    return;
+  }
+  fclose (file);
+
+  g_byte_array_set_size (journal->unsaved, 0);
+}
+
+static gboolean
+save_timeout_cb (EphySyncJournal *journal)
+{
+  journal->save_source_id = 0;
+  ephy_sync_journal_save (journal);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_sync_journal_schedule_save (EphySyncJournal *journal)
+{
+  if (journal->save_source_id)
+    return;
+
+  journal->save_source_id = g_timeout_add_seconds (SYNC_JOURNAL_SAVE_DELAY,
+                                                   (GSourceFunc)save_timeout_cb,
+                                                   journal);
+  g_source_set_name_by_id (journal->save_source_id, "[epiphany] sync_journal_save");
+}
+
+static void
+ephy_sync_journal_finalize (GObject *object)
+{
+  EphySyncJournal *journal = EPHY_SYNC_JOURNAL (object);
+
+  if (journal->save_source_id) {
+    g_source_remove (journal->save_source_id);
+    ephy_sync_journal_save (journal);
+  }
+
+  g_hash_table_unref (journal->collections);
+  g_byte_array_unref (journal->unsaved);
+  g_free (journal->filename);
+
+  G_OBJECT_CLASS (ephy_sync_journal_parent_class)->finalize (object);
+}
+
+static void
+ephy_sync_journal_class_init (EphySyncJournalClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = ephy_sync_journal_finalize;
+}
+
+static void
+ephy_sync_journal_init (EphySyncJournal *journal)
+{
+  journal->collections = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                (GDestroyNotify)g_hash_table_unref);
+  journal->unsaved = g_byte_array_new ();
+}
+
+EphySyncJournal *
+ephy_sync_journal_new (const char *filename)
+{
+  EphySyncJournal *journal;
+
+  g_assert (filename);
+
+  journal = g_object_new (EPHY_TYPE_SYNC_JOURNAL, NULL);
+  journal->filename = g_strdup (filename);
+  ephy_sync_journal_load (journal);
+
+  return journal;
+}
+
+/**
+ * ephy_sync_journal_add:
+ * @journal: an #EphySyncJournal
+ * @collection: the collection the record belongs to
+ * @id: the id of the record
+ * @bso: the encrypted BSO to upload, as a JSON string
+ *
+ * Records a local change that has to reach the server. A later change to
+ * the same record replaces the earlier one.
+ **/
+void
+ephy_sync_journal_add (EphySyncJournal *journal,
+                       const char      *collection,
+                       const char      *id,
+                       const char      *bso)
+{
+  gint64 time = g_get_real_time ();
+
+  g_assert (EPHY_IS_SYNC_JOURNAL (journal));
+  g_assert (collection);
+  g_assert (id);
+  g_assert (bso);
+
+  ephy_sync_journal_set (journal, collection, id, bso, time);
+  append_entry (journal->unsaved, FALSE, collection, id, bso, time);
+  journal->n_logged++;
+  ephy_sync_journal_schedule_save (journal);
+}
+
+/**
+ * ephy_sync_journal_forget:
+ * @journal: an #EphySyncJournal
+ * @collection: the collection the record belongs to
+ * @id: the id of the record
+ * @before: the time the upload of the record started at
+ *
+ * Drops the change to @id once the server has it, unless the record was
+ * changed again after @before, in which case the newer change still has to
+ * be uploaded.
+ **/
+void
+ephy_sync_journal_forget (EphySyncJournal *journal,
+                          const char      *collection,
+                          const char      *id,
+                          gint64           before)
+{
+  GHashTable *entries;
+  JournalEntry *entry;
+
+  g_assert (EPHY_IS_SYNC_JOURNAL (journal));
+  g_assert (collection);
+  g_assert (id);
+
+  entries = ephy_sync_journal_get_collection (journal, collection, FALSE);
+  if (!entries)
+    return;
+
+  entry = g_hash_table_lookup (entries, id);
+  if (!entry || entry->time > before)
+    return;
+
+  ephy_sync_journal_unset (journal, collection, id);
+  append_entry (journal->unsaved, TRUE, collection, id, "", before);
+  journal->n_logged++;
+  ephy_sync_journal_schedule_save (journal);
+}
+
+/**
+ * ephy_sync_journal_get_pending:
+ * @journal: an #EphySyncJournal
+ * @collection: a collection name
+ *
+ * Return value: (transfer full): the encrypted BSOs of the changes to
+ * @collection that the server has not acknowledged yet, or %NULL if there
+ * are none
+ **/
+char **
+ephy_sync_journal_get_pending (EphySyncJournal *journal,
+                               const char      *collection)
+{
+  GHashTableIter iter;
+  GHashTable *entries;
+  JournalEntry *entry;
+  GPtrArray *pending;
+
+  g_assert (EPHY_IS_SYNC_JOURNAL (journal));
+  g_assert (collection);
+
+  entries = ephy_sync_journal_get_collection (journal, collection, FALSE);
+  if (!entries || g_hash_table_size (entries) == 0)
+    return NULL;
+
+  pending = g_ptr_array_sized_new (g_hash_table_size (entries) + 1);
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    g_ptr_array_add (pending, g_strdup (entry->bso));
+  g_ptr_array_add (pending, NULL);
+
+  return (char **)g_ptr_array_free (pending, FALSE);
+}
+
+void
+ephy_sync_journal_clear (EphySyncJournal *journal)
+{
+  g_assert (EPHY_IS_SYNC_JOURNAL (journal));
+
+  g_hash_table_remove_all (journal->collections);
+  g_byte_array_set_size (journal->unsaved, 0);
+  journal->n_pending = 0;
+  journal->n_logged = 0;
+
+  if (journal->save_source_id) {
+    g_source_remove (journal->save_source_id);
+    journal->save_source_id = 0;
+  }
+
+  if (g_unlink (journal->filename) == -1 && errno != ENOENT)
+    g_warning ("Failed to remove sync journal %s: %s", journal->filename, g_strerror (errno));
+}
@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_SYNC_JOURNAL_FILE "sync-journal.gvariant"
+
+#define EPHY_TYPE_SYNC_JOURNAL (ephy_sync_journal_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphySyncJournal, ephy_sync_journal, EPHY, SYNC_JOURNAL, GObject)
+
+EphySyncJournal  *ephy_sync_journal_new         (const char      *filename);
+void              ephy_sync_journal_add         (EphySyncJournal *journal,
+                                                 const char      *collection,
+                                                 const char      *id,
+                                                 const char      *bso);
+void              ephy_sync_journal_forget      (EphySyncJournal *journal,
+                                                 const char      *collection,
+                                                 const char      *id,
+                                                 gint64           before);
+char            **ephy_sync_journal_get_pending (EphySyncJournal *journal,
+                                                 const char      *collection);
+void              ephy_sync_journal_clear       (EphySyncJournal *journal);
+
+G_END_DECLS
@@ -22,9 +22,11 @@
 #include "ephy-sync-service.h"
 
 #include "ephy-debug.h"
+#include "ephy-file-helpers.h"
 #include "ephy-notification.h"
 #include "ephy-settings.h"
 #include "ephy-sync-crypto.h"
+#include "ephy-sync-journal.h"
 #include "ephy-sync-utils.h"
 #include "ephy-user-agent.h"
 
@@ -33,6 +35,15 @@
 #include <libsoup/soup.h>
 #include <string.h>
 
+/* Below this many records per thread, decrypting in parallel isn't worth it. */
+#define EPHY_SYNC_MIN_RECORDS_PER_THREAD 64
+
+/* At most this many upload batches are being encrypted or sent at once. */
+#define EPHY_SYNC_MAX_BATCHES_IN_FLIGHT 4
+
+/* Collections are downloaded in pages of this many records. */
+#define EPHY_SYNC_DOWNLOAD_PAGE_SIZE 1000
+
 struct _EphySyncService {
   GObject      parent_instance;
 
@@ -50,6 +61,9 @@ struct _EphySyncService {
   char        *storage_credentials_key;
   gint64       storage_credentials_expiry_time;
   GQueue      *storage_queue;
+  GThreadPool *encrypt_pool;
+
+  EphySyncJournal *journal;
 
   char                 *certificate;
   SyncCryptoRSAKeyPair *key_pair;
@@ -122,14 +136,36 @@ typedef struct {
   gboolean                   is_last;
   GList                     *remotes_deleted;
   GList                     *remotes_updated;
+  SoupBuffer                *response;
+  SyncCryptoKeyBundle       *bundle;
+  GType                      type;
+  char                      *offset;
+  double                     newer;
+  double                     last_modified;
+  GPtrArray                 *to_upload;
+  GHashTable                *merged_ids;
+  gint64                     start_time;
 } SyncCollectionAsyncData;
 
+typedef struct {
+  JsonNode           *bso;
+  EphySynchronizable *remote;
+  gboolean            is_deleted;
+} SyncRecordData;
+
 typedef struct {
   EphySyncService           *service;
   EphySynchronizableManager *manager;
   EphySynchronizable        *synchronizable;
+  gint64                     start_time;
 } SyncAsyncData;
 
+typedef struct {
+  EphySyncService *service;
+  char            *collection;
+  gint64           start_time;
+} FlushJournalAsyncData;
+
 typedef struct {
   EphySyncService           *service;
   EphySynchronizableManager *manager;
@@ -137,10 +173,35 @@ typedef struct {
   guint                      start;
   guint                      end;
   char                      *batch_id;
-  gboolean                   batch_is_last;
   gboolean                   sync_done;
 } BatchUploadAsyncData;
 
+typedef struct {
+  BatchUploadAsyncData *data;
+  SyncCryptoKeyBundle  *bundle;
+  char                 *endpoint;
+  guint                 next;
+  guint                 n_batches;
+  guint                 n_uploaded;
+  guint                 n_failed;
+  guint                 in_flight;
+  gsize                 n_bytes;
+  gint64                start_time;
+} BatchUploadPipeline;
+
+typedef struct {
+  char     *id;
+  char     *cleartext;
+  JsonNode *bso;
+} BatchRecord;
+
+typedef struct {
+  BatchUploadPipeline *pipeline;
+  BatchRecord         *records;
+  guint                n_records;
+  char                *body;
+} BatchEncryptJob;
+
 static StorageRequestAsyncData *
 storage_request_async_data_new (const char          *endpoint,
                                 const char          *method,
@@ -237,6 +298,15 @@ sync_collection_async_data_new (EphySyncService           *service,
   data->is_last = is_last;
   data->remotes_deleted = NULL;
   data->remotes_updated = NULL;
+  data->response = NULL;
+  data->bundle = NULL;
+  data->type = G_TYPE_INVALID;
+  data->offset = NULL;
+  data->newer = 0;
+  data->last_modified = -1;
+  data->to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+  data->merged_ids = NULL;
+  data->start_time = g_get_real_time ();
 
   return data;
 }
@@ -250,6 +320,15 @@ sync_collection_async_data_free (SyncCollectionAsyncData *data)
   g_object_unref (data->manager);
   g_list_free_full (data->remotes_deleted, g_object_unref);
   g_list_free_full (data->remotes_updated, g_object_unref);
+  if (data->response)
+    soup_buffer_free (data->response);
+  if (data->bundle)
+    ephy_sync_crypto_key_bundle_free (data->bundle);
+  if (data->to_upload)
+    g_ptr_array_unref (data->to_upload);
+  if (data->merged_ids)
+    g_hash_table_unref (data->merged_ids);
+  g_free (data->offset);
   g_slice_free (SyncCollectionAsyncData, data);
 }
 
@@ -264,6 +343,7 @@ sync_async_data_new (EphySyncService           *service,
   data->service = g_object_ref (service);
   data->manager = g_object_ref (manager);
   data->synchronizable = g_object_ref (synchronizable);
+  data->start_time = g_get_real_time ();
 
   return data;
 }
@@ -279,6 +359,30 @@ sync_async_data_free (SyncAsyncData *data)
   g_slice_free (SyncAsyncData, data);
 }
 
+static FlushJournalAsyncData *
+flush_journal_async_data_new (EphySyncService *service,
+                              const char      *collection)
+{
+  FlushJournalAsyncData *data;
+
+  data = g_slice_new (FlushJournalAsyncData);
+  data->service = g_object_ref (service);
+  data->collection = g_strdup (collection);
+  data->start_time = g_get_real_time ();
+
+  return data;
+}
+
+static void
+flush_journal_async_data_free (FlushJournalAsyncData *data)
+{
+  g_assert (data);
+
+  g_object_unref (data->service);
+  g_free (data->collection);
+  g_slice_free (FlushJournalAsyncData, data);
+}
+
 static inline BatchUploadAsyncData *
 batch_upload_async_data_new (EphySyncService           *service,
                              EphySynchronizableManager *manager,
@@ -286,7 +390,6 @@ batch_upload_async_data_new (EphySyncService           *service,
                              guint                      start,
                              guint                      end,
                              const char                *batch_id,
-                             gboolean                   batch_is_last,
                              gboolean                   sync_done)
 {
   BatchUploadAsyncData *data;
@@ -298,7 +401,6 @@ batch_upload_async_data_new (EphySyncService           *service,
   data->start = start;
   data->end = end;
   data->batch_id = g_strdup (batch_id);
-  data->batch_is_last = batch_is_last;
   data->sync_done = sync_done;
 
   return data;
@@ -312,7 +414,7 @@ batch_upload_async_data_dup (BatchUploadAsyncData *data)
   return batch_upload_async_data_new (data->service, data->manager,
                                       data->synchronizables, data->start,
                                       data->end, data->batch_id,
-                                      data->batch_is_last, data->sync_done);
+                                      data->sync_done);
 }
 
 static inline void
@@ -1079,12 +1181,30 @@ delete_synchronizable_cb (SoupSession *session,
                           SoupMessage *msg,
                           gpointer     user_data)
 {
+  SyncAsyncData *data = (SyncAsyncData *)user_data;
+  const char *collection;
+
   if (msg->status_code == 200) {
     LOG ("Successfully deleted from server");
+    collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+    ephy_sync_journal_forget (data->service->journal, collection,
+                              ephy_synchronizable_get_id (data->synchronizable),
+                              data->start_time);
   } else {
     g_warning ("Failed to delete object. Status code: %u, response: %s",
                msg->status_code, msg->response_body->data);
   }
+
+  sync_async_data_free (data);
+}
+
+static gboolean
+ephy_sync_service_is_online (void)
+{
+  GNetworkMonitor *monitor;
+
+  monitor = g_network_monitor_get_default ();
+  return g_network_monitor_get_connectivity (monitor) == G_NETWORK_CONNECTIVITY_FULL;
 }
 
 static void
@@ -1128,11 +1248,18 @@ ephy_sync_service_delete_synchronizable (EphySyncService           *self,
   json_object_set_string_member (object, "payload", payload);
   body = json_to_string (node, FALSE);
 
+  /* Keep the deletion around until the server has it. */
+  ephy_sync_journal_add (self->journal, collection, id, body);
+  if (!ephy_sync_service_is_online ())
+    goto out;
+
   LOG ("Deleting object with id %s from collection %s...", id, collection);
   ephy_sync_service_queue_storage_request (self, endpoint,
                                            SOUP_METHOD_PUT, body, -1, -1,
-                                           delete_synchronizable_cb, NULL);
+                                           delete_synchronizable_cb,
+                                           sync_async_data_new (self, manager, synchronizable));
 
+out:
   g_free (id_safe);
   g_free (endpoint);
   g_free (record);
@@ -1236,8 +1363,17 @@ upload_synchronizable_cb (SoupSession *session,
                           gpointer     user_data)
 {
   SyncAsyncData *data = (SyncAsyncData *)user_data;
+  const char *collection;
   double time_modified;
 
+  /* Either way the server has dealt with the local change. */
+  if (msg->status_code == 412 || msg->status_code == 200) {
+    collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+    ephy_sync_journal_forget (data->service->journal, collection,
+                              ephy_synchronizable_get_id (data->synchronizable),
+                              data->start_time);
+  }
+
   /* Code 412 means that there is a more recent version on the server.
    * Download it.
    */
@@ -1287,15 +1423,22 @@ ephy_sync_service_upload_synchronizable (EphySyncService           *self,
    */
   id_safe = soup_uri_encode (id, NULL);
   endpoint = g_strdup_printf ("storage/%s/%s", collection, id_safe);
-  data = sync_async_data_new (self, manager, synchronizable);
   body = json_to_string (bso, FALSE);
 
+  /* Keep the change around until the server has it, so that changes made
+   * while offline or while a request fails are not lost. */
+  ephy_sync_journal_add (self->journal, collection, id, body);
+  if (!ephy_sync_service_is_online ())
+    goto out;
+
   LOG ("Uploading object with id %s...", id);
+  data = sync_async_data_new (self, manager, synchronizable);
   time_modified = ephy_synchronizable_get_server_time_modified (synchronizable);
   ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_PUT, body,
                                            -1, should_force ? -1 : time_modified,
                                            upload_synchronizable_cb, data);
 
+out:
   g_free (id_safe);
   g_free (body);
   g_free (endpoint);
@@ -1303,48 +1446,6 @@ ephy_sync_service_upload_synchronizable (EphySyncService           *self,
   ephy_sync_crypto_key_bundle_free (bundle);
 }
 
-static GPtrArray *
-ephy_sync_service_split_into_batches (EphySyncService           *self,
-                                      EphySynchronizableManager *manager,
-                                      GPtrArray                 *synchronizables,
-                                      guint                      start,
-                                      guint                      end)
-{
-  SyncCryptoKeyBundle *bundle;
-  GPtrArray *batches;
-  const char *collection;
-
-  g_assert (EPHY_IS_SYNC_SERVICE (self));
-  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
-  g_assert (synchronizables);
-
-  batches = g_ptr_array_new_with_free_func (g_free);
-  collection = ephy_synchronizable_manager_get_collection_name (manager);
-  bundle = ephy_sync_service_get_key_bundle (self, collection);
-
-  for (guint i = start; i < end; i += EPHY_SYNC_BATCH_SIZE) {
-    JsonNode *node = json_node_new (JSON_NODE_ARRAY);
-    JsonArray *array = json_array_new ();
-
-    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, end); k++) {
-      EphySynchronizable *synchronizable = g_ptr_array_index (synchronizables, k);
-      JsonNode *bso = ephy_synchronizable_to_bso (synchronizable, bundle);
-      JsonObject *object = json_object_ref (json_node_get_object (bso));
-
-      json_array_add_object_element (array, object);
-      json_node_unref (bso);
-    }
-
-    json_node_take_array (node, array);
-    g_ptr_array_add (batches, json_to_string (node, FALSE));
-    json_node_unref (node);
-  }
-
-  ephy_sync_crypto_key_bundle_free (bundle);
-
-  return batches;
-}
-
 static void
 commit_batch_cb (SoupSession *session,
                  SoupMessage *msg,
@@ -1368,25 +1469,81 @@ commit_batch_cb (SoupSession *session,
   batch_upload_async_data_free (data);
 }
 
+static void
+batch_upload_pipeline_free (BatchUploadPipeline *pipeline)
+{
+  g_assert (pipeline);
+
+  batch_upload_async_data_free (pipeline->data);
+  ephy_sync_crypto_key_bundle_free (pipeline->bundle);
+  g_free (pipeline->endpoint);
+  g_slice_free (BatchUploadPipeline, pipeline);
+}
+
+static void
+batch_encrypt_job_free (BatchEncryptJob *job)
+{
+  g_assert (job);
+
+  for (guint i = 0; i < job->n_records; i++) {
+    g_free (job->records[i].id);
+    g_free (job->records[i].cleartext);
+    if (job->records[i].bso)
+      json_node_unref (job->records[i].bso);
+  }
+  g_free (job->records);
+  g_free (job->body);
+  g_slice_free (BatchEncryptJob, job);
+}
+
+static void ephy_sync_service_pump_batch_upload (BatchUploadPipeline *pipeline);
+
 static void
 upload_batch_cb (SoupSession *session,
                  SoupMessage *msg,
                  gpointer     user_data)
 {
-  BatchUploadAsyncData *data = user_data;
+  BatchUploadPipeline *pipeline = user_data;
+  BatchUploadAsyncData *data = pipeline->data;
   const char *collection;
-  char *endpoint = NULL;
+  char *endpoint;
+  double elapsed;
 
   /* Note: "202 Accepted" status code. */
   if (msg->status_code != 202) {
     g_warning ("Failed to upload batch. Status code: %u, response: %s",
                msg->status_code, msg->response_body->data);
+    pipeline->n_failed++;
   } else {
     LOG ("Successfully uploaded batch");
   }
 
-  if (!data->batch_is_last)
-    goto out;
+  pipeline->in_flight--;
+  pipeline->n_uploaded++;
+
+  if (pipeline->n_uploaded < pipeline->n_batches) {
+    ephy_sync_service_pump_batch_upload (pipeline);
+    return;
+  }
+
+  /* Only commit once every batch has reached the server. Otherwise the
+   * server discards the uncommitted batch, and since the records of the
+   * failed batches would not be uploaded again until they change, merge the
+   * whole collection on the next sync instead. */
+  if (pipeline->n_failed > 0) {
+    g_warning ("Not committing batch, %u of %u uploads failed",
+               pipeline->n_failed, pipeline->n_batches);
+    ephy_synchronizable_manager_set_is_initial_sync (data->manager, TRUE);
+    if (data->sync_done)
+      g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    batch_upload_pipeline_free (pipeline);
+    return;
+  }
+
+  elapsed = (g_get_monotonic_time () - pipeline->start_time) / (double)G_USEC_PER_SEC;
+  LOG ("Uploaded %u records in %u batches (%" G_GSIZE_FORMAT " bytes) in %.2fs, %.0f records/s",
+       data->end - data->start, pipeline->n_batches, pipeline->n_bytes, elapsed,
+       elapsed > 0 ? (data->end - data->start) / elapsed : 0);
 
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
   endpoint = g_strdup_printf ("storage/%s?commit=true&batch=%s", collection, data->batch_id);
@@ -1395,12 +1552,87 @@ upload_batch_cb (SoupSession *session,
                                            commit_batch_cb,
                                            batch_upload_async_data_dup (data));
 
-out:
   g_free (endpoint);
-  /* Remove last reference to the array with the items to upload. */
-  if (data->batch_is_last)
-    g_ptr_array_unref (data->synchronizables);
-  batch_upload_async_data_free (data);
+  batch_upload_pipeline_free (pipeline);
+}
+
+static gboolean
+batch_encrypted_cb (BatchEncryptJob *job)
+{
+  BatchUploadPipeline *pipeline = job->pipeline;
+
+  pipeline->n_bytes += strlen (job->body);
+  ephy_sync_service_queue_storage_request (pipeline->data->service, pipeline->endpoint,
+                                           SOUP_METHOD_POST, job->body, -1, -1,
+                                           upload_batch_cb, pipeline);
+  batch_encrypt_job_free (job);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+encrypt_batch_func (BatchEncryptJob *job,
+                    gpointer         user_data)
+{
+  JsonNode *node = json_node_new (JSON_NODE_ARRAY);
+  JsonArray *array = json_array_new ();
+
+  /* The records were serialized on the main thread, so only the encryption
+   * happens here and the synchronizable objects are never touched. */
+  for (guint i = 0; i < job->n_records; i++) {
+    BatchRecord *record = &job->records[i];
+
+    if (!record->bso)
+      record->bso = ephy_synchronizable_cleartext_to_bso (record->id, record->cleartext,
+                                                          job->pipeline->bundle);
+    json_array_add_object_element (array, json_object_ref (json_node_get_object (record->bso)));
+  }
+
+  json_node_take_array (node, array);
+  job->body = json_to_string (node, FALSE);
+  json_node_unref (node);
+
+  g_idle_add ((GSourceFunc)batch_encrypted_cb, job);
+}
+
+static void
+ephy_sync_service_pump_batch_upload (BatchUploadPipeline *pipeline)
+{
+  BatchUploadAsyncData *data = pipeline->data;
+  EphySyncService *self = data->service;
+
+  /* Keep a bounded number of batches between encryption and the server, so
+   * a large first sync neither holds every encrypted batch in memory nor
+   * floods the storage queue. Serializing a single batch is cheap enough to
+   * do on the main thread, which is where the synchronizables live. */
+  while (pipeline->in_flight < EPHY_SYNC_MAX_BATCHES_IN_FLIGHT && pipeline->next < data->end) {
+    BatchEncryptJob *job;
+    guint end = MIN (pipeline->next + EPHY_SYNC_BATCH_SIZE, data->end);
+
+    job = g_slice_new0 (BatchEncryptJob);
+    job->pipeline = pipeline;
+    job->n_records = end - pipeline->next;
+    job->records = g_new0 (BatchRecord, job->n_records);
+
+    for (guint i = 0; i < job->n_records; i++) {
+      EphySynchronizable *synchronizable = g_ptr_array_index (data->synchronizables, pipeline->next + i);
+
+      if (ephy_synchronizable_uses_default_to_bso (synchronizable)) {
+        job->records[i].id = g_strdup (ephy_synchronizable_get_id (synchronizable));
+        job->records[i].cleartext = json_gobject_to_data (G_OBJECT (synchronizable), NULL);
+      } else {
+        job->records[i].bso = ephy_synchronizable_to_bso (synchronizable, pipeline->bundle);
+      }
+    }
+
+    pipeline->next = end;
+    pipeline->in_flight++;
+
+    if (!self->encrypt_pool)
+      self->encrypt_pool = g_thread_pool_new ((GFunc)encrypt_batch_func, NULL,
+                                              g_get_num_processors (), FALSE, NULL);
+    g_thread_pool_push (self->encrypt_pool, job, NULL);
+  }
 }
 
 static void
@@ -1409,12 +1641,11 @@ start_batch_upload_cb (SoupSession *session,
                        gpointer     user_data)
 {
   BatchUploadAsyncData *data = user_data;
-  GPtrArray *batches = NULL;
+  BatchUploadPipeline *pipeline;
   JsonNode *node = NULL;
   JsonObject *object;
   GError *error = NULL;
   const char *collection;
-  char *endpoint = NULL;
 
   /* Note: "202 Accepted" status code. */
   if (msg->status_code != 202) {
@@ -1433,31 +1664,25 @@ start_batch_upload_cb (SoupSession *session,
   object = json_node_get_object (node);
   data->batch_id = soup_uri_encode (json_object_get_string_member (object, "batch"), NULL);
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
-  endpoint = g_strdup_printf ("storage/%s?batch=%s", collection, data->batch_id);
-
-  batches = ephy_sync_service_split_into_batches (data->service, data->manager,
-                                                  data->synchronizables,
-                                                  data->start, data->end);
-  for (guint i = 0; i < batches->len; i++) {
-    BatchUploadAsyncData *data_dup = batch_upload_async_data_dup (data);
 
-    if (i == batches->len - 1)
-      data_dup->batch_is_last = TRUE;
+  pipeline = g_slice_new0 (BatchUploadPipeline);
+  pipeline->data = data;
+  pipeline->bundle = ephy_sync_service_get_key_bundle (data->service, collection);
+  pipeline->endpoint = g_strdup_printf ("storage/%s?batch=%s", collection, data->batch_id);
+  pipeline->next = data->start;
+  pipeline->n_batches = (data->end - data->start + EPHY_SYNC_BATCH_SIZE - 1) / EPHY_SYNC_BATCH_SIZE;
+  pipeline->start_time = g_get_monotonic_time ();
 
-    ephy_sync_service_queue_storage_request (data->service, endpoint, SOUP_METHOD_POST,
-                                             g_ptr_array_index (batches, i), -1, -1,
-                                             upload_batch_cb, data_dup);
-  }
+  /* The pipeline owns @data from now on. */
+  data = NULL;
+  ephy_sync_service_pump_batch_upload (pipeline);
 
 out:
-  g_free (endpoint);
   if (node)
     json_node_unref (node);
-  if (batches)
-    g_ptr_array_unref (batches);
-  batch_upload_async_data_free (data);
+  if (data)
+    batch_upload_async_data_free (data);
 }
-
 static void
 merge_collection_finished_cb (GPtrArray *to_upload,
                               gpointer   user_data)
@@ -1471,6 +1696,8 @@ merge_collection_finished_cb (GPtrArray *to_upload,
   if (!to_upload || to_upload->len == 0) {
     if (data->is_last)
       g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    if (to_upload)
+      g_ptr_array_unref (to_upload);
     goto out;
   }
 
@@ -1481,12 +1708,13 @@ merge_collection_finished_cb (GPtrArray *to_upload,
     bdata = batch_upload_async_data_new (data->service, data->manager,
                                          to_upload, i,
                                          MIN (i + step, to_upload->len),
-                                         NULL, FALSE,
+                                         NULL,
                                          data->is_last && i + step >= to_upload->len);
     ephy_sync_service_queue_storage_request (data->service, endpoint,
                                              SOUP_METHOD_POST, "[]", -1, -1,
                                              start_batch_upload_cb, bdata);
   }
+  g_ptr_array_unref (to_upload);
 
 out:
   g_free (endpoint);
@@ -1494,73 +1722,439 @@ out:
 }
 
 static void
-sync_collection_cb (SoupSession *session,
-                    SoupMessage *msg,
-                    gpointer     user_data)
+decrypt_record_func (SyncRecordData          *record,
+                     SyncCollectionAsyncData *data)
 {
-  SyncCollectionAsyncData *data = (SyncCollectionAsyncData *)user_data;
-  EphySynchronizable *remote;
-  SyncCryptoKeyBundle *bundle;
-  JsonNode *node = NULL;
-  JsonArray *array = NULL;
-  GError *error = NULL;
-  GType type;
-  const char *collection;
-  gboolean is_deleted;
+  record->remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (record->bso, data->type,
+                                                                      data->bundle, &record->is_deleted));
+}
 
-  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+static void
+parse_collection_thread (GTask                   *task,
+                         EphySyncService         *self,
+                         SyncCollectionAsyncData *data,
+                         GCancellable            *cancellable)
+{
+  JsonParser *parser;
+  JsonNode *node;
+  JsonArray *array;
+  SyncRecordData *records;
+  GError *error = NULL;
+  guint length;
+  guint num_threads;
 
-  if (msg->status_code != 200) {
-    g_warning ("Failed to get records in collection %s. Status code: %u, response: %s",
-               collection, msg->status_code, msg->response_body->data);
-    goto out_error;
-  }
-  node = json_from_string (msg->response_body->data, &error);
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, data->response->data, data->response->length, &error);
   if (error) {
     g_warning ("Response is not a valid JSON: %s", error->message);
-    goto out_error;
+    g_task_return_error (task, error);
+    goto out;
   }
-  array = json_node_get_array (node);
+  node = json_parser_get_root (parser);
+  array = node ? json_node_get_array (node) : NULL;
   if (!array) {
     g_warning ("JSON node does not hold an array");
-    goto out_error;
+    g_task_return_new_error (task, JSON_PARSER_ERROR, JSON_PARSER_ERROR_INVALID_DATA,
+                             "JSON node does not hold an array");
+    goto out;
   }
 
-  type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
-  bundle = ephy_sync_service_get_key_bundle (data->service, collection);
-  for (guint i = 0; i < json_array_get_length (array); i++) {
-    remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (json_array_get_element (array, i),
-                                                                type, bundle, &is_deleted));
-    if (!remote) {
+  /* Decrypting and deserializing a record is independent of the others, so
+   * spread the records over as many threads as it is worth it. */
+  length = json_array_get_length (array);
+  records = g_new0 (SyncRecordData, length);
+  num_threads = CLAMP (length / EPHY_SYNC_MIN_RECORDS_PER_THREAD, 1, g_get_num_processors ());
+
+  if (num_threads > 1) {
+    GThreadPool *pool;
+
+    pool = g_thread_pool_new ((GFunc)decrypt_record_func, data, num_threads, FALSE, NULL);
+    for (guint i = 0; i < length; i++) {
+      records[i].bso = json_array_get_element (array, i);
+      g_thread_pool_push (pool, &records[i], NULL);
+    }
+    /* Wait for all the records to be processed. */
+    g_thread_pool_free (pool, FALSE, TRUE);
+  } else {
+    for (guint i = 0; i < length; i++) {
+      records[i].bso = json_array_get_element (array, i);
+      decrypt_record_func (&records[i], data);
+    }
+  }
+
+  for (guint i = 0; i < length; i++) {
+    if (!records[i].remote) {
       g_warning ("Failed to create synchronizable object from BSO, skipping...");
       continue;
     }
-    if (is_deleted)
-      data->remotes_deleted = g_list_prepend (data->remotes_deleted, remote);
+    if (records[i].is_deleted)
+      data->remotes_deleted = g_list_prepend (data->remotes_deleted, records[i].remote);
     else
-      data->remotes_updated = g_list_prepend (data->remotes_updated, remote);
+      data->remotes_updated = g_list_prepend (data->remotes_updated, records[i].remote);
   }
 
+  g_free (records);
+  g_task_return_boolean (task, TRUE);
+
+out:
+  g_object_unref (parser);
+}
+
+static void ephy_sync_service_download_collection_page (SyncCollectionAsyncData *data);
+static void ephy_sync_service_flush_journal (EphySyncService *self, const char *collection, double unmodified_since);
+
+/* The merge has settled every record that the server sent, whichever of the
+ * local and the remote version won. A local change to one of them that is
+ * still pending is either part of what the merge uploads, or lost to a newer
+ * remote change, and must not be posted as it is. */
+static void
+forget_merged_changes (SyncCollectionAsyncData *data)
+{
+  const char *collection;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  for (GList *l = data->remotes_deleted; l; l = l->next)
+    ephy_sync_journal_forget (data->service->journal, collection,
+                              ephy_synchronizable_get_id (l->data), data->start_time);
+  for (GList *l = data->remotes_updated; l; l = l->next)
+    ephy_sync_journal_forget (data->service->journal, collection,
+                              ephy_synchronizable_get_id (l->data), data->start_time);
+}
+
+static void
+finish_collection_merge (SyncCollectionAsyncData *data)
+{
+  const char *collection;
+  GPtrArray *to_upload;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  ephy_sync_utils_set_download_cursor (collection, NULL, 0, 0);
+  ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
+
+  ephy_sync_service_flush_journal (data->service, collection, data->last_modified);
+
+  to_upload = g_steal_pointer (&data->to_upload);
+  merge_collection_finished_cb (to_upload, data);
+}
+
+static void
+collect_unmerged_cb (GPtrArray *collected,
+                     gpointer   user_data)
+{
+  SyncCollectionAsyncData *data = user_data;
+  GHashTable *to_upload_ids;
+
+  /* Without the local records, the initial sync is not complete. It starts
+   * over on the next sync. */
+  if (!collected) {
+    if (data->is_last)
+      g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    sync_collection_async_data_free (data);
+    return;
+  }
+
+  /* Skip the records that the merge of a page already returned. */
+  to_upload_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  for (guint i = 0; i < data->to_upload->len; i++)
+    g_hash_table_add (to_upload_ids,
+                      (gpointer)ephy_synchronizable_get_id (g_ptr_array_index (data->to_upload, i)));
+
+  for (guint i = 0; i < collected->len; i++) {
+    EphySynchronizable *synchronizable = g_ptr_array_index (collected, i);
+
+    if (!g_hash_table_contains (to_upload_ids, ephy_synchronizable_get_id (synchronizable)))
+      g_ptr_array_add (data->to_upload, g_object_ref (synchronizable));
+  }
+
+  g_hash_table_unref (to_upload_ids);
+  g_ptr_array_unref (collected);
+
+  finish_collection_merge (data);
+}
+
+/* Returns the IDs of the records that the merge of a page settled against
+ * the server, i.e. the remote ones that the merge did not return for upload. */
+static GPtrArray *
+get_merged_page_ids (SyncCollectionAsyncData *data,
+                     GPtrArray               *to_upload)
+{
+  GHashTable *to_upload_ids;
+  GPtrArray *ids;
+
+  to_upload_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  for (guint i = 0; to_upload && i < to_upload->len; i++)
+    g_hash_table_add (to_upload_ids,
+                      (gpointer)ephy_synchronizable_get_id (g_ptr_array_index (to_upload, i)));
+
+  ids = g_ptr_array_new ();
+  for (GList *l = data->remotes_updated; l; l = l->next) {
+    const char *id = ephy_synchronizable_get_id (l->data);
+
+    if (!g_hash_table_contains (to_upload_ids, id))
+      g_ptr_array_add (ids, (gpointer)id);
+  }
+
+  g_hash_table_unref (to_upload_ids);
+
+  return ids;
+}
+
+static void
+merge_collection_page_cb (GPtrArray *to_upload,
+                          gpointer   user_data)
+{
+  SyncCollectionAsyncData *data = user_data;
+  const char *collection;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  /* An initial merge only settles the local records matching the remote ones
+   * of the page. The local records that the server does not have are
+   * collected once, after the last page, so remember which ones are merged.
+   * When more pages follow, they are saved along with the download cursor,
+   * for a resumed sync not to upload them again. */
+  if (data->is_initial) {
+    GPtrArray *ids = get_merged_page_ids (data, to_upload);
+
+    for (guint i = 0; i < ids->len; i++)
+      g_hash_table_add (data->merged_ids, g_strdup (g_ptr_array_index (ids, i)));
+    if (data->offset)
+      ephy_sync_utils_add_merged_ids (collection, ids);
+
+    g_ptr_array_unref (ids);
+  }
+
+  /* Uploading now would modify the collection and invalidate the offset of
+   * the next page, so hold the records back until the last page is merged. */
+  if (to_upload) {
+    for (guint i = 0; i < to_upload->len; i++)
+      g_ptr_array_add (data->to_upload, g_object_ref (g_ptr_array_index (to_upload, i)));
+    g_ptr_array_unref (to_upload);
+  }
+
+  forget_merged_changes (data);
+  g_list_free_full (data->remotes_deleted, g_object_unref);
+  g_list_free_full (data->remotes_updated, g_object_unref);
+  data->remotes_deleted = NULL;
+  data->remotes_updated = NULL;
+
+  if (data->offset) {
+    /* This page is merged, so a later sync can pick up from the next one. */
+    ephy_sync_utils_set_download_cursor (collection, data->offset,
+                                         data->newer, data->last_modified);
+    ephy_sync_service_download_collection_page (data);
+    return;
+  }
+
+  if (data->is_initial) {
+    ephy_synchronizable_manager_collect_unmerged (data->manager, data->merged_ids,
+                                                  collect_unmerged_cb, data);
+    return;
+  }
+
+  finish_collection_merge (data);
+}
+
+static void
+parse_collection_cb (EphySyncService *self,
+                     GAsyncResult    *result,
+                     gpointer         user_data)
+{
+  SyncCollectionAsyncData *data = (SyncCollectionAsyncData *)user_data;
+  const char *collection;
+
+  if (!g_task_propagate_boolean (G_TASK (result), NULL)) {
+    if (data->is_last)
+      g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    sync_collection_async_data_free (data);
+    return;
+  }
+
+  g_clear_pointer (&data->response, soup_buffer_free);
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
   LOG ("Found %u deleted objects and %u new/updated objects in %s collection",
        g_list_length (data->remotes_deleted),
        g_list_length (data->remotes_updated),
        collection);
 
-  ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
   ephy_synchronizable_manager_merge (data->manager, data->is_initial,
                                      data->remotes_deleted, data->remotes_updated,
-                                     merge_collection_finished_cb, data);
-  goto out_no_error;
+                                     merge_collection_page_cb, data);
+}
 
-out_error:
-  if (data->is_last)
-    g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
-  sync_collection_async_data_free (data);
-out_no_error:
+static void
+sync_collection_cb (SoupSession *session,
+                    SoupMessage *msg,
+                    gpointer     user_data)
+{
+  SyncCollectionAsyncData *data = (SyncCollectionAsyncData *)user_data;
+  const char *collection;
+  const char *last_modified;
+  GTask *task;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  if (msg->status_code != 200) {
+    g_warning ("Failed to get records in collection %s. Status code: %u, response: %s",
+               collection, msg->status_code, msg->response_body->data);
+    /* "412 Precondition Failed" means the collection changed since the first
+     * page and the offset is no longer valid. Start over on the next sync. */
+    if (msg->status_code == 412)
+      ephy_sync_utils_set_download_cursor (collection, NULL, 0, 0);
+    if (data->is_last)
+      g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    sync_collection_async_data_free (data);
+    return;
+  }
+
+  g_free (data->offset);
+  data->offset = g_strdup (soup_message_headers_get_one (msg->response_headers, "X-Weave-Next-Offset"));
+  if (data->last_modified < 0) {
+    last_modified = soup_message_headers_get_one (msg->response_headers, "X-Last-Modified");
+    if (last_modified)
+      data->last_modified = g_ascii_strtod (last_modified, NULL);
+  }
+
+  /* Parsing the response and decrypting the records is expensive for large
+   * collections, so it is done in a thread to keep the UI responsive. */
+  data->response = soup_message_body_flatten (msg->response_body);
+  data->type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
+  if (!data->bundle)
+    data->bundle = ephy_sync_service_get_key_bundle (data->service, collection);
+
+  task = g_task_new (data->service, NULL, (GAsyncReadyCallback)parse_collection_cb, data);
+  g_task_set_task_data (task, data, NULL);
+  g_task_run_in_thread (task, (GTaskThreadFunc)parse_collection_thread);
+  g_object_unref (task);
+}
+
+static void
+ephy_sync_service_download_collection_page (SyncCollectionAsyncData *data)
+{
+  GString *endpoint;
+  const char *collection;
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+
+  /* Every page must be requested with the same query for the offset to be
+   * meaningful, hence the fixed sort order. */
+  endpoint = g_string_new (NULL);
+  g_string_printf (endpoint, "storage/%s?full=true&sort=oldest&limit=%u",
+                   collection, EPHY_SYNC_DOWNLOAD_PAGE_SIZE);
+  if (!data->is_initial)
+    g_string_append_printf (endpoint, "&newer=%.2lf", data->newer);
+  if (data->offset) {
+    char *offset = soup_uri_encode (data->offset, NULL);
+    g_string_append_printf (endpoint, "&offset=%s", offset);
+    g_free (offset);
+  }
+
+  /* Make the server reject the following pages if the collection is modified
+   * in the meantime, since the offset would then skip or repeat records. */
+  ephy_sync_service_queue_storage_request (data->service, endpoint->str, SOUP_METHOD_GET,
+                                           NULL, -1, data->last_modified,
+                                           sync_collection_cb, data);
+
+  g_string_free (endpoint, TRUE);
+}
+
+static void
+flush_journal_cb (SoupSession *session,
+                  SoupMessage *msg,
+                  gpointer     user_data)
+{
+  FlushJournalAsyncData *data = user_data;
+  JsonNode *node = NULL;
+  JsonObject *object;
+  JsonArray *success;
+  GError *error = NULL;
+
+  /* "412 Precondition Failed" means that another device changed the
+   * collection since it was downloaded. The changes stay in the journal, and
+   * the next sync merges them against the newer records before trying again. */
+  if (msg->status_code == 412) {
+    LOG ("%s collection changed on the server, keeping pending changes for the next sync",
+         data->collection);
+    goto out;
+  }
+
+  if (msg->status_code != 200) {
+    g_warning ("Failed to upload pending changes. Status code: %u, response: %s",
+               msg->status_code, msg->response_body->data);
+    goto out;
+  }
+
+  node = json_from_string (msg->response_body->data, &error);
+  if (error) {
+    g_warning ("Response is not a valid JSON: %s", error->message);
+    g_error_free (error);
+    goto out;
+  }
+
+  /* Records that the server rejected stay in the journal for the next sync. */
+  object = json_node_get_object (node);
+  success = object ? json_object_get_array_member (object, "success") : NULL;
+  for (guint i = 0; success && i < json_array_get_length (success); i++)
+    ephy_sync_journal_forget (data->service->journal, data->collection,
+                              json_array_get_string_element (success, i),
+                              data->start_time);
+
+  LOG ("Uploaded %u pending changes to %s collection",
+       success ? json_array_get_length (success) : 0, data->collection);
+
+out:
   if (node)
     json_node_unref (node);
-  if (error)
-    g_error_free (error);
+  flush_journal_async_data_free (data);
+}
+
+/* Uploads the changes that could not be uploaded when they were made, e.g.
+ * because the browser was offline. This happens once the collection has been
+ * downloaded and merged, which already took care of the records changed on
+ * other devices in the meantime, see forget_merged_changes(). The upload is
+ * conditional on the collection being unmodified since @unmodified_since, so
+ * that a change made elsewhere after that is never overwritten. */
+static void
+ephy_sync_service_flush_journal (EphySyncService *self,
+                                 const char      *collection,
+                                 double           unmodified_since)
+{
+  char **pending;
+  char *endpoint;
+  guint length;
+
+  g_assert (EPHY_IS_SYNC_SERVICE (self));
+  g_assert (collection);
+
+  pending = ephy_sync_journal_get_pending (self->journal, collection);
+  if (!pending)
+    return;
+
+  endpoint = g_strdup_printf ("storage/%s", collection);
+  length = g_strv_length (pending);
+  LOG ("Uploading %u pending changes to %s collection...", length, collection);
+
+  for (guint i = 0; i < length; i += EPHY_SYNC_BATCH_SIZE) {
+    GString *body = g_string_new ("[");
+
+    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, length); k++) {
+      if (k > i)
+        g_string_append_c (body, ',');
+      g_string_append (body, pending[k]);
+    }
+    g_string_append_c (body, ']');
+
+    ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_POST,
+                                             body->str, -1, unmodified_since, flush_journal_cb,
+                                             flush_journal_async_data_new (self, collection));
+    g_string_free (body, TRUE);
+  }
+
+  g_free (endpoint);
+  g_strfreev (pending);
 }
 
 static void
@@ -1570,7 +2164,6 @@ ephy_sync_service_sync_collection (EphySyncService           *self,
 {
   SyncCollectionAsyncData *data;
   const char *collection;
-  char *endpoint;
   gboolean is_initial;
 
   g_assert (EPHY_IS_SYNC_SERVICE (self));
@@ -1579,34 +2172,34 @@ ephy_sync_service_sync_collection (EphySyncService           *self,
 
   collection = ephy_synchronizable_manager_get_collection_name (manager);
   is_initial = ephy_synchronizable_manager_is_initial_sync (manager);
+  data = sync_collection_async_data_new (self, manager, is_initial, is_last);
+
+  if (ephy_sync_utils_get_download_cursor (collection, &data->offset,
+                                           &data->newer, &data->last_modified))
+    LOG ("Resuming download of %s collection from offset %s", collection, data->offset);
+  else if (!is_initial)
+    data->newer = ephy_synchronizable_manager_get_sync_time (manager);
 
   if (is_initial) {
-    endpoint = g_strdup_printf ("storage/%s?full=true", collection);
-  } else {
-    endpoint = g_strdup_printf ("storage/%s?newer=%.2lf&full=true", collection,
-                                ephy_synchronizable_manager_get_sync_time (manager));
+    if (data->offset)
+      data->merged_ids = ephy_sync_utils_get_merged_ids (collection);
+    else
+      data->merged_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   }
 
   LOG ("Syncing %s collection %s...", collection, is_initial ? "initial" : "regular");
-  data = sync_collection_async_data_new (self, manager, is_initial, is_last);
-  ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_GET,
-                                           NULL, -1, -1,
-                                           sync_collection_cb, data);
-
-  g_free (endpoint);
+  ephy_sync_service_download_collection_page (data);
 }
 
 static gboolean
 ephy_sync_service_sync_internal (EphySyncService *self)
 {
-  GNetworkMonitor *monitor;
   guint index = 0;
   guint num_managers;
 
   g_assert (ephy_sync_utils_user_is_signed_in ());
 
-  monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL) {
+  if (!ephy_sync_service_is_online ()) {
     g_signal_emit (self, signals[SYNC_FINISHED], 0);
     return G_SOURCE_CONTINUE;
   }
@@ -1720,6 +2313,7 @@ out_error:
    * when the preferences dialog is opened. */
   ephy_sync_utils_set_sync_user (NULL);
   ephy_sync_utils_set_sync_time (0);
+  ephy_sync_utils_clear_download_cursors ();
   ephy_sync_utils_set_bookmarks_sync_is_initial (TRUE);
   ephy_sync_utils_set_passwords_sync_is_initial (TRUE);
   ephy_sync_utils_set_history_sync_is_initial (TRUE);
@@ -1910,6 +2504,9 @@ ephy_sync_service_finalize (GObject *object)
   g_free (self->crypto_keys);
   g_slist_free (self->managers);
   g_queue_free_full (self->storage_queue, (GDestroyNotify)storage_request_async_data_free);
+  if (self->encrypt_pool)
+    g_thread_pool_free (self->encrypt_pool, TRUE, TRUE);
+  g_object_unref (self->journal);
   ephy_sync_service_clear_storage_credentials (self);
 
   G_OBJECT_CLASS (ephy_sync_service_parent_class)->finalize (object);
@@ -1946,10 +2543,16 @@ ephy_sync_service_constructed (GObject *object)
 static void
 ephy_sync_service_init (EphySyncService *self)
 {
+  char *filename;
+
   self->session = soup_session_new ();
   self->storage_queue = g_queue_new ();
   self->secrets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
+  filename = g_build_filename (ephy_dot_dir (), EPHY_SYNC_JOURNAL_FILE, NULL);
+  self->journal = ephy_sync_journal_new (filename);
+  g_free (filename);
+
   if (ephy_sync_utils_user_is_signed_in ())
     ephy_sync_service_load_secrets (self);
 }
@@ -2584,16 +3187,10 @@ synchronizable_deleted_cb (EphySynchronizableManager *manager,
                            EphySynchronizable        *synchronizable,
                            EphySyncService           *self)
 {
-  GNetworkMonitor *monitor;
-
   g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (EPHY_IS_SYNC_SERVICE (self));
 
-  monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL)
-    return;
-
   if (!ephy_sync_utils_user_is_signed_in ())
     return;
 
@@ -2606,16 +3203,10 @@ synchronizable_modified_cb (EphySynchronizableManager *manager,
                             gboolean                   should_force,
                             EphySyncService           *self)
 {
-  GNetworkMonitor *monitor;
-
   g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (EPHY_IS_SYNC_SERVICE (self));
 
-  monitor = g_network_monitor_get_default ();
-  if (g_network_monitor_get_connectivity (monitor) != G_NETWORK_CONNECTIVITY_FULL)
-    return;
-
   if (!ephy_sync_utils_user_is_signed_in ())
     return;
 
@@ -2755,6 +3346,8 @@ ephy_sync_service_sign_out (EphySyncService *self)
   ephy_sync_utils_set_passwords_sync_is_initial (TRUE);
   ephy_sync_utils_set_history_sync_is_initial (TRUE);
   ephy_sync_utils_set_sync_time (0);
+  ephy_sync_utils_clear_download_cursors ();
+  ephy_sync_journal_clear (self->journal);
 }
 
 void
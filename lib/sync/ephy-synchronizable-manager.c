@@ -44,6 +44,7 @@ ephy_synchronizable_manager_default_init (EphySynchronizableManagerInterface *if
   iface->remove = ephy_synchronizable_manager_remove;
   iface->save = ephy_synchronizable_manager_save;
   iface->merge = ephy_synchronizable_manager_merge;
+  iface->collect_unmerged = ephy_synchronizable_manager_collect_unmerged;
 
   signals[SYNCHRONIZABLE_DELETED] =
     g_signal_new ("synchronizable-deleted",
@@ -263,6 +264,11 @@ ephy_synchronizable_manager_save (EphySynchronizableManager *manager,
  * with the local objects in @manager's collection. When the merge is completed,
  * @callback will be invoked with a list of objects that need to be (re)uploaded
  * to server. Transfer full for the list of objects to be (re)uploaded.
+ *
+ * The collection is downloaded in pages, each of which is merged on its own.
+ * An initial merge only settles the local objects matching the remote ones;
+ * the local objects that the server does not have are collected once every
+ * page is merged, see ephy_synchronizable_manager_collect_unmerged().
  **/
 void
 ephy_synchronizable_manager_merge (EphySynchronizableManager              *manager,
@@ -280,3 +286,34 @@ ephy_synchronizable_manager_merge (EphySynchronizableManager              *manag
   iface = EPHY_SYNCHRONIZABLE_MANAGER_GET_IFACE (manager);
   iface->merge (manager, is_initial, remotes_deleted, remotes_updated, callback, user_data);
 }
+
+/**
+ * ephy_synchronizable_manager_collect_unmerged:
+ * @manager: an #EphySynchronizableManager
+ * @merged_ids: (element-type utf8 utf8): the IDs of the local objects that are
+ *              known to match the server's after the initial merge
+ * @callback: an #EphySynchronizableManagerMergeCallback that will be called
+ *            with the objects collected.
+ * @user_data: user data to pass to the @callback.
+ *
+ * Completes an initial merge, once every page of the collection has been
+ * merged with ephy_synchronizable_manager_merge(). @callback will be invoked
+ * with the local objects whose ID is not in @merged_ids, which the server
+ * does not have and which need to be uploaded. Transfer full for the list of
+ * objects to be uploaded.
+ **/
+void
+ephy_synchronizable_manager_collect_unmerged (EphySynchronizableManager              *manager,
+                                              GHashTable                             *merged_ids,
+                                              EphySynchronizableManagerMergeCallback  callback,
+                                              gpointer                                user_data)
+{
+  EphySynchronizableManagerInterface *iface;
+
+  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
+  g_assert (merged_ids);
+  g_assert (callback);
+
+  iface = EPHY_SYNCHRONIZABLE_MANAGER_GET_IFACE (manager);
+  iface->collect_unmerged (manager, merged_ids, callback, user_data);
+}
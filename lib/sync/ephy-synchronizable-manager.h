@@ -55,6 +55,10 @@ struct _EphySynchronizableManagerInterface {
                                                    GList                                  *remotes_updated,
                                                    EphySynchronizableManagerMergeCallback  callback,
                                                    gpointer                                user_data);
+  void                 (*collect_unmerged)        (EphySynchronizableManager              *manager,
+                                                   GHashTable                             *merged_ids,
+                                                   EphySynchronizableManagerMergeCallback  callback,
+                                                   gpointer                                user_data);
 };
 
 const char         *ephy_synchronizable_manager_get_collection_name     (EphySynchronizableManager *manager);
@@ -77,5 +81,9 @@ void                ephy_synchronizable_manager_merge                   (EphySyn
                                                                          GList                                  *remotes_updated,
                                                                          EphySynchronizableManagerMergeCallback  callback,
                                                                          gpointer                                user_data);
+void                ephy_synchronizable_manager_collect_unmerged        (EphySynchronizableManager              *manager,
+                                                                         GHashTable                             *merged_ids,
+                                                                         EphySynchronizableManagerMergeCallback  callback,
+                                                                         gpointer                                user_data);
 
 G_END_DECLS
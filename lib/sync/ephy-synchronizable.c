@@ -223,24 +223,76 @@ ephy_synchronizable_default_to_bso (EphySynchronizable  *synchronizable,
                                     SyncCryptoKeyBundle *bundle)
 {
   JsonNode *bso;
-  JsonObject *object;
   char *serialized;
-  char *payload;
 
   g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
   g_assert (bundle);
 
   serialized = json_gobject_to_data (G_OBJECT (synchronizable), NULL);
-  payload = ephy_sync_crypto_encrypt_record (serialized, bundle);
+  bso = ephy_synchronizable_cleartext_to_bso (ephy_synchronizable_get_id (synchronizable),
+                                              serialized, bundle);
+  g_free (serialized);
+
+  return bso;
+}
+
+/**
+ * ephy_synchronizable_uses_default_to_bso:
+ * @synchronizable: an #EphySynchronizable
+ *
+ * Checks whether @synchronizable's #EphySynchronizableInterface.to_bso()
+ * is ephy_synchronizable_default_to_bso(), in which case its BSO can be
+ * built with ephy_synchronizable_cleartext_to_bso() from the JSON
+ * serialization of the object.
+ *
+ * Return value: %TRUE if @synchronizable uses the default to_bso()
+ **/
+gboolean
+ephy_synchronizable_uses_default_to_bso (EphySynchronizable *synchronizable)
+{
+  EphySynchronizableInterface *iface;
+
+  g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
+
+  iface = EPHY_SYNCHRONIZABLE_GET_IFACE (synchronizable);
+  return iface->to_bso == ephy_synchronizable_default_to_bso;
+}
+
+/**
+ * ephy_synchronizable_cleartext_to_bso:
+ * @id: the id of the record
+ * @cleartext: the JSON serialization of the record
+ * @bundle: a %SyncCryptoKeyBundle holding the encryption key and the HMAC key
+ *          used to encrypt the Basic Storage Object
+ *
+ * Encrypts @cleartext into the payload of a Basic Storage Object. Unlike
+ * ephy_synchronizable_to_bso(), this does not touch the #EphySynchronizable
+ * object, so it is safe to call from a worker thread.
+ *
+ * Return value: (transfer full): the BSO as a #JsonNode
+ **/
+JsonNode *
+ephy_synchronizable_cleartext_to_bso (const char          *id,
+                                      const char          *cleartext,
+                                      SyncCryptoKeyBundle *bundle)
+{
+  JsonNode *bso;
+  JsonObject *object;
+  char *payload;
+
+  g_assert (id);
+  g_assert (cleartext);
+  g_assert (bundle);
+
+  payload = ephy_sync_crypto_encrypt_record (cleartext, bundle);
   bso = json_node_new (JSON_NODE_OBJECT);
   object = json_object_new ();
-  json_object_set_string_member (object, "id", ephy_synchronizable_get_id (synchronizable));
+  json_object_set_string_member (object, "id", id);
   json_object_set_string_member (object, "payload", payload);
   json_node_set_object (bso, object);
 
   json_object_unref (object);
   g_free (payload);
-  g_free (serialized);
 
   return bso;
 }
@@ -56,5 +56,9 @@ GObject    *ephy_synchronizable_from_bso                  (JsonNode            *
 /* Default implementations. */
 JsonNode   *ephy_synchronizable_default_to_bso            (EphySynchronizable  *synchronizable,
                                                            SyncCryptoKeyBundle *bundle);
+gboolean    ephy_synchronizable_uses_default_to_bso       (EphySynchronizable  *synchronizable);
+JsonNode   *ephy_synchronizable_cleartext_to_bso          (const char          *id,
+                                                           const char          *cleartext,
+                                                           SyncCryptoKeyBundle *bundle);
 
 G_END_DECLS
@@ -39,11 +39,6 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <string.h>
-#if 0
-/* FIXME: Refactor the DNS prefetch, this is a layering violation */
-#include <libsoup/soup.h>
-#include <webkit2/webkit2.h>
-#endif
 
 /**
  * SECTION:ephy-location-entry
@@ -77,8 +72,6 @@ struct _EphyLocationEntry {
 
   guint hash;
 
-  gulong dns_prefetch_handler;
-
   guint user_changed : 1;
   guint can_redo : 1;
   guint block_update : 1;
@@ -773,7 +766,6 @@ ephy_location_entry_init (EphyLocationEntry *le)
   le->user_changed = FALSE;
   le->block_update = FALSE;
   le->saved_text = NULL;
-  le->dns_prefetch_handler = 0;
 
   ephy_location_entry_construct_contents (le);
 }
@@ -784,61 +776,6 @@ ephy_location_entry_new (void)
   return GTK_WIDGET (g_object_new (EPHY_TYPE_LOCATION_ENTRY, NULL));
 }
 
-#if 0
-/* FIXME: Refactor the DNS prefetch, this is a layering violation */
-typedef struct {
-  SoupURI *uri;
-  EphyLocationEntry *entry;
-} PrefetchHelper;
-
-static void
-free_prefetch_helper (PrefetchHelper *helper)
-{
-  soup_uri_free (helper->uri);
-  g_object_unref (helper->entry);
-  g_slice_free (PrefetchHelper, helper);
-}
-
-static gboolean
-do_dns_prefetch (PrefetchHelper *helper)
-{
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
-
-  if (helper->uri)
-    webkit_web_context_prefetch_dns (ephy_embed_shell_get_web_context (shell), helper->uri->host);
-
-  helper->entry->dns_prefetch_handler = 0;
-
-  return FALSE;
-}
-
-static void
-schedule_dns_prefetch (EphyLocationEntry *entry, guint interval, const gchar *url)
-{
-  PrefetchHelper *helper;
-  SoupURI *uri;
-
-  uri = soup_uri_new (url);
-  if (!uri || !uri->host) {
-    soup_uri_free (uri);
-    return;
-  }
-
-  if (entry->dns_prefetch_handler)
-    g_source_remove (entry->dns_prefetch_handler);
-
-  helper = g_slice_new0 (PrefetchHelper);
-  helper->entry = g_object_ref (entry);
-  helper->uri = uri;
-
-  entry->dns_prefetch_handler =
-    g_timeout_add_full (G_PRIORITY_DEFAULT, interval,
-                        (GSourceFunc)do_dns_prefetch, helper,
-                        (GDestroyNotify)free_prefetch_helper);
-  g_source_set_name_by_id (entry->dns_prefetch_handler, "[epiphany] do_dns_prefetch");
-}
-#endif
-
 static gboolean
 cursor_on_match_cb (GtkEntryCompletion *completion,
                     GtkTreeModel       *model,
@@ -861,11 +798,6 @@ cursor_on_match_cb (GtkEntryCompletion *completion,
   gtk_editable_set_position (GTK_EDITABLE (entry), -1);
   le->block_update = FALSE;
 
-#if 0
-/* FIXME: Refactor the DNS prefetch, this is a layering violation */
-  schedule_dns_prefetch (le, 250, (const gchar *)url);
-#endif
-
   g_free (url);
 
   return TRUE;
@@ -327,6 +327,7 @@ ephy_bookmark_set_url (EphyBookmark *self, const char *url)
 
   g_free (self->url);
   self->url = g_strdup (url);
+  g_object_notify_by_pspec (G_OBJECT (self), obj_properties[PROP_BMK_URI]);
 }
 
 const char *
@@ -364,6 +365,7 @@ ephy_bookmark_set_id (EphyBookmark *self,
 
   g_free (self->id);
   self->id = g_strdup (id);
+  g_object_notify_by_pspec (G_OBJECT (self), obj_properties[PROP_ID]);
 }
 
 const char *
@@ -33,15 +33,34 @@
 
 #define EPHY_BOOKMARKS_FILE "bookmarks.gvdb"
 
+/* Changes are written back to disk at most once per this many seconds. */
+#define EPHY_BOOKMARKS_SAVE_DELAY 2
+
 struct _EphyBookmarksManager {
   GObject     parent_instance;
 
   GSequence  *bookmarks;
   GSequence  *tags;
 
+  /* Lookup indexes, kept up to date from the bookmarks' change signals. */
+  GHashTable *index_entries;      /* EphyBookmark -> BookmarkIndexEntry */
+  GHashTable *bookmarks_by_id;    /* id -> EphyBookmark */
+  GHashTable *bookmarks_by_url;   /* url -> GList of EphyBookmark */
+  GHashTable *bookmarks_by_tag;   /* tag -> set of EphyBookmark */
+  GHashTable *untagged_bookmarks; /* set of EphyBookmark */
+
   gchar      *gvdb_filename;
+  guint       save_source_id;
 };
 
+/* The keys a bookmark is currently indexed under, so that its old entries
+ * can be dropped when its id or url changes. */
+typedef struct {
+  GSequenceIter *iter;
+  char          *id;
+  char          *url;
+} BookmarkIndexEntry;
+
 static void list_model_iface_init     (GListModelInterface *iface);
 static void ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *iface);
 
@@ -70,12 +89,44 @@ ephy_bookmarks_manager_save_to_file (EphyBookmarksManager *self, GTask *task)
 {
   gboolean result;
 
+  /* Whatever was pending is part of this write. */
+  if (self->save_source_id) {
+    g_source_remove (self->save_source_id);
+    self->save_source_id = 0;
+  }
+
   result = ephy_bookmarks_export (self, self->gvdb_filename, NULL);
 
   if (task)
     g_task_return_boolean (task, result);
 }
 
+static gboolean
+save_timeout_cb (EphyBookmarksManager *self)
+{
+  self->save_source_id = 0;
+
+  if (!ephy_bookmarks_export (self, self->gvdb_filename, NULL))
+    g_warning ("Failed to write bookmarks to %s", self->gvdb_filename);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Writing the file rebuilds it from scratch, so instead of doing that for
+ * every single change, batch all the changes made within a short interval
+ * into one write. Pending changes are flushed on dispose. */
+void
+ephy_bookmarks_manager_schedule_save (EphyBookmarksManager *self)
+{
+  if (self->save_source_id)
+    return;
+
+  self->save_source_id = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT_IDLE,
+                                                     EPHY_BOOKMARKS_SAVE_DELAY,
+                                                     (GSourceFunc)save_timeout_cb,
+                                                     self, NULL);
+}
+
 static void
 ephy_bookmarks_manager_copy_tags_from_bookmark (EphyBookmarksManager *self,
                                                 EphyBookmark         *dest,
@@ -106,11 +157,172 @@ ephy_bookmarks_manager_create_tags_from_bookmark (EphyBookmarksManager *self,
     ephy_bookmarks_manager_create_tag (self, g_sequence_get (iter));
 }
 
+static void
+bookmark_index_entry_free (BookmarkIndexEntry *entry)
+{
+  g_free (entry->id);
+  g_free (entry->url);
+  g_slice_free (BookmarkIndexEntry, entry);
+}
+
+static void
+ephy_bookmarks_manager_index_id (EphyBookmarksManager *self,
+                                 EphyBookmark         *bookmark,
+                                 BookmarkIndexEntry   *entry)
+{
+  entry->id = g_strdup (ephy_bookmark_get_id (bookmark));
+  if (entry->id)
+    g_hash_table_insert (self->bookmarks_by_id, g_strdup (entry->id), bookmark);
+}
+
+static void
+ephy_bookmarks_manager_unindex_id (EphyBookmarksManager *self,
+                                   EphyBookmark         *bookmark,
+                                   BookmarkIndexEntry   *entry)
+{
+  /* Another bookmark might have taken over the id in the meantime. */
+  if (entry->id && g_hash_table_lookup (self->bookmarks_by_id, entry->id) == bookmark)
+    g_hash_table_remove (self->bookmarks_by_id, entry->id);
+
+  g_clear_pointer (&entry->id, g_free);
+}
+
+static void
+ephy_bookmarks_manager_index_url (EphyBookmarksManager *self,
+                                  EphyBookmark         *bookmark,
+                                  BookmarkIndexEntry   *entry)
+{
+  GList *list;
+
+  entry->url = g_strdup (ephy_bookmark_get_url (bookmark));
+  if (!entry->url)
+    return;
+
+  /* Several bookmarks may share a url, keep them all. */
+  list = g_hash_table_lookup (self->bookmarks_by_url, entry->url);
+  if (list)
+    list = g_list_append (list, bookmark);
+  else
+    g_hash_table_insert (self->bookmarks_by_url, g_strdup (entry->url), g_list_prepend (NULL, bookmark));
+}
+
+static void
+ephy_bookmarks_manager_unindex_url (EphyBookmarksManager *self,
+                                    EphyBookmark         *bookmark,
+                                    BookmarkIndexEntry   *entry)
+{
+  char *key;
+  GList *list;
+
+  if (entry->url &&
+      g_hash_table_lookup_extended (self->bookmarks_by_url, entry->url, (gpointer *)&key, (gpointer *)&list)) {
+    g_hash_table_steal (self->bookmarks_by_url, entry->url);
+    list = g_list_remove (list, bookmark);
+    if (list)
+      g_hash_table_insert (self->bookmarks_by_url, key, list);
+    else
+      g_free (key);
+  }
+
+  g_clear_pointer (&entry->url, g_free);
+}
+
+static void
+ephy_bookmarks_manager_index_tag (EphyBookmarksManager *self,
+                                  EphyBookmark         *bookmark,
+                                  const char           *tag)
+{
+  GHashTable *tagged;
+
+  tagged = g_hash_table_lookup (self->bookmarks_by_tag, tag);
+  if (!tagged) {
+    tagged = g_hash_table_new (NULL, NULL);
+    g_hash_table_insert (self->bookmarks_by_tag, g_strdup (tag), tagged);
+  }
+
+  g_hash_table_add (tagged, bookmark);
+  g_hash_table_remove (self->untagged_bookmarks, bookmark);
+}
+
+static void
+ephy_bookmarks_manager_unindex_tag (EphyBookmarksManager *self,
+                                    EphyBookmark         *bookmark,
+                                    const char           *tag)
+{
+  GHashTable *tagged;
+
+  tagged = g_hash_table_lookup (self->bookmarks_by_tag, tag);
+  if (tagged) {
+    g_hash_table_remove (tagged, bookmark);
+    if (g_hash_table_size (tagged) == 0)
+      g_hash_table_remove (self->bookmarks_by_tag, tag);
+  }
+}
+
+static void
+ephy_bookmarks_manager_index_bookmark (EphyBookmarksManager *self,
+                                       EphyBookmark         *bookmark,
+                                       GSequenceIter        *iter)
+{
+  BookmarkIndexEntry *entry;
+  GSequenceIter *tag_iter;
+
+  entry = g_slice_new0 (BookmarkIndexEntry);
+  entry->iter = iter;
+  ephy_bookmarks_manager_index_id (self, bookmark, entry);
+  ephy_bookmarks_manager_index_url (self, bookmark, entry);
+  g_hash_table_insert (self->index_entries, bookmark, entry);
+
+  g_hash_table_add (self->untagged_bookmarks, bookmark);
+  for (tag_iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (bookmark));
+       !g_sequence_iter_is_end (tag_iter); tag_iter = g_sequence_iter_next (tag_iter))
+    ephy_bookmarks_manager_index_tag (self, bookmark, g_sequence_get (tag_iter));
+}
+
+static void
+ephy_bookmarks_manager_unindex_bookmark (EphyBookmarksManager *self,
+                                         EphyBookmark         *bookmark)
+{
+  BookmarkIndexEntry *entry;
+  GSequenceIter *tag_iter;
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  g_assert (entry != NULL);
+
+  ephy_bookmarks_manager_unindex_id (self, bookmark, entry);
+  ephy_bookmarks_manager_unindex_url (self, bookmark, entry);
+  g_hash_table_remove (self->index_entries, bookmark);
+
+  for (tag_iter = g_sequence_get_begin_iter (ephy_bookmark_get_tags (bookmark));
+       !g_sequence_iter_is_end (tag_iter); tag_iter = g_sequence_iter_next (tag_iter))
+    ephy_bookmarks_manager_unindex_tag (self, bookmark, g_sequence_get (tag_iter));
+  g_hash_table_remove (self->untagged_bookmarks, bookmark);
+}
+
+static void
+ephy_bookmarks_manager_dispose (GObject *object)
+{
+  EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
+
+  if (self->save_source_id) {
+    g_source_remove (self->save_source_id);
+    save_timeout_cb (self);
+  }
+
+  G_OBJECT_CLASS (ephy_bookmarks_manager_parent_class)->dispose (object);
+}
+
 static void
 ephy_bookmarks_manager_finalize (GObject *object)
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
 
+  g_hash_table_unref (self->index_entries);
+  g_hash_table_unref (self->bookmarks_by_id);
+  g_hash_table_unref (self->bookmarks_by_url);
+  g_hash_table_unref (self->bookmarks_by_tag);
+  g_hash_table_unref (self->untagged_bookmarks);
+
   g_sequence_free (self->bookmarks);
   g_sequence_free (self->tags);
 
@@ -124,6 +336,7 @@ ephy_bookmarks_manager_class_init (EphyBookmarksManagerClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->dispose = ephy_bookmarks_manager_dispose;
   object_class->finalize = ephy_bookmarks_manager_finalize;
 
   signals[BOOKMARK_ADDED] =
@@ -212,6 +425,12 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
   self->bookmarks = g_sequence_new (g_object_unref);
   self->tags = g_sequence_new (g_free);
 
+  self->index_entries = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)bookmark_index_entry_free);
+  self->bookmarks_by_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->bookmarks_by_url = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_list_free);
+  self->bookmarks_by_tag = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+  self->untagged_bookmarks = g_hash_table_new (NULL, NULL);
+
   g_sequence_insert_sorted (self->tags,
                             g_strdup (EPHY_BOOKMARKS_FAVORITES_TAG),
                             (GCompareDataFunc)ephy_bookmark_tags_compare,
@@ -237,14 +456,38 @@ bookmark_url_changed_cb (EphyBookmark         *bookmark,
                          GParamSpec           *pspec,
                          EphyBookmarksManager *self)
 {
+  BookmarkIndexEntry *entry;
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  if (entry && g_strcmp0 (entry->url, ephy_bookmark_get_url (bookmark)) != 0) {
+    ephy_bookmarks_manager_unindex_url (self, bookmark, entry);
+    ephy_bookmarks_manager_index_url (self, bookmark, entry);
+  }
+
   g_signal_emit (self, signals[BOOKMARK_URL_CHANGED], 0, bookmark);
 }
 
+static void
+bookmark_id_changed_cb (EphyBookmark         *bookmark,
+                        GParamSpec           *pspec,
+                        EphyBookmarksManager *self)
+{
+  BookmarkIndexEntry *entry;
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  if (entry && g_strcmp0 (entry->id, ephy_bookmark_get_id (bookmark)) != 0) {
+    ephy_bookmarks_manager_unindex_id (self, bookmark, entry);
+    ephy_bookmarks_manager_index_id (self, bookmark, entry);
+  }
+}
+
 static void
 bookmark_tag_added_cb (EphyBookmark         *bookmark,
                        const char           *tag,
                        EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_index_tag (self, bookmark, tag);
+
   g_signal_emit (self, signals[BOOKMARK_TAG_ADDED], 0, bookmark, tag);
 }
 
@@ -253,6 +496,10 @@ bookmark_tag_removed_cb (EphyBookmark         *bookmark,
                          const char           *tag,
                          EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_unindex_tag (self, bookmark, tag);
+  if (g_sequence_is_empty (ephy_bookmark_get_tags (bookmark)))
+    g_hash_table_add (self->untagged_bookmarks, bookmark);
+
   g_signal_emit (self, signals[BOOKMARK_TAG_REMOVED], 0, bookmark, tag);
 }
 
@@ -270,6 +517,8 @@ ephy_bookmarks_manager_watch_bookmark (EphyBookmarksManager *self,
                            G_CALLBACK (bookmark_title_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "notify::bmkUri",
                            G_CALLBACK (bookmark_url_changed_cb), self, 0);
+  g_signal_connect_object (bookmark, "notify::id",
+                           G_CALLBACK (bookmark_id_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-added",
                            G_CALLBACK (bookmark_tag_added_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-removed",
@@ -282,6 +531,7 @@ ephy_bookmarks_manager_unwatch_bookmark (EphyBookmarksManager *self,
 {
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_title_changed_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_url_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_id_changed_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_added_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_removed_cb, self);
 }
@@ -320,6 +570,8 @@ ephy_bookmarks_manager_add_bookmark_internal (EphyBookmarksManager *self,
   iter = ephy_bookmarks_search_and_insert_bookmark (self->bookmarks,
                                                     g_object_ref (bookmark));
   if (iter) {
+    ephy_bookmarks_manager_index_bookmark (self, bookmark, iter);
+
     /* Update list */
     position = g_sequence_iter_get_position (iter);
     g_list_model_items_changed (G_LIST_MODEL (self), position, 0, 1);
@@ -329,9 +581,7 @@ ephy_bookmarks_manager_add_bookmark_internal (EphyBookmarksManager *self,
   }
 
   if (should_save)
-    ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                               (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                               NULL);
+    ephy_bookmarks_manager_schedule_save (self);
 }
 
 void
@@ -362,43 +612,39 @@ ephy_bookmarks_manager_add_bookmarks (EphyBookmarksManager *self,
     g_signal_emit_by_name (self, "synchronizable-modified", bookmark, FALSE);
   }
 
-  ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                             (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                             NULL);
+  ephy_bookmarks_manager_schedule_save (self);
 }
 
 static void
 ephy_bookmarks_manager_remove_bookmark_internal (EphyBookmarksManager *self,
                                                  EphyBookmark         *bookmark)
 {
+  BookmarkIndexEntry *entry;
   GSequenceIter *iter;
   gint position;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (EPHY_IS_BOOKMARK (bookmark));
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-    if (g_strcmp0 (ephy_bookmark_get_id (g_sequence_get (iter)),
-                   ephy_bookmark_get_id (bookmark)) == 0)
-      break;
-  }
-  g_assert (!g_sequence_iter_is_end (iter));
+  /* Callers may pass a different instance carrying the same id. */
+  bookmark = g_hash_table_lookup (self->bookmarks_by_id, ephy_bookmark_get_id (bookmark));
+  g_assert (bookmark != NULL);
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  iter = entry->iter;
 
   /* Ensure the bookmark is removed from our list before the signal is emitted,
    * because this is the bookmark REMOVED signal after all, so callers expect
    * it to be already gone.
    */
   g_object_ref (bookmark);
+  ephy_bookmarks_manager_unindex_bookmark (self, bookmark);
   position = g_sequence_iter_get_position (iter);
   g_sequence_remove (iter);
   g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
   g_signal_emit (self, signals[BOOKMARK_REMOVED], 0, bookmark);
 
-  ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                             (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                             NULL);
+  ephy_bookmarks_manager_schedule_save (self);
 
   ephy_bookmarks_manager_unwatch_bookmark (self, bookmark);
   g_object_unref (bookmark);
@@ -418,42 +664,24 @@ EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_url (EphyBookmarksManager *self,
                                             const char           *url)
 {
-  GSequenceIter *iter;
+  GList *list;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (url != NULL);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
+  list = g_hash_table_lookup (self->bookmarks_by_url, url);
 
-    if (g_strcmp0 (ephy_bookmark_get_url (bookmark), url) == 0)
-      return bookmark;
-  }
-
-  return NULL;
+  return list ? list->data : NULL;
 }
 
 EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_id (EphyBookmarksManager *self,
                                            const char           *id)
 {
-  GSequenceIter *iter;
-
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (id != NULL);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
-
-    if (g_strcmp0 (ephy_bookmark_get_id (bookmark), id) == 0)
-      return bookmark;
-  }
-
-  return NULL;
+  return g_hash_table_lookup (self->bookmarks_by_id, id);
 }
 
 void
@@ -482,6 +710,7 @@ void
 ephy_bookmarks_manager_delete_tag (EphyBookmarksManager *self, const char *tag)
 {
   GSequenceIter *iter = NULL;
+  GHashTable *tagged;
   int position;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
@@ -500,8 +729,16 @@ ephy_bookmarks_manager_delete_tag (EphyBookmarksManager *self, const char *tag)
 
   g_sequence_remove (iter);
 
-  /* Also remove the tag from each bookmark if they have it */
-  g_sequence_foreach (self->bookmarks, (GFunc)ephy_bookmark_remove_tag, (gpointer)tag);
+  /* Also remove the tag from each bookmark if they have it. This drops the
+   * tag's index entry along the way, so walk a copy of it. */
+  tagged = g_hash_table_lookup (self->bookmarks_by_tag, tag);
+  if (tagged) {
+    GList *bookmarks = g_hash_table_get_keys (tagged);
+
+    for (GList *l = bookmarks; l != NULL; l = l->next)
+      ephy_bookmark_remove_tag (l->data, tag);
+    g_list_free (bookmarks);
+  }
 
   g_signal_emit (self, signals[TAG_DELETED], 0, tag, position);
 }
@@ -535,42 +772,47 @@ ephy_bookmarks_manager_get_bookmarks_with_tag (EphyBookmarksManager *self,
                                                const char           *tag)
 {
   GSequence *bookmarks;
-  GSequenceIter *iter;
+  GHashTable *tagged;
+  GHashTableIter iter;
+  gpointer bookmark;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
 
   bookmarks = g_sequence_new (g_object_unref);
 
-  if (tag == NULL) {
-    for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-      EphyBookmark *bookmark = g_sequence_get (iter);
-
-      if (g_sequence_is_empty (ephy_bookmark_get_tags (bookmark))) {
-        g_sequence_insert_sorted (bookmarks,
-                                  g_object_ref (bookmark),
-                                  (GCompareDataFunc)ephy_bookmark_bookmarks_compare_func,
-                                  NULL);
-      }
-    }
-  } else {
-    for (iter = g_sequence_get_begin_iter (self->bookmarks);
-         !g_sequence_iter_is_end (iter);
-         iter = g_sequence_iter_next (iter)) {
-      EphyBookmark *bookmark = g_sequence_get (iter);
-
-      if (ephy_bookmark_has_tag (bookmark, tag))
-        g_sequence_insert_sorted (bookmarks,
-                                  g_object_ref (bookmark),
-                                  (GCompareDataFunc)ephy_bookmark_bookmarks_compare_func,
-                                  NULL);
-    }
-  }
+  if (tag == NULL)
+    tagged = self->untagged_bookmarks;
+  else
+    tagged = g_hash_table_lookup (self->bookmarks_by_tag, tag);
+
+  if (tagged == NULL)
+    return bookmarks;
+
+  g_hash_table_iter_init (&iter, tagged);
+  while (g_hash_table_iter_next (&iter, &bookmark, NULL))
+    g_sequence_append (bookmarks, g_object_ref (bookmark));
+
+  g_sequence_sort (bookmarks, (GCompareDataFunc)ephy_bookmark_bookmarks_compare_func, NULL);
 
   return bookmarks;
 }
 
+gboolean
+ephy_bookmarks_manager_has_bookmarks_with_tag (EphyBookmarksManager *self,
+                                               const char           *tag)
+{
+  GHashTable *tagged;
+
+  g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
+
+  if (tag == NULL)
+    tagged = self->untagged_bookmarks;
+  else
+    tagged = g_hash_table_lookup (self->bookmarks_by_tag, tag);
+
+  return tagged != NULL && g_hash_table_size (tagged) > 0;
+}
+
 GSequence *
 ephy_bookmarks_manager_get_tags (EphyBookmarksManager *self)
 {
@@ -725,9 +967,7 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (manager);
 
-  ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                             (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                             NULL);
+  ephy_bookmarks_manager_schedule_save (self);
 }
 
 static GPtrArray *
@@ -736,15 +976,11 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
 {
   GPtrArray *to_upload;
   EphyBookmark *bookmark;
-  GSequence *bookmarks;
-  GSequenceIter *iter;
-  GHashTable *dont_upload;
   double timestamp;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
 
   to_upload = g_ptr_array_new_with_free_func (g_object_unref);
-  dont_upload = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   for (GList *l = remote_bookmarks; l && l->data; l = l->next) {
     const char *id;
@@ -775,12 +1011,13 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
+        g_ptr_array_add (to_upload, g_object_ref (bookmark));
       } else {
         /* Same id, different url. Keep both and upload local one with new id. */
         char *new_id = ephy_sync_utils_get_random_sync_id ();
         ephy_bookmark_set_id (bookmark, new_id);
         ephy_bookmarks_manager_add_bookmark_internal (self, l->data, FALSE);
-        g_hash_table_add (dont_upload, g_strdup (id));
+        g_ptr_array_add (to_upload, g_object_ref (bookmark));
         g_free (new_id);
       }
     } else {
@@ -791,10 +1028,10 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
+        g_ptr_array_add (to_upload, g_object_ref (bookmark));
       } else {
         /* Different id, different url. Add remote bookmark. */
         ephy_bookmarks_manager_add_bookmark_internal (self, l->data, FALSE);
-        g_hash_table_add (dont_upload, g_strdup (id));
       }
     }
 
@@ -806,19 +1043,8 @@ next:
     g_free (parent_id);
   }
 
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (self);
-  for (iter = g_sequence_get_begin_iter (bookmarks);
-       !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
-    bookmark = g_sequence_get (iter);
-    if (!g_hash_table_contains (dont_upload, ephy_bookmark_get_id (bookmark)))
-      g_ptr_array_add (to_upload, g_object_ref (bookmark));
-  }
-
   /* Commit changes to file. */
-  ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                             (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                             NULL);
-  g_hash_table_unref (dont_upload);
+  ephy_bookmarks_manager_schedule_save (self);
 
   return to_upload;
 }
@@ -893,9 +1119,7 @@ next:
   }
 
   /* Commit changes to file. */
-  ephy_bookmarks_manager_save_to_file_async (self, NULL,
-                                             (GAsyncReadyCallback)ephy_bookmarks_manager_save_to_file_warn_on_error_cb,
-                                             NULL);
+  ephy_bookmarks_manager_schedule_save (self);
 
   return to_upload;
 }
@@ -919,6 +1143,29 @@ synchronizable_manager_merge (EphySynchronizableManager              *manager,
   callback (to_upload, user_data);
 }
 
+static void
+synchronizable_manager_collect_unmerged (EphySynchronizableManager              *manager,
+                                         GHashTable                             *merged_ids,
+                                         EphySynchronizableManagerMergeCallback  callback,
+                                         gpointer                                user_data)
+{
+  EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (manager);
+  GPtrArray *to_upload;
+  GSequenceIter *iter;
+
+  to_upload = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (iter = g_sequence_get_begin_iter (self->bookmarks);
+       !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+
+    if (!g_hash_table_contains (merged_ids, ephy_bookmark_get_id (bookmark)))
+      g_ptr_array_add (to_upload, g_object_ref (bookmark));
+  }
+
+  callback (to_upload, user_data);
+}
+
 static void
 ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *iface)
 {
@@ -932,4 +1179,5 @@ ephy_synchronizable_manager_iface_init (EphySynchronizableManagerInterface *ifac
   iface->remove = synchronizable_manager_remove;
   iface->save = synchronizable_manager_save;
   iface->merge = synchronizable_manager_merge;
+  iface->collect_unmerged = synchronizable_manager_collect_unmerged;
 }
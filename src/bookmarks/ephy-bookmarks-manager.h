@@ -58,6 +58,8 @@ gboolean     ephy_bookmarks_manager_tag_exists                    (EphyBookmarks
 GSequence   *ephy_bookmarks_manager_get_bookmarks                 (EphyBookmarksManager *self);
 GSequence   *ephy_bookmarks_manager_get_bookmarks_with_tag        (EphyBookmarksManager *self,
                                                                    const char           *tag);
+gboolean     ephy_bookmarks_manager_has_bookmarks_with_tag        (EphyBookmarksManager *self,
+                                                                   const char           *tag);
 GSequence   *ephy_bookmarks_manager_get_tags                      (EphyBookmarksManager *self);
 
 void        ephy_bookmarks_manager_save_to_file_async             (EphyBookmarksManager *self,
@@ -68,6 +70,7 @@ gboolean     ephy_bookmarks_manager_save_to_file_finish           (EphyBookmarks
                                                                    GAsyncResult         *result,
                                                                    GError              **error);
 void         ephy_bookmarks_manager_load_from_file                (EphyBookmarksManager *self);
+void         ephy_bookmarks_manager_schedule_save                 (EphyBookmarksManager *self);
 
 void         ephy_bookmarks_manager_save_to_file_warn_on_error_cb (GObject      *object,
                                                                    GAsyncResult *result,
@@ -425,6 +425,27 @@ sort_by_relevance (gconstpointer a, gconstpointer b)
     return 0;
 }
 
+/* Resolve the hosts of the best matches while the user is still typing, so
+ * the lookup is out of the way if one of them gets picked. */
+static void
+prefetch_best_rows (GSList *rows)
+{
+  EphyPrefetcher *prefetcher;
+  GPtrArray *uris;
+  GSList *l;
+
+  prefetcher = ephy_embed_shell_get_prefetcher (ephy_embed_shell_get_default ());
+  if (!prefetcher || !rows)
+    return;
+
+  uris = g_ptr_array_new ();
+  for (l = rows; l; l = l->next)
+    g_ptr_array_add (uris, ((PotentialRow *)l->data)->location);
+
+  ephy_prefetcher_prefetch_candidates (prefetcher, (const char * const *)uris->pdata, uris->len);
+  g_ptr_array_free (uris, TRUE);
+}
+
 static void
 query_completed_cb (EphyHistoryService *service,
                     gboolean            success,
@@ -432,10 +453,11 @@ query_completed_cb (EphyHistoryService *service,
                     FindURLsData       *user_data)
 {
   EphyCompletionModel *model = user_data->model;
-  GList *p, *urls;
+  EphyHistoryURLResults *urls;
   GSequence *bookmarks;
   GSequenceIter *iter;
   GSList *list = NULL;
+  guint i;
 
   /* Bookmarks */
   bookmarks = ephy_bookmarks_manager_get_bookmarks (model->bookmarks_manager);
@@ -459,10 +481,10 @@ query_completed_cb (EphyHistoryService *service,
   }
 
   /* History */
-  urls = (GList *)result_data;
+  urls = (EphyHistoryURLResults *)result_data;
 
-  for (p = urls; p != NULL; p = p->next) {
-    EphyHistoryURL *url = (EphyHistoryURL *)p->data;
+  for (i = 0; i < ephy_history_url_results_get_length (urls); i++) {
+    EphyHistoryURL *url = ephy_history_url_results_get (urls, i);
 
     list = add_to_potential_rows (list, url->title, url->url, NULL, url->visit_count, FALSE, TRUE);
   }
@@ -474,13 +496,15 @@ query_completed_cb (EphyHistoryService *service,
    * in the current model one by one, sorted by relevance. */
   replace_rows_in_model (model, list);
 
+  prefetch_best_rows (list);
+
   /* Notify */
   if (user_data->callback)
     user_data->callback (service, success, result_data, user_data->user_data);
 
   g_free (user_data->search_string);
   g_slice_free (FindURLsData, user_data);
-  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+  ephy_history_url_results_free (urls);
   g_slist_free_full (list, (GDestroyNotify)free_potential_row);
   g_clear_object (&model->cancellable);
 }
@@ -575,16 +599,20 @@ ephy_completion_model_update_for_string (EphyCompletionModel   *model,
 {
   char **strings;
   int i;
-  GList *query = NULL;
+  EphyHistoryQuery *query;
   FindURLsData *user_data;
 
   g_return_if_fail (EPHY_IS_COMPLETION_MODEL (model));
   g_return_if_fail (search_string != NULL);
 
+  query = ephy_history_query_new ();
+  query->limit = MAX_COMPLETION_HISTORY_URLS;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
   /* Split the search string. */
   strings = g_strsplit (search_string, " ", -1);
   for (i = 0; strings[i]; i++)
-    query = g_list_append (query, g_strdup (strings[i]));
+    query->substring_list = g_list_append (query->substring_list, g_strdup (strings[i]));
   g_strfreev (strings);
 
   update_search_terms (model, search_string);
@@ -601,14 +629,12 @@ ephy_completion_model_update_for_string (EphyCompletionModel   *model,
   }
   model->cancellable = g_cancellable_new ();
 
-  ephy_history_service_find_urls (model->history_service,
-                                  0, 0,
-                                  MAX_COMPLETION_HISTORY_URLS, 0,
-                                  query,
-                                  EPHY_HISTORY_SORT_MOST_VISITED,
-                                  model->cancellable,
-                                  (EphyHistoryJobCallback)query_completed_cb,
-                                  user_data);
+  ephy_history_service_query_url_results (model->history_service,
+                                          query,
+                                          model->cancellable,
+                                          (EphyHistoryJobCallback)query_completed_cb,
+                                          user_data);
+  ephy_history_query_free (query);
 }
 
 EphyCompletionModel *
@@ -311,14 +311,16 @@ middle_click_handle_on_history_menu_item (EphyEmbed                 *embed,
   EphyEmbed *new_embed = NULL;
   const gchar *url;
 
-  new_embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
-                                  embed,
-                                  0);
+  url = webkit_back_forward_list_item_get_original_uri (item);
+  new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, url,
+                                       EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
+                                       embed,
+                                       0,
+                                       0);
   g_assert (new_embed != NULL);
 
   /* Load the new URL */
-  url = webkit_back_forward_list_item_get_original_uri (item);
   ephy_web_view_load_url (ephy_embed_get_web_view (new_embed), url);
 }
 
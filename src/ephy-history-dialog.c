@@ -37,9 +37,10 @@
 #include <string.h>
 #include <time.h>
 
-#define NUM_RESULTS_LIMIT -1
-/* 3/5 of gdkframeclockidle.c's FRAME_INTERVAL (16667 microsecs) */
-#define GTK_TREE_VIEW_TIME_MS_PER_IDLE 10
+/* History is fetched one page at a time, using the last loaded row as the
+ * keyset cursor for the next page. A new page is requested whenever less
+ * than one viewport of rows is left below the visible area. */
+#define NUM_RESULTS_PER_PAGE 100
 
 struct _EphyHistoryDialog {
   GtkDialog parent_instance;
@@ -62,8 +63,11 @@ struct _EphyHistoryDialog {
 
   GActionGroup *action_group;
 
-  GList *urls;
-  guint sorter_source;
+  GCancellable *page_cancellable;
+  EphyHistoryURL *last_url;
+  gboolean page_pending;
+  gboolean all_pages_loaded;
+  guint load_page_idle_id;
 
   char *search_text;
 
@@ -90,41 +94,7 @@ typedef enum {
   COLUMN_SYNC_ID
 } EphyHistoryDialogColumns;
 
-static gboolean
-add_urls_source (EphyHistoryDialog *self)
-{
-  EphyHistoryURL *url;
-  GTimer *timer;
-  GList *element;
-
-  if (self->urls == NULL) {
-    self->sorter_source = 0;
-    return G_SOURCE_REMOVE;
-  }
-
-  timer = g_timer_new ();
-  g_timer_start (timer);
-
-  do {
-    element = self->urls;
-    url = element->data;
-    gtk_list_store_insert_with_values (GTK_LIST_STORE (self->liststore),
-                                       NULL, G_MAXINT,
-                                       COLUMN_DATE, url->last_visit_time,
-                                       COLUMN_NAME, url->title,
-                                       COLUMN_LOCATION, url->url,
-                                       COLUMN_SYNC_ID, url->sync_id,
-                                       -1);
-    self->urls = g_list_remove_link (self->urls, element);
-    ephy_history_url_free (url);
-    g_list_free_1 (element);
-  } while (self->urls &&
-           g_timer_elapsed (timer, NULL) < GTK_TREE_VIEW_TIME_MS_PER_IDLE / 1000.);
-
-  g_timer_destroy (timer);
-
-  return G_SOURCE_CONTINUE;
-}
+static void schedule_load_next_page (EphyHistoryDialog *self);
 
 static void
 on_find_urls_cb (gpointer service,
@@ -133,22 +103,40 @@ on_find_urls_cb (gpointer service,
                  gpointer user_data)
 {
   EphyHistoryDialog *self = EPHY_HISTORY_DIALOG (user_data);
-  GtkTreeViewColumn *column;
+  EphyHistoryURLResults *urls = (EphyHistoryURLResults *)result_data;
+  guint n_urls;
+  guint i;
+
+  self->page_pending = FALSE;
 
   if (success != TRUE)
     return;
 
-  self->urls = (GList *)result_data;
+  n_urls = ephy_history_url_results_get_length (urls);
+  for (i = 0; i < n_urls; i++) {
+    EphyHistoryURL *url = ephy_history_url_results_get (urls, i);
 
-  gtk_tree_view_set_model (GTK_TREE_VIEW (self->treeview), NULL);
-  gtk_list_store_clear (GTK_LIST_STORE (self->liststore));
-  gtk_tree_view_set_model (GTK_TREE_VIEW (self->treeview), GTK_TREE_MODEL (self->liststore));
+    gtk_list_store_insert_with_values (GTK_LIST_STORE (self->liststore),
+                                       NULL, G_MAXINT,
+                                       COLUMN_DATE, url->last_visit_time,
+                                       COLUMN_NAME, url->title,
+                                       COLUMN_LOCATION, url->url,
+                                       COLUMN_SYNC_ID, url->sync_id,
+                                       -1);
+  }
 
-  column = gtk_tree_view_get_column (GTK_TREE_VIEW (self->treeview), self->sort_column);
-  gtk_tree_view_column_set_sort_order (column, self->sort_ascending ? GTK_SORT_ASCENDING : GTK_SORT_DESCENDING);
-  gtk_tree_view_column_set_sort_indicator (column, TRUE);
+  if (n_urls < NUM_RESULTS_PER_PAGE)
+    self->all_pages_loaded = TRUE;
+
+  if (n_urls > 0) {
+    ephy_history_url_free (self->last_url);
+    self->last_url = ephy_history_url_copy (ephy_history_url_results_get (urls, n_urls - 1));
+  }
+
+  ephy_history_url_results_free (urls);
 
-  self->sorter_source = g_idle_add ((GSourceFunc)add_urls_source, self);
+  /* The viewport might still not be filled, e.g. for a tall window. */
+  schedule_load_next_page (self);
 }
 
 static GList *
@@ -171,54 +159,133 @@ substrings_filter (EphyHistoryDialog *self)
   return substrings;
 }
 
+static EphyHistorySortType
+get_sort_type (EphyHistoryDialog *self)
+{
+  switch (self->sort_column) {
+    case COLUMN_DATE:
+      return self->sort_ascending ? EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED : EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+    case COLUMN_NAME:
+      return self->sort_ascending ? EPHY_HISTORY_SORT_TITLE_ASCENDING : EPHY_HISTORY_SORT_TITLE_DESCENDING;
+    case COLUMN_LOCATION:
+      return self->sort_ascending ? EPHY_HISTORY_SORT_URL_ASCENDING : EPHY_HISTORY_SORT_URL_DESCENDING;
+    default:
+      return EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
+  }
+}
+
+static gboolean
+needs_next_page (EphyHistoryDialog *self)
+{
+  GtkAdjustment *adjustment;
+  double page_size;
+  double remaining;
+
+  /* The first page is always needed. */
+  if (self->last_url == NULL)
+    return TRUE;
+
+  /* Wait until the tree view is allocated before fetching any more. */
+  adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self->treeview));
+  if (adjustment == NULL)
+    return FALSE;
+
+  page_size = gtk_adjustment_get_page_size (adjustment);
+  if (page_size <= 0)
+    return FALSE;
+
+  remaining = gtk_adjustment_get_upper (adjustment) -
+              (gtk_adjustment_get_value (adjustment) + page_size);
+
+  return remaining < page_size;
+}
+
+static void
+load_next_page (EphyHistoryDialog *self)
+{
+  EphyHistoryQuery *query;
+
+  if (self->history_service == NULL ||
+      self->page_pending ||
+      self->all_pages_loaded ||
+      !needs_next_page (self))
+    return;
+
+  query = ephy_history_query_new ();
+  query->substring_list = substrings_filter (self);
+  query->sort_type = get_sort_type (self);
+  query->limit = NUM_RESULTS_PER_PAGE;
+  query->after = ephy_history_url_copy (self->last_url);
+
+  self->page_pending = TRUE;
+  ephy_history_service_query_url_results (self->history_service, query,
+                                          self->page_cancellable,
+                                          (EphyHistoryJobCallback)on_find_urls_cb, self);
+  ephy_history_query_free (query);
+}
+
+static gboolean
+load_next_page_idle_cb (EphyHistoryDialog *self)
+{
+  self->load_page_idle_id = 0;
+  load_next_page (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* The adjustment changes many times while scrolling and while new rows are
+ * laid out, so only check whether a page is needed once things settled. */
+static void
+schedule_load_next_page (EphyHistoryDialog *self)
+{
+  if (self->load_page_idle_id)
+    return;
+
+  self->load_page_idle_id = g_idle_add ((GSourceFunc)load_next_page_idle_cb, self);
+  g_source_set_name_by_id (self->load_page_idle_id, "[epiphany] load_next_page_idle_cb");
+}
+
 static void
-remove_pending_sorter_source (EphyHistoryDialog *self)
+cancel_pending_page (EphyHistoryDialog *self)
 {
-  if (self->sorter_source != 0) {
-    g_source_remove (self->sorter_source);
-    self->sorter_source = 0;
+  if (self->load_page_idle_id) {
+    g_source_remove (self->load_page_idle_id);
+    self->load_page_idle_id = 0;
   }
 
-  if (self->urls != NULL) {
-    g_list_free_full (self->urls, (GDestroyNotify)ephy_history_url_free);
-    self->urls = NULL;
+  if (self->page_cancellable) {
+    g_cancellable_cancel (self->page_cancellable);
+    g_clear_object (&self->page_cancellable);
   }
+
+  self->page_pending = FALSE;
 }
 
 static void
 filter_now (EphyHistoryDialog *self)
 {
-  gint64 from, to;
-  GList *substrings;
-  EphyHistorySortType type;
+  GtkTreeViewColumn *column;
 
-  substrings = substrings_filter (self);
+  cancel_pending_page (self);
+  self->page_cancellable = g_cancellable_new ();
 
-  from = to = -1;       /* all */
+  g_clear_pointer (&self->last_url, ephy_history_url_free);
+  self->all_pages_loaded = FALSE;
 
-  switch (self->sort_column) {
-    case COLUMN_DATE:
-      type = self->sort_ascending ? EPHY_HISTORY_SORT_LEAST_RECENTLY_VISITED : EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
-      break;
-    case COLUMN_NAME:
-      type = self->sort_ascending ? EPHY_HISTORY_SORT_TITLE_ASCENDING : EPHY_HISTORY_SORT_TITLE_DESCENDING;
-      break;
-    case COLUMN_LOCATION:
-      type = self->sort_ascending ? EPHY_HISTORY_SORT_URL_ASCENDING : EPHY_HISTORY_SORT_URL_DESCENDING;
-      break;
-    default:
-      type = EPHY_HISTORY_SORT_MOST_RECENTLY_VISITED;
-  }
+  gtk_list_store_clear (GTK_LIST_STORE (self->liststore));
 
-  remove_pending_sorter_source (self);
+  column = gtk_tree_view_get_column (GTK_TREE_VIEW (self->treeview), self->sort_column);
+  gtk_tree_view_column_set_sort_order (column, self->sort_ascending ? GTK_SORT_ASCENDING : GTK_SORT_DESCENDING);
+  gtk_tree_view_column_set_sort_indicator (column, TRUE);
 
-  ephy_history_service_find_urls (self->history_service,
-                                  from, to,
-                                  NUM_RESULTS_LIMIT, 0,
-                                  substrings,
-                                  type,
-                                  self->cancellable,
-                                  (EphyHistoryJobCallback)on_find_urls_cb, self);
+  load_next_page (self);
+}
+
+static void
+on_vadjustment_changed (GtkAdjustment     *adjustment,
+                        EphyHistoryDialog *self)
+{
+  schedule_load_next_page (self);
 }
 
 static void
@@ -644,7 +711,8 @@ ephy_history_dialog_dispose (GObject *object)
                                           self);
   g_clear_object (&self->history_service);
 
-  remove_pending_sorter_source (self);
+  cancel_pending_page (self);
+  g_clear_pointer (&self->last_url, ephy_history_url_free);
 
   G_OBJECT_CLASS (ephy_history_dialog_parent_class)->dispose (object);
 }
@@ -772,6 +840,7 @@ static void
 ephy_history_dialog_init (EphyHistoryDialog *self)
 {
   EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  GtkAdjustment *adjustment;
   const char *tooltip;
   GAction *action;
 
@@ -779,10 +848,14 @@ ephy_history_dialog_init (EphyHistoryDialog *self)
 
   self->cancellable = g_cancellable_new ();
 
-  self->urls = NULL;
   self->sort_ascending = FALSE;
   self->sort_column = COLUMN_DATE;
-  self->sorter_source = 0;
+
+  adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (self->treeview));
+  g_signal_connect_object (adjustment, "value-changed",
+                           G_CALLBACK (on_vadjustment_changed), self, 0);
+  g_signal_connect_object (adjustment, "changed",
+                           G_CALLBACK (on_vadjustment_changed), self, 0);
 
   ephy_gui_ensure_window_group (GTK_WINDOW (self));
 
@@ -28,6 +28,7 @@
 #include "ephy-session.h"
 #include "ephy-settings.h"
 #include "ephy-shell.h"
+#include "ephy-startup-timeline.h"
 #include "ephy-string.h"
 #include "ephy-web-app-utils.h"
 
@@ -261,6 +262,7 @@ main (int   argc,
 
   /* Initialise our debug helpers */
   ephy_debug_init ();
+  ephy_startup_timeline_mark ("main");
 
   /* get this early, since gdk will unset the env var */
   user_time = get_startup_id ();
@@ -339,6 +341,7 @@ main (int   argc,
   if (!ephy_file_helpers_init (profile_directory, flags, &error)) {
     g_error ("Fatal initialization error: %s", error->message);
   }
+  ephy_startup_timeline_mark ("file-helpers");
 
   /* Run the migration in all cases, except when running a private
      instance without a given profile directory or running in
@@ -350,6 +353,7 @@ main (int   argc,
       exit (1);
     }
   }
+  ephy_startup_timeline_mark ("profile-migration");
 
   arbitrary_url = g_settings_get_boolean (EPHY_SETTINGS_LOCKDOWN,
                                           EPHY_PREFS_LOCKDOWN_ARBITRARY_URL);
@@ -429,6 +433,7 @@ main (int   argc,
   g_unix_signal_add (SIGINT, (GSourceFunc)handle_shutdown_signal, GINT_TO_POINTER (SIGINT));
   g_unix_signal_add (SIGTERM, (GSourceFunc)handle_shutdown_signal, GINT_TO_POINTER (SIGTERM));
 
+  ephy_startup_timeline_mark ("shell-created");
   status = g_application_run (G_APPLICATION (ephy_shell), argc, argv);
 
   /* Shutdown */
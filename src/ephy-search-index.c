@@ -0,0 +1,656 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-search-index.h"
+
+#include "ephy-debug.h"
+#include "ephy-favicon-helpers.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+/* The index is a GVariant of type a(ssssub), one (url, title, haystack,
+ * icon, visit_count, is_bookmark) tuple per URL, sorted by relevance:
+ * bookmarks first, then by visit count. The haystack is the casefolded title,
+ * URL and tags, so that queries are plain substring searches over mapped
+ * memory. The icon is the path of a PNG copy of the favicon, which the
+ * reader can't get from the browser's favicon database, or "". */
+#define SEARCH_INDEX_TYPE G_VARIANT_TYPE ("a(ssssub)")
+#define SEARCH_INDEX_MAX_HISTORY_URLS 1000
+#define SEARCH_INDEX_FAVICONS_DIR "search-favicons"
+
+struct _EphySearchIndex {
+  GObject parent_instance;
+
+  char *filename;
+  GFileMonitor *monitor;
+  gboolean stale;
+
+  GMappedFile *mapped_file;
+  GVariant *entries;
+  GHashTable *positions;
+};
+
+G_DEFINE_TYPE (EphySearchIndex, ephy_search_index, G_TYPE_OBJECT)
+
+static void
+ephy_search_index_unload (EphySearchIndex *index)
+{
+  g_clear_pointer (&index->positions, g_hash_table_unref);
+  g_clear_pointer (&index->entries, g_variant_unref);
+  g_clear_pointer (&index->mapped_file, g_mapped_file_unref);
+}
+
+static void
+ephy_search_index_load (EphySearchIndex *index)
+{
+  GBytes *bytes;
+  GVariant *variant;
+  GError *error = NULL;
+
+  ephy_search_index_unload (index);
+  index->stale = FALSE;
+
+  index->mapped_file = g_mapped_file_new (index->filename, FALSE, &error);
+  if (!index->mapped_file) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Failed to load search index %s: %s", index->filename, error->message);
+    g_error_free (error);
+    return;
+  }
+
+  bytes = g_mapped_file_get_bytes (index->mapped_file);
+  variant = g_variant_new_from_bytes (SEARCH_INDEX_TYPE, bytes, FALSE);
+  g_bytes_unref (bytes);
+
+  /* The file is written by the browser, but don't trust it blindly. */
+  if (!g_variant_is_normal_form (variant)) {
+    g_warning ("Search index %s is corrupted, ignoring it", index->filename);
+    g_variant_unref (variant);
+    g_clear_pointer (&index->mapped_file, g_mapped_file_unref);
+    return;
+  }
+
+  index->entries = g_variant_ref_sink (variant);
+  LOG ("Loaded search index with %" G_GSIZE_FORMAT " entries", g_variant_n_children (index->entries));
+}
+
+static void
+ensure_loaded (EphySearchIndex *index)
+{
+  if (index->stale)
+    ephy_search_index_load (index);
+}
+
+static void
+file_changed_cb (GFileMonitor      *monitor,
+                 GFile             *file,
+                 GFile             *other_file,
+                 GFileMonitorEvent  event_type,
+                 EphySearchIndex   *index)
+{
+  /* Reload lazily, the browser may replace the file several times. */
+  if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event_type == G_FILE_MONITOR_EVENT_CREATED ||
+      event_type == G_FILE_MONITOR_EVENT_DELETED ||
+      event_type == G_FILE_MONITOR_EVENT_RENAMED)
+    index->stale = TRUE;
+}
+
+static void
+ephy_search_index_dispose (GObject *object)
+{
+  EphySearchIndex *index = EPHY_SEARCH_INDEX (object);
+
+  if (index->monitor) {
+    g_signal_handlers_disconnect_by_func (index->monitor, file_changed_cb, index);
+    g_clear_object (&index->monitor);
+  }
+
+  G_OBJECT_CLASS (ephy_search_index_parent_class)->dispose (object);
+}
+
+static void
+ephy_search_index_finalize (GObject *object)
+{
+  EphySearchIndex *index = EPHY_SEARCH_INDEX (object);
+
+  ephy_search_index_unload (index);
+  g_free (index->filename);
+
+  G_OBJECT_CLASS (ephy_search_index_parent_class)->finalize (object);
+}
+
+static void
+ephy_search_index_class_init (EphySearchIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_search_index_dispose;
+  object_class->finalize = ephy_search_index_finalize;
+}
+
+static void
+ephy_search_index_init (EphySearchIndex *index)
+{
+}
+
+/**
+ * ephy_search_index_new:
+ * @filename: the index file written by ephy_search_index_rebuild()
+ *
+ * Maps the search index in memory. The index is reloaded when the file
+ * changes. It is never modified by the reader.
+ *
+ * Returns: (transfer full): a new #EphySearchIndex
+ **/
+EphySearchIndex *
+ephy_search_index_new (const char *filename)
+{
+  EphySearchIndex *index;
+  GFile *file;
+
+  index = g_object_new (EPHY_TYPE_SEARCH_INDEX, NULL);
+  index->filename = g_strdup (filename);
+
+  file = g_file_new_for_path (filename);
+  index->monitor = g_file_monitor_file (file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+  if (index->monitor)
+    g_signal_connect (index->monitor, "changed", G_CALLBACK (file_changed_cb), index);
+  g_object_unref (file);
+
+  ephy_search_index_load (index);
+
+  return index;
+}
+
+/**
+ * ephy_search_index_query:
+ * @index: an #EphySearchIndex
+ * @terms: the search terms
+ * @max_results: the maximum number of results
+ *
+ * Finds the most relevant URLs matching all of @terms, case insensitively,
+ * in their title, address or tags.
+ *
+ * Returns: (transfer full): a %NULL-terminated array of URLs
+ **/
+char **
+ephy_search_index_query (EphySearchIndex  *index,
+                         char            **terms,
+                         guint             max_results)
+{
+  GPtrArray *results;
+  GPtrArray *needles;
+  gsize i, n_entries;
+
+  g_assert (EPHY_IS_SEARCH_INDEX (index));
+
+  ensure_loaded (index);
+
+  results = g_ptr_array_new ();
+  if (!index->entries)
+    goto out;
+
+  needles = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; terms[i]; i++) {
+    if (*terms[i])
+      g_ptr_array_add (needles, g_utf8_casefold (terms[i], -1));
+  }
+
+  n_entries = g_variant_n_children (index->entries);
+  for (i = 0; i < n_entries && results->len < max_results; i++) {
+    const char *url;
+    const char *haystack;
+    guint j;
+
+    g_variant_get_child (index->entries, i, "(&s&s&s&sub)", &url, NULL, &haystack, NULL, NULL, NULL);
+
+    for (j = 0; j < needles->len; j++) {
+      if (!strstr (haystack, g_ptr_array_index (needles, j)))
+        break;
+    }
+
+    if (j == needles->len)
+      g_ptr_array_add (results, g_strdup (url));
+  }
+
+  g_ptr_array_free (needles, TRUE);
+
+out:
+  g_ptr_array_add (results, NULL);
+
+  return (char **)g_ptr_array_free (results, FALSE);
+}
+
+/**
+ * ephy_search_index_lookup:
+ * @index: an #EphySearchIndex
+ * @url: a URL returned by ephy_search_index_query()
+ * @title: (out) (transfer none): return location for the title
+ * @icon: (out) (transfer none): return location for the path of the
+ *   favicon of @url, or %NULL if it has none
+ * @is_bookmark: (out): return location for whether @url is bookmarked
+ *
+ * Returns: %TRUE if @url is in the index
+ **/
+gboolean
+ephy_search_index_lookup (EphySearchIndex  *index,
+                          const char       *url,
+                          const char      **title,
+                          const char      **icon,
+                          gboolean         *is_bookmark)
+{
+  gpointer position;
+
+  g_assert (EPHY_IS_SEARCH_INDEX (index));
+
+  if (!index->entries)
+    return FALSE;
+
+  if (!index->positions) {
+    gsize i, n_entries = g_variant_n_children (index->entries);
+
+    index->positions = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < n_entries; i++) {
+      const char *entry_url;
+
+      g_variant_get_child (index->entries, i, "(&s&s&s&sub)", &entry_url, NULL, NULL, NULL, NULL, NULL);
+      g_hash_table_insert (index->positions, (char *)entry_url, GSIZE_TO_POINTER (i + 1));
+    }
+  }
+
+  position = g_hash_table_lookup (index->positions, url);
+  if (!position)
+    return FALSE;
+
+  g_variant_get_child (index->entries, GPOINTER_TO_SIZE (position) - 1, "(&s&s&s&sub)",
+                       NULL, title, NULL, icon, NULL, is_bookmark);
+
+  if (icon && !**icon)
+    *icon = NULL;
+
+  return TRUE;
+}
+
+typedef struct {
+  char *url;
+  char *title;
+  char *haystack;
+  char *icon;
+  guint visit_count;
+  gboolean is_bookmark;
+} IndexEntry;
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+  g_free (entry->url);
+  g_free (entry->title);
+  g_free (entry->haystack);
+  g_free (entry->icon);
+  g_free (entry);
+}
+
+static IndexEntry *
+index_entry_new (const char *url,
+                 const char *title,
+                 const char *tags,
+                 guint       visit_count,
+                 gboolean    is_bookmark)
+{
+  IndexEntry *entry = g_new (IndexEntry, 1);
+  char *haystack;
+
+  entry->url = g_strdup (url);
+  entry->title = g_strdup (title ? title : "");
+  entry->icon = NULL;
+  entry->visit_count = visit_count;
+  entry->is_bookmark = is_bookmark;
+
+  /* Separate the fields so that no term can match across them. */
+  haystack = g_strjoin ("\n", entry->title, url, tags ? tags : "", NULL);
+  entry->haystack = g_utf8_casefold (haystack, -1);
+  g_free (haystack);
+
+  return entry;
+}
+
+static int
+compare_relevance (IndexEntry **a,
+                   IndexEntry **b)
+{
+  if ((*a)->is_bookmark != (*b)->is_bookmark)
+    return (*a)->is_bookmark ? -1 : 1;
+
+  return (*a)->visit_count > (*b)->visit_count ? -1 : (*a)->visit_count < (*b)->visit_count;
+}
+
+typedef struct {
+  GVariant *variant;
+  char *filename;
+  char *favicons_dir;
+  /* Favicon path -> URL of a page using it. */
+  GHashTable *icons;
+} WriteIndexData;
+
+static void
+write_index_data_free (WriteIndexData *data)
+{
+  g_variant_unref (data->variant);
+  g_free (data->filename);
+  g_free (data->favicons_dir);
+  g_hash_table_unref (data->icons);
+  g_free (data);
+}
+
+static void
+write_index_thread (GTask          *task,
+                    gpointer        source_object,
+                    WriteIndexData *data,
+                    GCancellable   *cancellable)
+{
+  GHashTable *missing;
+  GHashTableIter iter;
+  gpointer path, url;
+  GDir *dir;
+  const char *name;
+  GError *error = NULL;
+
+  if (!g_file_set_contents (data->filename,
+                            g_variant_get_data (data->variant),
+                            g_variant_get_size (data->variant),
+                            &error)) {
+    g_warning ("Failed to write search index %s: %s", data->filename, error->message);
+    g_clear_error (&error);
+  }
+
+  /* Drop the favicons no longer in the index, and report the ones that
+   * still need to be saved. */
+  dir = g_dir_open (data->favicons_dir, 0, NULL);
+  while (dir && (name = g_dir_read_name (dir))) {
+    char *file = g_build_filename (data->favicons_dir, name, NULL);
+
+    if (!g_hash_table_contains (data->icons, file))
+      g_unlink (file);
+    g_free (file);
+  }
+  g_clear_pointer (&dir, g_dir_close);
+
+  missing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_iter_init (&iter, data->icons);
+  while (g_hash_table_iter_next (&iter, &path, &url)) {
+    if (!g_file_test (path, G_FILE_TEST_EXISTS))
+      g_hash_table_insert (missing, g_strdup (path), g_strdup (url));
+  }
+
+  if (g_hash_table_size (missing) > 0)
+    g_mkdir_with_parents (data->favicons_dir, 0700);
+
+  g_task_return_pointer (task, missing, (GDestroyNotify)g_hash_table_unref);
+}
+
+static void
+save_favicon_thread (GTask        *task,
+                     GdkPixbuf    *favicon,
+                     const char   *path,
+                     GCancellable *cancellable)
+{
+  char *buffer = NULL;
+  gsize size;
+  GError *error = NULL;
+
+  if (!gdk_pixbuf_save_to_buffer (favicon, &buffer, &size, "png", &error, NULL) ||
+      !g_file_set_contents (path, buffer, size, &error)) {
+    g_warning ("Failed to save favicon %s: %s", path, error->message);
+    g_error_free (error);
+  }
+  g_free (buffer);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+get_favicon_cb (WebKitFaviconDatabase *database,
+                GAsyncResult          *result,
+                char                  *path)
+{
+  cairo_surface_t *surface;
+  GdkPixbuf *favicon;
+  GTask *task;
+
+  surface = webkit_favicon_database_get_favicon_finish (database, result, NULL);
+  favicon = ephy_pixbuf_get_from_surface_scaled (surface, 0, 0);
+  g_clear_pointer (&surface, cairo_surface_destroy);
+
+  if (favicon) {
+    task = g_task_new (favicon, NULL, NULL, NULL);
+    g_task_set_task_data (task, g_strdup (path), g_free);
+    g_task_run_in_thread (task, (GTaskThreadFunc)save_favicon_thread);
+    g_object_unref (task);
+    g_object_unref (favicon);
+  }
+
+  g_free (path);
+}
+
+static void
+write_index_cb (WebKitFaviconDatabase *database,
+                GAsyncResult          *result,
+                gpointer               user_data)
+{
+  GHashTable *missing;
+  GHashTableIter iter;
+  gpointer path, url;
+
+  missing = g_task_propagate_pointer (G_TASK (result), NULL);
+  if (!missing)
+    return;
+
+  /* Saved favicons are picked up by the search provider as soon as they
+   * exist, there is no need to write the index again. */
+  g_hash_table_iter_init (&iter, missing);
+  while (g_hash_table_iter_next (&iter, &path, &url)) {
+    webkit_favicon_database_get_favicon (database, url, NULL,
+                                         (GAsyncReadyCallback)get_favicon_cb,
+                                         g_strdup (path));
+  }
+
+  g_hash_table_unref (missing);
+}
+
+typedef struct {
+  EphyBookmarksManager *bookmarks_manager;
+  WebKitFaviconDatabase *favicon_database;
+  char *filename;
+} RebuildData;
+
+static void
+rebuild_data_free (RebuildData *data)
+{
+  g_clear_object (&data->bookmarks_manager);
+  g_clear_object (&data->favicon_database);
+  g_free (data->filename);
+  g_free (data);
+}
+
+static void
+index_entry_set_icon (IndexEntry            *entry,
+                      WebKitFaviconDatabase *database,
+                      const char            *favicons_dir,
+                      GHashTable            *icons)
+{
+  char *favicon_uri;
+  char *checksum;
+  char *name;
+
+  favicon_uri = webkit_favicon_database_get_favicon_uri (database, entry->url);
+  if (!favicon_uri)
+    return;
+
+  /* Pages sharing a favicon share its file too. */
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, favicon_uri, -1);
+  name = g_strconcat (checksum, ".png", NULL);
+  entry->icon = g_build_filename (favicons_dir, name, NULL);
+
+  if (!g_hash_table_contains (icons, entry->icon))
+    g_hash_table_insert (icons, g_strdup (entry->icon), g_strdup (entry->url));
+
+  g_free (name);
+  g_free (checksum);
+  g_free (favicon_uri);
+}
+
+static void
+query_urls_cb (EphyHistoryService *service,
+               gboolean            success,
+               GList              *urls,
+               RebuildData        *data)
+{
+  GHashTable *bookmarked;
+  GPtrArray *entries;
+  GVariantBuilder builder;
+  WriteIndexData *write_data;
+  GSequence *bookmarks;
+  char *dirname;
+  GSequenceIter *iter;
+  GTask *task;
+  guint i;
+
+  if (!success)
+    goto out;
+
+  entries = g_ptr_array_new_with_free_func ((GDestroyNotify)index_entry_free);
+  bookmarked = g_hash_table_new (g_str_hash, g_str_equal);
+
+  bookmarks = ephy_bookmarks_manager_get_bookmarks (data->bookmarks_manager);
+  for (iter = g_sequence_get_begin_iter (bookmarks);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    EphyBookmark *bookmark = g_sequence_get (iter);
+    GSequence *tags = ephy_bookmark_get_tags (bookmark);
+    GSequenceIter *tag_iter;
+    GString *tag_string;
+
+    if (g_hash_table_contains (bookmarked, ephy_bookmark_get_url (bookmark)))
+      continue;
+
+    tag_string = g_string_new (NULL);
+    for (tag_iter = g_sequence_get_begin_iter (tags);
+         !g_sequence_iter_is_end (tag_iter);
+         tag_iter = g_sequence_iter_next (tag_iter)) {
+      g_string_append (tag_string, g_sequence_get (tag_iter));
+      g_string_append_c (tag_string, ' ');
+    }
+
+    g_hash_table_add (bookmarked, (char *)ephy_bookmark_get_url (bookmark));
+    g_ptr_array_add (entries, index_entry_new (ephy_bookmark_get_url (bookmark),
+                                               ephy_bookmark_get_title (bookmark),
+                                               tag_string->str, 0, TRUE));
+    g_string_free (tag_string, TRUE);
+  }
+
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    if (g_hash_table_contains (bookmarked, url->url))
+      continue;
+
+    g_ptr_array_add (entries, index_entry_new (url->url, url->title, NULL,
+                                               MAX (url->visit_count, 0), FALSE));
+  }
+
+  g_ptr_array_sort (entries, (GCompareFunc)compare_relevance);
+
+  write_data = g_new0 (WriteIndexData, 1);
+  write_data->filename = g_strdup (data->filename);
+  write_data->icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  dirname = g_path_get_dirname (data->filename);
+  write_data->favicons_dir = g_build_filename (dirname, SEARCH_INDEX_FAVICONS_DIR, NULL);
+  g_free (dirname);
+
+  g_variant_builder_init (&builder, SEARCH_INDEX_TYPE);
+  for (i = 0; i < entries->len; i++) {
+    IndexEntry *entry = g_ptr_array_index (entries, i);
+
+    if (data->favicon_database)
+      index_entry_set_icon (entry, data->favicon_database, write_data->favicons_dir, write_data->icons);
+
+    g_variant_builder_add (&builder, "(ssssub)",
+                           entry->url, entry->title, entry->haystack,
+                           entry->icon ? entry->icon : "",
+                           entry->visit_count, entry->is_bookmark);
+  }
+  write_data->variant = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  LOG ("Writing search index with %u entries", entries->len);
+
+  task = g_task_new (data->favicon_database, NULL,
+                     data->favicon_database ? (GAsyncReadyCallback)write_index_cb : NULL,
+                     NULL);
+  g_task_set_task_data (task, write_data, (GDestroyNotify)write_index_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)write_index_thread);
+  g_object_unref (task);
+
+  g_hash_table_unref (bookmarked);
+  g_ptr_array_free (entries, TRUE);
+
+out:
+  g_list_free_full (urls, (GDestroyNotify)ephy_history_url_free);
+  rebuild_data_free (data);
+}
+
+/**
+ * ephy_search_index_rebuild:
+ * @history_service: the history service
+ * @bookmarks_manager: the bookmarks manager
+ * @favicon_database: (nullable): the favicon database
+ * @filename: the file to write the index to
+ *
+ * Asynchronously writes a new search index with all bookmarks and the most
+ * visited history URLs, replacing @filename atomically. The favicons found
+ * in @favicon_database are saved next to it.
+ **/
+void
+ephy_search_index_rebuild (EphyHistoryService    *history_service,
+                           EphyBookmarksManager  *bookmarks_manager,
+                           WebKitFaviconDatabase *favicon_database,
+                           const char            *filename)
+{
+  EphyHistoryQuery *query;
+  RebuildData *data;
+
+  data = g_new0 (RebuildData, 1);
+  data->bookmarks_manager = g_object_ref (bookmarks_manager);
+  if (favicon_database)
+    data->favicon_database = g_object_ref (favicon_database);
+  data->filename = g_strdup (filename);
+
+  query = ephy_history_query_new ();
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+  query->limit = SEARCH_INDEX_MAX_HISTORY_URLS;
+  query->ignore_hidden = TRUE;
+
+  ephy_history_service_query_urls (history_service, query, NULL,
+                                   (EphyHistoryJobCallback)query_urls_cb,
+                                   data);
+  ephy_history_query_free (query);
+}
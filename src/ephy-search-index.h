@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-bookmarks-manager.h"
+#include "ephy-history-service.h"
+
+#include <glib-object.h>
+#include <webkit2/webkit2.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_SEARCH_INDEX_FILE "search-index.gvariant"
+
+#define EPHY_TYPE_SEARCH_INDEX (ephy_search_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphySearchIndex, ephy_search_index, EPHY, SEARCH_INDEX, GObject)
+
+EphySearchIndex *ephy_search_index_new     (const char            *filename);
+char           **ephy_search_index_query   (EphySearchIndex       *index,
+                                            char                 **terms,
+                                            guint                  max_results);
+gboolean         ephy_search_index_lookup  (EphySearchIndex       *index,
+                                            const char            *url,
+                                            const char           **title,
+                                            const char           **icon,
+                                            gboolean              *is_bookmark);
+
+void             ephy_search_index_rebuild (EphyHistoryService    *history_service,
+                                            EphyBookmarksManager  *bookmarks_manager,
+                                            WebKitFaviconDatabase *favicon_database,
+                                            const char            *filename);
+
+G_END_DECLS
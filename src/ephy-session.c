@@ -578,7 +578,12 @@ session_tab_new (EphyEmbed   *embed,
                           !session->closing);
   session_tab->crashed = (error_page == EPHY_WEB_VIEW_ERROR_PAGE_CRASH ||
                           error_page == EPHY_WEB_VIEW_ERROR_PROCESS_CRASH);
-  session_tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
+  /* Tabs that were not loaded yet, or were discarded, show a placeholder:
+   * save the history that will be restored instead. */
+  if (ephy_embed_has_load_pending (embed) && ephy_embed_get_delayed_session_state (embed))
+    session_tab->state = webkit_web_view_session_state_ref (ephy_embed_get_delayed_session_state (embed));
+  else
+    session_tab->state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (web_view));
 
   return session_tab;
 }
@@ -1012,7 +1017,7 @@ confirm_before_recover (EphyWindow *window, const char *url, const char *title)
   EphyEmbed *embed;
 
   embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
-                                   title, NULL,
+                                   title, NULL, NULL,
                                    window, NULL,
                                    EPHY_NEW_TAB_APPEND_LAST,
                                    0);
@@ -1149,6 +1154,7 @@ session_parse_embed (SessionParserContext *context,
 
     embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
                                      title, NULL,
+                                     is_blank_page ? NULL : url,
                                      context->window, NULL, flags,
                                      0);
 
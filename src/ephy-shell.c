@@ -34,8 +34,10 @@
 #include "ephy-lockdown.h"
 #include "ephy-notification.h"
 #include "ephy-prefs.h"
+#include "ephy-search-index.h"
 #include "ephy-session.h"
 #include "ephy-settings.h"
+#include "ephy-startup-timeline.h"
 #include "ephy-sync-utils.h"
 #include "ephy-title-box.h"
 #include "ephy-title-widget.h"
@@ -57,9 +59,11 @@ struct _EphyShell {
   GList *windows;
   GObject *lockdown;
   EphyBookmarksManager *bookmarks_manager;
-  EphyPasswordManager *password_manager;
   EphyHistoryManager *history_manager;
   EphyOpenTabsManager *open_tabs_manager;
+  EphyTabDiscarder *tab_discarder;
+  guint search_index_timeout_id;
+  guint search_index_update_id;
   GNetworkMonitor *network_monitor;
   GtkWidget *history_dialog;
   GObject *prefs_dialog;
@@ -70,6 +74,11 @@ struct _EphyShell {
 
 static EphyShell *ephy_shell = NULL;
 
+/* Rebuild the search provider index regularly, and soon after history or
+ * bookmarks are removed so that it doesn't keep forgotten URLs around. */
+#define SEARCH_INDEX_REBUILD_INTERVAL (30 * 60)
+#define SEARCH_INDEX_UPDATE_DELAY 30
+
 static void ephy_shell_dispose (GObject *object);
 static void ephy_shell_finalize (GObject *object);
 
@@ -377,6 +386,110 @@ sync_secrets_load_finished_cb (EphySyncService *service,
   ephy_sync_service_start_sync (service);
 }
 
+static void
+ephy_shell_rebuild_search_index (EphyShell *shell)
+{
+  EphyEmbedShell *embed_shell = EPHY_EMBED_SHELL (shell);
+  char *filename;
+
+  filename = g_build_filename (ephy_dot_dir (), EPHY_SEARCH_INDEX_FILE, NULL);
+  ephy_search_index_rebuild (ephy_embed_shell_get_global_history_service (embed_shell),
+                             ephy_shell_get_bookmarks_manager (shell),
+                             webkit_web_context_get_favicon_database (ephy_embed_shell_get_web_context (embed_shell)),
+                             filename);
+  g_free (filename);
+}
+
+static gboolean
+search_index_timeout_cb (EphyShell *shell)
+{
+  ephy_shell_rebuild_search_index (shell);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+search_index_update_cb (EphyShell *shell)
+{
+  shell->search_index_update_id = 0;
+  ephy_shell_rebuild_search_index (shell);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ephy_shell_schedule_search_index_update (EphyShell *shell)
+{
+  if (shell->search_index_update_id)
+    return;
+
+  shell->search_index_update_id = g_timeout_add_seconds (SEARCH_INDEX_UPDATE_DELAY,
+                                                         (GSourceFunc)search_index_update_cb,
+                                                         shell);
+  g_source_set_name_by_id (shell->search_index_update_id, "[epiphany] search_index_update_cb");
+}
+
+static void
+history_cleared_cb (EphyHistoryService *service,
+                    EphyShell          *shell)
+{
+  if (shell->search_index_update_id) {
+    g_source_remove (shell->search_index_update_id);
+    shell->search_index_update_id = 0;
+  }
+
+  ephy_shell_rebuild_search_index (shell);
+}
+
+static void
+ephy_shell_setup_search_index (EphyShell *shell)
+{
+  EphyHistoryService *service;
+  EphyBookmarksManager *manager;
+
+  service = ephy_embed_shell_get_global_history_service (EPHY_EMBED_SHELL (shell));
+  manager = ephy_shell_get_bookmarks_manager (shell);
+
+  g_signal_connect_object (service, "cleared",
+                           G_CALLBACK (history_cleared_cb), shell, 0);
+  g_signal_connect_object (service, "url-deleted",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (service, "host-deleted",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (service, "visit-url",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (service, "url-title-changed",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-added",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-removed",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-title-changed",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-url-changed",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-tag-added",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "bookmark-tag-removed",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+  g_signal_connect_object (manager, "tag-deleted",
+                           G_CALLBACK (ephy_shell_schedule_search_index_update), shell, G_CONNECT_SWAPPED);
+
+  ephy_shell_schedule_search_index_update (shell);
+
+  shell->search_index_timeout_id = g_timeout_add_seconds (SEARCH_INDEX_REBUILD_INTERVAL,
+                                                          (GSourceFunc)search_index_timeout_cb,
+                                                          shell);
+  g_source_set_name_by_id (shell->search_index_timeout_id, "[epiphany] search_index_timeout_cb");
+}
+
+static void
+start_sync_deferred (EphyEmbedShell *embed_shell)
+{
+  /* Create the sync service, which starts syncing periodically. */
+  ephy_shell_get_sync_service (EPHY_SHELL (embed_shell));
+}
+
 static void
 ephy_shell_startup (GApplication *application)
 {
@@ -416,13 +529,19 @@ ephy_shell_startup (GApplication *application)
                               G_BINDING_SYNC_CREATE);
 
       if (mode == EPHY_EMBED_SHELL_MODE_BROWSER && ephy_sync_utils_user_is_signed_in ()) {
-        /* Create the sync service. */
-        ephy_shell_get_sync_service (shell);
+        ephy_embed_shell_defer_init (embed_shell, "sync", EPHY_DEFERRED_INIT_PRIORITY_SYNC,
+                                     start_sync_deferred);
       }
+
+      if (mode == EPHY_EMBED_SHELL_MODE_BROWSER)
+        ephy_shell_setup_search_index (shell);
     }
 
     gtk_application_set_app_menu (GTK_APPLICATION (application),
                                   G_MENU_MODEL (gtk_builder_get_object (builder, "app-menu")));
+
+    if (mode != EPHY_EMBED_SHELL_MODE_TEST)
+      shell->tab_discarder = ephy_tab_discarder_new ();
   } else {
     g_action_map_add_action_entries (G_ACTION_MAP (application),
                                      app_mode_app_entries, G_N_ELEMENTS (app_mode_app_entries),
@@ -432,6 +551,7 @@ ephy_shell_startup (GApplication *application)
   }
 
   g_object_unref (builder);
+  ephy_startup_timeline_mark ("shell-startup");
 }
 
 static void
@@ -689,9 +809,19 @@ ephy_shell_dispose (GObject *object)
   g_clear_object (&shell->network_monitor);
   g_clear_object (&shell->sync_service);
   g_clear_object (&shell->bookmarks_manager);
-  g_clear_object (&shell->password_manager);
   g_clear_object (&shell->history_manager);
   g_clear_object (&shell->open_tabs_manager);
+  g_clear_object (&shell->tab_discarder);
+
+  if (shell->search_index_timeout_id) {
+    g_source_remove (shell->search_index_timeout_id);
+    shell->search_index_timeout_id = 0;
+  }
+
+  if (shell->search_index_update_id) {
+    g_source_remove (shell->search_index_update_id);
+    shell->search_index_update_id = 0;
+  }
 
   g_slist_free_full (shell->open_uris_idle_ids, remove_open_uris_idle_cb);
   shell->open_uris_idle_ids = NULL;
@@ -728,6 +858,8 @@ ephy_shell_get_default (void)
 /**
  * ephy_shell_new_tab_full:
  * @shell: a #EphyShell
+ * @related_view: the view to share a web process with, or %NULL
+ * @address: the address the tab is about to load, or %NULL
  * @window: the target #EphyWindow or %NULL
  * @previous_embed: the referrer embed, or %NULL
  * @user_time: a timestamp, or 0
@@ -735,18 +867,23 @@ ephy_shell_get_default (void)
  * Create a new tab and the parent window when necessary.
  * Use this function to open urls in new window/tabs.
  *
+ * Unless @related_view is given, the process scheduler decides which web
+ * process the tab goes to from @address.
+ *
  * Return value: (transfer none): the created #EphyEmbed
  **/
 EphyEmbed *
 ephy_shell_new_tab_full (EphyShell      *shell,
                          const char     *title,
                          WebKitWebView  *related_view,
+                         const char     *address,
                          EphyWindow     *window,
                          EphyEmbed      *previous_embed,
                          EphyNewTabFlags flags,
                          guint32         user_time)
 {
   EphyEmbedShell *embed_shell;
+  EphyProcessScheduler *scheduler;
   GtkWidget *web_view;
   EphyEmbed *embed = NULL;
   gboolean jump_to = FALSE;
@@ -776,6 +913,10 @@ ephy_shell_new_tab_full (EphyShell      *shell,
   if (flags & EPHY_NEW_TAB_FIRST)
     position = 0;
 
+  scheduler = ephy_embed_shell_get_process_scheduler (embed_shell);
+  if (!related_view && scheduler && address && address[0] != '\0')
+    related_view = ephy_process_scheduler_get_related_view (scheduler, address);
+
   if (related_view)
     web_view = ephy_web_view_new_with_related_view (related_view);
   else
@@ -813,7 +954,7 @@ ephy_shell_new_tab (EphyShell      *shell,
                     EphyEmbed      *previous_embed,
                     EphyNewTabFlags flags)
 {
-  return ephy_shell_new_tab_full (shell, NULL, NULL, parent_window,
+  return ephy_shell_new_tab_full (shell, NULL, NULL, NULL, parent_window,
                                   previous_embed, flags,
                                   0);
 }
@@ -904,10 +1045,7 @@ ephy_shell_get_password_manager (EphyShell *shell)
 {
   g_assert (EPHY_IS_SHELL (shell));
 
-  if (shell->password_manager == NULL)
-    shell->password_manager = ephy_password_manager_new ();
-
-  return shell->password_manager;
+  return ephy_embed_shell_get_password_manager (EPHY_EMBED_SHELL (shell));
 }
 
 /**
@@ -946,6 +1084,19 @@ ephy_shell_get_open_tabs_manager (EphyShell *shell)
   return shell->open_tabs_manager;
 }
 
+/**
+ * ephy_shell_get_tab_discarder:
+ *
+ * Return value: (transfer none) (nullable):
+ **/
+EphyTabDiscarder *
+ephy_shell_get_tab_discarder (EphyShell *shell)
+{
+  g_assert (EPHY_IS_SHELL (shell));
+
+  return shell->tab_discarder;
+}
+
 /**
  * ephy_shell_get_net_monitor:
  *
@@ -1175,16 +1326,16 @@ ephy_shell_open_uris_idle (OpenURIsData *data)
       reusing_empty_tab = TRUE;
   }
 
+  url = data->uris ? data->uris[data->current_uri] : NULL;
+
   if (!reusing_empty_tab) {
     embed = ephy_shell_new_tab_full (data->shell,
-                                     NULL, NULL,
+                                     NULL, NULL, url,
                                      data->window,
                                      data->previous_embed,
                                      data->flags | page_flags,
                                      data->user_time);
   }
-
-  url = data->uris ? data->uris[data->current_uri] : NULL;
   if (url && url[0] != '\0') {
     ephy_web_view_load_url (ephy_embed_get_web_view (embed), url);
 
@@ -30,6 +30,7 @@
 #include "ephy-password-manager.h"
 #include "ephy-session.h"
 #include "ephy-sync-service.h"
+#include "ephy-tab-discarder.h"
 #include "ephy-window.h"
 
 #include <webkit2/webkit2.h>
@@ -94,6 +95,7 @@ EphyEmbed      *ephy_shell_new_tab                      (EphyShell *shell,
 EphyEmbed      *ephy_shell_new_tab_full                 (EphyShell *shell,
                                                          const char *title,
                                                          WebKitWebView *related_view,
+                                                         const char *address,
                                                          EphyWindow *parent_window,
                                                          EphyEmbed *previous_embed,
                                                          EphyNewTabFlags flags,
@@ -111,6 +113,8 @@ EphyHistoryManager *ephy_shell_get_history_manager       (EphyShell *shell);
 
 EphyOpenTabsManager *ephy_shell_get_open_tabs_manager    (EphyShell *shell);
 
+EphyTabDiscarder *ephy_shell_get_tab_discarder           (EphyShell *shell);
+
 EphySyncService *ephy_shell_get_sync_service             (EphyShell *shell);
 
 GtkWidget       *ephy_shell_get_history_dialog           (EphyShell *shell);
@@ -0,0 +1,417 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-discarder.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed-container.h"
+#include "ephy-embed-utils.h"
+#include "ephy-embed.h"
+#include "ephy-shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Notify when tasks were stalled waiting for memory for 150ms in a 2s
+ * window. Unprivileged processes may only use windows of multiples of 2s. */
+#define PSI_MEMORY_FILE "/proc/pressure/memory"
+#define PSI_MEMORY_TRIGGER "some 150000 2000000"
+
+/* Without PSI, check the available memory periodically instead. */
+#define MEMINFO_FILE "/proc/meminfo"
+#define MEMINFO_POLL_INTERVAL 10
+#define MEMINFO_LOW_AVAILABLE_PERCENT 10
+
+/* Don't discard more than a few tabs at a time, and give the web processes
+ * some time to release their memory before considering the next batch. */
+#define DISCARD_BATCH_SIZE 2
+#define DISCARD_INTERVAL (10 * G_USEC_PER_SEC)
+#define RECLAIM_MEASURE_DELAY 5
+
+/* Tabs hidden more recently than this are never discarded. */
+#define MIN_HIDDEN_TIME (5 * 60 * G_USEC_PER_SEC)
+
+struct _EphyTabDiscarder {
+  GObject parent_instance;
+
+  int psi_fd;
+  guint psi_source_id;
+  guint poll_source_id;
+
+  gint64 last_discard_time;
+  guint64 available_before_discard;
+  guint measure_source_id;
+  GCancellable *cancellable;
+
+  guint discard_count;
+  guint64 reclaimed_memory;
+};
+
+G_DEFINE_TYPE (EphyTabDiscarder, ephy_tab_discarder, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_DISCARD_COUNT,
+  PROP_RECLAIMED_MEMORY,
+  LAST_PROP
+};
+
+static GParamSpec *obj_properties[LAST_PROP];
+
+static gboolean
+read_meminfo (guint64 *total,
+              guint64 *available)
+{
+  char *contents;
+  char *line;
+  gboolean found_total = FALSE;
+  gboolean found_available = FALSE;
+
+  if (!g_file_get_contents (MEMINFO_FILE, &contents, NULL, NULL))
+    return FALSE;
+
+  for (line = contents; line && *line; line = strchr (line, '\n') ? strchr (line, '\n') + 1 : NULL) {
+    if (g_str_has_prefix (line, "MemTotal:")) {
+      *total = g_ascii_strtoull (line + strlen ("MemTotal:"), NULL, 10) * 1024;
+      found_total = TRUE;
+    } else if (g_str_has_prefix (line, "MemAvailable:")) {
+      *available = g_ascii_strtoull (line + strlen ("MemAvailable:"), NULL, 10) * 1024;
+      found_available = TRUE;
+    }
+  }
+  g_free (contents);
+
+  return found_total && found_available;
+}
+
+static gboolean
+measure_reclaimed_memory_cb (EphyTabDiscarder *discarder)
+{
+  guint64 total, available;
+
+  discarder->measure_source_id = 0;
+
+  /* Only an estimate: other processes allocate and free memory too. */
+  if (read_meminfo (&total, &available) && available > discarder->available_before_discard) {
+    discarder->reclaimed_memory += available - discarder->available_before_discard;
+    g_object_notify_by_pspec (G_OBJECT (discarder), obj_properties[PROP_RECLAIMED_MEMORY]);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+embed_can_be_discarded (EphyEmbed *embed,
+                        gint64     now)
+{
+  EphyWebView *view = ephy_embed_get_web_view (embed);
+  const char *address;
+
+  if (gtk_widget_get_mapped (GTK_WIDGET (embed)) ||
+      gtk_widget_in_destruction (GTK_WIDGET (embed)) ||
+      ephy_embed_has_load_pending (embed) ||
+      ephy_embed_inspector_is_loaded (embed))
+    return FALSE;
+
+  if (now - ephy_embed_get_last_visible_time (embed) < MIN_HIDDEN_TIME)
+    return FALSE;
+
+  if (webkit_web_view_is_playing_audio (WEBKIT_WEB_VIEW (view)) ||
+      ephy_web_view_is_loading (view) ||
+      ephy_web_view_get_is_blank (view) ||
+      ephy_web_view_is_overview (view) ||
+      ephy_web_view_get_error_page (view) != EPHY_WEB_VIEW_ERROR_PAGE_NONE)
+    return FALSE;
+
+  /* Internal pages are cheap, and can't always be reloaded. */
+  address = ephy_web_view_get_address (view);
+  return ephy_embed_utils_address_has_web_scheme (address);
+}
+
+static void
+has_modified_forms_cb (EphyWebView      *view,
+                       GAsyncResult     *result,
+                       EphyTabDiscarder *discarder)
+{
+  EphyEmbed *embed;
+  gboolean has_modified_forms;
+  GError *error = NULL;
+
+  has_modified_forms = ephy_web_view_has_modified_forms_finish (view, result, &error);
+  if (error) {
+    g_error_free (error);
+    goto out;
+  }
+
+  /* Check again, the user may have switched to the tab in the meantime. */
+  embed = EPHY_EMBED (gtk_widget_get_ancestor (GTK_WIDGET (view), EPHY_TYPE_EMBED));
+  if (!has_modified_forms && embed && embed_can_be_discarded (embed, g_get_monotonic_time ())) {
+    LOG ("Discarding tab %s", ephy_web_view_get_address (view));
+    ephy_embed_discard (embed);
+
+    discarder->discard_count++;
+    g_object_notify_by_pspec (G_OBJECT (discarder), obj_properties[PROP_DISCARD_COUNT]);
+
+    if (!discarder->measure_source_id) {
+      discarder->measure_source_id = g_timeout_add_seconds (RECLAIM_MEASURE_DELAY,
+                                                            (GSourceFunc)measure_reclaimed_memory_cb,
+                                                            discarder);
+      g_source_set_name_by_id (discarder->measure_source_id, "[epiphany] measure_reclaimed_memory_cb");
+    }
+  }
+
+out:
+  g_object_unref (discarder);
+  g_object_unref (view);
+}
+
+static int
+compare_last_visible_time (EphyEmbed *a,
+                           EphyEmbed *b)
+{
+  gint64 time_a = ephy_embed_get_last_visible_time (a);
+  gint64 time_b = ephy_embed_get_last_visible_time (b);
+
+  return time_a < time_b ? -1 : time_a > time_b;
+}
+
+static void
+ephy_tab_discarder_discard_tabs (EphyTabDiscarder *discarder)
+{
+  GList *windows;
+  GList *candidates = NULL;
+  gint64 now;
+  guint64 total;
+  guint n = 0;
+
+  now = g_get_monotonic_time ();
+  if (discarder->last_discard_time &&
+      now - discarder->last_discard_time < DISCARD_INTERVAL)
+    return;
+
+  windows = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+  for (GList *w = windows; w; w = w->next) {
+    GList *tabs;
+
+    if (!EPHY_IS_EMBED_CONTAINER (w->data))
+      continue;
+
+    tabs = ephy_embed_container_get_children (EPHY_EMBED_CONTAINER (w->data));
+    for (GList *t = tabs; t; t = t->next) {
+      if (embed_can_be_discarded (t->data, now))
+        candidates = g_list_prepend (candidates, t->data);
+    }
+    g_list_free (tabs);
+  }
+
+  if (!candidates)
+    return;
+
+  discarder->last_discard_time = now;
+  if (!discarder->measure_source_id)
+    read_meminfo (&total, &discarder->available_before_discard);
+
+  /* Least recently used first. Tabs with modified forms are kept, which is
+   * only known asynchronously. */
+  candidates = g_list_sort (candidates, (GCompareFunc)compare_last_visible_time);
+  for (GList *l = candidates; l && n < DISCARD_BATCH_SIZE; l = l->next, n++) {
+    EphyWebView *view = ephy_embed_get_web_view (l->data);
+
+    ephy_web_view_has_modified_forms (g_object_ref (view),
+                                      discarder->cancellable,
+                                      (GAsyncReadyCallback)has_modified_forms_cb,
+                                      g_object_ref (discarder));
+  }
+
+  g_list_free (candidates);
+}
+
+static gboolean
+psi_event_cb (int               fd,
+              GIOCondition      condition,
+              EphyTabDiscarder *discarder)
+{
+  if (condition & G_IO_ERR) {
+    g_warning ("Memory pressure monitoring stopped");
+    discarder->psi_source_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  LOG ("Memory pressure notified");
+  ephy_tab_discarder_discard_tabs (discarder);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+meminfo_poll_cb (EphyTabDiscarder *discarder)
+{
+  guint64 total, available;
+
+  if (read_meminfo (&total, &available) &&
+      available * 100 < total * MEMINFO_LOW_AVAILABLE_PERCENT) {
+    LOG ("Low available memory: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes", available, total);
+    ephy_tab_discarder_discard_tabs (discarder);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+ephy_tab_discarder_monitor_psi (EphyTabDiscarder *discarder)
+{
+  int fd;
+
+  fd = open (PSI_MEMORY_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  /* The trigger string must be written with its terminating NUL. */
+  if (write (fd, PSI_MEMORY_TRIGGER, strlen (PSI_MEMORY_TRIGGER) + 1) < 0) {
+    LOG ("Failed to set memory pressure trigger: %s", g_strerror (errno));
+    close (fd);
+    return FALSE;
+  }
+
+  discarder->psi_fd = fd;
+  discarder->psi_source_id = g_unix_fd_add (fd, G_IO_PRI | G_IO_ERR,
+                                            (GUnixFDSourceFunc)psi_event_cb,
+                                            discarder);
+  return TRUE;
+}
+
+static void
+ephy_tab_discarder_get_property (GObject    *object,
+                                 guint       prop_id,
+                                 GValue     *value,
+                                 GParamSpec *pspec)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (object);
+
+  switch (prop_id) {
+    case PROP_DISCARD_COUNT:
+      g_value_set_uint (value, discarder->discard_count);
+      break;
+    case PROP_RECLAIMED_MEMORY:
+      g_value_set_uint64 (value, discarder->reclaimed_memory);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+ephy_tab_discarder_dispose (GObject *object)
+{
+  EphyTabDiscarder *discarder = EPHY_TAB_DISCARDER (object);
+
+  if (discarder->cancellable) {
+    g_cancellable_cancel (discarder->cancellable);
+    g_clear_object (&discarder->cancellable);
+  }
+
+  if (discarder->psi_source_id) {
+    g_source_remove (discarder->psi_source_id);
+    discarder->psi_source_id = 0;
+  }
+
+  if (discarder->psi_fd != -1) {
+    close (discarder->psi_fd);
+    discarder->psi_fd = -1;
+  }
+
+  if (discarder->poll_source_id) {
+    g_source_remove (discarder->poll_source_id);
+    discarder->poll_source_id = 0;
+  }
+
+  if (discarder->measure_source_id) {
+    g_source_remove (discarder->measure_source_id);
+    discarder->measure_source_id = 0;
+  }
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_discarder_class_init (EphyTabDiscarderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = ephy_tab_discarder_get_property;
+  object_class->dispose = ephy_tab_discarder_dispose;
+
+  obj_properties[PROP_DISCARD_COUNT] =
+    g_param_spec_uint ("discard-count",
+                       "Discard count",
+                       "The number of tabs discarded",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  obj_properties[PROP_RECLAIMED_MEMORY] =
+    g_param_spec_uint64 ("reclaimed-memory",
+                         "Reclaimed memory",
+                         "Estimated memory, in bytes, released by discarding tabs",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
+}
+
+static void
+ephy_tab_discarder_init (EphyTabDiscarder *discarder)
+{
+  discarder->psi_fd = -1;
+  discarder->cancellable = g_cancellable_new ();
+
+  if (!ephy_tab_discarder_monitor_psi (discarder)) {
+    LOG ("Memory pressure information not available, polling " MEMINFO_FILE);
+    discarder->poll_source_id = g_timeout_add_seconds (MEMINFO_POLL_INTERVAL,
+                                                       (GSourceFunc)meminfo_poll_cb,
+                                                       discarder);
+    g_source_set_name_by_id (discarder->poll_source_id, "[epiphany] meminfo_poll_cb");
+  }
+}
+
+EphyTabDiscarder *
+ephy_tab_discarder_new (void)
+{
+  return g_object_new (EPHY_TYPE_TAB_DISCARDER, NULL);
+}
+
+guint
+ephy_tab_discarder_get_discard_count (EphyTabDiscarder *discarder)
+{
+  g_assert (EPHY_IS_TAB_DISCARDER (discarder));
+
+  return discarder->discard_count;
+}
+
+guint64
+ephy_tab_discarder_get_reclaimed_memory (EphyTabDiscarder *discarder)
+{
+  g_assert (EPHY_IS_TAB_DISCARDER (discarder));
+
+  return discarder->reclaimed_memory;
+}
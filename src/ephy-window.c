@@ -361,11 +361,16 @@ ephy_window_open_link (EphyLink     *link,
     if (flags & EPHY_LINK_NEW_TAB_APPEND_AFTER)
       ntflags |= EPHY_NEW_TAB_APPEND_AFTER;
 
-    new_embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                    target_window,
-                                    embed, ntflags);
+    new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                         NULL, NULL, address,
+                                         target_window,
+                                         embed, ntflags,
+                                         0);
   } else if (!embed) {
-    new_embed = ephy_shell_new_tab (ephy_shell_get_default (), window, NULL, 0);
+    new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                         NULL, NULL, address,
+                                         window, NULL, 0,
+                                         0);
   } else {
     new_embed = embed;
   }
@@ -1808,6 +1813,7 @@ create_web_view_cb (WebKitWebView          *web_view,
   embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
                                    NULL,
                                    web_view,
+                                   NULL,
                                    target_window,
                                    EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (web_view),
                                    flags,
@@ -1951,7 +1957,7 @@ decide_navigation_policy (WebKitWebView            *web_view,
       embed = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (window));
 
       new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
-                                           NULL, NULL,
+                                           NULL, NULL, uri,
                                            window,
                                            embed,
                                            EPHY_NEW_TAB_APPEND_AFTER | EPHY_NEW_TAB_JUMP,
@@ -2008,7 +2014,7 @@ decide_navigation_policy (WebKitWebView            *web_view,
               (EPHY_EMBED_CONTAINER (window));
 
     new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
-                                         NULL, NULL,
+                                         NULL, NULL, uri,
                                          target_window,
                                          embed,
                                          flags,
@@ -74,8 +74,10 @@ view_in_destination (EphyWindow     *window,
       g_assert_not_reached ();
   }
 
-  new_embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  dest_window, embed, flags);
+  new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, g_value_get_string (&value),
+                                       dest_window, embed, flags,
+                                       0);
 
   new_view = ephy_embed_get_web_view (new_embed);
   session_state = webkit_web_view_get_session_state (WEBKIT_WEB_VIEW (ephy_embed_get_web_view (embed)));
@@ -381,8 +383,10 @@ popup_cmd_search_selection (GSimpleAction *action,
 
   search_term = g_variant_get_string (parameter, NULL);
   search_url = ephy_embed_utils_autosearch_address (search_term);
-  new_embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  EPHY_WINDOW (user_data), embed, EPHY_NEW_TAB_APPEND_AFTER | EPHY_NEW_TAB_JUMP);
+  new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, search_url,
+                                       EPHY_WINDOW (user_data), embed, EPHY_NEW_TAB_APPEND_AFTER | EPHY_NEW_TAB_JUMP,
+                                       0);
   ephy_web_view_load_url (ephy_embed_get_web_view (new_embed), search_url);
   g_free (search_url);
 }
@@ -22,11 +22,10 @@
 
 #include "ephy-search-provider.h"
 
-#include "ephy-bookmarks-manager.h"
-#include "ephy-completion-model.h"
 #include "ephy-file-helpers.h"
 #include "ephy-prefs.h"
 #include "ephy-profile-utils.h"
+#include "ephy-search-index.h"
 #include "ephy-shell.h"
 
 #include <gio/gio.h>
@@ -39,11 +38,9 @@ struct _EphySearchProvider {
   GApplication parent_instance;
 
   EphyShellSearchProvider2 *skeleton;
-  GCancellable             *cancellable;
 
   GSettings                *settings;
-  EphyBookmarksManager     *bookmarks_manager;
-  EphyCompletionModel      *model;
+  EphySearchIndex          *index;
 };
 
 struct _EphySearchProviderClass {
@@ -53,91 +50,32 @@ struct _EphySearchProviderClass {
 G_DEFINE_TYPE (EphySearchProvider, ephy_search_provider, G_TYPE_APPLICATION)
 
 #define INACTIVITY_TIMEOUT 60 * 1000 /* One minute, in milliseconds */
+#define MAX_RESULTS 10
 
-static void
-on_model_updated (EphyHistoryService *service,
-                  gboolean            success,
-                  gpointer            result_data,
-                  gpointer            user_data)
+/* Queries are answered from the index written by the browser, so that they
+ * never wait for the history database. */
+static char **
+gather_results (EphySearchProvider *self,
+                char              **terms)
 {
-  GTask *task = user_data;
-  EphySearchProvider *self = g_task_get_source_object (task);
-  GtkTreeModel *model = GTK_TREE_MODEL (self->model);
-  GtkTreeIter iter;
+  char **urls;
+  char *search_string;
   GPtrArray *results;
-  const char *search_string;
-  gboolean ok;
-
-  results = g_ptr_array_new ();
+  guint i;
 
-  ok = gtk_tree_model_get_iter_first (model, &iter);
-  while (ok) {
-    char *result;
+  urls = ephy_search_index_query (self->index, terms, MAX_RESULTS);
 
-    result = gtk_tree_model_get_string_from_iter (model, &iter);
-    g_ptr_array_add (results, result);
-
-    ok = gtk_tree_model_iter_next (model, &iter);
-  }
+  results = g_ptr_array_new ();
+  for (i = 0; urls[i]; i++)
+    g_ptr_array_add (results, urls[i]);
+  g_free (urls);
 
-  search_string = g_task_get_task_data (task);
+  search_string = g_strjoinv (" ", terms);
   g_ptr_array_add (results, g_strdup_printf ("special:search:%s", search_string));
   g_ptr_array_add (results, NULL);
+  g_free (search_string);
 
-  g_task_return_pointer (task,
-                         g_ptr_array_free (results, FALSE),
-                         (GDestroyNotify)g_strfreev);
-}
-
-static char **
-gather_results_finish (EphySearchProvider *self,
-                       GAsyncResult       *result,
-                       GError            **error)
-{
-  return g_task_propagate_pointer (G_TASK (result), error);
-}
-
-static void
-gather_results_async (EphySearchProvider *self,
-                      char              **terms,
-                      GCancellable       *cancellable,
-                      GAsyncReadyCallback callback,
-                      gpointer            user_data)
-{
-  GTask *task;
-  char *search_string;
-
-  task = g_task_new (self, cancellable, callback, user_data);
-
-  search_string = g_strjoinv (" ", terms);
-  g_task_set_task_data (task, search_string, g_free);
-
-  ephy_completion_model_update_for_string (self->model,
-                                           search_string,
-                                           on_model_updated,
-                                           task);
-}
-
-static void
-complete_request (GObject      *object,
-                  GAsyncResult *result,
-                  gpointer      user_data)
-{
-  EphySearchProvider *self = EPHY_SEARCH_PROVIDER (object);
-  char **results;
-  GError *error;
-
-  error = NULL;
-  results = gather_results_finish (self, result, &error);
-
-  if (results) {
-    g_dbus_method_invocation_return_value (user_data,
-                                           g_variant_new ("(^as)", results));
-  } else {
-    g_dbus_method_invocation_take_error (user_data, error);
-  }
-
-  g_application_release (G_APPLICATION (self));
+  return (char **)g_ptr_array_free (results, FALSE);
 }
 
 static gboolean
@@ -146,11 +84,13 @@ handle_get_initial_result_set (EphyShellSearchProvider2 *skeleton,
                                char                    **terms,
                                EphySearchProvider       *self)
 {
-  g_application_hold (G_APPLICATION (self));
-  g_cancellable_reset (self->cancellable);
+  char **results;
 
-  gather_results_async (self, terms, self->cancellable,
-                        complete_request, invocation);
+  results = gather_results (self, terms);
+  ephy_shell_search_provider2_complete_get_initial_result_set (skeleton,
+                                                               invocation,
+                                                               (const char * const *)results);
+  g_strfreev (results);
 
   return TRUE;
 }
@@ -162,11 +102,13 @@ handle_get_subsearch_result_set (EphyShellSearchProvider2 *skeleton,
                                  char                    **terms,
                                  EphySearchProvider       *self)
 {
-  g_application_hold (G_APPLICATION (self));
-  g_cancellable_reset (self->cancellable);
+  char **results;
 
-  gather_results_async (self, terms, self->cancellable,
-                        complete_request, invocation);
+  results = gather_results (self, terms);
+  ephy_shell_search_provider2_complete_get_subsearch_result_set (skeleton,
+                                                                 invocation,
+                                                                 (const char * const *)results);
+  g_strfreev (results);
 
   return TRUE;
 }
@@ -177,16 +119,15 @@ handle_get_result_metas (EphyShellSearchProvider2 *skeleton,
                          char                    **results,
                          EphySearchProvider       *self)
 {
-  GtkTreeModel *model = GTK_TREE_MODEL (self->model);
-  GtkTreeIter iter;
   int i;
   GVariantBuilder builder;
   GIcon *favicon;
-  char *name, *url;
+  const char *name;
+  const char *icon;
+  char *type;
   gboolean is_bookmark;
 
   g_application_hold (G_APPLICATION (self));
-  g_cancellable_cancel (self->cancellable);
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
 
@@ -204,42 +145,42 @@ handle_get_result_metas (EphyShellSearchProvider2 *skeleton,
       continue;
     }
 
-    if (!gtk_tree_model_get_iter_from_string (model, &iter, results[i]))
+    if (!ephy_search_index_lookup (self->index, results[i], &name, &icon, &is_bookmark))
       continue;
 
-    gtk_tree_model_get (model, &iter,
-                        EPHY_COMPLETION_TEXT_COL, &name,
-                        EPHY_COMPLETION_URL_COL, &url,
-                        EPHY_COMPLETION_FAVICON_COL, &favicon,
-                        EPHY_COMPLETION_EXTRA_COL, &is_bookmark,
-                        -1);
-
     g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
     g_variant_builder_add (&builder, "{sv}",
-                           "id", g_variant_new_string (url));
+                           "id", g_variant_new_string (results[i]));
     g_variant_builder_add (&builder, "{sv}",
-                           "name", g_variant_new_string (name));
+                           "name", g_variant_new_string (*name ? name : results[i]));
 
-    if (favicon == NULL) {
-      char *type;
+    /* The browser saves the favicons of the index as files, since the
+     * provider does not open its favicon database. They may not have been
+     * saved yet. */
+    if (icon && g_file_test (icon, G_FILE_TEST_IS_REGULAR)) {
+      GFile *file = g_file_new_for_path (icon);
 
+      favicon = g_file_icon_new (file);
+      g_object_unref (file);
+    } else {
       type = g_content_type_from_mime_type ("text/html");
       favicon = g_content_type_get_icon (type);
+      g_free (type);
+    }
 
-      if (is_bookmark) {
-        GEmblem *emblem;
-        GIcon *emblem_icon, *emblemed;
+    if (is_bookmark) {
+      GEmblem *emblem;
+      GIcon *emblem_icon, *emblemed;
 
-        emblem_icon = g_themed_icon_new ("emblem-favorite");
-        emblem = g_emblem_new (emblem_icon);
+      emblem_icon = g_themed_icon_new ("emblem-favorite");
+      emblem = g_emblem_new (emblem_icon);
 
-        emblemed = g_emblemed_icon_new (favicon, emblem);
+      emblemed = g_emblemed_icon_new (favicon, emblem);
 
-        g_object_unref (emblem);
-        g_object_unref (emblem_icon);
-        g_object_unref (favicon);
-        favicon = emblemed;
-      }
+      g_object_unref (emblem);
+      g_object_unref (emblem_icon);
+      g_object_unref (favicon);
+      favicon = emblemed;
     }
 
     g_variant_builder_add (&builder, "{sv}",
@@ -247,8 +188,6 @@ handle_get_result_metas (EphyShellSearchProvider2 *skeleton,
     g_variant_builder_close (&builder);
 
     g_object_unref (favicon);
-    g_free (name);
-    g_free (url);
   }
 
   ephy_shell_search_provider2_complete_get_result_metas (skeleton,
@@ -314,7 +253,6 @@ handle_activate_result (EphyShellSearchProvider2 *skeleton,
                         EphySearchProvider       *self)
 {
   g_application_hold (G_APPLICATION (self));
-  g_cancellable_cancel (self->cancellable);
 
   if (strcmp (identifier, "special:search") == 0)
     launch_search (self, terms, timestamp);
@@ -335,7 +273,6 @@ handle_launch_search (EphyShellSearchProvider2 *skeleton,
                       EphySearchProvider       *self)
 {
   g_application_hold (G_APPLICATION (self));
-  g_cancellable_cancel (self->cancellable);
 
   launch_search (self, terms, timestamp);
 
@@ -349,7 +286,6 @@ static void
 ephy_search_provider_init (EphySearchProvider *self)
 {
   char *filename;
-  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
 
   g_application_set_flags (G_APPLICATION (self), G_APPLICATION_IS_SERVICE);
 
@@ -368,14 +304,10 @@ ephy_search_provider_init (EphySearchProvider *self)
 
   self->settings = g_settings_new (EPHY_PREFS_SCHEMA);
 
-  filename = g_build_filename (ephy_dot_dir (), EPHY_HISTORY_FILE, NULL);
-  self->bookmarks_manager = ephy_bookmarks_manager_new ();
-  self->model = ephy_completion_model_new (ephy_embed_shell_get_global_history_service (shell),
-                                           self->bookmarks_manager);
+  filename = g_build_filename (ephy_dot_dir (), EPHY_SEARCH_INDEX_FILE, NULL);
+  self->index = ephy_search_index_new (filename);
   g_free (filename);
 
-  self->cancellable = g_cancellable_new ();
-
   g_application_set_inactivity_timeout (G_APPLICATION (self), INACTIVITY_TIMEOUT);
 }
 
@@ -428,9 +360,7 @@ ephy_search_provider_dispose (GObject *object)
   self = EPHY_SEARCH_PROVIDER (object);
 
   g_clear_object (&self->settings);
-  g_clear_object (&self->cancellable);
-  g_clear_object (&self->model);
-  g_clear_object (&self->bookmarks_manager);
+  g_clear_object (&self->index);
 
   G_OBJECT_CLASS (ephy_search_provider_parent_class)->dispose (object);
 }
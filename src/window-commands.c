@@ -749,10 +749,12 @@ window_cmd_navigation_new_tab (GSimpleAction *action,
       back_item = webkit_back_forward_list_get_back_item (history);
       back_uri = webkit_back_forward_list_item_get_original_uri (back_item);
 
-      embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
-                                  NULL,
-                                  0);
+      embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, back_uri,
+                                       EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
+                                       NULL,
+                                       0,
+                                       0);
 
       web_view = EPHY_GET_WEBKIT_WEB_VIEW_FROM_EMBED (embed);
       webkit_web_view_load_uri (web_view, back_uri);
@@ -769,10 +771,12 @@ window_cmd_navigation_new_tab (GSimpleAction *action,
       forward_item = webkit_back_forward_list_get_forward_item (history);
       forward_uri = webkit_back_forward_list_item_get_original_uri (forward_item);
 
-      embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
-                                  embed,
-                                  0);
+      embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, forward_uri,
+                                       EPHY_WINDOW (gtk_widget_get_toplevel (GTK_WIDGET (embed))),
+                                       embed,
+                                       0,
+                                       0);
 
       web_view = EPHY_GET_WEBKIT_WEB_VIEW_FROM_EMBED (embed);
       webkit_web_view_load_uri (web_view, forward_uri);
@@ -2343,10 +2347,12 @@ window_cmd_tabs_duplicate (GSimpleAction *action,
   view = WEBKIT_WEB_VIEW (ephy_embed_get_web_view (embed));
   session_state = webkit_web_view_get_session_state (view);
 
-  new_embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  EPHY_WINDOW (user_data),
-                                  embed,
-                                  EPHY_NEW_TAB_APPEND_AFTER | EPHY_NEW_TAB_JUMP);
+  new_embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
+                                       NULL, NULL, webkit_web_view_get_uri (view),
+                                       EPHY_WINDOW (user_data),
+                                       embed,
+                                       EPHY_NEW_TAB_APPEND_AFTER | EPHY_NEW_TAB_JUMP,
+                                       0);
 
   new_view = WEBKIT_WEB_VIEW (ephy_embed_get_web_view (new_embed));
 
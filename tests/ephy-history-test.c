@@ -262,6 +262,65 @@ test_set_url_title_url_not_existent (void)
   gtk_main ();
 }
 
+static void
+coalesced_url_updates_done (EphyHistoryService *service, gboolean success, gpointer result_data, gpointer user_data)
+{
+  EphyHistoryURL *url = (EphyHistoryURL *)result_data;
+  guint *n_title_changes = user_data;
+
+  g_assert (success == TRUE);
+
+  /* Only the latest title and thumbnail time were saved, and notified. */
+  g_assert_cmpstr (url->title, ==, "GNOME 3");
+  g_assert_cmpint (url->thumbnail_time, ==, 42);
+  g_assert_cmpuint (*n_title_changes, ==, 1);
+
+  ephy_history_url_free (url);
+  g_object_unref (service);
+  gtk_main_quit ();
+}
+
+static void
+coalesced_url_title_changed (EphyHistoryService *service, const char *url, const char *title, guint *n_title_changes)
+{
+  g_assert_cmpstr (url, ==, "http://www.gnome.org");
+  g_assert_cmpstr (title, ==, "GNOME 3");
+
+  if ((*n_title_changes)++ == 0)
+    ephy_history_service_get_url (service, "http://www.gnome.org", NULL, coalesced_url_updates_done, n_title_changes);
+}
+
+static void
+coalesced_url_updates_visit_created (EphyHistoryService *service, gboolean success, gpointer result_data, gpointer user_data)
+{
+  g_assert (success == TRUE);
+
+  ephy_history_service_set_url_title (service, "http://www.gnome.org", "GNOME 1", NULL, NULL, NULL);
+  ephy_history_service_set_url_thumbnail_time (service, "http://www.gnome.org", 41, NULL, NULL, NULL);
+  ephy_history_service_set_url_title (service, "http://www.gnome.org", "GNOME 2", NULL, NULL, NULL);
+  ephy_history_service_set_url_thumbnail_time (service, "http://www.gnome.org", 42, NULL, NULL, NULL);
+  ephy_history_service_set_url_title (service, "http://www.gnome.org", "GNOME 3", NULL, NULL, NULL);
+}
+
+static void
+test_coalesced_url_updates (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file);
+  EphyHistoryPageVisit *visit;
+  guint n_title_changes = 0;
+
+  g_signal_connect (service, "url-title-changed",
+                    G_CALLBACK (coalesced_url_title_changed), &n_title_changes);
+
+  visit = ephy_history_page_visit_new ("http://www.gnome.org", 0, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, coalesced_url_updates_visit_created, NULL);
+  ephy_history_page_visit_free (visit);
+  g_free (temporary_file);
+
+  gtk_main ();
+}
+
 static void
 test_get_url_done (EphyHistoryService *service, gboolean success, gpointer result_data, gpointer user_data)
 {
@@ -443,6 +502,87 @@ test_complex_url_query_with_time_range (void)
   gtk_main ();
 }
 
+static void
+verify_url_query_second_page (EphyHistoryService *service,
+                              gboolean            success,
+                              gpointer            result_data,
+                              gpointer            user_data)
+{
+  GList *urls = (GList *)result_data;
+
+  g_assert (success == TRUE);
+
+  /* The page following the keyset cursor. */
+  g_assert_cmpint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.gnome.org");
+  g_assert_cmpstr (((EphyHistoryURL *)urls->next->data)->url, ==, "http://www.musicbrainz.org");
+
+  ephy_history_url_list_free (urls);
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+verify_url_query_first_page (EphyHistoryService *service,
+                             gboolean            success,
+                             gpointer            result_data,
+                             gpointer            user_data)
+{
+  EphyHistoryQuery *query;
+  GList *urls = (GList *)result_data;
+  GList *last;
+
+  g_assert (success == TRUE);
+
+  g_assert_cmpint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.wikipedia.org");
+  g_assert_cmpstr (((EphyHistoryURL *)urls->next->data)->url, ==, "http://www.freedesktop.org");
+
+  /* Continue right after the last row of the first page. */
+  last = g_list_last (urls);
+  query = ephy_history_query_new ();
+  query->limit = 2;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+  query->after = ephy_history_url_copy (last->data);
+
+  ephy_history_service_query_urls (service, query, NULL, verify_url_query_second_page, NULL);
+  ephy_history_query_free (query);
+  ephy_history_url_list_free (urls);
+}
+
+static void
+perform_paginated_url_query (EphyHistoryService *service,
+                             gboolean            success,
+                             gpointer            result_data,
+                             gpointer            user_data)
+{
+  EphyHistoryQuery *query;
+
+  g_assert (success == TRUE);
+
+  query = ephy_history_query_new ();
+  query->limit = 2;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
+  ephy_history_service_query_urls (service, query, NULL, verify_url_query_first_page, NULL);
+  ephy_history_query_free (query);
+}
+
+static void
+test_paginated_url_query (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file);
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+
+  ephy_history_service_add_visits (service, visits, NULL, perform_paginated_url_query, NULL);
+
+  gtk_main ();
+}
+
 static void
 verify_query_after_clear (EphyHistoryService *service,
                           gboolean            success,
@@ -491,6 +631,274 @@ test_clear (void)
   gtk_main ();
 }
 
+static EphyHistoryPageVisit *
+create_synced_page_visit (const char *url,
+                          const char *sync_id,
+                          gint64      visit_time)
+{
+  EphyHistoryPageVisit *visit = ephy_history_page_visit_new (url, visit_time, EPHY_PAGE_VISIT_TYPED);
+
+  visit->url->sync_id = g_strdup (sync_id);
+  return visit;
+}
+
+static EphyHistoryURL *
+create_synced_url (const char *url,
+                   const char *sync_id,
+                   gint64      last_visit_time)
+{
+  EphyHistoryURL *history_url = ephy_history_url_new (url, NULL, 0, 0, last_visit_time);
+
+  history_url->sync_id = g_strdup (sync_id);
+  return history_url;
+}
+
+static int
+compare_sync_id (EphyHistoryURL *url,
+                 const char     *sync_id)
+{
+  return g_strcmp0 (url->sync_id, sync_id);
+}
+
+static void
+verify_synced_urls (EphyHistoryService *service,
+                    gboolean            success,
+                    gpointer            result_data,
+                    gpointer            user_data)
+{
+  GList *urls = (GList *)result_data;
+
+  g_assert (success == TRUE);
+
+  /* The URL matched by address under another sync ID, and the URL left
+   * unmatched. */
+  g_assert_cmpint (g_list_length (urls), ==, 2);
+  g_assert_nonnull (g_list_find_custom (urls, "local-wikipedia", (GCompareFunc)compare_sync_id));
+  g_assert_nonnull (g_list_find_custom (urls, "local-kde", (GCompareFunc)compare_sync_id));
+
+  ephy_history_url_list_free (urls);
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+verify_merged_url (EphyHistoryService *service,
+                   gboolean            success,
+                   gpointer            result_data,
+                   gpointer            user_data)
+{
+  EphyHistoryURL *url = (EphyHistoryURL *)result_data;
+  GHashTable *merged_ids;
+
+  g_assert (success == TRUE);
+
+  /* The new URL keeps its remote sync ID. */
+  g_assert_cmpstr (url->url, ==, "http://www.freedesktop.org");
+  g_assert_cmpstr (url->sync_id, ==, "remote-freedesktop");
+  g_assert_cmpint (url->last_visit_time, ==, 15);
+
+  ephy_history_url_free (url);
+
+  merged_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_add (merged_ids, "local-gnome");
+  g_hash_table_add (merged_ids, "remote-wikipedia");
+  g_hash_table_add (merged_ids, "remote-freedesktop");
+  ephy_history_service_find_synced_urls (service, merged_ids, NULL, verify_synced_urls, NULL);
+  g_hash_table_unref (merged_ids);
+}
+
+static void
+verify_merge_urls (EphyHistoryService *service,
+                   gboolean            success,
+                   gpointer            result_data,
+                   gpointer            user_data)
+{
+  EphyHistoryMergeResult *result = (EphyHistoryMergeResult *)result_data;
+  EphyHistoryURL *match;
+
+  g_assert (success == TRUE);
+  g_assert_cmpint (result->matches->len, ==, 3);
+
+  /* Matched by sync ID, with the last visit time before the merge. */
+  match = g_ptr_array_index (result->matches, 0);
+  g_assert_cmpstr (match->sync_id, ==, "local-gnome");
+  g_assert_cmpint (match->last_visit_time, ==, 10);
+
+  /* Matched by URL, under its local sync ID. */
+  match = g_ptr_array_index (result->matches, 1);
+  g_assert_cmpstr (match->url, ==, "http://www.wikipedia.org");
+  g_assert_cmpstr (match->sync_id, ==, "local-wikipedia");
+
+  /* Not known locally. */
+  g_assert (g_ptr_array_index (result->matches, 2) == NULL);
+
+  ephy_history_merge_result_free (result);
+
+  ephy_history_service_get_url (service, "http://www.freedesktop.org", NULL, verify_merged_url, NULL);
+}
+
+static void
+perform_merge_urls (EphyHistoryService *service,
+                    gboolean            success,
+                    gpointer            result_data,
+                    gpointer            user_data)
+{
+  GPtrArray *urls;
+
+  g_assert (success == TRUE);
+
+  urls = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_url_free);
+  g_ptr_array_add (urls, create_synced_url ("http://www.gnome.org", "local-gnome", 20));
+  g_ptr_array_add (urls, create_synced_url ("http://www.wikipedia.org", "remote-wikipedia", 5));
+  g_ptr_array_add (urls, create_synced_url ("http://www.freedesktop.org", "remote-freedesktop", 15));
+
+  ephy_history_service_merge_urls (service, urls, NULL, verify_merge_urls, NULL);
+  g_ptr_array_unref (urls);
+}
+
+static void
+test_merge_urls (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file);
+  GList *visits = NULL;
+
+  visits = g_list_append (visits, create_synced_page_visit ("http://www.gnome.org", "local-gnome", 10));
+  visits = g_list_append (visits, create_synced_page_visit ("http://www.wikipedia.org", "local-wikipedia", 10));
+  visits = g_list_append (visits, create_synced_page_visit ("http://www.kde.org", "local-kde", 5));
+
+  ephy_history_service_add_visits (service, visits, NULL, perform_merge_urls, NULL);
+  ephy_history_page_visit_list_free (visits);
+  g_free (temporary_file);
+
+  gtk_main ();
+}
+
+static void
+verify_url_results_query (EphyHistoryService *service,
+                          gboolean            success,
+                          gpointer            result_data,
+                          gpointer            user_data)
+{
+  EphyHistoryURLResults *results = (EphyHistoryURLResults *)result_data;
+  EphyHistoryURL *url;
+  GList *urls;
+
+  g_assert (success == TRUE);
+
+  /* Same rows, in the same order, as the list query returns. */
+  g_assert_cmpuint (ephy_history_url_results_get_length (results), ==, 2);
+  url = ephy_history_url_results_get (results, 0);
+  g_assert_cmpstr (url->url, ==, "http://www.wikipedia.org");
+  g_assert_cmpint (url->visit_count, ==, 30);
+  g_assert (url->host != NULL);
+  g_assert_cmpint (url->host->id, >, 0);
+  url = ephy_history_url_results_get (results, 1);
+  g_assert_cmpstr (url->url, ==, "http://www.freedesktop.org");
+
+  /* The rows outlive the results once converted to a list. */
+  urls = ephy_history_url_results_to_list (results);
+  ephy_history_url_results_free (results);
+
+  g_assert_cmpint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, "http://www.wikipedia.org");
+  g_assert_cmpstr (((EphyHistoryURL *)urls->next->data)->url, ==, "http://www.freedesktop.org");
+
+  ephy_history_url_list_free (urls);
+  g_object_unref (service);
+
+  gtk_main_quit ();
+}
+
+static void
+perform_url_results_query (EphyHistoryService *service,
+                           gboolean            success,
+                           gpointer            result_data,
+                           gpointer            user_data)
+{
+  EphyHistoryQuery *query;
+
+  g_assert (success == TRUE);
+
+  query = ephy_history_query_new ();
+  query->limit = 2;
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
+  ephy_history_service_query_url_results (service, query, NULL, verify_url_results_query, NULL);
+  ephy_history_query_free (query);
+}
+
+static void
+test_url_results_query (void)
+{
+  gchar *temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-history-test.db", NULL);
+  EphyHistoryService *service = ensure_empty_history (temporary_file);
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+
+  ephy_history_service_add_visits (service, visits, NULL, perform_url_results_query, NULL);
+
+  gtk_main ();
+}
+
+#define URL_RESULTS_BENCHMARK_ROWS 10000
+#define URL_RESULTS_BENCHMARK_RUNS 20
+
+/* Builds and frees query sized result sets both ways, the way the history
+ * thread and its callers do, without the database getting in the way. */
+static void
+test_url_results_benchmark (void)
+{
+  double list_time = 0;
+  double results_time = 0;
+  int run;
+  int i;
+
+  for (run = 0; run < URL_RESULTS_BENCHMARK_RUNS; run++) {
+    EphyHistoryURLResults *results;
+    GList *urls = NULL;
+
+    g_test_timer_start ();
+    for (i = 0; i < URL_RESULTS_BENCHMARK_ROWS; i++) {
+      char *address = g_strdup_printf ("http://www.example.com/%d", i);
+      EphyHistoryURL *url = ephy_history_url_new (address, "Example Domain", i, 0, i);
+
+      url->sync_id = g_strdup ("0123456789ab");
+      url->host = ephy_history_host_new (NULL, NULL, 0, 1.0);
+      urls = g_list_prepend (urls, url);
+      g_free (address);
+    }
+    urls = g_list_reverse (urls);
+    ephy_history_url_list_free (urls);
+    list_time += g_test_timer_elapsed ();
+
+    g_test_timer_start ();
+    results = ephy_history_url_results_new (0);
+    for (i = 0; i < URL_RESULTS_BENCHMARK_ROWS; i++) {
+      char *address = g_strdup_printf ("http://www.example.com/%d", i);
+      EphyHistoryURL *url = ephy_history_url_results_append (results, address, "Example Domain", "0123456789ab");
+
+      url->visit_count = i;
+      url->last_visit_time = i;
+      g_free (address);
+    }
+    g_assert_cmpuint (ephy_history_url_results_get_length (results), ==, URL_RESULTS_BENCHMARK_ROWS);
+    ephy_history_url_results_free (results);
+    results_time += g_test_timer_elapsed ();
+  }
+
+  /* Both loops also pay for formatting the address of every row. */
+  g_test_message ("%d rows: list %.3f ms, results %.3f ms",
+                  URL_RESULTS_BENCHMARK_ROWS,
+                  list_time * 1000 / URL_RESULTS_BENCHMARK_RUNS,
+                  results_time * 1000 / URL_RESULTS_BENCHMARK_RUNS);
+  g_test_minimized_result (results_time / URL_RESULTS_BENCHMARK_RUNS,
+                           "Built and freed %d rows in %g seconds",
+                           URL_RESULTS_BENCHMARK_ROWS, results_time / URL_RESULTS_BENCHMARK_RUNS);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -504,11 +912,18 @@ main (int argc, char *argv[])
   g_test_add_func ("/embed/history/test_set_url_title", test_set_url_title);
   g_test_add_func ("/embed/history/test_set_url_title_is_correct", test_set_url_title_is_correct);
   g_test_add_func ("/embed/history/test_set_url_title_url_not_existent", test_set_url_title_url_not_existent);
+  g_test_add_func ("/embed/history/test_coalesced_url_updates", test_coalesced_url_updates);
   g_test_add_func ("/embed/history/test_get_url", test_get_url);
   g_test_add_func ("/embed/history/test_get_url_not_existent", test_get_url_not_existent);
   g_test_add_func ("/embed/history/test_complex_url_query", test_complex_url_query);
   g_test_add_func ("/embed/history/test_complex_url_query_with_time_range", test_complex_url_query_with_time_range);
+  g_test_add_func ("/embed/history/test_paginated_url_query", test_paginated_url_query);
   g_test_add_func ("/embed/history/test_clear", test_clear);
+  g_test_add_func ("/embed/history/test_merge_urls", test_merge_urls);
+  g_test_add_func ("/embed/history/test_url_results_query", test_url_results_query);
+
+  if (g_test_perf ())
+    g_test_add_func ("/embed/history/test_url_results_benchmark", test_url_results_benchmark);
 
   return g_test_run ();
 }
@@ -0,0 +1,218 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-pixbuf-utils.h"
+
+#include <glib.h>
+
+#define BENCHMARK_ITERATIONS 50
+
+static cairo_surface_t *
+create_surface (int    width,
+                int    height,
+                double red,
+                double green,
+                double blue,
+                double alpha)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (surface);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_rgba (cr, red, green, blue, alpha);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+static void
+assert_pixel (GdkPixbuf *pixbuf,
+              int        x,
+              int        y,
+              guchar     red,
+              guchar     green,
+              guchar     blue,
+              guchar     alpha)
+{
+  guchar *pixel;
+
+  pixel = gdk_pixbuf_get_pixels (pixbuf) + y * gdk_pixbuf_get_rowstride (pixbuf) + x * 4;
+  g_assert_cmpint (pixel[0], ==, red);
+  g_assert_cmpint (pixel[1], ==, green);
+  g_assert_cmpint (pixel[2], ==, blue);
+  g_assert_cmpint (pixel[3], ==, alpha);
+}
+
+static void
+test_ephy_pixbuf_downscale_solid (void)
+{
+  cairo_surface_t *surface;
+  GdkPixbuf *pixbuf;
+
+  surface = create_surface (401, 299, 1, 0.5, 0, 1);
+  pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 0, 0, 401, 299, 180, 135);
+
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, 180);
+  g_assert_cmpint (gdk_pixbuf_get_height (pixbuf), ==, 135);
+  for (int y = 0; y < 135; y++) {
+    for (int x = 0; x < 180; x++)
+      assert_pixel (pixbuf, x, y, 0xff, 0x80, 0x00, 0xff);
+  }
+
+  g_object_unref (pixbuf);
+  cairo_surface_destroy (surface);
+}
+
+static void
+test_ephy_pixbuf_downscale_average (void)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  GdkPixbuf *pixbuf;
+
+  /* Black and white stripes average to grey. */
+  surface = create_surface (4, 4, 0, 0, 0, 1);
+  cr = cairo_create (surface);
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_rectangle (cr, 0, 0, 1, 4);
+  cairo_rectangle (cr, 2, 0, 1, 4);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+
+  pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 0, 0, 4, 4, 2, 2);
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < 2; x++)
+      assert_pixel (pixbuf, x, y, 0x80, 0x80, 0x80, 0xff);
+  }
+
+  g_object_unref (pixbuf);
+  cairo_surface_destroy (surface);
+}
+
+static void
+test_ephy_pixbuf_downscale_crop (void)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  GdkPixbuf *pixbuf;
+
+  surface = create_surface (200, 100, 1, 0, 0, 1);
+  cr = cairo_create (surface);
+  cairo_set_source_rgb (cr, 0, 0, 1);
+  cairo_rectangle (cr, 100, 0, 100, 100);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+
+  pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 100, 0, 100, 100, 10, 10);
+  for (int y = 0; y < 10; y++) {
+    for (int x = 0; x < 10; x++)
+      assert_pixel (pixbuf, x, y, 0x00, 0x00, 0xff, 0xff);
+  }
+
+  g_object_unref (pixbuf);
+  cairo_surface_destroy (surface);
+}
+
+static void
+test_ephy_pixbuf_downscale_alpha (void)
+{
+  cairo_surface_t *surface;
+  GdkPixbuf *pixbuf;
+
+  /* Cairo data is premultiplied, the pixbuf must not be. */
+  surface = create_surface (8, 8, 1, 1, 1, 128 / 255.);
+  pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 0, 0, 8, 8, 2, 2);
+  assert_pixel (pixbuf, 0, 0, 0xff, 0xff, 0xff, 0x80);
+  g_object_unref (pixbuf);
+  cairo_surface_destroy (surface);
+
+  surface = create_surface (8, 8, 0, 0, 0, 0);
+  pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 0, 0, 8, 8, 2, 2);
+  assert_pixel (pixbuf, 1, 1, 0x00, 0x00, 0x00, 0x00);
+  g_object_unref (pixbuf);
+  cairo_surface_destroy (surface);
+}
+
+static void
+test_ephy_pixbuf_downscale_benchmark (void)
+{
+  cairo_surface_t *surface;
+  double elapsed;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Only run in perf mode");
+    return;
+  }
+
+  /* A visible-area snapshot of a maximized window, as taken for thumbnails. */
+  surface = create_surface (1920, 1080, 0.2, 0.4, 0.6, 1);
+
+  g_test_timer_start ();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    GdkPixbuf *pixbuf;
+
+    pixbuf = ephy_pixbuf_get_from_surface_downscaled (surface, 240, 0, 1440, 1080, 180, 135);
+    g_object_unref (pixbuf);
+  }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1000 / BENCHMARK_ITERATIONS,
+                           "Box downscale: %.3f ms per snapshot",
+                           elapsed * 1000 / BENCHMARK_ITERATIONS);
+
+  g_test_timer_start ();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    GdkPixbuf *snapshot;
+    GdkPixbuf *scaled;
+
+    snapshot = gdk_pixbuf_get_from_surface (surface, 240, 0, 1440, 1080);
+    scaled = gdk_pixbuf_scale_simple (snapshot, 180, 135, GDK_INTERP_BILINEAR);
+    g_object_unref (scaled);
+    g_object_unref (snapshot);
+  }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1000 / BENCHMARK_ITERATIONS,
+                           "GdkPixbuf convert and bilinear scale: %.3f ms per snapshot",
+                           elapsed * 1000 / BENCHMARK_ITERATIONS);
+
+  cairo_surface_destroy (surface);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/ephy-pixbuf-utils/downscale_solid",
+                   test_ephy_pixbuf_downscale_solid);
+  g_test_add_func ("/lib/ephy-pixbuf-utils/downscale_average",
+                   test_ephy_pixbuf_downscale_average);
+  g_test_add_func ("/lib/ephy-pixbuf-utils/downscale_crop",
+                   test_ephy_pixbuf_downscale_crop);
+  g_test_add_func ("/lib/ephy-pixbuf-utils/downscale_alpha",
+                   test_ephy_pixbuf_downscale_alpha);
+  g_test_add_func ("/lib/ephy-pixbuf-utils/downscale_benchmark",
+                   test_ephy_pixbuf_downscale_benchmark);
+
+  return g_test_run ();
+}
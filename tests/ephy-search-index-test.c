@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-search-index.h"
+
+#include "ephy-bookmark.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+static char *
+get_empty_index_filename (void)
+{
+  char *filename = g_build_filename (ephy_dot_dir (), EPHY_SEARCH_INDEX_FILE, NULL);
+
+  g_unlink (filename);
+
+  return filename;
+}
+
+static void
+visit_added_cb (EphyHistoryService *service,
+                gboolean            success,
+                gpointer            result_data,
+                gpointer            user_data)
+{
+  g_assert_true (success);
+  gtk_main_quit ();
+}
+
+static gboolean
+wait_for_index_cb (const char *filename)
+{
+  /* The index is replaced atomically, so it is complete once it exists. */
+  if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+    return G_SOURCE_CONTINUE;
+
+  gtk_main_quit ();
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_search_index_missing (void)
+{
+  EphySearchIndex *index;
+  char *filename = get_empty_index_filename ();
+  char *terms[] = { "gnome", NULL };
+  char **results;
+
+  index = ephy_search_index_new (filename);
+
+  results = ephy_search_index_query (index, terms, 10);
+  g_assert_cmpuint (g_strv_length (results), ==, 0);
+  g_assert_false (ephy_search_index_lookup (index, "http://www.gnome.org/", NULL, NULL, NULL));
+
+  g_strfreev (results);
+  g_object_unref (index);
+  g_free (filename);
+}
+
+static void
+test_search_index_build_and_load (void)
+{
+  EphyHistoryService *history_service;
+  EphyBookmarksManager *bookmarks_manager;
+  EphyHistoryPageVisit *visit;
+  EphyBookmark *bookmark;
+  EphySearchIndex *index;
+  GSequence *tags;
+  char *history_filename;
+  char *filename = get_empty_index_filename ();
+  char *gnome_terms[] = { "gnome", NULL };
+  char *tag_terms[] = { "DOCS", "example", NULL };
+  char **results;
+  const char *title;
+  const char *icon;
+  gboolean is_bookmark;
+
+  history_filename = g_build_filename (ephy_dot_dir (), "search-index-test.db", NULL);
+  g_unlink (history_filename);
+  history_service = ephy_history_service_new (history_filename, EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  visit = ephy_history_page_visit_new ("http://www.gnome.org/", 0, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (history_service, visit, NULL, visit_added_cb, NULL);
+  ephy_history_page_visit_free (visit);
+  gtk_main ();
+
+  bookmarks_manager = ephy_bookmarks_manager_new ();
+  tags = g_sequence_new (g_free);
+  g_sequence_append (tags, g_strdup ("Docs"));
+  bookmark = ephy_bookmark_new ("https://example.com/", "Example Domain", tags, "0123456789ab");
+  ephy_bookmarks_manager_add_bookmark (bookmarks_manager, bookmark);
+  g_object_unref (bookmark);
+
+  ephy_search_index_rebuild (history_service, bookmarks_manager, NULL, filename);
+  g_timeout_add (10, (GSourceFunc)wait_for_index_cb, filename);
+  gtk_main ();
+
+  index = ephy_search_index_new (filename);
+
+  results = ephy_search_index_query (index, gnome_terms, 10);
+  g_assert_cmpuint (g_strv_length (results), ==, 1);
+  g_assert_cmpstr (results[0], ==, "http://www.gnome.org/");
+  g_assert_true (ephy_search_index_lookup (index, results[0], &title, &icon, &is_bookmark));
+  g_assert_null (icon);
+  g_assert_false (is_bookmark);
+  g_strfreev (results);
+
+  /* Terms match case insensitively, tags included. */
+  results = ephy_search_index_query (index, tag_terms, 10);
+  g_assert_cmpuint (g_strv_length (results), ==, 1);
+  g_assert_cmpstr (results[0], ==, "https://example.com/");
+  g_assert_true (ephy_search_index_lookup (index, results[0], &title, &icon, &is_bookmark));
+  g_assert_cmpstr (title, ==, "Example Domain");
+  g_assert_true (is_bookmark);
+  g_strfreev (results);
+
+  g_object_unref (index);
+  g_object_unref (bookmarks_manager);
+  g_object_unref (history_service);
+  g_free (history_filename);
+  g_free (filename);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/ephy-search-index/missing",
+                   test_search_index_missing);
+  g_test_add_func ("/src/ephy-search-index/build_and_load",
+                   test_search_index_build_and_load);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
@@ -53,6 +53,7 @@ test_ephy_shell_basic_embeds (void)
              (ephy_shell,
              NULL,       /* title */
              NULL,       /* related view */
+             NULL,       /* address */
              window,
              NULL,       /* embed */
              EPHY_NEW_TAB_DONT_SHOW_WINDOW,       /* flags */
@@ -70,6 +71,7 @@ test_ephy_shell_basic_embeds (void)
              (ephy_shell,
              NULL,       /* title */
              NULL,       /* related view */
+             NULL,       /* address */
              window,       /* window */
              NULL,       /* embed */
              EPHY_NEW_TAB_DONT_SHOW_WINDOW,       /* flags */
@@ -0,0 +1,168 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-snapshot-service.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <libgnome-desktop/gnome-desktop-thumbnail.h>
+
+/* Unlike the snapshot service test, these tests do not take snapshots from
+ * a web view: they put them in the disk cache themselves. */
+
+static time_t mtime;
+
+static char *
+save_snapshot (const char *url)
+{
+  GnomeDesktopThumbnailFactory *factory;
+  GdkPixbuf *pixbuf;
+  char *path;
+
+  factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_LARGE);
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, EPHY_THUMBNAIL_WIDTH, EPHY_THUMBNAIL_HEIGHT);
+  gdk_pixbuf_fill (pixbuf, 0);
+  gnome_desktop_thumbnail_factory_save_thumbnail (factory, pixbuf, url, mtime);
+  path = gnome_desktop_thumbnail_factory_lookup (factory, url, mtime);
+  g_object_unref (pixbuf);
+  g_object_unref (factory);
+
+  g_assert_nonnull (path);
+  return path;
+}
+
+static void
+on_snapshot_path_ready (EphySnapshotService *service,
+                        GAsyncResult        *result,
+                        char               **path)
+{
+  *path = ephy_snapshot_service_get_snapshot_path_for_url_finish (service, result, NULL);
+
+  gtk_main_quit ();
+}
+
+static char *
+get_snapshot_path (EphySnapshotService *service,
+                   const char          *url,
+                   time_t               snapshot_mtime)
+{
+  char *path = NULL;
+
+  ephy_snapshot_service_get_snapshot_path_for_url_async (service, url, snapshot_mtime, NULL,
+                                                         (GAsyncReadyCallback)on_snapshot_path_ready,
+                                                         &path);
+  gtk_main ();
+
+  return path;
+}
+
+static void
+test_snapshot_index_round_trip (void)
+{
+  EphySnapshotService *service;
+  const char *url = "http://example.com/indexed";
+  char *saved_path;
+  char *path;
+
+  saved_path = save_snapshot (url);
+
+  service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+  path = get_snapshot_path (service, url, mtime);
+  g_assert_cmpstr (path, ==, saved_path);
+  g_free (path);
+
+  /* Finalizing writes the pending index, which the next instance loads. */
+  g_object_unref (service);
+
+  service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+  path = get_snapshot_path (service, url, mtime);
+  g_assert_cmpstr (path, ==, saved_path);
+  g_free (path);
+  g_object_unref (service);
+
+  g_free (saved_path);
+}
+
+static void
+test_snapshot_index_validation (void)
+{
+  EphySnapshotService *service;
+  const char *changed_url = "http://example.com/changed";
+  const char *removed_url = "http://example.com/removed";
+  char *changed_path;
+  char *removed_path;
+  char *path;
+
+  changed_path = save_snapshot (changed_url);
+  removed_path = save_snapshot (removed_url);
+
+  service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+  path = get_snapshot_path (service, changed_url, mtime);
+  g_assert_cmpstr (path, ==, changed_path);
+  g_free (path);
+  path = get_snapshot_path (service, removed_url, mtime);
+  g_assert_cmpstr (path, ==, removed_path);
+  g_free (path);
+  g_object_unref (service);
+
+  g_unlink (removed_path);
+
+  /* An indexed snapshot is neither returned for another mtime, nor once it
+   * is gone from the disk cache. */
+  service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+  g_assert_null (get_snapshot_path (service, changed_url, mtime + 1));
+  g_assert_null (get_snapshot_path (service, removed_url, mtime));
+  g_object_unref (service);
+
+  g_free (changed_path);
+  g_free (removed_path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  mtime = time (NULL);
+
+  g_test_add_func ("/lib/ephy-snapshot-index/round_trip",
+                   test_snapshot_index_round_trip);
+  g_test_add_func ("/lib/ephy-snapshot-index/validation",
+                   test_snapshot_index_validation);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
@@ -0,0 +1,263 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-journal.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+static char *
+get_empty_journal_filename (void)
+{
+  char *filename = g_build_filename (g_get_tmp_dir (), "epiphany-sync-journal-test.gvariant", NULL);
+
+  g_unlink (filename);
+
+  return filename;
+}
+
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(const char **)a, *(const char **)b);
+}
+
+static void
+test_ephy_sync_journal_persist (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+  char **pending;
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_add (journal, "history", "a", "{\"id\":\"a\"}");
+  ephy_sync_journal_add (journal, "history", "b", "{\"id\":\"b\"}");
+  ephy_sync_journal_add (journal, "passwords", "c", "{\"id\":\"c\"}");
+  /* A later change to the same record replaces the earlier one. */
+  ephy_sync_journal_add (journal, "history", "a", "{\"id\":\"a\",\"deleted\":true}");
+  /* The pending save is written when the journal goes away. */
+  g_object_unref (journal);
+
+  g_assert (g_file_test (filename, G_FILE_TEST_IS_REGULAR));
+
+  journal = ephy_sync_journal_new (filename);
+
+  pending = ephy_sync_journal_get_pending (journal, "history");
+  g_assert (pending);
+  g_assert_cmpuint (g_strv_length (pending), ==, 2);
+  qsort (pending, 2, sizeof (char *), compare_strings);
+  g_assert_cmpstr (pending[0], ==, "{\"id\":\"a\",\"deleted\":true}");
+  g_assert_cmpstr (pending[1], ==, "{\"id\":\"b\"}");
+  g_strfreev (pending);
+
+  pending = ephy_sync_journal_get_pending (journal, "passwords");
+  g_assert (pending);
+  g_assert_cmpuint (g_strv_length (pending), ==, 1);
+  g_assert_cmpstr (pending[0], ==, "{\"id\":\"c\"}");
+  g_strfreev (pending);
+
+  g_assert_null (ephy_sync_journal_get_pending (journal, "bookmarks"));
+
+  g_object_unref (journal);
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static void
+test_ephy_sync_journal_forget (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+  char **pending;
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_add (journal, "history", "a", "{\"id\":\"a\"}");
+  ephy_sync_journal_add (journal, "history", "b", "{\"id\":\"b\"}");
+
+  /* The server acknowledged "a", uploaded after the change was made. */
+  ephy_sync_journal_forget (journal, "history", "a", g_get_real_time ());
+  /* "b" changed again after its upload started, so it is still pending. */
+  ephy_sync_journal_forget (journal, "history", "b", 0);
+  /* Unknown records and collections are ignored. */
+  ephy_sync_journal_forget (journal, "history", "c", g_get_real_time ());
+  ephy_sync_journal_forget (journal, "passwords", "a", g_get_real_time ());
+
+  pending = ephy_sync_journal_get_pending (journal, "history");
+  g_assert (pending);
+  g_assert_cmpuint (g_strv_length (pending), ==, 1);
+  g_assert_cmpstr (pending[0], ==, "{\"id\":\"b\"}");
+  g_strfreev (pending);
+  g_object_unref (journal);
+
+  /* What was forgotten stays forgotten. */
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_forget (journal, "history", "b", g_get_real_time ());
+  g_assert_null (ephy_sync_journal_get_pending (journal, "history"));
+  g_object_unref (journal);
+
+  journal = ephy_sync_journal_new (filename);
+  g_assert_null (ephy_sync_journal_get_pending (journal, "history"));
+  g_object_unref (journal);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static void
+test_ephy_sync_journal_clear (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_add (journal, "history", "a", "{\"id\":\"a\"}");
+  g_object_unref (journal);
+  g_assert (g_file_test (filename, G_FILE_TEST_IS_REGULAR));
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_clear (journal);
+  g_assert_null (ephy_sync_journal_get_pending (journal, "history"));
+  g_assert (!g_file_test (filename, G_FILE_TEST_EXISTS));
+  g_object_unref (journal);
+
+  g_free (filename);
+}
+
+static void
+test_ephy_sync_journal_corrupted (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+
+  g_assert (g_file_set_contents (filename, "not a journal", -1, NULL));
+
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "*corrupted*");
+  journal = ephy_sync_journal_new (filename);
+  g_test_assert_expected_messages ();
+
+  g_assert_null (ephy_sync_journal_get_pending (journal, "history"));
+  g_object_unref (journal);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static void
+test_ephy_sync_journal_truncated (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+  char *contents;
+  gsize length;
+  char **pending;
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_add (journal, "history", "a", "{\"id\":\"a\"}");
+  ephy_sync_journal_add (journal, "history", "b", "{\"id\":\"b\"}");
+  g_object_unref (journal);
+
+  /* Cut the last entry short, as a crash while appending would. */
+  g_assert (g_file_get_contents (filename, &contents, &length, NULL));
+  g_assert (g_file_set_contents (filename, contents, length - 3, NULL));
+  g_free (contents);
+
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "*corrupted*");
+  journal = ephy_sync_journal_new (filename);
+  g_test_assert_expected_messages ();
+
+  pending = ephy_sync_journal_get_pending (journal, "history");
+  g_assert (pending);
+  g_assert_cmpuint (g_strv_length (pending), ==, 1);
+  g_assert_cmpstr (pending[0], ==, "{\"id\":\"a\"}");
+  g_strfreev (pending);
+  g_object_unref (journal);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+static void
+test_ephy_sync_journal_compact (void)
+{
+  EphySyncJournal *journal;
+  char *filename = get_empty_journal_filename ();
+  char *contents;
+  gsize length;
+  gsize compact_length;
+  char **pending;
+
+  journal = ephy_sync_journal_new (filename);
+  ephy_sync_journal_add (journal, "history", "kept", "{\"id\":\"kept\"}");
+  g_object_unref (journal);
+  g_assert (g_file_get_contents (filename, &contents, &length, NULL));
+  g_free (contents);
+  compact_length = length;
+
+  /* Acknowledged changes pile up in the log until it is rewritten. */
+  journal = ephy_sync_journal_new (filename);
+  for (guint i = 0; i < 1000; i++) {
+    char *id = g_strdup_printf ("%u", i);
+
+    ephy_sync_journal_add (journal, "history", id, "{}");
+    ephy_sync_journal_forget (journal, "history", id, g_get_real_time ());
+    g_free (id);
+  }
+  g_object_unref (journal);
+
+  g_assert (g_file_get_contents (filename, &contents, &length, NULL));
+  g_free (contents);
+  g_assert_cmpuint (length, ==, compact_length);
+
+  journal = ephy_sync_journal_new (filename);
+  pending = ephy_sync_journal_get_pending (journal, "history");
+  g_assert (pending);
+  g_assert_cmpuint (g_strv_length (pending), ==, 1);
+  g_assert_cmpstr (pending[0], ==, "{\"id\":\"kept\"}");
+  g_strfreev (pending);
+  g_object_unref (journal);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/sync/ephy-sync-journal/persist",
+                   test_ephy_sync_journal_persist);
+  g_test_add_func ("/lib/sync/ephy-sync-journal/forget",
+                   test_ephy_sync_journal_forget);
+  g_test_add_func ("/lib/sync/ephy-sync-journal/clear",
+                   test_ephy_sync_journal_clear);
+  g_test_add_func ("/lib/sync/ephy-sync-journal/corrupted",
+                   test_ephy_sync_journal_corrupted);
+  g_test_add_func ("/lib/sync/ephy-sync-journal/truncated",
+                   test_ephy_sync_journal_truncated);
+  g_test_add_func ("/lib/sync/ephy-sync-journal/compact",
+                   test_ephy_sync_journal_compact);
+
+  return g_test_run ();
+}
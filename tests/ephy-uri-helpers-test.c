@@ -24,7 +24,9 @@
 #include "ephy-settings.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
+#include <unistd.h>
 
 static void
 test_ephy_uri_helpers_remove_tracking (void)
@@ -49,6 +51,14 @@ test_ephy_uri_helpers_remove_tracking (void)
     { "http://www.test.com/?utm_source=feedburner&view=lno&_reqid=1234", "http://www.test.com/?view=lno&_reqid=1234" },
     { "http://www.test.com/?some&valid&query", "http://www.test.com/?some&valid&query" },
     { "http://www.test.com/?utm_source=feedburner&some&valid&query", "http://www.test.com/?some&valid&query" },
+    { "http://www.test.com/?p=1&utm_source=feedburner#anchor", "http://www.test.com/?p=1#anchor" },
+    { "http://www.test.com/?utm_source=feedburner#anchor", "http://www.test.com/#anchor" },
+    { "http://www.test.com/#utm_source=feedburner", "http://www.test.com/#utm_source=feedburner" },
+    { "http://www.test.com/?utm%5Fsource=feedburner&p=1", "http://www.test.com/?p=1" },
+    { "http://www.test.com/?utm%source=feedburner", "http://www.test.com/?utm%source=feedburner" },
+    { "http://www.test.com/?utm_source&utm_medium=&p=1", "http://www.test.com/?p=1" },
+    { "http://user@foo.youtube.com:8080/?feature=foo&v=1", "http://user@foo.youtube.com:8080/?v=1" },
+    { "http://youtube.com.test.com/?feature=foo", "http://youtube.com.test.com/?feature=foo" },
   };
   guint i;
 
@@ -65,6 +75,122 @@ test_ephy_uri_helpers_remove_tracking (void)
   }
 }
 
+static void
+test_ephy_uri_helpers_load_tracking_parameters (void)
+{
+  char *filename;
+  char *result;
+  GError *error = NULL;
+  int fd;
+
+  fd = g_file_open_tmp ("tracking-parameters-XXXXXX", &filename, &error);
+  g_assert_no_error (error);
+  close (fd);
+
+  g_file_set_contents (filename,
+                       "# Comment\n"
+                       "\n"
+                       "tracker\n"
+                       "ref example.com\n"
+                       "ref example.org\n",
+                       -1, &error);
+  g_assert_no_error (error);
+
+  g_assert_true (ephy_uri_helpers_load_tracking_parameters (filename, &error));
+  g_assert_no_error (error);
+
+  result = ephy_remove_tracking_from_uri ("http://test.com/?tracker=1&ref=2");
+  g_assert_cmpstr (result, ==, "http://test.com/?ref=2");
+  g_free (result);
+
+  result = ephy_remove_tracking_from_uri ("http://www.example.org/?ref=2&q=3");
+  g_assert_cmpstr (result, ==, "http://www.example.org/?q=3");
+  g_free (result);
+
+  g_assert_null (ephy_remove_tracking_from_uri ("http://test.com/?utm_source=feedburner"));
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+/* Requests as seen by the web extension when browsing a few news and
+ * shopping sites, only used when no log is given in EPHY_REQUEST_LOG. */
+static const char *default_request_log[] = {
+  "https://www.example-news.com/",
+  "https://www.example-news.com/static/css/main.css?v=20180301",
+  "https://cdn.example-news.com/js/app.min.js?v=3.2.1",
+  "https://cdn.example-news.com/img/lead.jpg?w=1200&h=630&fit=crop&auto=format",
+  "https://fonts.example.com/css?family=Open+Sans:400,700&subset=latin",
+  "https://www.example-news.com/2018/03/story.html?utm_source=twitter&utm_medium=social&utm_campaign=spring",
+  "https://ads.example.net/pagead/ads?client=ca-pub-123&output=html&h=90&w=728&format=728x90&url=https%3A%2F%2Fwww.example-news.com%2F",
+  "https://stats.example.org/collect?v=1&_v=j66&a=12345&t=pageview&dl=https%3A%2F%2Fwww.example-news.com%2F&ul=en-us&de=UTF-8",
+  "https://www.youtube.com/embed/abcdef?feature=oembed&autoplay=0",
+  "https://shop.example.com/item/1234?ref_=nav&color=blue&size=m",
+  "https://shop.example.com/search?q=running+shoes&page=2&sort=price",
+  "https://www.facebook.com/plugins/like.php?href=https%3A%2F%2Fexample.com&ref=ts&fref=ts",
+  "https://api.example.com/v2/items?ids=1,2,3,4,5,6,7,8,9,10&fields=id,name,price",
+  "https://cdn.example.com/assets/logo.svg",
+};
+
+static void
+test_ephy_uri_helpers_remove_tracking_benchmark (void)
+{
+  GPtrArray *urls;
+  const char *log;
+  guint stripped = 0;
+  double elapsed;
+  int iterations;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Only run in perf mode");
+    return;
+  }
+
+  /* A request log, one URL per line, can be given to run over real data. */
+  urls = g_ptr_array_new_with_free_func (g_free);
+  log = g_getenv ("EPHY_REQUEST_LOG");
+  if (log) {
+    char *contents;
+    char **lines;
+    GError *error = NULL;
+
+    g_file_get_contents (log, &contents, NULL, &error);
+    g_assert_no_error (error);
+    lines = g_strsplit (contents, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+      if (lines[i][0] != '\0')
+        g_ptr_array_add (urls, g_strdup (lines[i]));
+    }
+    g_strfreev (lines);
+    g_free (contents);
+    iterations = 10;
+  } else {
+    for (guint i = 0; i < G_N_ELEMENTS (default_request_log); i++)
+      g_ptr_array_add (urls, g_strdup (default_request_log[i]));
+    iterations = 10000;
+  }
+
+  g_test_timer_start ();
+  for (int i = 0; i < iterations; i++) {
+    for (guint j = 0; j < urls->len; j++) {
+      char *result = ephy_remove_tracking_from_uri (g_ptr_array_index (urls, j));
+
+      if (result) {
+        stripped++;
+        g_free (result);
+      }
+    }
+  }
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed * 1e9 / (iterations * urls->len),
+                           "Removed tracking from %u of %u requests, %.1f ns per request",
+                           stripped / iterations, urls->len,
+                           elapsed * 1e9 / (iterations * urls->len));
+
+  g_ptr_array_free (urls, TRUE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -80,6 +206,10 @@ main (int argc, char *argv[])
 
   g_test_add_func ("/lib/ephy-uri-helpers/remove_tracking",
                    test_ephy_uri_helpers_remove_tracking);
+  g_test_add_func ("/lib/ephy-uri-helpers/remove_tracking_benchmark",
+                   test_ephy_uri_helpers_remove_tracking_benchmark);
+  g_test_add_func ("/lib/ephy-uri-helpers/load_tracking_parameters",
+                   test_ephy_uri_helpers_load_tracking_parameters);
 
   ret = g_test_run ();
 
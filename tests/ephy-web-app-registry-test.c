@@ -0,0 +1,145 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  Copyright © 2018 The Epiphany Authors
+ *
+ *  This file is part of Epiphany.
+ *
+ *  Epiphany is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Epiphany is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Epiphany.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-web-app-utils.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+static char *
+get_registry_filename (void)
+{
+  char *apps_dir = ephy_default_dot_dir ();
+  char *filename = g_build_filename (apps_dir, "web-apps.gvariant", NULL);
+
+  g_free (apps_dir);
+
+  return filename;
+}
+
+static void
+rename_web_app (const char *desktop_file,
+                const char *name)
+{
+  GKeyFile *key = g_key_file_new ();
+
+  g_assert_true (g_key_file_load_from_file (key, desktop_file, G_KEY_FILE_KEEP_TRANSLATIONS, NULL));
+  g_key_file_set_string (key, "Desktop Entry", "Name", name);
+  g_assert_true (g_key_file_save_to_file (key, desktop_file, NULL));
+  g_key_file_free (key);
+}
+
+static void
+assert_web_app_list (const char *name)
+{
+  GList *apps;
+
+  apps = ephy_web_application_get_application_list ();
+  g_assert_cmpint (g_list_length (apps), ==, 1);
+  g_assert_cmpstr (((EphyWebApplication *)apps->data)->name, ==, name);
+  g_assert_cmpstr (((EphyWebApplication *)apps->data)->url, ==, "http://www.gnome.org/");
+  ephy_web_application_free_application_list (apps);
+}
+
+static void
+test_web_app_registry (void)
+{
+  char *desktop_file;
+  char *registry;
+  GList *apps;
+
+  registry = get_registry_filename ();
+
+  /* Creating an application registers it. */
+  desktop_file = ephy_web_application_create ("http://www.gnome.org/", "GNOME.org", NULL);
+  g_assert_nonnull (desktop_file);
+  g_assert_true (g_file_test (registry, G_FILE_TEST_IS_REGULAR));
+  assert_web_app_list ("GNOME.org");
+
+  /* Listing the applications does not read their desktop files. */
+  rename_web_app (desktop_file, "Renamed");
+  assert_web_app_list ("GNOME.org");
+
+  /* A missing registry is rebuilt from the desktop files. */
+  g_assert_cmpint (g_unlink (registry), ==, 0);
+  assert_web_app_list ("Renamed");
+  g_assert_true (g_file_test (registry, G_FILE_TEST_IS_REGULAR));
+
+  /* So is a corrupted one, once. */
+  rename_web_app (desktop_file, "Renamed again");
+  g_assert_true (g_file_set_contents (registry, "not a registry", -1, NULL));
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "*corrupted*");
+  assert_web_app_list ("Renamed again");
+  g_test_assert_expected_messages ();
+  assert_web_app_list ("Renamed again");
+
+  /* Deleting an application unregisters it. */
+  g_assert_true (ephy_web_application_delete ("GNOME.org"));
+  g_assert_true (g_file_test (registry, G_FILE_TEST_IS_REGULAR));
+  apps = ephy_web_application_get_application_list ();
+  g_assert_null (apps);
+
+  g_free (desktop_file);
+  g_free (registry);
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *xdg_data_home;
+  char *xdg_config_home;
+  char *default_dot_dir;
+  int ret;
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_PRIVATE_PROFILE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  /* Web applications are stored in the default profile directory and
+   * linked from $XDG_DATA_HOME, so point both inside our disposable
+   * profile directory. */
+  xdg_data_home = g_build_filename (ephy_dot_dir (), "xdg_share", NULL);
+  g_setenv ("XDG_DATA_HOME", xdg_data_home, TRUE);
+  xdg_config_home = g_build_filename (ephy_dot_dir (), "xdg_config", NULL);
+  g_setenv ("XDG_CONFIG_HOME", xdg_config_home, TRUE);
+  default_dot_dir = ephy_default_dot_dir ();
+  g_mkdir_with_parents (default_dot_dir, 0700);
+  g_free (default_dot_dir);
+
+  gtk_test_init (&argc, &argv);
+
+  ephy_debug_init ();
+
+  g_test_add_func ("/lib/ephy-web-app-utils/registry",
+                   test_web_app_registry);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+  g_free (xdg_config_home);
+  g_free (xdg_data_home);
+
+  return ret;
+}